@@ -42,9 +42,90 @@
 #define RTXOFF_USE_PROCESS_CLOCK 1
 #endif
 
+// RTXOff virtual time configuration.
+// Define to 1 to let the kernel clock skip ahead whenever no thread other than the idle thread can run.
+// Instead of waiting in real time for the next thread delay or timer to expire, the kernel jumps straight to it,
+// so delays and timeouts complete as fast as the host can process them and always expire in the same order.
+// Time still passes normally while RTX threads are running.
+// Note: since time can jump forward at any point where the system is idle, code outside RTX threads that
+// waits on the kernel clock (e.g. test harness threads injecting interrupts) will see time passing very quickly.
+#ifndef RTXOFF_USE_VIRTUAL_TIME
+#define RTXOFF_USE_VIRTUAL_TIME 0
+#endif
+
+// RTXOff tickless configuration.
+// Define to 1 to store thread delays and timers as absolute deadlines on the kernel clock (in microseconds)
+// instead of as a number of ticks after the last tick.  The scheduler then wakes up exactly at each deadline
+// rather than at the next tick boundary after it, so delays and periodic timers don't pick up any rounding error.
+// The tick count (e.g. osKernelGetTickCount()) still advances at OS_TICK_FREQ.
+#ifndef RTXOFF_TICKLESS
+#define RTXOFF_TICKLESS 0
+#endif
+
+// RTXOff deadline heap configuration.
+// Define to 1 to keep thread delays and timers in binary min-heaps ordered by absolute deadline, instead of in
+// RTX's delta-sorted lists.  Starting a delay or timer is then O(log n) instead of O(n), which matters for programs
+// with thousands of outstanding timeouts.  Expiry order is the same: equal deadlines expire in the order they were started.
+#ifndef RTXOFF_DEADLINE_HEAP
+#define RTXOFF_DEADLINE_HEAP 0
+#endif
+
+// RTXOff scheduler trace configuration.
+// Define to 1 to record thread switches, preemptions, waits, ISRs, timer expiries and mutex contention into
+// a ring buffer (see rtxoff_trace.h).  When 0, the trace points compile to nothing.
+#ifndef RTXOFF_TRACE
+#define RTXOFF_TRACE 0
+#endif
+
+// Number of events that the trace ring buffer holds.  Once it is full, the oldest events are overwritten.
+// Must be a power of two.  Each event takes 56 bytes.
+#ifndef RTXOFF_TRACE_BUFFER_SIZE
+#define RTXOFF_TRACE_BUFFER_SIZE 65536
+#endif
+
+// RTXOff record/replay configuration.
+// Define to 1 to support recording the points where the scheduler preempts threads (set the RTXOFF_RECORD_FILE
+// environment variable) and forcing the same preemptions in a later run (set RTXOFF_REPLAY_FILE).  See rtxoff_replay.h.
+// Requires RTXOFF_TICKLESS and RTXOFF_DEADLINE_HEAP to be 0.
+#ifndef RTXOFF_RECORD_REPLAY
+#define RTXOFF_RECORD_REPLAY 0
+#endif
+
+// Number of device interrupts (IRQn 0 and up) that the simulated NVIC supports.  Every interrupt has an entry
+// in a fixed table, so using an IRQ number at or above this is an error.
+#ifndef RTXOFF_NVIC_IRQ_COUNT
+#define RTXOFF_NVIC_IRQ_COUNT 240
+#endif
+
+// RTXOff stack checking configuration.
+// Define to 1 to run each RTX thread on a host stack sized from the stack_size it was created with (times
+// RTXOFF_STACK_SCALE), with a guard area below it so that overflowing it crashes with an error instead of corrupting
+// memory.  The stack is painted with the stack watermark pattern, so osThreadGetStackSpace() and
+// mbed_stats_stack_get_each() report the most stack each thread has used.  When 0, threads run on default sized
+// host stacks and osThreadGetStackSpace() returns 0.
+#ifndef RTXOFF_STACK_CHECK
+#define RTXOFF_STACK_CHECK 0
+#endif
+
+// Host stack bytes per byte of target stack, used when RTXOFF_STACK_CHECK is 1.  Code built for the host uses more
+// stack than the same code on the target (64 bit pointers, bigger frames, the host's C library), so each thread gets
+// this many times its stack_size, and its usage is divided by this before being reported.  Tune it until a
+// thread's reported usage roughly matches what it uses on the target.
+#ifndef RTXOFF_STACK_SCALE
+#define RTXOFF_STACK_SCALE 4
+#endif
+
+// Number of host threads kept after their RTX threads exit, so that osThreadNew() can reuse them instead of
+// creating a new host thread.  Set to 0 to create a new host thread every time.
+#ifndef RTXOFF_THREAD_POOL_SIZE
+#define RTXOFF_THREAD_POOL_SIZE 16
+#endif
+
 //   <o>Global Dynamic Memory size [bytes] <0-1073741824:8>
 //   <i> Defines the combined global dynamic memory size.
 //   <i> Default: 32768
+//   Note: Each kernel has its own dynamic memory.  Control blocks are bigger on the host than on the target,
+//   and thread stacks are not allocated from it, so usage is not the same as on the target.
 #ifndef OS_DYNAMIC_MEM_SIZE
 #define OS_DYNAMIC_MEM_SIZE         32768
 #endif
@@ -57,8 +138,8 @@
 #define OS_TICK_FREQ                1000
 #endif
 
-// NOTE: RTXOff does not support ticks < 1ms
-#define OS_TICK_PERIOD_MS 1000/OS_TICK_FREQ
+// NOTE: Mbed OS requires a 1ms tick (see mbed_rtx_conf.h)
+#define OS_TICK_PERIOD_US (1000000/OS_TICK_FREQ)
 
 //   <e>Round-Robin Thread switching
 //   <i> Enables Round-Robin Thread switching.
@@ -3,6 +3,7 @@
 #include <system_error>
 #include <thread>
 #include <cstring>
+#include <algorithm>
 
 ThreadDispatcher::Mutex::Mutex()
 {
@@ -13,13 +14,59 @@ ThreadDispatcher::Mutex::~Mutex() {
     instance().unlockMutex();
 }
 
+// Dispatcher selected for this host thread, or nullptr to use the default one
+static thread_local ThreadDispatcher * currentDispatcher = nullptr;
+
+std::atomic<uint32_t> ThreadDispatcher::runningCount(0);
+
 ThreadDispatcher &ThreadDispatcher::instance() {
+    if(currentDispatcher != nullptr)
+    {
+        return *currentDispatcher;
+    }
+
     static ThreadDispatcher instance;
     return instance;
 }
 
+void ThreadDispatcher::setCurrent(ThreadDispatcher * dispatcher)
+{
+    currentDispatcher = dispatcher;
+}
+
 thread_local bool isDispatcher = false;
 
+#if RTXOFF_RECORD_REPLAY
+// Number of times this host thread has recursively locked the kernel mutex
+static thread_local uint32_t kernelLockDepth = 0;
+#endif
+
+// Whether this host thread runs an RTX thread
+static thread_local bool isRtxThread = false;
+
+void ThreadDispatcher::markRtxThread()
+{
+    isRtxThread = true;
+}
+
+bool ThreadDispatcher::onRtxThread()
+{
+    return isRtxThread;
+}
+
+// Get the amount of real time that the dispatcher should wait for in order to wake up at the given kernel clock time.
+static std::chrono::nanoseconds realTimeUntil(RTXClock::time_point wakeupTime)
+{
+	using namespace std::chrono;
+
+	nanoseconds waitTime = duration_cast<nanoseconds>(wakeupTime - RTXClock::now());
+#if RTXOFF_USE_PROCESS_CLOCK
+	// Process time can pass faster than real time when multiple host threads are busy, so never sleep past the next tick
+	waitTime = std::min<nanoseconds>(waitTime, microseconds(OS_TICK_PERIOD_US));
+#endif
+	return std::max<nanoseconds>(waitTime, nanoseconds(0));
+}
+
 #if USE_WINTHREAD
 ThreadDispatcher::ThreadDispatcher()
 {
@@ -27,12 +74,12 @@ ThreadDispatcher::ThreadDispatcher()
     InitializeCriticalSection(&kernelDataMutex);
 }
 
-void ThreadDispatcher::lockMutex()
+void ThreadDispatcher::lockKernelDataMutex()
 {
     EnterCriticalSection(&kernelDataMutex);
 }
 
-void ThreadDispatcher::unlockMutex()
+void ThreadDispatcher::unlockKernelDataMutex()
 {
     LeaveCriticalSection(&kernelDataMutex);
 }
@@ -41,6 +88,26 @@ void ThreadDispatcher::requestSchedule()
 {
     WakeConditionVariable(&kernelModeCondVar);
 }
+
+void ThreadDispatcher::waitUntil(RTXClock::time_point wakeupTime)
+{
+	using namespace std::chrono;
+
+	DWORD timeoutMs = INFINITE;
+	if(wakeupTime != RTXClock::time_point::max())
+	{
+		// round up so that we don't wake up before the deadline
+		nanoseconds waitTime = realTimeUntil(wakeupTime);
+		milliseconds waitTimeMs = duration_cast<milliseconds>(waitTime);
+		if(waitTimeMs < waitTime)
+		{
+			++waitTimeMs;
+		}
+		timeoutMs = static_cast<DWORD>(waitTimeMs.count());
+	}
+
+	SleepConditionVariableCS(&kernelModeCondVar, &kernelDataMutex, timeoutMs);
+}
 #else
 
 ThreadDispatcher::ThreadDispatcher()
@@ -69,7 +136,7 @@ ThreadDispatcher::ThreadDispatcher()
 #endif
 }
 
-void ThreadDispatcher::lockMutex()
+void ThreadDispatcher::lockKernelDataMutex()
 {
     int pthread_errorcode = pthread_mutex_lock(&kernelDataMutex);
     if(pthread_errorcode != 0)
@@ -78,7 +145,7 @@ void ThreadDispatcher::lockMutex()
     }
 }
 
-void ThreadDispatcher::unlockMutex()
+void ThreadDispatcher::unlockKernelDataMutex()
 {
     int pthread_errorcode = pthread_mutex_unlock(&kernelDataMutex);
     if(pthread_errorcode != 0)
@@ -105,32 +172,102 @@ void ThreadDispatcher::requestSchedule()
     }
 }
 
+void ThreadDispatcher::waitUntil(RTXClock::time_point wakeupTime)
+{
+    if(wakeupTime == RTXClock::time_point::max())
+    {
+        pthread_cond_wait(&kernelModeCondVar, &kernelDataMutex);
+        return;
+    }
+
+    // calculate absolute time to wake up
+    int64_t waitTimeNs = realTimeUntil(wakeupTime).count();
+    struct timespec wakeupTimespec;
+    clock_gettime(CLOCK_MONOTONIC, &wakeupTimespec);
+    wakeupTimespec.tv_sec += waitTimeNs / 1000000000;
+    wakeupTimespec.tv_nsec += waitTimeNs % 1000000000;
+    if(wakeupTimespec.tv_nsec >= 1000000000)
+    {
+        wakeupTimespec.tv_sec += 1;
+        wakeupTimespec.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&kernelModeCondVar, &kernelDataMutex, &wakeupTimespec);
+}
+
 #endif
 
+void ThreadDispatcher::lockMutex()
+{
+    lockKernelDataMutex();
+
+#if RTXOFF_RECORD_REPLAY
+    // Only the outermost lock by an RTX thread counts as a kernel entry.
+    // Other host threads (including the dispatcher and ISRs) don't run in a repeatable order.
+    if(++kernelLockDepth == 1 && isRtxThread)
+    {
+        replayKernelEntry();
+    }
+#endif
+}
+
+void ThreadDispatcher::unlockMutex()
+{
+#if RTXOFF_RECORD_REPLAY
+    // note: can be called an extra time while a thread is exiting, see unlockKernelDataMutex()
+    if(kernelLockDepth > 0)
+    {
+        --kernelLockDepth;
+    }
+#endif
+
+    unlockKernelDataMutex();
+}
+
 void ThreadDispatcher::dispatchForever()
 {
     isDispatcher = true;
+#if RTXOFF_RECORD_REPLAY
+    // Simulated boards run in an unpredictable order relative to each other, so only the first one can be recorded
+    if(runningCount == 0)
+    {
+        replay.start();
+    }
+#endif
+    ++runningCount;
+    stats.startTime = RTXClock::now();
 	while(true)
 	{
-		// Dispatch the current thread
+		// Dispatch the current thread.
+		stats.runStartTime = RTXClock::now();
+#if !RTXOFF_USE_PROCESS_CLOCK
+		// The default idle hook does nothing, so there's no point in actually running the idle thread.
+		// (when using the process clock, though, a running thread is what makes time pass)
+		if(!(thread.run.curr == thread.idle && hooks.idle_hook == rtxOffDefaultIdleFunc))
+#endif
+		{
 #if RTXOFF_DEBUG && RTXOFF_VERBOSE
-        std::cerr << "Resuming thread " << thread.run.curr->name << std::endl;
+			std::cerr << "Resuming thread " << thread.run.curr->name << std::endl;
 #endif
-		thread_suspender_resume(thread.run.curr->osThread, thread.run.curr->suspenderData);
+			thread_suspender_resume(thread.run.curr->osThread, thread.run.curr->suspenderData);
+		}
 
-        // wait on the kernel mode cond var
-        // note: a spurious wakeup is OK, because if the next thread hasn't changed and there is no timer tick, then
-        // waking up won't do anything.
-#if USE_WINTHREAD
-		SleepConditionVariableCS(&kernelModeCondVar, &kernelDataMutex, OS_TICK_PERIOD_MS);
-#else
-		// calculate absolute time to wake up
-		struct timespec wakeupTime;
-		clock_gettime(CLOCK_MONOTONIC, &wakeupTime);
-		wakeupTime.tv_nsec += OS_TICK_PERIOD_MS * 1000000;
-		wakeupTime.tv_sec += OS_TICK_PERIOD_MS / 1000;
-		pthread_cond_timedwait(&kernelModeCondVar, &kernelDataMutex, &wakeupTime);
-#endif
+		// Sleep until there is something to do: a thread asking to be switched out, a pending interrupt,
+		// or the next delay, timer, or round robin deadline.
+		// note: a spurious wakeup is OK, because we just check again and go back to sleep.
+		while(!hasPendingWork())
+		{
+			if(!getNextDeadline(plannedWakeupTime))
+			{
+				plannedWakeupTime = RTXClock::time_point::max();
+			}
+			else if(plannedWakeupTime <= RTXClock::now())
+			{
+				break;
+			}
+
+			waitUntil(plannedWakeupTime);
+		}
+		plannedWakeupTime = RTXClock::time_point::min();
 
 		if(thread.run.curr != nullptr)
 		{
@@ -139,8 +276,12 @@ void ThreadDispatcher::dispatchForever()
             std::cerr << "Suspending thread " << thread.run.curr->name << std::endl;
 #endif
             thread_suspender_suspend(thread.run.curr->osThread, thread.run.curr->suspenderData);
+            statsChargeRunTime();
 		}
 
+		// Thread that was running, or nullptr if it exited
+		osRtxThread_t * suspendedThread = thread.run.curr;
+
 		if(!interrupt.enabled)
 		{
 			// If interrupts are disabled, the scheduler can't run on the real processor.
@@ -171,8 +312,12 @@ void ThreadDispatcher::dispatchForever()
 		}
 
 		// check if there are interrupts to process
-		if(!interrupt.pendingInterrupts.empty())
+		acceptInjectedInterrupts();
+		if(interrupt.table.anyPending() && !replaying())
 		{
+			++thread.run.curr->stats.isr_preemptions;
+			++stats.interrupts;
+
 			processInterrupts();
 			processQueuedISRData();
 
@@ -185,10 +330,14 @@ void ThreadDispatcher::dispatchForever()
 				thread.run.curr = thread.run.next;
 				thread.run.next = nullptr;
 			}
+
+#if RTXOFF_RECORD_REPLAY
+			replay.recordInterrupts(thread.run.curr);
+#endif
 		}
 
 		// regardless of what else happened, check if enough time has passed to deliver a tick.
-		if(updateTick())
+		if(!replaying() && updateTick())
 		{
 			// deliver the next tick
 			onTick();
@@ -200,6 +349,45 @@ void ThreadDispatcher::dispatchForever()
 			// load thread that tick handler says to use
 			thread.run.curr = thread.run.next;
 			thread.run.next = nullptr;
+
+#if RTXOFF_RECORD_REPLAY
+			replay.recordTick(kernel.tick, kernel.tickDelta, thread.run.curr);
+#endif
+		}
+
+#if RTXOFF_RECORD_REPLAY
+		// When replaying, ticks and interrupts come from the recording instead, at the same steps that they were recorded at
+		while(replayEventReady())
+		{
+			replayNextEvent();
+		}
+#endif
+
+#if RTXOFF_USE_VIRTUAL_TIME
+		// If only the idle thread can run, then nothing will happen until the next delay or timer expires.
+		// So, skip straight to that point instead of waiting for it.
+		// Note: other threads may have idle priority, so we also need to check that nothing else is ready.
+		if(thread.run.curr == thread.idle && thread.ready.thread_list == nullptr && !interrupt.table.anyPending() && !interrupt.injections.pending()
+			&& skipToNextDeadline() && updateTick())
+		{
+			onTick();
+
+#if RTXOFF_DEBUG && RTXOFF_VERBOSE
+			std::cerr << "Skipped to tick " << kernel.tick << ", curr is now " << thread.run.next->name << std::endl;
+#endif
+			thread.run.curr = thread.run.next;
+			thread.run.next = nullptr;
+
+#if RTXOFF_RECORD_REPLAY
+			replay.recordTick(kernel.tick, kernel.tickDelta, thread.run.curr);
+#endif
+		}
+#endif
+
+		if(thread.run.curr != suspendedThread)
+		{
+			statsRecordSwitch(suspendedThread, thread.run.curr);
+			RTXOFF_TRACE_EVENT(RTXOFF_TRACE_THREAD_SWITCH, thread.run.curr, suspendedThread, 0);
 		}
 
 		thread.run.curr->state = osRtxThreadRunning;
@@ -224,6 +412,7 @@ void ThreadDispatcher::dispatch(osRtxThread_t *toDispatch) {
             std::cerr << thread_ready->name << " is higher priority than the current (or next) thread " << th->name << ", switching to it now." << std::endl;
 #endif
 			// Preempt running Thread
+            RTXOFF_TRACE_EVENT(RTXOFF_TRACE_PREEMPT, thread.run.curr, thread_ready, 0);
             osRtxThreadListRemove(thread_ready);
             osRtxThreadBlock(thread.run.curr);
             switchNextThread(thread_ready);
@@ -232,6 +421,7 @@ void ThreadDispatcher::dispatch(osRtxThread_t *toDispatch) {
         if ((kernel.state == osRtxKernelRunning) &&
             (toDispatch->priority > thread.run.curr->priority)) {
             // Preempt running Thread
+            RTXOFF_TRACE_EVENT(RTXOFF_TRACE_PREEMPT, thread.run.curr, toDispatch, 0);
             osRtxThreadBlock(thread.run.curr);
             switchNextThread(toDispatch);
 #if RTXOFF_DEBUG
@@ -246,7 +436,7 @@ void ThreadDispatcher::dispatch(osRtxThread_t *toDispatch) {
 
 void ThreadDispatcher::onTick()
 {
-	kernel.tick++;
+	// note: kernel.tick has already been advanced by updateTick()
 
 	// Process Timers
 	if (timer.tick != NULL) {
@@ -311,8 +501,45 @@ void ThreadDispatcher::blockUntilWoken() {
         return;
     }
 
-    requestSchedule();
-    unlockMutex();
+#if !USE_WINTHREAD
+    osRtxThread_t *nextThread = thread.run.next;
+
+    // Fast path: if this is a voluntary switch to another user thread, hand the processor directly to it
+    // instead of waking the dispatcher and waiting for it to deliver a suspend signal to us.
+    // The dispatcher still has to handle switches to the idle thread (so it can do idle-time processing)
+    // and anything happening while interrupts are disabled.
+    if (nextThread != nullptr && nextThread != thread.idle && currThread == thread.run.curr &&
+        interrupt.enabled && kernel.state == osRtxKernelRunning) {
+
+#if RTXOFF_DEBUG && RTXOFF_VERBOSE
+        std::cerr << "Handing off from thread " << currThread->name << " to " << nextThread->name << std::endl;
+#endif
+        // note: this has to happen before the next thread can run, since it might switch back to us right away
+        thread_suspender_prepare_park();
+
+        statsChargeRunTime();
+        statsRecordSwitch(currThread, nextThread);
+        RTXOFF_TRACE_EVENT(RTXOFF_TRACE_THREAD_SWITCH, nextThread, currThread, 0);
+
+        thread.run.curr = nextThread;
+        thread.run.next = nullptr;
+        nextThread->state = osRtxThreadRunning;
+        thread_suspender_resume(nextThread->osThread, nextThread->suspenderData);
+
+        // round robin deadline may have changed
+        updateWakeupTime();
+
+        unlockMutex();
+
+        // Note: if the next thread has already switched back to us, this returns immediately.
+        thread_suspender_park_current_thread();
+    }
+    else
+#endif
+    {
+        requestSchedule();
+        unlockMutex();
+    }
 
     // The scheduler thread is now ready to run.  So all we need to do to run it
     // (and switch to another thread) is yield the processor. For loop there in case
@@ -324,26 +551,409 @@ void ThreadDispatcher::blockUntilWoken() {
     lockMutex();
 }
 
-bool ThreadDispatcher::updateTick()
+void ThreadDispatcher::statsChargeRunTime()
 {
-	using namespace std::chrono;
+	RTXClock::time_point now = RTXClock::now();
+	if(thread.run.curr != nullptr)
+	{
+		thread.run.curr->stats.run_time += (now - stats.runStartTime).count();
+	}
+	stats.runStartTime = now;
+}
 
-	auto nowTime = RTXClock::now();
-	auto timeDelta = nowTime - lastTickTime;
-	if(timeDelta >= tickDuration)
+void ThreadDispatcher::statsRecordSwitch(osRtxThread_t * from, osRtxThread_t * to)
+{
+	++stats.switches;
+
+	if(from != nullptr)
+	{
+		// Threads that are still ready to run were switched out by someone else
+		if(from->state == osRtxThreadReady)
+		{
+			++from->stats.involuntary_switches;
+		}
+		else
+		{
+			++from->stats.voluntary_switches;
+		}
+	}
+
+	to->stats.ready_time += RTXClock::now().time_since_epoch().count() - to->stats.ready_since;
+}
+
+int64_t ThreadDispatcher::statsGetRunTime(osRtxThread_t const * statsThread)
+{
+	int64_t runTime = statsThread->stats.run_time;
+	if(statsThread == thread.run.curr && stats.runStartTime != RTXClock::time_point())
+	{
+		runTime += (RTXClock::now() - stats.runStartTime).count();
+	}
+	return runTime;
+}
+
+#if RTXOFF_RECORD_REPLAY
+void ThreadDispatcher::replayKernelEntry()
+{
+	if(kernel.state != osRtxKernelRunning || replay.mode == ScheduleReplay::Mode::Off)
+	{
+		return;
+	}
+
+	// If the recording has a preemption before this point, the thread has to wait here until the dispatcher has delivered it.
+	// (the thread might not run again for a while if the preemption switches to another thread)
+	while(replay.eventDue() && interrupt.enabled)
+	{
+		uint64_t eventsReplayed = replay.eventsReplayed;
+		requestSchedule();
+		unlockKernelDataMutex();
+
+		while(replay.eventsReplayed == eventsReplayed)
+		{
+			rtxoff_thread_yield();
+		}
+
+		lockKernelDataMutex();
+	}
+
+	++replay.step;
+
+	// if the thread doesn't enter the kernel again for a while, the dispatcher needs to deliver the next event on its own
+	if(replay.eventDue())
+	{
+		requestSchedule();
+	}
+}
+
+bool ThreadDispatcher::replayEventReady()
+{
+	if(!replay.eventDue())
+	{
+		return false;
+	}
+
+	ScheduleReplay::Event const & event = replay.currentEvent();
+	if(event.type == ScheduleReplay::Event::Tick || event.irqs.empty())
 	{
-		// note: duration_cast always rounds down.
-		kernel.tickDelta = static_cast<uint32_t>(duration_cast<milliseconds>(timeDelta).count());
-		kernel.tick += static_cast<uint32_t>(duration_cast<milliseconds>(timeDelta).count());
-		lastTickTime += duration_cast<milliseconds>(timeDelta);
 		return true;
 	}
+
+	acceptInjectedInterrupts();
+	std::unique_lock<std::recursive_mutex> lock(interrupt.mutex);
+	InterruptData * interruptData = interrupt.table.find(event.irqs.front());
+	if(interruptData != nullptr && interruptData->pending)
+	{
+		replay.waitingSince = std::chrono::steady_clock::time_point();
+		return true;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if(replay.waitingSince == std::chrono::steady_clock::time_point())
+	{
+		replay.waitingSince = now;
+	}
+	else if(now - replay.waitingSince > ScheduleReplay::interruptTimeout)
+	{
+		replay.waitingSince = std::chrono::steady_clock::time_point();
+		replay.diverge("IRQ " + std::to_string(event.irqs.front()) + " never became pending");
+		lastTickTime = RTXClock::now();
+		publishTick();
+	}
+	return false;
+}
+
+void ThreadDispatcher::replayNextEvent()
+{
+	ScheduleReplay::Event const & event = replay.currentEvent();
+
+	if(event.type == ScheduleReplay::Event::Tick)
+	{
+		kernel.tickDelta = event.tickDelta;
+		kernel.tick = event.tick;
+		publishTick();
+		onTick();
+
+		thread.run.curr = thread.run.next;
+		thread.run.next = nullptr;
+	}
 	else
 	{
+		++thread.run.curr->stats.isr_preemptions;
+		++stats.interrupts;
+
+		interrupt.active = true;
+		std::unique_lock<std::recursive_mutex> lock(interrupt.mutex);
+
+		for(IRQn_Type irq : event.irqs)
+		{
+			// The interrupt might come from a host thread (e.g. a simulated peripheral) that hasn't raised it yet,
+			// so give it some time.
+			auto giveUpTime = std::chrono::steady_clock::now() + ScheduleReplay::interruptTimeout;
+			InterruptData * interruptData = interrupt.table.find(irq);
+			while(interruptData == nullptr || !interruptData->pending)
+			{
+				if(std::chrono::steady_clock::now() > giveUpTime)
+				{
+					interrupt.active = false;
+					replay.diverge("IRQ " + std::to_string(irq) + " never became pending");
+					return;
+				}
+
+				lock.unlock();
+				rtxoff_thread_yield();
+				lock.lock();
+				acceptInjectedInterrupts();
+			}
+
+			deliverInterrupt(interruptData);
+		}
+
+		interrupt.active = false;
+		lock.unlock();
+
+		processQueuedISRData();
+		if(thread.run.next != nullptr)
+		{
+			thread.run.curr = thread.run.next;
+			thread.run.next = nullptr;
+		}
+	}
+
+	replay.finishEvent(thread.run.curr);
+
+	if(!replaying())
+	{
+		// ticks come from the clock again, starting now
+		lastTickTime = RTXClock::now();
+		publishTick();
+	}
+}
+#endif
+
+int64_t ThreadDispatcher::ticksSinceLastTick()
+{
+#if RTXOFF_RECORD_REPLAY
+	// Only count ticks once the dispatcher delivers them, so that they happen at the same step when replayed
+	if(replay.mode != ScheduleReplay::Mode::Off)
+	{
+		return 0;
+	}
+#endif
+	return (RTXClock::now() - lastTickTime) / tickDuration;
+}
+
+uint32_t ThreadDispatcher::tickCount()
+{
+#if RTXOFF_RECORD_REPLAY
+	// ticksSinceLastTick() is 0 in this mode
+	if(replay.mode != ScheduleReplay::Mode::Off)
+	{
+		return publishedTick.load(std::memory_order_acquire);
+	}
+#endif
+	RTXClock::time_point epoch(RTXClock::duration(tickEpoch.load(std::memory_order_acquire)));
+	return static_cast<uint32_t>((RTXClock::now() - epoch) / tickDuration);
+}
+
+void ThreadDispatcher::publishTick()
+{
+	publishedTick.store(kernel.tick, std::memory_order_release);
+	tickEpoch.store((lastTickTime - static_cast<int64_t>(kernel.tick) * tickDuration).time_since_epoch().count(),
+		std::memory_order_release);
+}
+
+bool ThreadDispatcher::getNextDeadline(RTXClock::time_point & deadline)
+{
+	bool hasDeadline = false;
+
+#if RTXOFF_RECORD_REPLAY
+	if(replaying())
+	{
+		// Nothing happens because of time passing, only when the recording says so.
+		// But if the dispatcher is waiting for a recorded interrupt to be raised, check back periodically.
+		if(replay.eventDue())
+		{
+			deadline = RTXClock::now() + tickDuration;
+			return true;
+		}
 		return false;
 	}
+#endif
+
+#if RTXOFF_DEADLINE_HEAP
+	const osRtxThread_t * delayHead = thread.delay_heap.top();
+	const osRtxTimer_t * timerHead = timer.heap.top();
+#else
+	const osRtxThread_t * delayHead = thread.delay_list;
+	const osRtxTimer_t * timerHead = timer.list;
+#endif
+
+#if RTXOFF_TICKLESS || RTXOFF_DEADLINE_HEAP
+	// Both lists store the absolute deadline of each element
+	if(delayHead != nullptr)
+	{
+		deadline = RTXClock::time_point(RTXClock::duration(delayHead->delay));
+		hasDeadline = true;
+	}
+	if(timerHead != nullptr)
+	{
+		RTXClock::time_point timerDeadline(RTXClock::duration(timerHead->tick));
+		if(!hasDeadline || timerDeadline < deadline)
+		{
+			deadline = timerDeadline;
+			hasDeadline = true;
+		}
+	}
+#else
+	// Both lists store the delay of their first element relative to the last tick.
+	int64_t ticks = -1;
+	if(delayHead != nullptr)
+	{
+		ticks = delayHead->delay;
+	}
+	if(timerHead != nullptr && (ticks < 0 || timerHead->tick < ticks))
+	{
+		ticks = timerHead->tick;
+	}
+	if(ticks >= 0)
+	{
+		deadline = lastTickTime + std::max<int64_t>(ticks, 1) * tickDuration;
+		hasDeadline = true;
+	}
+#endif
+
+	// Round robin only matters if there's another thread at the same priority waiting for a turn
+	osRtxThread_t * readyThread = thread.ready.thread_list;
+	if(thread.robin.timeout != 0 && thread.run.curr != nullptr && readyThread != nullptr &&
+		readyThread->priority == thread.run.curr->priority)
+	{
+		// If the running thread has changed, onTick() needs to reset the round robin counter on the next tick.
+		int64_t robinTicks = thread.robin.thread == thread.run.curr ? thread.robin.tick : 1;
+		RTXClock::time_point robinDeadline = lastTickTime + std::max<int64_t>(robinTicks, 1) * tickDuration;
+		if(!hasDeadline || robinDeadline < deadline)
+		{
+			deadline = robinDeadline;
+			hasDeadline = true;
+		}
+	}
+
+#if RTXOFF_RECORD_REPLAY
+	// ticksSinceLastTick() doesn't count ticks that haven't been delivered when recording, so make sure each one is delivered on time
+	if(replay.mode == ScheduleReplay::Mode::Record)
+	{
+		RTXClock::time_point nextTick = lastTickTime + tickDuration;
+		if(!hasDeadline || nextTick < deadline)
+		{
+			deadline = nextTick;
+			hasDeadline = true;
+		}
+	}
+#endif
+
+	return hasDeadline;
 }
 
+#if RTXOFF_TICKLESS
+int64_t ThreadDispatcher::deadlineAfterTicks(int64_t ticks)
+{
+	return (RTXClock::now() + ticks * tickDuration).time_since_epoch().count();
+}
+
+int64_t ThreadDispatcher::deadlineNow()
+{
+	return RTXClock::now().time_since_epoch().count();
+}
+#elif RTXOFF_DEADLINE_HEAP
+int64_t ThreadDispatcher::deadlineAfterTicks(int64_t ticks)
+{
+	// Same as the delta lists: count from the last tick delivered by the dispatcher, plus any ticks it hasn't delivered yet.
+	return (lastTickTime + (ticks + ticksSinceLastTick()) * tickDuration).time_since_epoch().count();
+}
+
+int64_t ThreadDispatcher::deadlineNow()
+{
+	// Deadlines are on tick boundaries, so they expire when the tick they're on is delivered.
+	return lastTickTime.time_since_epoch().count();
+}
+#endif
+
+bool ThreadDispatcher::hasPendingWork()
+{
+	bool threadSwitch = thread.run.next != nullptr || thread.run.curr == nullptr || thread.run.curr->state != osRtxThreadRunning;
+
+#if RTXOFF_RECORD_REPLAY
+	if(replaying())
+	{
+		// pending interrupts wait until the recording says to deliver them
+		return threadSwitch || replayEventReady();
+	}
+#endif
+
+	return threadSwitch || interrupt.table.anyPending() || interrupt.injections.pending();
+}
+
+void ThreadDispatcher::updateWakeupTime()
+{
+	if(isDispatcher)
+	{
+		// dispatcher will recalculate its wakeup time before it next sleeps
+		return;
+	}
+
+	RTXClock::time_point deadline;
+	if(getNextDeadline(deadline) && deadline < plannedWakeupTime)
+	{
+		requestSchedule();
+	}
+}
+
+bool ThreadDispatcher::updateTick()
+{
+	auto nowTime = RTXClock::now();
+
+	// note: integer division of durations always rounds down.
+	int64_t ticks = (nowTime - lastTickTime) / tickDuration;
+	kernel.tickDelta = static_cast<uint32_t>(ticks);
+	kernel.tick += static_cast<uint32_t>(ticks);
+	lastTickTime += ticks * tickDuration;
+	publishTick();
+
+#if RTXOFF_TICKLESS
+	// delays and timers can also expire in between ticks
+	RTXClock::time_point deadline;
+	return ticks > 0 || (getNextDeadline(deadline) && deadline <= nowTime);
+#else
+	return ticks > 0;
+#endif
+}
+
+#if RTXOFF_USE_VIRTUAL_TIME
+bool ThreadDispatcher::skipToNextDeadline()
+{
+	// The clock is shared by all simulated boards, so it can't skip ahead while another board might be running.
+	if(runningCount > 1)
+	{
+		return false;
+	}
+
+	// Find the time when something wakes up
+	RTXClock::time_point deadline;
+	if(!getNextDeadline(deadline))
+	{
+		// Nothing is going to wake up on its own, so only an interrupt can make something happen.
+		// Let time pass normally.
+		return false;
+	}
+
+	auto nowTime = RTXClock::now();
+	if(deadline > nowTime)
+	{
+		RTXClock::advance(std::chrono::duration_cast<RTXClock::duration>(deadline - nowTime));
+	}
+
+	return true;
+}
+#endif
+
 void ThreadDispatcher::processInterrupts()
 {
 	// set global interrupt flag
@@ -352,29 +962,144 @@ void ThreadDispatcher::processInterrupts()
 	std::unique_lock<std::recursive_mutex> lock(interrupt.mutex);
 
 	// More interrupts could be added when we call interrupt handlers, so loop in a way that handles that
-	while(interrupt.enabled && !interrupt.pendingInterrupts.empty())
+	deliverPreemptingInterrupts();
+
+	interrupt.active = false;
+	return;
+}
+
+uint32_t ThreadDispatcher::preemptPriority(InterruptData const * interruptData) const
+{
+	uint32_t preemptPriority;
+	uint32_t subPriority;
+	NVIC_DecodePriority(interruptData->priority, interrupt.priorityGroupMask, &preemptPriority, &subPriority);
+	return preemptPriority;
+}
+
+bool ThreadDispatcher::canPreempt(InterruptData const * candidate) const
+{
+	if(interrupt.activeDepth == 0)
 	{
-		InterruptData * currInterrupt = *interrupt.pendingInterrupts.begin();
+		return true;
+	}
+	return preemptPriority(candidate) < preemptPriority(interrupt.activeStack[interrupt.activeDepth - 1]);
+}
 
-#if RTXOFF_DEBUG
-		std::cerr << "Calling interrupt vector for IRQ " << currInterrupt->irq << std::endl;
-#endif
+void ThreadDispatcher::deliverPreemptingInterrupts()
+{
+	acceptInjectedInterrupts();
+	while(interrupt.enabled && interrupt.table.anyPending() && canPreempt(interrupt.table.highestPending()))
+	{
+		deliverInterrupt(interrupt.table.highestPending());
+		acceptInjectedInterrupts();
+	}
+}
+
+void ThreadDispatcher::acceptInjectedInterrupts()
+{
+	if(!interrupt.injections.pending())
+	{
+		return;
+	}
+
+	std::unique_lock<std::recursive_mutex> lock(interrupt.mutex);
+	interrupt.injections.take(
+		[this](size_t index)
+		{
+			interrupt.table.setPending(interrupt.table.at(index), true);
+		},
+		[this](InterruptInjection * request)
+		{
+			InterruptData & interruptData = *interrupt.table.find(request->irq);
+			interrupt.table.setPending(interruptData, true);
+			request->next = interruptData.waiting;
+			interruptData.waiting = request;
+		});
+}
+
+void ThreadDispatcher::wakeForInjection()
+{
+	// take the kernel mutex so that the wakeup can't get lost while the dispatcher is deciding whether to sleep
+	lockKernelDataMutex();
+	requestSchedule();
+	unlockKernelDataMutex();
+}
+
+void ThreadDispatcher::finishInjections(InterruptData & interruptData, bool delivered)
+{
+	InterruptInjection * request = interruptData.waiting;
+	interruptData.waiting = nullptr;
+	finishInjections(request, delivered);
+}
 
-		// deliver this interrupt
-		currInterrupt->active = true;
-		if(currInterrupt->vector != nullptr)
+void ThreadDispatcher::finishInjections(InterruptInjection * request, bool delivered)
+{
+	while(request != nullptr)
+	{
+		// the callback may free the request
+		InterruptInjection * next = request->next;
+		bool allocated = request->allocated;
+		request->callback(request->irq, delivered ? 1 : 0, request->context);
+		if(allocated)
 		{
-			currInterrupt->vector();
+			delete request;
 		}
+		request = next;
+	}
+}
 
-		// now remove it from the queue
-		currInterrupt->active = false;
-		currInterrupt->pending = false;
-		interrupt.pendingInterrupts.erase(currInterrupt);
+void ThreadDispatcher::interruptPreemptionPoint()
+{
+	if(!isDispatcher || interrupt.activeDepth == 0)
+	{
+		return;
 	}
 
-	interrupt.active = false;
-	return;
+#if RTXOFF_RECORD_REPLAY
+	// recordings only hold the order that interrupts were delivered in, not how they nested
+	if(replay.mode != ScheduleReplay::Mode::Off)
+	{
+		return;
+	}
+#endif
+
+	std::unique_lock<std::recursive_mutex> lock(interrupt.mutex);
+	deliverPreemptingInterrupts();
+}
+
+void ThreadDispatcher::deliverInterrupt(InterruptData * toDeliver)
+{
+#if RTXOFF_DEBUG
+	std::cerr << "Calling interrupt vector for IRQ " << toDeliver->irq << std::endl;
+#endif
+
+	// deliver this interrupt.  Like on the real NVIC, it stops being pending when the vector starts, so
+	// it can be raised again while it runs.
+	toDeliver->active = true;
+	interrupt.table.setPending(*toDeliver, false);
+	interrupt.activeStack[interrupt.activeDepth++] = toDeliver;
+
+	// requests that come in while the vector runs wait for the next time it runs
+	InterruptInjection * waiting = toDeliver->waiting;
+	toDeliver->waiting = nullptr;
+
+	RTXOFF_TRACE_EVENT(RTXOFF_TRACE_ISR_ENTER, nullptr, toDeliver->irq, 0);
+	if(toDeliver->vector != nullptr)
+	{
+		toDeliver->vector();
+	}
+	RTXOFF_TRACE_EVENT(RTXOFF_TRACE_ISR_EXIT, nullptr, toDeliver->irq, 0);
+
+	--interrupt.activeDepth;
+	toDeliver->active = false;
+	finishInjections(waiting, true);
+
+#if RTXOFF_RECORD_REPLAY
+	if(replay.mode == ScheduleReplay::Mode::Record)
+	{
+		replay.batch.push_back(toDeliver->irq);
+	}
+#endif
 }
 
 void ThreadDispatcher::queuePostProcess(osRtxObject_t *object)
@@ -440,16 +1165,32 @@ void ThreadDispatcher::delayListInsert(osRtxThread_t *toDelay, int64_t delay) {
         toDelay->delay = delay;
         toDelay->delay_prev = prev;
         toDelay->delay_next = NULL;
+        toDelay->in_wait_list = 1U;
         if (prev != NULL) {
             prev->delay_next = toDelay;
         } else {
             thread.wait_list = toDelay;
         }
     } else {
+        toDelay->in_wait_list = 0U;
+#if RTXOFF_TICKLESS || RTXOFF_DEADLINE_HEAP
+        delay = deadlineAfterTicks(delay);
+#else
+        // Delays are relative to the last tick delivered by the dispatcher, which might have been a while ago
+        // if it's been asleep.
+        delay += ticksSinceLastTick();
+#endif
+
+#if RTXOFF_DEADLINE_HEAP
+        toDelay->delay = delay;
+        thread.delay_heap.insert(toDelay);
+#else
         prev = NULL;
         next = thread.delay_list;
         while ((next != NULL) && (next->delay <= delay)) {
+#if !RTXOFF_TICKLESS
             delay -= next->delay;
+#endif
             prev = next;
             next = next->delay_next;
         }
@@ -462,9 +1203,14 @@ void ThreadDispatcher::delayListInsert(osRtxThread_t *toDelay, int64_t delay) {
             thread.delay_list = toDelay;
         }
         if (next != NULL) {
+#if !RTXOFF_TICKLESS
             next->delay -= delay;
+#endif
             next->delay_prev = toDelay;
         }
+#endif
+
+        updateWakeupTime();
     }
 }
 
@@ -474,7 +1220,8 @@ void ThreadDispatcher::delayListRemove(osRtxThread_t *toRemove) {
               << toRemove->delay_prev << ",next=" << toRemove->delay_next << ")" << "from delay list ("
               << thread.wait_list << ")" << std::endl;
 #endif
-    if (toRemove->delay == osWaitForever) {
+    if (toRemove->in_wait_list) {
+        toRemove->in_wait_list = 0U;
         if (toRemove->delay_next != NULL) {
             toRemove->delay_next->delay_prev = toRemove->delay_prev;
         }
@@ -485,8 +1232,13 @@ void ThreadDispatcher::delayListRemove(osRtxThread_t *toRemove) {
             thread.wait_list = toRemove->delay_next;
         }
     } else {
+#if RTXOFF_DEADLINE_HEAP
+        thread.delay_heap.remove(toRemove);
+#else
         if (toRemove->delay_next != NULL) {
+#if !RTXOFF_TICKLESS
             toRemove->delay_next->delay += toRemove->delay;
+#endif
             toRemove->delay_next->delay_prev = toRemove->delay_prev;
         }
         if (toRemove->delay_prev != NULL) {
@@ -495,62 +1247,97 @@ void ThreadDispatcher::delayListRemove(osRtxThread_t *toRemove) {
         } else {
             thread.delay_list = toRemove->delay_next;
         }
+#endif
     }
 }
 
+// Move a thread whose delay has run out from the delay list to the ready list
+static void delayExpired(osRtxThread_t * expiredThread)
+{
+	osRtxObject_t *object;
+
+	switch (expiredThread->state) {
+		case osRtxThreadWaitingDelay:
+			break;
+		case osRtxThreadWaitingThreadFlags:
+			break;
+		case osRtxThreadWaitingEventFlags:
+			break;
+		case osRtxThreadWaitingMutex:
+			object = reinterpret_cast<osRtxObject_t *>(osRtxThreadListRoot(expiredThread));
+			osRtxMutexOwnerRestore(reinterpret_cast<osRtxMutex_t *>(object), expiredThread);
+			break;
+		case osRtxThreadWaitingSemaphore:
+			break;
+		case osRtxThreadWaitingMemoryPool:
+			break;
+		case osRtxThreadWaitingMessageGet:
+			break;
+		case osRtxThreadWaitingMessagePut:
+			break;
+		default:
+			// Invalid
+			break;
+	}
+#if RTXOFF_DEBUG
+	std::cerr << expiredThread->name << " has finished its waiting period at tick " << ThreadDispatcher::instance().kernel.tick << ", moving to ready list" << std::endl;
+#endif
+	RTXOFF_TRACE_EVENT(RTXOFF_TRACE_WAIT_EXIT, expiredThread, static_cast<uint32_t>(osErrorTimeout), 0);
+	osRtxThreadListRemove(expiredThread);
+	osRtxThreadReadyPut(expiredThread);
+}
+
+#if RTXOFF_DEADLINE_HEAP
+
+void ThreadDispatcher::delayListTick()
+{
+	// Deadlines are absolute, so a thread that is overdue by several ticks (because the dispatcher slept through them)
+	// and every thread after it that has also passed its deadline expire here, like the negative delay carry in the list version.
+	const int64_t expiry = deadlineNow();
+
+	osRtxThread_t *delayTopThread = thread.delay_heap.top();
+	while ((delayTopThread != nullptr) && (delayTopThread->delay <= expiry)) {
+		thread.delay_heap.remove(delayTopThread);
+		delayExpired(delayTopThread);
+		delayTopThread = thread.delay_heap.top();
+	}
+}
+
+#else
+
 void ThreadDispatcher::delayListTick()
 {
 	osRtxThread_t *delayTopThread;
-	osRtxObject_t *object;
 
 	delayTopThread = thread.delay_list;
 	if (delayTopThread == NULL) {
 		return;
 	}
 
+	// Threads whose delay value is at or below this have finished waiting
+#if RTXOFF_TICKLESS
+	const int64_t expiry = deadlineNow();
+#else
+	const int64_t expiry = 0;
 	delayTopThread->delay -= kernel.tickDelta;
+#endif
 
-	if (delayTopThread->delay <= 0)
+	if (delayTopThread->delay <= expiry)
 	{
 		do {
-			switch (delayTopThread->state) {
-				case osRtxThreadWaitingDelay:
-					break;
-				case osRtxThreadWaitingThreadFlags:
-					break;
-				case osRtxThreadWaitingEventFlags:
-					break;
-				case osRtxThreadWaitingMutex:
-					object = reinterpret_cast<osRtxObject_t *>(osRtxThreadListRoot(delayTopThread));
-					osRtxMutexOwnerRestore(reinterpret_cast<osRtxMutex_t *>(object), delayTopThread);
-					break;
-				case osRtxThreadWaitingSemaphore:
-					break;
-				case osRtxThreadWaitingMemoryPool:
-					break;
-				case osRtxThreadWaitingMessageGet:
-					break;
-				case osRtxThreadWaitingMessagePut:
-					break;
-				default:
-					// Invalid
-					break;
-			}
-#if RTXOFF_DEBUG
-			std::cerr << delayTopThread->name << " has finished its waiting period at tick " << kernel.tick << ", moving to ready list" << std::endl;
-#endif
-			osRtxThreadListRemove(delayTopThread);
-			osRtxThreadReadyPut(delayTopThread);
+			delayExpired(delayTopThread);
 
+#if !RTXOFF_TICKLESS
 			// proxy a negative delay value onto the next thread
 			if(delayTopThread->delay_next != nullptr)
 			{
 				delayTopThread->delay_next->delay += delayTopThread->delay;
 			}
+#endif
 
 			delayTopThread = delayTopThread->delay_next;
 
-		} while ((delayTopThread != NULL) && (delayTopThread->delay <= 0));
+		} while ((delayTopThread != NULL) && (delayTopThread->delay <= expiry));
 		if (delayTopThread != NULL) {
 			delayTopThread->delay_prev = NULL;
 		}
@@ -558,6 +1345,8 @@ void ThreadDispatcher::delayListTick()
 	}
 }
 
+#endif
+
 
 
 
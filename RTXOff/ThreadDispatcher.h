@@ -8,43 +8,19 @@
 #include "rtxoff_internal.h"
 #include "rtxoff_nvic.h"
 #include "rtxoff_clock.h"
+#include "rtxoff_deadline_heap.h"
+#include "rtxoff_interrupt_table.h"
+#include "rtxoff_interrupt_injection.h"
+#include "rtxoff_memory.h"
+#include "rtxoff_replay.h"
 
 #include "RTX_Config.h"
 
+#include <atomic>
 #include <chrono>
-#include <map>
-#include <set>
 #include <mutex>
 #include <queue>
 
-struct InterruptData
-{
-	IRQn_Type irq;
-	InterruptData(IRQn_Type _irq): irq(_irq) {}
-	bool enabled = false; // Whether this interrupt is enabled (can be triggered)
-	bool pending = false; // Whether this interrupt is pending (will be called)
-	bool active = false; // whether this interrupt is currently being delivered
-	void (*vector)() = nullptr; // Interrupt vector to call for this interrupt
-	uint8_t priority = 0x0; // Priority.  Lower value will be triggered first.
-};
-
-struct InterruptDataComparator
-{
-	bool operator()(InterruptData const * lhs, InterruptData const * rhs) const
-	{
-		if(lhs->priority != rhs->priority)
-		{
-			// we want the lowest priority to sort first in the set.
-			return lhs->priority < rhs->priority;
-		}
-		else
-		{
-			// per the specs, fall back to interrupt number
-			return lhs->irq < rhs->irq;
-		}
-	}
-};
-
 /**
  * To implement CMSIS-RTOS on top of a desktop OS, one OS thread is maintained for each RTX
  * thread.  However, the thread dispatcher follows a single rule: only one RTX thread can be running at a time.
@@ -86,11 +62,21 @@ public:
 			osRtxThread_t             *next = nullptr;  ///< Next Thread to Run
 		} run;
 		osRtxObject_t 				 ready;  ///< Ready List Object.  Linked list of threads sorted by priority.
+		struct {                            ///< Index into the ready list so that threads can be inserted without walking it
+			uint64_t                levels = 0;  ///< Bitmap of priority levels that have at least one thread in the ready list
+			osRtxThread_t *tails[osPriorityISR + 1] = {};  ///< Last thread in the ready list at each priority level
+		} readyIndex;
 		osRtxThread_t               *idle;  ///< Idle Thread
 		osRtxThread_t               *timer;  ///< Timer Thread
+#if RTXOFF_DEADLINE_HEAP
+		DeadlineHeap<osRtxThread_t, &osRtxThread_t::delay, &osRtxThread_t::delay_heap_index,
+			&osRtxThread_t::delay_heap_order> delay_heap;  ///< Delay Heap (replaces the delay list)
+#else
 		osRtxThread_t         *delay_list;  ///< Delay List
+#endif
 		osRtxThread_t          *wait_list;  ///< Wait List (no Timeout)
 		osRtxThread_t     *terminate_list;  ///< Terminate Thread List
+		uint32_t               nextSerial = 0;  ///< Serial number to give to the next thread created
 		struct {                            ///< Thread Round Robin Info
 			osRtxThread_t           *thread = nullptr;  ///< Round Robin Thread
 			int64_t                   tick = 0;  ///< Round Robin Time Tick
@@ -99,22 +85,44 @@ public:
 	} thread;
 
 	struct {                              ///< Timer Info
+#if RTXOFF_DEADLINE_HEAP
+		DeadlineHeap<osRtxTimer_t, &osRtxTimer_t::tick, &osRtxTimer_t::heap_index,
+			&osRtxTimer_t::heap_order> heap;  ///< Active Timer Heap (replaces the timer list)
+#else
 		osRtxTimer_t                *list = nullptr;  ///< Active Timer List
+#endif
 		osRtxThread_t             *thread = nullptr;  ///< Timer Thread
 		osRtxMessageQueue_t           *mq = nullptr;  ///< Timer Message Queue
 		void                (*tick)() = nullptr;  ///< Timer Tick Function
 	} timer;
 
+	MemoryArena memory{OS_DYNAMIC_MEM_SIZE};  ///< Dynamic memory for objects created without caller-provided memory
+
+	// Memory for the kernel's own objects.  Like on RTX, these don't come out of the dynamic memory.
+	struct {
+		osRtxThread_t         idle_thread;  ///< Idle Thread control block
+		osRtxThread_t        timer_thread;  ///< Timer Thread control block
+		osRtxMessageQueue_t      timer_mq;  ///< Timer Message Queue control block
+		uint64_t timer_mq_data[(osRtxMessageQueueMemSize(OS_TIMER_CB_QUEUE, sizeof(osRtxTimerFinfo_t)) + 7) / 8];  ///< Timer Message Queue data
+	} system_objects;
+
 	struct {
 		bool active = false; // Whether an ISR is currently being called
-		uint32_t priorityGroupMask;  // Priority group mask, see PRIGROUP register description
-		std::map<IRQn_Type, InterruptData> interruptData; // data for each interrupt.
-		std::set<InterruptData *, InterruptDataComparator> pendingInterrupts; // Set of interrupts that are pending, sorted by priority.
+		uint32_t priorityGroupMask = 0;  // Priority group mask, see PRIGROUP register description
+
+		// Interrupts currently being delivered, with the innermost (most recently preempting) one last
+		InterruptData * activeStack[InterruptTable::priorityLevels] = {};
+		size_t activeDepth = 0;
+		InterruptTable table; // data for each interrupt, and which ones are pending
+		InterruptInjectionQueue injections; // interrupts raised with NVIC_SetPendingIRQAsync() that aren't in the table yet.  Not protected by the mutex.
 		std::recursive_mutex mutex; // Seperate mutex to protect data in this struct.  OK to use std::mutex since we don't need special OS features.
 
 		// Whether interrupts are enabled for the simulated processor.
 		// Note: not protected by above mutex, but should only be modified by scheduler/RTOS threads.
 		bool enabled = true;
+
+		// Number of times core_util_critical_section_enter() has been called without a matching exit.
+		uint32_t criticalSectionDepth = 0;
 	} interrupt;
 
 	///< ISR Post Processing functions.
@@ -134,7 +142,32 @@ public:
 	// Time of the last system tick.  Once the clock time goes one tick period past this,
 	// we call the tick handler.
 	RTXClock::time_point lastTickTime;
-	std::chrono::milliseconds tickDuration = std::chrono::milliseconds(OS_TICK_PERIOD_MS);
+	std::chrono::microseconds tickDuration = std::chrono::microseconds(OS_TICK_PERIOD_US);
+
+	// Copies of kernel.tick and lastTickTime for tickCount(), which reads them without the kernel mutex.
+	// tickEpoch is lastTickTime minus kernel.tick ticks (as an RTXClock count), so the current tick count is
+	// just (now - tickEpoch) / tickDuration.  Updated by publishTick().
+	std::atomic<uint32_t> publishedTick{0};
+	std::atomic<RTXClock::rep> tickEpoch{0};
+
+	// Time that the dispatcher is currently planning to wake up at.  Threads compare new deadlines to this
+	// in order to decide if they need to wake the dispatcher early.  Is time_point::max() if the dispatcher is
+	// waiting without a timeout, and time_point::min() if it is not currently waiting.
+	RTXClock::time_point plannedWakeupTime = RTXClock::time_point::min();
+
+	// CPU usage statistics
+	struct {
+		RTXClock::time_point startTime;  ///< Time that the kernel started
+		RTXClock::time_point runStartTime;  ///< Time that the current thread was last resumed
+		uint64_t switches = 0;  ///< Total number of thread switches
+		uint64_t interrupts = 0;  ///< Total number of times that ISRs have been run
+		uint64_t criticalSections = 0;  ///< Total number of (outermost) critical sections entered
+	} stats;
+
+#if RTXOFF_RECORD_REPLAY
+	// Recording or replay of scheduling decisions
+	ScheduleReplay replay;
+#endif
 
 	struct
 	{
@@ -182,11 +215,34 @@ public:
 	ThreadDispatcher();
 
 	/**
-	 * Singleton accessor
+	 * Singleton accessor.
+	 * Returns the dispatcher for the simulated board that the calling host thread belongs to (see setCurrent()),
+	 * or the default dispatcher if no board has been selected.
 	 * @return
 	 */
 	static ThreadDispatcher & instance();
 
+	/**
+	 * Select the dispatcher that instance() returns on the calling host thread.
+	 * RTX threads automatically use the dispatcher of the thread that created them.
+	 * @param dispatcher Dispatcher to use, or nullptr for the default one.
+	 */
+	static void setCurrent(ThreadDispatcher * dispatcher);
+
+	/**
+	 * Mark the calling host thread as running an RTX thread, so that its kernel calls count as steps
+	 * for record/replay.  Called when RTX threads start.
+	 */
+	static void markRtxThread();
+
+	/**
+	 * Whether the calling host thread runs an RTX thread, and so can be suspended by the dispatcher at any time.
+	 */
+	static bool onRtxThread();
+
+	// Number of dispatchers that have been started with dispatchForever()
+	static std::atomic<uint32_t> runningCount;
+
 	ThreadDispatcher(ThreadDispatcher const & other) = delete;
 	ThreadDispatcher& operator=(ThreadDispatcher const & other) = delete;
 
@@ -194,6 +250,10 @@ public:
 	void lockMutex();
 	void unlockMutex();
 
+	// lock and unlock the global mutex without counting a kernel entry
+	void lockKernelDataMutex();
+	void unlockKernelDataMutex();
+
 	/**
 	 * Run the dispatcher forever without returning.  Called by osKernelStart().
 	 * Should be called with the data mutex already locked.
@@ -226,6 +286,13 @@ public:
 	 */
 	void requestSchedule();
 
+	/**
+	 * Called from the dispatcher to sleep until the given kernel clock time, or until requestSchedule() is called.
+	 * Pass RTXClock::time_point::max() to sleep with no timeout.
+	 * Expects to be called with the kernel mode mutex locked.  It is released while sleeping.
+	 */
+	void waitUntil(RTXClock::time_point wakeupTime);
+
 	/**
 	 * Call this from an RTX thread. Requests a schedule, yields to the scheduler thread,
 	 * and doesn't return until unless it's the current running thread.
@@ -245,13 +312,144 @@ public:
 	/**
 	 * Update the current tick and last tick time based on the current time.
 	 *
-	 * @return true iff the current time increased by at least 1.
+	 * @return true iff the current time increased by at least 1, or (in tickless mode) a delay or timer has expired.
 	 */
 	bool updateTick();
 
+	/**
+	 * Get the number of whole ticks that have passed since the last tick was delivered by the dispatcher.
+	 * Since the dispatcher only wakes up when it has something to do, this can be more than 0
+	 * while it is sleeping.
+	 */
+	int64_t ticksSinceLastTick();
+
+	/**
+	 * Get the current tick count: kernel.tick plus ticksSinceLastTick().
+	 * Doesn't need the kernel mutex, so that reading the clock from any thread doesn't contend with the dispatcher.
+	 */
+	uint32_t tickCount();
+
+	/**
+	 * Update the copies of the tick state that tickCount() reads.  Must be called with the kernel mutex locked
+	 * whenever kernel.tick or lastTickTime changes.
+	 */
+	void publishTick();
+
+	/**
+	 * Get the next time at which something needs the dispatcher:
+	 * a thread delay expiring, a timer expiring, or a round robin timeout.
+	 *
+	 * @param deadline Filled in with the deadline.  May be in the past if it's overdue.
+	 * @return true iff anything is scheduled.
+	 */
+	bool getNextDeadline(RTXClock::time_point & deadline);
+
+#if RTXOFF_TICKLESS || RTXOFF_DEADLINE_HEAP
+	/**
+	 * Get the deadline that is the given number of ticks from now, for use in the delay and timer lists.
+	 * Without RTXOFF_TICKLESS, this is rounded to a tick boundary the same way that delta list delays are.
+	 *
+	 * @return Deadline, in RTXClock::duration units since the clock's epoch.
+	 */
+	int64_t deadlineAfterTicks(int64_t ticks);
+
+	/**
+	 * Get the time to compare deadlines in the delay and timer lists against.  Anything at or before this has expired.
+	 *
+	 * @return Time, in RTXClock::duration units since the clock's epoch.
+	 */
+	int64_t deadlineNow();
+#endif
+
+	/**
+	 * Check whether the dispatcher has anything to do right now, e.g. switching threads or handling interrupts.
+	 */
+	bool hasPendingWork();
+
+	/**
+	 * Call after changing something that could move the dispatcher's next deadline earlier
+	 * (delay list, timer list, or ready list).  Wakes up the dispatcher if needed so that it can recalculate it.
+	 */
+	void updateWakeupTime();
+
+#if RTXOFF_USE_VIRTUAL_TIME
+	/**
+	 * Called when the idle thread is the only thread that can run.  Advances the kernel clock to the point
+	 * where the next thread delay or timer expires, so that the next call to updateTick() will deliver it.
+	 *
+	 * @return true iff there was a delay or timer to skip ahead to.
+	 */
+	bool skipToNextDeadline();
+#endif
+
+	// Statistics functions
+	// -------------------------------------------------------
+
+	/**
+	 * Add the time since the current thread was last resumed to its run time, and restart the count.
+	 * Call when the current thread stops running.
+	 */
+	void statsChargeRunTime();
+
+	/**
+	 * Record that the running thread changed.
+	 * @param from Thread that was running before, or nullptr if it exited.
+	 * @param to Thread that is running now.
+	 */
+	void statsRecordSwitch(osRtxThread_t * from, osRtxThread_t * to);
+
+	/**
+	 * Get the run time of a thread, including the time it has been running for if it's the current thread.
+	 */
+	int64_t statsGetRunTime(osRtxThread_t const * statsThread);
+
 	// Interrupt handling functions
 	// -------------------------------------------------------
 
+	/**
+	 * Call the vector for one pending interrupt and remove it from the interrupt queue.
+	 * Expects to be called with the interrupts mutex locked and interrupt.active set.
+	 */
+	void deliverInterrupt(InterruptData * toDeliver);
+
+	/**
+	 * Get the preempt (group) priority of an interrupt, which is the part of its priority above the
+	 * subpriority bits selected by the priority grouping.
+	 */
+	uint32_t preemptPriority(InterruptData const * interruptData) const;
+
+	/**
+	 * Whether a pending interrupt can preempt the innermost interrupt being delivered.  Like on a Cortex-M,
+	 * only a lower preempt priority preempts, the subpriority only decides the order of pending interrupts.
+	 * Anything can preempt thread code.
+	 */
+	bool canPreempt(InterruptData const * candidate) const;
+
+	/**
+	 * Deliver pending interrupts for as long as the highest priority one can preempt the current context.
+	 * Expects to be called with the interrupts mutex locked and interrupt.active set.
+	 */
+	void deliverPreemptingInterrupts();
+
+	/**
+	 * Make the interrupts in the injection queue pending.  Can be called from any thread.
+	 */
+	void acceptInjectedInterrupts();
+
+	/**
+	 * Wake up the dispatcher after adding to the injection queue.  Can be called from the dispatcher, or
+	 * from any other thread that doesn't hold the interrupts mutex.
+	 */
+	void wakeForInjection();
+
+	/**
+	 * Call the callbacks of the injection requests waiting on an interrupt, and forget them.
+	 * Expects to be called with the interrupts mutex locked.
+	 * @param delivered Whether the interrupt's vector ran, or it stopped being pending some other way
+	 */
+	void finishInjections(InterruptData & interruptData, bool delivered);
+	static void finishInjections(InterruptInjection * request, bool delivered);
+
 	/**
 	 * Process interrupts in the interrupt queue by calling the interrupt handler functions.
 	 * Continues to process interrupts until there are no more left to deliver.
@@ -259,6 +457,16 @@ public:
 	 */
 	void processInterrupts();
 
+	/**
+	 * Called when an interrupt handler does something that could let a higher priority interrupt in, such as
+	 * raising an interrupt or leaving a critical section.  If this is the dispatcher thread and an interrupt
+	 * is being delivered, delivers any pending interrupts that preempt it before returning.
+	 *
+	 * Since RTXOff can't stop a vector that is running on the host, these calls are the only points where
+	 * nested interrupts can happen.
+	 */
+	void interruptPreemptionPoint();
+
 	/**
 	 * Enqueue an object for post processing after the ISR.
 	 * @param object
@@ -270,10 +478,46 @@ public:
 	 */
 	void processQueuedISRData();
 
+	// Record/replay functions
+	// -------------------------------------------------------
+
+	/**
+	 * Whether ticks and interrupts are currently coming from a recording instead of from the clock and NVIC.
+	 */
+	bool replaying() const
+	{
+#if RTXOFF_RECORD_REPLAY
+		return replay.mode == ScheduleReplay::Mode::Replay;
+#else
+		return false;
+#endif
+	}
+
+#if RTXOFF_RECORD_REPLAY
+	/**
+	 * Called when an RTX thread enters the kernel.  Counts the step, and when replaying,
+	 * holds the thread back until any preemption recorded before this step has been delivered.
+	 * Expects to be called with the kernel mode mutex locked.
+	 */
+	void replayKernelEntry();
+
+	/**
+	 * Check whether the dispatcher can deliver the next recorded tick or set of interrupts now.
+	 * Recorded interrupts have to wait until something raises them, since that might be the running thread.
+	 */
+	bool replayEventReady();
+
+	/**
+	 * Called from the dispatcher to deliver the next recorded tick or set of interrupts.
+	 */
+	void replayNextEvent();
+#endif
+
 	// RTX Delay list functions
 	// -------------------------------------------------------
 
 	/// Insert a Thread into the Delay list sorted by Delay (Lowest at Head).
+	/// In tickless mode, the list stores absolute deadlines instead of delays relative to the previous thread.
 	/// \param[in]  thread          thread object.
 	/// \param[in]  delay           delay value.
 	void delayListInsert(osRtxThread_t * toDelay, int64_t delay);
@@ -447,15 +447,15 @@ extern const osThreadDef_t os_thread_def_##name
 const osThreadDef_t os_thread_def_##name = \
 { (name), (priority), 1, (stacksz) }
 #else
+// Threads can be created from the same definition several times, so each one gets its own control block and
+// stack from the kernel, like threads with more than one instance in the CMSIS 5 version of this macro.
 #define osThreadDef(name, priority, stacksz) \
-uint64_t os_thread_stack##name[(stacksz)?(((stacksz+7)/8)):1]; \
-static osRtxThread_t os_thread_cb_##name; \
 const osThreadDef_t os_thread_def_##name = \
 { (name), \
   { #name, osThreadDetached, \
-    &os_thread_cb_##name,\
-    osRtxThreadCbSize, \
-    (stacksz) ? (&os_thread_stack##name) : NULL, \
+    NULL, \
+    0U, \
+    NULL, \
     8*((stacksz+7)/8), \
     (priority), 0U, 0U } }
 #endif
@@ -73,6 +73,9 @@ typedef osRtxTimer_t mbed_rtos_storage_timer_t;
 #define MBED_RTOS_STORAGE_MEM_POOL_MEM_SIZE(block_count, block_size) \
   osRtxMemoryPoolMemSize(block_count, block_size)
 
+#define MBED_RTOS_STORAGE_MSG_QUEUE_MEM_SIZE(msg_count, msg_size) \
+  osRtxMessageQueueMemSize(msg_count, msg_size)
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,8 +6,6 @@
 #include <ThreadDispatcher.h>
 #include "mbed_critical.h"
 
-static uint32_t critical_section_reentrancy_counter = 0;
-
 bool core_util_are_interrupts_enabled(void)
 {
 	return ThreadDispatcher::instance().interrupt.enabled;
@@ -20,7 +18,7 @@ bool core_util_is_isr_active(void)
 
 bool core_util_in_critical_section(void)
 {
-	return critical_section_reentrancy_counter > 0;
+	return ThreadDispatcher::instance().interrupt.criticalSectionDepth > 0;
 }
 
 void core_util_critical_section_enter(void)
@@ -31,24 +29,36 @@ void core_util_critical_section_enter(void)
 	// also disable interrupts (mainly so that trying to call RTXOff functions will trigger an error)
 	ThreadDispatcher::instance().interrupt.enabled = false;
 
-	++critical_section_reentrancy_counter;
+	if (ThreadDispatcher::instance().interrupt.criticalSectionDepth++ == 0)
+	{
+		++ThreadDispatcher::instance().stats.criticalSections;
+	}
 }
 
 void core_util_critical_section_exit(void)
 {
 
 	// If critical_section_enter has not previously been called, do nothing
-	if (critical_section_reentrancy_counter == 0) {
+	if (ThreadDispatcher::instance().interrupt.criticalSectionDepth == 0) {
 		return;
 	}
 
-	--critical_section_reentrancy_counter;
+	--ThreadDispatcher::instance().interrupt.criticalSectionDepth;
 
 	// this is a recursive mutex so we need to unlock it as many times as we locked it
 	ThreadDispatcher::instance().unlockMutex();
 
-	if (critical_section_reentrancy_counter == 0)
+	if (ThreadDispatcher::instance().interrupt.criticalSectionDepth == 0)
 	{
 		ThreadDispatcher::instance().interrupt.enabled = true;
+
+		// in an interrupt handler, higher priority interrupts that came in during the critical section preempt it now
+		ThreadDispatcher::instance().interruptPreemptionPoint();
+
+		// if an interrupt came in while we were in the critical section, make sure the dispatcher wakes up to handle it
+		if(ThreadDispatcher::instance().interrupt.table.anyPending() || ThreadDispatcher::instance().interrupt.injections.pending())
+		{
+			ThreadDispatcher::instance().requestSchedule();
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+//
+// RTXOff multiple board support
+//
+
+#include "rtxoff_board.h"
+#include "ThreadDispatcher.h"
+
+#include <thread>
+#include <iostream>
+
+RTXOffBoard::RTXOffBoard(const char * name):
+dispatcher(new ThreadDispatcher()),
+name(name)
+{
+}
+
+void RTXOffBoard::start(osThreadFunc_t mainFunc, void * argument)
+{
+	ThreadDispatcher * boardDispatcher = dispatcher;
+	const char * boardName = name;
+
+	// This host thread becomes the board's dispatcher thread, so it never exits
+	std::thread boardThread([boardDispatcher, boardName, mainFunc, argument]()
+	{
+		ThreadDispatcher::setCurrent(boardDispatcher);
+
+		osKernelInitialize();
+
+		osThreadAttr_t mainThreadAttr = {};
+		mainThreadAttr.priority = osPriorityNormal;
+		mainThreadAttr.name = "main";
+
+		if(osThreadNew(mainFunc, argument, &mainThreadAttr) == nullptr)
+		{
+			std::cerr << "Main thread for board " << boardName << " not created" << std::endl;
+		}
+
+		osKernelStart();
+		std::cerr << "Failed to start RTOS for board " << boardName << std::endl;
+	});
+
+	boardThread.detach();
+}
+
+void RTXOffBoard::select()
+{
+	ThreadDispatcher::setCurrent(dispatcher);
+}
+
+void RTXOffBoard::selectDefault()
+{
+	ThreadDispatcher::setCurrent(nullptr);
+}
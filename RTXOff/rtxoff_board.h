@@ -0,0 +1,66 @@
+//
+// Header for running several independent RTXOff kernels ("boards") in one process.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_BOARD_H
+#define MBED_BENCHTEST_RTXOFF_BOARD_H
+
+#include "cmsis_os2.h"
+
+class ThreadDispatcher;
+
+/**
+ * One simulated board: a complete RTXOff kernel with its own dispatcher, tick count, interrupt table,
+ * and set of RTOS objects.  The program's own mbed_start() runs on the default board, and each RTXOffBoard
+ * that it starts runs alongside it on its own host thread, so boards can run on separate host cores.
+ *
+ * RTOS objects belong to the board whose thread created them, and must only be used by threads on that board.
+ * Boards should communicate through non-RTOS means, e.g. host mutexes and queues, plus NVIC_SetPendingIRQ()
+ * to interrupt the receiving board.
+ *
+ * A board's kernel cannot be stopped once it has been started, so RTXOffBoard objects are never destroyed.
+ */
+class RTXOffBoard
+{
+	ThreadDispatcher * dispatcher;
+	const char * name;
+
+public:
+	/**
+	 * Create a board.  Its kernel doesn't run until start() is called.
+	 * @param name Name of the board, used in error messages.
+	 */
+	explicit RTXOffBoard(const char * name);
+
+	RTXOffBoard(RTXOffBoard const & other) = delete;
+	RTXOffBoard& operator=(RTXOffBoard const & other) = delete;
+
+	/**
+	 * Start the board's kernel on a new host thread, with a main thread that runs the given function.
+	 * Returns immediately.  May be called from any thread, but only once per board.
+	 *
+	 * @param mainFunc Function for the board's main thread
+	 * @param argument Argument to pass to mainFunc
+	 */
+	void start(osThreadFunc_t mainFunc, void * argument = nullptr);
+
+	/**
+	 * Make RTXOff functions called from the current host thread operate on this board.
+	 * This is for host threads that aren't RTX threads, e.g. a test harness thread calling NVIC_SetPendingIRQ()
+	 * to deliver a simulated peripheral interrupt to a board.  RTX threads are always on the board that created them,
+	 * and must not call this.
+	 */
+	void select();
+
+	/**
+	 * Make RTXOff functions called from the current host thread operate on the default board.
+	 */
+	static void selectDefault();
+
+	const char * getName() const
+	{
+		return name;
+	}
+};
+
+#endif //MBED_BENCHTEST_RTXOFF_BOARD_H
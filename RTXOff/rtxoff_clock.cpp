@@ -1,8 +1,12 @@
 #include "rtxoff_clock.h"
 #include "rtxoff_internal.h"
 
+#include <atomic>
+
 using namespace std::chrono;
 
+#if RTXOFF_USE_PROCESS_CLOCK || RTXOFF_USE_VIRTUAL_TIME || RTXOFF_TICKLESS
+
 #if RTXOFF_USE_PROCESS_CLOCK
 #if USE_WINTHREAD
 
@@ -17,29 +21,65 @@ uint64_t filetimeToHundredNS(FILETIME & filetime)
 	return largeInt.QuadPart;
 }
 
-RTXClock::time_point RTXClock::now()
+// Get the time that the host clock reports
+static RTXClock::time_point hostNow()
 {
 	// get process times from OS
 	FILETIME creationTime, exitTime, kernelTime, userTime;
 	GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime);
 
 	uint64_t totalTimeHundredNS = filetimeToHundredNS(userTime);
-	return time_point(microseconds(totalTimeHundredNS / 10));
+	return RTXClock::time_point(microseconds(totalTimeHundredNS / 10));
 }
 
 #else
 
 #include <ctime>
 
-RTXClock::time_point RTXClock::now()
+// Get the time that the host clock reports
+static RTXClock::time_point hostNow()
 {
     struct timespec processTime;
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &processTime);
 
-    return time_point(
+    return RTXClock::time_point(
             duration_cast<microseconds>(seconds(processTime.tv_sec)) +
             duration_cast<microseconds>(nanoseconds(processTime.tv_nsec)));
 }
 
+#endif
+#else
+
+// Get the time that the host clock reports
+static RTXClock::time_point hostNow()
+{
+	return RTXClock::time_point(duration_cast<microseconds>(steady_clock::now().time_since_epoch()));
+}
+
+#endif
+
+#if RTXOFF_USE_VIRTUAL_TIME
+
+// Total amount of time that the clock has been advanced by.
+// Atomic because the clock can be read from any thread, not just ones holding the kernel mutex.
+static std::atomic<RTXClock::rep> skippedTime(0);
+
+RTXClock::time_point RTXClock::now()
+{
+	return hostNow() + duration(skippedTime.load());
+}
+
+void RTXClock::advance(duration amount)
+{
+	skippedTime += amount.count();
+}
+
+#else
+
+RTXClock::time_point RTXClock::now()
+{
+	return hostNow();
+}
+
 #endif
 #endif
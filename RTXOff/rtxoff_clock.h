@@ -8,7 +8,7 @@
 #include "RTX_Config.h"
 #include <chrono>
 
-#if RTXOFF_USE_PROCESS_CLOCK
+#if RTXOFF_USE_PROCESS_CLOCK || RTXOFF_USE_VIRTUAL_TIME || RTXOFF_TICKLESS
 /** A C++11 chrono TrivialClock for the RTXOff kernel millisecond tick count.
  * Inspired by a similar feature in Mbed RTOS.
  *
@@ -23,6 +23,14 @@ struct RTXClock {
 
 	static constexpr bool is_steady = true;
 	static time_point now();
+
+#if RTXOFF_USE_VIRTUAL_TIME
+	/**
+	 * Move the clock forward by the given amount, on top of the time that passes normally.
+	 * Used by the dispatcher to skip over periods where the kernel has nothing to do.
+	 */
+	static void advance(duration amount);
+#endif
 };
 #else
 typedef std::chrono::steady_clock RTXClock;
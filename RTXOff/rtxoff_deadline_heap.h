@@ -0,0 +1,151 @@
+//
+// Min-heap used for the delay and timer lists when RTXOFF_DEADLINE_HEAP is enabled.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_DEADLINE_HEAP_H
+#define MBED_BENCHTEST_RTXOFF_DEADLINE_HEAP_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Binary min-heap of kernel objects, ordered by an absolute deadline stored in each object.
+ * Inserting and removing are O(log n), and finding the earliest deadline is O(1).
+ *
+ * Objects with equal deadlines come out in the order that they were inserted, which matches the
+ * order that RTX's sorted lists give them.
+ *
+ * The heap doesn't own its objects; instead, each object stores its own position in the heap
+ * so that it can be removed from the middle without searching.
+ *
+ * @tparam T Object type
+ * @tparam Deadline Member of T holding the deadline that the heap is ordered by.  Must not be changed while the object is in the heap.
+ * @tparam Index Member of T that the heap uses to store the object's position
+ * @tparam Order Member of T that the heap uses to store the object's insertion order
+ */
+template<typename T, int64_t T::*Deadline, uint32_t T::*Index, uint64_t T::*Order>
+class DeadlineHeap
+{
+	std::vector<T *> elements;
+
+	// Order value to give to the next inserted element
+	uint64_t nextOrder = 0;
+
+	// Whether a should come out of the heap before b
+	static bool before(const T * a, const T * b)
+	{
+		if(a->*Deadline != b->*Deadline)
+		{
+			return a->*Deadline < b->*Deadline;
+		}
+		return a->*Order < b->*Order;
+	}
+
+	void place(size_t pos, T * element)
+	{
+		elements[pos] = element;
+		element->*Index = static_cast<uint32_t>(pos);
+	}
+
+	void siftUp(size_t pos)
+	{
+		T * element = elements[pos];
+		while(pos > 0)
+		{
+			size_t parent = (pos - 1) / 2;
+			if(!before(element, elements[parent]))
+			{
+				break;
+			}
+			place(pos, elements[parent]);
+			pos = parent;
+		}
+		place(pos, element);
+	}
+
+	void siftDown(size_t pos)
+	{
+		T * element = elements[pos];
+		const size_t count = elements.size();
+		while(true)
+		{
+			size_t child = 2 * pos + 1;
+			if(child >= count)
+			{
+				break;
+			}
+			if(child + 1 < count && before(elements[child + 1], elements[child]))
+			{
+				child++;
+			}
+			if(!before(elements[child], element))
+			{
+				break;
+			}
+			place(pos, elements[child]);
+			pos = child;
+		}
+		place(pos, element);
+	}
+
+public:
+	typedef typename std::vector<T *>::const_iterator const_iterator;
+
+	bool empty() const
+	{
+		return elements.empty();
+	}
+
+	size_t size() const
+	{
+		return elements.size();
+	}
+
+	/**
+	 * Get the object with the earliest deadline, or nullptr if the heap is empty.
+	 */
+	T * top() const
+	{
+		return elements.empty() ? nullptr : elements.front();
+	}
+
+	/**
+	 * Add an object to the heap.  Its deadline must already be set.
+	 */
+	void insert(T * element)
+	{
+		element->*Order = nextOrder++;
+		elements.push_back(element);
+		siftUp(elements.size() - 1);
+	}
+
+	/**
+	 * Remove an object from the heap.  It must currently be in the heap.
+	 */
+	void remove(T * element)
+	{
+		const size_t pos = element->*Index;
+		T * last = elements.back();
+		elements.pop_back();
+		if(last != element)
+		{
+			place(pos, last);
+			siftUp(pos);
+			siftDown(last->*Index);
+		}
+	}
+
+	// Iteration over all objects in the heap, in no particular order
+	const_iterator begin() const
+	{
+		return elements.begin();
+	}
+
+	const_iterator end() const
+	{
+		return elements.end();
+	}
+};
+
+#endif //MBED_BENCHTEST_RTXOFF_DEADLINE_HEAP_H
@@ -33,7 +33,7 @@ osStatus_t osDelayUntil (uint32_t ticks)
 
 	ThreadDispatcher::Mutex mutex;
 
-	ticks -= ThreadDispatcher::instance().kernel.tick;
+	ticks -= osKernelGetTickCount();
 	if ((ticks == 0U) || (ticks > 0x7FFFFFFFU)) {
 		return osErrorParameter;
 	}
@@ -1,5 +1,6 @@
 #include "ThreadDispatcher.h"
 #include "rtxoff_internal.h"
+#include <new>
 
 //  ==== Helper functions ====
 
@@ -98,14 +99,30 @@ osEventFlagsId_t osEventFlagsNew (const osEventFlagsAttr_t *attr)
 	// Process attributes
 	if (attr != NULL) {
 		name = attr->name;
+		ef   = static_cast<osRtxEventFlags_t *>(attr->cb_mem);
+		if (ef != NULL) {
+			if (!is_aligned_p(ef) || (attr->cb_size < sizeof(osRtxEventFlags_t))) {
+				return NULL;
+			}
+		} else {
+			if (attr->cb_size != 0U) {
+				return NULL;
+			}
+		}
 	} else {
 		name = "<anonymous event flags>";
 		ef   = NULL;
 	}
 
-	ef = new osRtxEventFlags_t();
+	// Allocate object memory if not provided
+	if (ef == NULL) {
+		ef = static_cast<osRtxEventFlags_t *>(osRtxMemoryAlloc(sizeof(osRtxEventFlags_t)));
+		flags = osRtxFlagSystemObject;
+	}
 
 	if (ef != NULL) {
+		new (ef) osRtxEventFlags_t();
+
 		// Initialize control block
 		ef->id          = osRtxIdEventFlags;
 		ef->flags       = flags;
@@ -320,7 +337,9 @@ osStatus_t osEventFlagsDelete (osEventFlagsId_t ef_id)
 	ef->id = osRtxIdInvalid;
 
 	// Free object memory
-	delete ef;
+	if ((ef->flags & osRtxFlagSystemObject) != 0U) {
+		osRtxMemoryFree(ef);
+	}
 
 	if (thisThread->state != osRtxThreadRunning)
 	{
@@ -8,6 +8,8 @@
 #include "cmsis_os.h"
 #include "rtxoff_os.h"
 #include "align.h"
+#include "rtxoff_trace.h"
+#include "RTX_Config.h"
 
 #include <string>
 #include <iostream>
@@ -63,5 +65,20 @@ uint32_t osRtxMemoryPoolInit(osRtxMpInfo_t *mp_info, uint32_t block_count, uint3
 void *osRtxMemoryPoolAlloc(osRtxMpInfo_t *mp_info);
 osStatus_t osRtxMemoryPoolFree(osRtxMpInfo_t *mp_info, void *block);
 
+// Dynamic memory functions.  Allocate from and free to the current kernel's dynamic memory (OS_DYNAMIC_MEM_SIZE).
+// osRtxMemoryAlloc() returns nullptr if the memory is full.
+void *osRtxMemoryAlloc(size_t size);
+void osRtxMemoryFree(void *block);
+
+// Scheduler trace points.  Pointer arguments are recorded as integers.
+#if RTXOFF_TRACE
+void rtxOffTraceRecord(uint32_t type, const void * thread, uint64_t arg0, uint64_t arg1);
+void rtxOffTraceThreadCreate(const osRtxThread_t * thread);
+#define RTXOFF_TRACE_EVENT(type, thread, arg0, arg1) rtxOffTraceRecord((type), (thread), (uint64_t)(arg0), (uint64_t)(arg1))
+#define RTXOFF_TRACE_THREAD_NEW(thread) rtxOffTraceThreadCreate(thread)
+#else
+#define RTXOFF_TRACE_EVENT(type, thread, arg0, arg1) ((void)0)
+#define RTXOFF_TRACE_THREAD_NEW(thread) ((void)0)
+#endif
 
 #endif //RTXOFF_INTERNAL_H
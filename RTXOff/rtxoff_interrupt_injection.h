@@ -0,0 +1,129 @@
+//
+// Queue for interrupts raised asynchronously by host threads, e.g. a test harness simulating a peripheral.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_INTERRUPT_INJECTION_H
+#define MBED_BENCHTEST_RTXOFF_INTERRUPT_INJECTION_H
+
+#include "rtxoff_interrupt_table.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * A request to raise an interrupt that wants to know when the interrupt's vector has run.
+ */
+struct InterruptInjection
+{
+	IRQn_Type irq = 0;
+	NVIC_InjectionCallback callback = nullptr;
+	void * context = nullptr;
+
+	// Whether the injection queue allocated this request and deletes it once the callback is called
+	bool allocated = false;
+
+	// Next request in the queue, or in the list of requests waiting on the same interrupt
+	InterruptInjection * next = nullptr;
+};
+
+/**
+ * Interrupts raised by host threads without waiting for them to be delivered.  Any number of threads can push
+ * without locks, while the dispatcher (or any thread that holds the interrupts mutex) takes everything in the
+ * queue at once and makes it pending in the interrupt table.
+ *
+ * Requests without a callback only set a bit for their interrupt, so raising the same interrupt many times
+ * before the dispatcher gets to it only makes it pending once, like on the real NVIC.  Requests with a callback
+ * are kept in a list so that each callback gets called.
+ */
+class InterruptInjectionQueue
+{
+	static constexpr size_t wordCount = (InterruptTable::size + 63) / 64;
+
+	// Bit i of word i / 64 is set if the interrupt at table index i has been raised
+	std::atomic<uint64_t> requested[wordCount] = {};
+
+	// Requests with callbacks, most recent first
+	std::atomic<InterruptInjection *> requests{nullptr};
+
+	// Set when anything has been pushed since the queue was last taken
+	std::atomic<bool> nonEmpty{false};
+
+public:
+	/**
+	 * Raise the interrupt at the given table index.
+	 * @return true if the queue was empty, in which case the caller needs to wake up the dispatcher
+	 */
+	bool push(size_t index)
+	{
+		requested[index / 64].fetch_or(uint64_t(1) << (index % 64), std::memory_order_release);
+		return !nonEmpty.exchange(true, std::memory_order_acq_rel);
+	}
+
+	/**
+	 * Add a request with a callback.  The request must stay valid until its callback has been called.
+	 * @return true if the queue was empty, in which case the caller needs to wake up the dispatcher
+	 */
+	bool push(InterruptInjection * request)
+	{
+		InterruptInjection * head = requests.load(std::memory_order_relaxed);
+		do
+		{
+			request->next = head;
+		}
+		while(!requests.compare_exchange_weak(head, request, std::memory_order_release, std::memory_order_relaxed));
+		return !nonEmpty.exchange(true, std::memory_order_acq_rel);
+	}
+
+	/**
+	 * Whether anything may have been pushed since the queue was last taken.
+	 */
+	bool pending() const
+	{
+		return nonEmpty.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Take everything out of the queue.  Calls raiseIndex(index) for each raised interrupt, then
+	 * raiseRequest(request) for each request with a callback in the order they were pushed.
+	 */
+	template<typename IndexFunc, typename RequestFunc>
+	void take(IndexFunc raiseIndex, RequestFunc raiseRequest)
+	{
+		if(!nonEmpty.exchange(false, std::memory_order_acq_rel))
+		{
+			return;
+		}
+
+		for(size_t word = 0; word < wordCount; ++word)
+		{
+			uint64_t bits = requested[word].exchange(0, std::memory_order_acquire);
+			while(bits != 0)
+			{
+				raiseIndex(word * 64 + InterruptTable::lowestSetBit(bits));
+				bits &= bits - 1;
+			}
+		}
+
+		// the list is most recent first, so reverse it
+		InterruptInjection * newestFirst = requests.exchange(nullptr, std::memory_order_acquire);
+		InterruptInjection * oldestFirst = nullptr;
+		while(newestFirst != nullptr)
+		{
+			InterruptInjection * next = newestFirst->next;
+			newestFirst->next = oldestFirst;
+			oldestFirst = newestFirst;
+			newestFirst = next;
+		}
+
+		while(oldestFirst != nullptr)
+		{
+			InterruptInjection * next = oldestFirst->next;
+			oldestFirst->next = nullptr;
+			raiseRequest(oldestFirst);
+			oldestFirst = next;
+		}
+	}
+};
+
+#endif //MBED_BENCHTEST_RTXOFF_INTERRUPT_INJECTION_H
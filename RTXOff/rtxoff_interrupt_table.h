@@ -0,0 +1,197 @@
+//
+// Table of the simulated NVIC's interrupts, with an index of the pending ones by priority.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_INTERRUPT_TABLE_H
+#define MBED_BENCHTEST_RTXOFF_INTERRUPT_TABLE_H
+
+#include "rtxoff_nvic.h"
+#include "RTX_Config.h"
+
+#include <cstdint>
+#include <cstddef>
+
+struct InterruptInjection;
+
+struct InterruptData
+{
+	IRQn_Type irq = 0;
+	bool enabled = false; // Whether this interrupt is enabled (can be triggered).  Only change through InterruptTable.
+	bool pending = false; // Whether this interrupt is pending (will be called once enabled).  Only change through InterruptTable.
+	bool active = false; // whether this interrupt is currently being delivered
+	void (*vector)() = nullptr; // Interrupt vector to call for this interrupt
+	InterruptInjection * waiting = nullptr; // Injection requests to notify once the vector next finishes running
+	uint8_t priority = 0x0; // Priority.  Lower value will be triggered first.  Only change through InterruptTable.
+};
+
+/**
+ * Holds the data for every interrupt in a flat array indexed by IRQ number, covering the 16 processor exceptions
+ * (IRQn -16 to -1) and RTXOFF_NVIC_IRQ_COUNT device interrupts.
+ *
+ * Pending interrupts are indexed by a bitmap of the priority levels that have at least one pending interrupt, plus
+ * a bitmap of the pending interrupts at each level.  Only enabled interrupts are in the index, since a disabled
+ * one stays pending without being delivered.  Finding the interrupt to deliver next is then a couple of
+ * find-first-set operations instead of a search.  Like on the real NVIC, interrupts at the same priority are
+ * delivered lowest IRQ number first.
+ */
+class InterruptTable
+{
+public:
+	// Number of processor exceptions before the device interrupts
+	static constexpr size_t exceptionCount = 16;
+
+	static constexpr size_t size = exceptionCount + RTXOFF_NVIC_IRQ_COUNT;
+
+	// Number of priority levels implemented
+	static constexpr size_t priorityLevels = size_t(1) << NVIC_PRIO_BITS;
+
+private:
+	static constexpr size_t wordCount = (size + 63) / 64;
+
+	InterruptData interrupts[size];
+
+	// Bit n is set if any interrupt with priority n is pending
+	uint32_t pendingLevels = 0;
+
+	// Bit i of word i / 64 at each level is set if the interrupt at index i is pending with that priority
+	uint64_t pendingAtLevel[priorityLevels][wordCount] = {};
+
+
+	void setState(InterruptData & interrupt, bool pending, bool enabled)
+	{
+		bool wasIndexed = interrupt.pending && interrupt.enabled;
+		interrupt.pending = pending;
+		interrupt.enabled = enabled;
+		bool indexed = pending && enabled;
+		if(indexed != wasIndexed)
+		{
+			if(indexed)
+			{
+				addPending(indexOf(interrupt.irq));
+			}
+			else
+			{
+				removePending(indexOf(interrupt.irq));
+			}
+		}
+	}
+
+	void addPending(size_t index)
+	{
+		uint8_t level = interrupts[index].priority;
+		pendingAtLevel[level][index / 64] |= uint64_t(1) << (index % 64);
+		pendingLevels |= uint32_t(1) << level;
+	}
+
+	void removePending(size_t index)
+	{
+		uint8_t level = interrupts[index].priority;
+		pendingAtLevel[level][index / 64] &= ~(uint64_t(1) << (index % 64));
+		for(size_t word = 0; word < wordCount; ++word)
+		{
+			if(pendingAtLevel[level][word] != 0)
+			{
+				return;
+			}
+		}
+		pendingLevels &= ~(uint32_t(1) << level);
+	}
+
+public:
+	static size_t indexOf(IRQn_Type irq)
+	{
+		return static_cast<size_t>(irq + static_cast<IRQn_Type>(exceptionCount));
+	}
+
+	/// Get the index of the lowest set bit in a nonzero value.
+	static inline int lowestSetBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctzll(value);
+#endif
+	}
+
+	InterruptTable()
+	{
+		for(size_t index = 0; index < size; ++index)
+		{
+			interrupts[index].irq = static_cast<IRQn_Type>(index) - static_cast<IRQn_Type>(exceptionCount);
+		}
+	}
+
+	/**
+	 * Get the data for an interrupt, or nullptr if the IRQ number is out of range.
+	 */
+	InterruptData * find(IRQn_Type irq)
+	{
+		if(irq < -static_cast<IRQn_Type>(exceptionCount) || irq >= static_cast<IRQn_Type>(RTXOFF_NVIC_IRQ_COUNT))
+		{
+			return nullptr;
+		}
+		return &interrupts[indexOf(irq)];
+	}
+
+	/**
+	 * Get the data for the interrupt at an index from indexOf().
+	 */
+	InterruptData & at(size_t index)
+	{
+		return interrupts[index];
+	}
+
+	/**
+	 * Set or clear an interrupt's pending flag.
+	 */
+	void setPending(InterruptData & interrupt, bool pending)
+	{
+		setState(interrupt, pending, interrupt.enabled);
+	}
+
+	/**
+	 * Enable or disable an interrupt.
+	 */
+	void setEnabled(InterruptData & interrupt, bool enabled)
+	{
+		setState(interrupt, interrupt.pending, enabled);
+	}
+
+	/**
+	 * Change an interrupt's priority.  Priorities beyond the implemented levels wrap around, like the
+	 * unimplemented bits of the NVIC's priority registers.
+	 */
+	void setPriority(InterruptData & interrupt, uint32_t priority)
+	{
+		bool pending = interrupt.pending;
+		setPending(interrupt, false);
+		interrupt.priority = static_cast<uint8_t>(priority & (priorityLevels - 1));
+		setPending(interrupt, pending);
+	}
+
+	/**
+	 * Whether any enabled interrupt is pending.
+	 */
+	bool anyPending() const
+	{
+		return pendingLevels != 0;
+	}
+
+	/**
+	 * Get the pending interrupt that should be delivered first.  Only valid if anyPending() is true.
+	 */
+	InterruptData * highestPending()
+	{
+		uint64_t const * level = pendingAtLevel[lowestSetBit(pendingLevels)];
+		size_t word = 0;
+		while(level[word] == 0)
+		{
+			++word;
+		}
+		return &interrupts[word * 64 + lowestSetBit(level[word])];
+	}
+};
+
+#endif //MBED_BENCHTEST_RTXOFF_INTERRUPT_TABLE_H
@@ -98,26 +98,26 @@ osStatus_t osKernelStart (void)
 	}
 
 	// Create Idle Thread
-	static const osThreadAttr_t os_idle_thread_attr = {
+	const osThreadAttr_t os_idle_thread_attr = {
 			"rtxoff_idle",
 			osThreadDetached,
+			&ThreadDispatcher::instance().system_objects.idle_thread,
+			sizeof(osRtxThread_t),
 			nullptr,
-			0,
-			nullptr,
-			0,
+			OS_IDLE_THREAD_STACK_SIZE,
 			osPriorityIdle,
 			0U,
 			0U
 	};
 
 	// Create Timer Thread
-	static const osThreadAttr_t os_timer_thread_attr = {
+	const osThreadAttr_t os_timer_thread_attr = {
 			"rtxoff_timer",
 			osThreadDetached,
+			&ThreadDispatcher::instance().system_objects.timer_thread,
+			sizeof(osRtxThread_t),
 			nullptr,
-			0,
-			nullptr,
-			0,
+			OS_TIMER_THREAD_STACK_SIZE,
             static_cast<osPriority_t>(OS_TIMER_THREAD_PRIO),
             OS_TIMER_THREAD_TZ_MOD_ID,
 			0U
@@ -140,7 +140,9 @@ osStatus_t osKernelStart (void)
 
 /// Get the RTOS kernel tick count.
 uint32_t osKernelGetTickCount (void) {
-	return ThreadDispatcher::instance().kernel.tick;
+	// note: the dispatcher only delivers ticks when it has something to do, so this adds on any that have passed
+	// since then.  Doesn't lock the kernel mutex, since this is behind every Kernel::Clock::now().
+	return ThreadDispatcher::instance().tickCount();
 }
 
 /// Get the RTOS kernel tick frequency.
@@ -151,6 +153,15 @@ uint32_t osKernelGetTickFreq (void) {
 /// Get the RTOS kernel system timer count.
 /// This should be finer grain than the tick count.
 uint32_t osKernelGetSysTimerCount (void) {
+#if RTXOFF_RECORD_REPLAY
+	// When recording or replaying, time only moves forward when the dispatcher delivers a tick,
+	// so that the program sees the same times in both runs.
+	ThreadDispatcher & dispatcher = ThreadDispatcher::instance();
+	if(dispatcher.replay.mode != ScheduleReplay::Mode::Off)
+	{
+		return static_cast<uint32_t>(dispatcher.kernel.tick * std::chrono::duration_cast<RTXClock::duration>(dispatcher.tickDuration).count());
+	}
+#endif
 	return static_cast<uint32_t>(RTXClock::now().time_since_epoch().count());
 }
 
@@ -6,6 +6,11 @@
 #include "mbed_rtxoff_storage.h"
 #include <iostream>
 
+// Stack size of the main thread, the same default as Mbed OS's rtos.main-thread-stack-size
+#ifndef MBED_CONF_RTOS_MAIN_THREAD_STACK_SIZE
+#define MBED_CONF_RTOS_MAIN_THREAD_STACK_SIZE 4096
+#endif
+
 osThreadAttr_t _main_thread_attr;
 mbed_rtos_storage_thread_t _main_obj;
 
@@ -37,6 +42,7 @@ int main(void)
 	// create and start main thread
 	_main_thread_attr.priority = osPriorityNormal;
 	_main_thread_attr.name = "main";
+	_main_thread_attr.stack_size = MBED_CONF_RTOS_MAIN_THREAD_STACK_SIZE;
 
 	osThreadId_t result = osThreadNew(reinterpret_cast<osThreadFunc_t>(&mbed_start), NULL, &_main_thread_attr);
 	if ((void *)result == nullptr) {
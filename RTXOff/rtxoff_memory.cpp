@@ -0,0 +1,135 @@
+//
+// Kernel dynamic memory, see rtxoff_memory.h
+//
+
+#include "rtxoff_memory.h"
+#include "ThreadDispatcher.h"
+
+MemoryArena::MemoryArena(size_t size)
+{
+	// Need room for at least the first and last block headers
+	memorySize = (size / sizeof(uint64_t)) * sizeof(uint64_t);
+	if(memorySize < 2 * sizeof(Block))
+	{
+		memorySize = 0;
+		return;
+	}
+
+	memory = new uint64_t[memorySize / sizeof(uint64_t)];
+
+	Block * end = reinterpret_cast<Block *>(reinterpret_cast<uint8_t *>(memory) + memorySize - sizeof(Block));
+	end->next = nullptr;
+	end->used = sizeof(Block);
+
+	head = reinterpret_cast<Block *>(memory);
+	head->next = end;
+	head->used = 0;
+}
+
+MemoryArena::~MemoryArena()
+{
+	delete[] memory;
+}
+
+void * MemoryArena::allocate(size_t size)
+{
+	if(head == nullptr || size == 0 || size > memorySize)
+	{
+		++failureCount;
+		return nullptr;
+	}
+
+	size = align(size + sizeof(Block));
+
+	// find the first gap between blocks that's big enough
+	Block * block = head;
+	while(true)
+	{
+		if(block->next == nullptr)
+		{
+			++failureCount;
+			return nullptr;
+		}
+
+		size_t space = static_cast<size_t>(reinterpret_cast<uint8_t *>(block->next) - reinterpret_cast<uint8_t *>(block));
+		if(space - block->used >= size)
+		{
+			break;
+		}
+		block = block->next;
+	}
+
+	if(block->used == 0)
+	{
+		// the first block is free, so use it
+		block->used = size;
+	}
+	else
+	{
+		Block * newBlock = reinterpret_cast<Block *>(reinterpret_cast<uint8_t *>(block) + block->used);
+		newBlock->next = block->next;
+		newBlock->used = size;
+		block->next = newBlock;
+		block = newBlock;
+	}
+
+	usedBytes += size;
+	if(usedBytes > maxUsedBytes)
+	{
+		maxUsedBytes = usedBytes;
+	}
+	++blockCount;
+
+	return block + 1;
+}
+
+bool MemoryArena::free(void * pointer)
+{
+	if(head == nullptr || pointer == nullptr)
+	{
+		return false;
+	}
+
+	Block * target = static_cast<Block *>(pointer) - 1;
+	Block * previous = nullptr;
+	Block * block = head;
+	while(block != target)
+	{
+		previous = block;
+		block = block->next;
+		if(block == nullptr)
+		{
+			return false;
+		}
+	}
+
+	usedBytes -= block->used;
+	--blockCount;
+
+	if(previous == nullptr)
+	{
+		// the first block stays in the list, just mark it free
+		block->used = 0;
+	}
+	else
+	{
+		previous->next = block->next;
+	}
+	return true;
+}
+
+void * osRtxMemoryAlloc(size_t size)
+{
+	ThreadDispatcher::Mutex mutex;
+	return ThreadDispatcher::instance().memory.allocate(size);
+}
+
+void osRtxMemoryFree(void * block)
+{
+	ThreadDispatcher::Mutex mutex;
+	if(!ThreadDispatcher::instance().memory.free(block))
+	{
+		std::cerr << "RTXOFF Critical Error: freeing memory that was not allocated from this kernel's dynamic memory" << std::endl;
+		exit(4);
+	}
+}
@@ -0,0 +1,73 @@
+//
+// Kernel dynamic memory, which RTOS objects are allocated from when the caller doesn't provide memory for them.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_MEMORY_H
+#define MBED_BENCHTEST_RTXOFF_MEMORY_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * First-fit allocator over a fixed-size block of memory, which works the same way as RTX's rtx_memory.c.
+ * Like on RTX, allocations fail once the memory is full, and the peak usage shows how much memory the
+ * program's objects need.  Sizes are host sizes, so objects take more memory than they do on the target.
+ *
+ * Not thread safe.  The kernel's arena is only used with the kernel mutex locked.
+ */
+class MemoryArena
+{
+	// Header in front of each block.  Blocks are kept in a list in address order, which ends with an empty
+	// block at the end of the memory.
+	struct Block
+	{
+		Block * next;
+
+		// Size of the block including its header, or 0 if this is the first block and it's free
+		size_t used;
+	};
+
+	uint64_t * memory = nullptr;
+	size_t memorySize = 0;
+	Block * head = nullptr;
+
+	size_t usedBytes = 0;
+	size_t maxUsedBytes = 0;
+	uint32_t blockCount = 0;
+	uint32_t failureCount = 0;
+
+public:
+	explicit MemoryArena(size_t size);
+	~MemoryArena();
+
+	MemoryArena(MemoryArena const &) = delete;
+	MemoryArena & operator=(MemoryArena const &) = delete;
+
+	/**
+	 * Allocate a block, aligned to 8 bytes.
+	 * @return the block, or nullptr if there is no free space big enough
+	 */
+	void * allocate(size_t size);
+
+	/**
+	 * Free a block from allocate().
+	 * @return false if the block was not allocated from this arena
+	 */
+	bool free(void * block);
+
+	size_t size() const { return memorySize; }
+
+	/// Bytes currently allocated, including block headers
+	size_t used() const { return usedBytes; }
+
+	/// Most bytes that have been allocated at once
+	size_t maxUsed() const { return maxUsedBytes; }
+
+	/// Number of blocks currently allocated
+	uint32_t blocks() const { return blockCount; }
+
+	/// Number of allocations that have failed because there was no space
+	uint32_t failures() const { return failureCount; }
+};
+
+#endif //MBED_BENCHTEST_RTXOFF_MEMORY_H
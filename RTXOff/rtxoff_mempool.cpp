@@ -209,7 +209,7 @@ static osMemoryPoolId_t svcRtxMemoryPoolNew(uint32_t block_count, uint32_t block
 
     // Allocate object memory if not provided
     if (mp == nullptr) {
-        mp = new osRtxMemoryPool_t;
+        mp = static_cast<osRtxMemoryPool_t *>(osRtxMemoryAlloc(sizeof(osRtxMemoryPool_t)));
         flags = osRtxFlagSystemObject;
     } else {
         flags = 0U;
@@ -218,10 +218,10 @@ static osMemoryPoolId_t svcRtxMemoryPoolNew(uint32_t block_count, uint32_t block
     // Allocate data memory if not provided
     if ((mp != nullptr) && (mp_mem == nullptr)) {
         //lint -e{9079} "conversion from pointer to void to pointer to other type" [MISRA Note 5]
-        mp_mem = new uint8_t[size];
+        mp_mem = osRtxMemoryAlloc(size);
         if (mp_mem == nullptr) {
             if ((flags & osRtxFlagSystemObject) != 0U) {
-                delete mp;
+                osRtxMemoryFree(mp);
             }
             mp = nullptr;
         } else {
@@ -460,12 +460,12 @@ static osStatus_t svcRtxMemoryPoolDelete(osMemoryPoolId_t mp_id) {
 
     // Free data memory
     if ((mp->flags & osRtxFlagSystemMemory) != 0U) {
-        delete static_cast<uint8_t *>(mp->mp_info.block_base);
+        osRtxMemoryFree(mp->mp_info.block_base);
     }
 
     // Free object memory
     if ((mp->flags & osRtxFlagSystemObject) != 0U) {
-        delete mp;
+        osRtxMemoryFree(mp);
     }
 
     // add event
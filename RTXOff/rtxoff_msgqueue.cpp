@@ -6,39 +6,83 @@
 #include <limits>
 
 #include "ThreadDispatcher.h"
+#include "rtxoff_msgqueue.h"
+
+// Values of osRtxMessage_t::reserved_state for Messages out of the Queue (0 otherwise)
+#define MESSAGE_RESERVED 1U   // taken by osMessageQueueReserve(), not committed yet
+#define MESSAGE_BORROWED 2U   // taken by osMessageQueueBorrow(), not released yet
 
 //  ==== Helper functions ====
 
+/// Find the run of a priority in the index of a Message Queue.
+/// \param[in]  mq              message queue object.
+/// \param[in]  priority        message priority.
+/// \return index of the run with this priority, or of the first run with a lower priority.
+static uint32_t MessageQueueFindRun(const osRtxMessageQueue_t *mq, uint8_t priority) {
+
+    // runs are sorted highest priority first
+    uint32_t low = 0U;
+    uint32_t high = mq->msg_run_count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2U;
+        if (mq->msg_runs[mid]->priority > priority) {
+            low = mid + 1U;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
 /// Put a Message into Queue sorted by Priority (Highest at Head).
+/// A Message that doesn't have a higher priority than the last one goes straight to the tail.
+/// Otherwise the index of the last Message of each priority in the Queue is searched for the
+/// last one with the same or the next higher priority, so the list isn't searched for its
+/// place.  The index holds one entry per priority in the Queue, which is usually only a few.
 /// \param[in]  mq              message queue object.
 /// \param[in]  msg             message object.
 static void MessageQueuePut(osRtxMessageQueue_t *mq, osRtxMessage_t *msg) {
 
     osRtxMessage_t *prev, *next;
+    uint8_t priority = msg->priority;
 
-    if (mq->msg_last != nullptr) {
+    if ((mq->msg_last == nullptr) || (priority <= mq->msg_last->priority)) {
         prev = mq->msg_last;
-        next = nullptr;
-        while ((prev != nullptr) && (prev->priority < msg->priority)) {
-            next = prev;
-            prev = prev->prev;
+        if (mq->msg_runs != nullptr) {
+            if ((prev == nullptr) || (priority < prev->priority)) {
+                mq->msg_run_count++;
+            }
+            mq->msg_runs[mq->msg_run_count - 1U] = msg;
         }
-        msg->prev = prev;
-        msg->next = next;
-        if (prev != nullptr) {
-            prev->next = msg;
+    } else if (mq->msg_runs != nullptr) {
+        uint32_t run = MessageQueueFindRun(mq, priority);
+        if (mq->msg_runs[run]->priority == priority) {
+            prev = mq->msg_runs[run];
         } else {
-            mq->msg_first = msg;
+            prev = (run > 0U) ? mq->msg_runs[run - 1U] : nullptr;
+            memmove(&mq->msg_runs[run + 1U], &mq->msg_runs[run], (mq->msg_run_count - run) * sizeof(mq->msg_runs[0]));
+            mq->msg_run_count++;
         }
-        if (next != nullptr) {
-            next->prev = msg;
-        } else {
-            mq->msg_last = msg;
+        mq->msg_runs[run] = msg;
+    } else {
+        // without an index, search back from the tail
+        prev = mq->msg_last;
+        while ((prev != nullptr) && (prev->priority < priority)) {
+            prev = prev->prev;
         }
+    }
+    next = (prev != nullptr) ? prev->next : mq->msg_first;
+
+    msg->prev = prev;
+    msg->next = next;
+    if (prev != nullptr) {
+        prev->next = msg;
     } else {
-        msg->prev = nullptr;
-        msg->next = nullptr;
         mq->msg_first = msg;
+    }
+    if (next != nullptr) {
+        next->prev = msg;
+    } else {
         mq->msg_last = msg;
     }
 
@@ -85,6 +129,8 @@ static osRtxMessage_t *MessageQueueGet(osRtxMessageQueue_t *mq) {
 /// \param[in]  msg             message object.
 static void MessageQueueRemove(osRtxMessageQueue_t *mq, const osRtxMessage_t *msg) {
 
+    uint8_t priority = msg->priority;
+
     if (msg->prev != nullptr) {
         msg->prev->next = msg->next;
     } else {
@@ -95,32 +141,66 @@ static void MessageQueueRemove(osRtxMessageQueue_t *mq, const osRtxMessage_t *ms
     } else {
         mq->msg_last = msg->prev;
     }
-}
 
-static void sendWaitingMessage(osRtxMessageQueue_t *mq, bool dispatch) {
-    auto *msg = static_cast<osRtxMessage_t *>(osRtxMemoryPoolAlloc(&mq->mp_info));
-    if (msg != nullptr) {
-        // Wakeup waiting Thread with highest Priority
-        osRtxThread_t *thread = osRtxThreadListGet(reinterpret_cast<osRtxObject_t *>(mq));
-        osRtxThreadWaitExit(thread, (uint32_t) osOK, dispatch);
+    if (mq->msg_runs != nullptr) {
+        uint32_t run = MessageQueueFindRun(mq, priority);
+        if (mq->msg_runs[run] == msg) {
+            if ((msg->prev != nullptr) && (msg->prev->priority == priority)) {
+                mq->msg_runs[run] = msg->prev;
+            } else {
+                mq->msg_run_count--;
+                memmove(&mq->msg_runs[run], &mq->msg_runs[run + 1U], (mq->msg_run_count - run) * sizeof(mq->msg_runs[0]));
+            }
+        }
+    }
+}
 
-        const void *ptr_src = thread->queueBlockedData.msg_body.send;
-        memcpy(&msg[1], ptr_src, mq->msg_size);
-        // Store Message into Queue
-        msg->id = osRtxIdMessage;
-        msg->flags = 0U;
-        msg->priority = thread->queueBlockedData.msg_prio.send;
-        MessageQueuePut(mq, msg);
-        thread->waitValPresent = true;
+/// Find the highest priority Thread waiting on a Message Queue in the given state.
+/// Threads waiting to put and to get can be in the list at the same time, since
+/// reserved and borrowed Messages take up space without being in the Queue.
+/// \param[in]  mq              message queue object.
+/// \param[in]  state           osRtxThreadWaitingMessagePut or osRtxThreadWaitingMessageGet.
+/// \return thread object or nullptr.
+static osRtxThread_t *MessageQueueWaiter(const osRtxMessageQueue_t *mq, uint8_t state) {
+    osRtxThread_t *thread;
 
+    for (thread = mq->thread_list; thread != nullptr; thread = thread->thread_next) {
+        if (thread->state == state) {
+            break;
+        }
     }
+    return thread;
 }
 
-static void receiveWaitingMessage(osRtxMessageQueue_t *mq, const void *msg_body, uint8_t msg_prio, bool dispatch) {
-    // Wakeup waiting Thread with highest Priority
+/// Get the Message holding a message body from osMessageQueueReserve() or osMessageQueueBorrow().
+/// \param[in]  mq              message queue object.
+/// \param[in]  msg_ptr         message body.
+/// \return message object, or nullptr if msg_ptr isn't a reserved or borrowed message of this queue.
+static osRtxMessage_t *MessageQueueBlock(const osRtxMessageQueue_t *mq, const void *msg_ptr) {
+    auto base = reinterpret_cast<uintptr_t>(mq->mp_info.block_base);
+    auto lim = reinterpret_cast<uintptr_t>(mq->mp_info.block_lim);
+    uintptr_t block = reinterpret_cast<uintptr_t>(msg_ptr) - sizeof(osRtxMessage_t);
+
+    if ((msg_ptr == nullptr) || (block < base) || (block >= lim) || (((block - base) % mq->mp_info.block_size) != 0U)) {
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return nullptr;
+    }
+
+    auto *msg = reinterpret_cast<osRtxMessage_t *>(block);
+    if ((msg->id != osRtxIdMessage) || ((msg->reserved_state != MESSAGE_RESERVED) && (msg->reserved_state != MESSAGE_BORROWED))) {
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return nullptr;
+    }
+    return msg;
+}
 
-    osRtxThread_t *thread = osRtxThreadListGet(reinterpret_cast<osRtxObject_t *>(mq));
-    osRtxThreadWaitExit(thread, (uint32_t) osOK, dispatch);
+/// Hand a Message to a Thread waiting in osMessageQueueGet().
+/// \param[in]  mq              message queue object.
+/// \param[in]  thread          thread object waiting to get.
+/// \param[in]  msg_body        message body.
+/// \param[in]  msg_prio        message priority.
+static void receiveWaitingMessage(osRtxMessageQueue_t *mq, osRtxThread_t *thread, const void *msg_body, uint8_t msg_prio) {
+    osRtxThreadListRemove(thread);
 
     void *ptr_dst = thread->queueBlockedData.msg_body.receive;
     memcpy(ptr_dst, msg_body, mq->msg_size);
@@ -129,7 +209,101 @@ static void receiveWaitingMessage(osRtxMessageQueue_t *mq, const void *msg_body,
     if ((rec = thread->queueBlockedData.msg_prio.receive) != nullptr) {
         *rec = msg_prio;
     }
-    thread->waitValPresent = true;
+    osRtxThreadWaitExit(thread, (uint32_t) osOK, false);
+}
+
+static bool sendWaitingMessage(osRtxMessageQueue_t *mq);
+
+/// Deliver a new Message: hand it to the highest priority Thread waiting to get one,
+/// or put it into the Queue if there is none.
+/// \param[in]  mq              message queue object.
+/// \param[in]  msg             message object, with its body and priority filled in.
+/// \return true if a Thread was woken.
+static bool MessageQueueDeliver(osRtxMessageQueue_t *mq, osRtxMessage_t *msg) {
+    osRtxThread_t *thread = (mq->thread_list != nullptr) ? MessageQueueWaiter(mq, osRtxThreadWaitingMessageGet) : nullptr;
+
+    msg->flags = 0U;
+    if (thread == nullptr) {
+        msg->reserved_state = 0U;
+        MessageQueuePut(mq, msg);
+        return false;
+    } else if (thread->queueBlockedData.msg_body.receive == nullptr) {
+        // Thread is waiting in osMessageQueueBorrow(), give it the Message itself
+        osRtxThreadListRemove(thread);
+        msg->reserved_state = MESSAGE_BORROWED;
+        uint8_t *rec;
+        if ((rec = thread->queueBlockedData.msg_prio.receive) != nullptr) {
+            *rec = msg->priority;
+        }
+        osRtxThreadWaitExit(thread, reinterpret_cast<uintptr_t>(&msg[1]), false);
+    } else {
+        receiveWaitingMessage(mq, thread, &msg[1], msg->priority);
+
+        // Free memory
+        msg->id = osRtxIdInvalid;
+        (void) osRtxMemoryPoolFree(&mq->mp_info, msg);
+        (void) sendWaitingMessage(mq);
+    }
+    return true;
+}
+
+/// Give a free Message to the highest priority Thread waiting to put one.
+/// \param[in]  mq              message queue object.
+/// \return true if a Thread was woken.
+static bool sendWaitingMessage(osRtxMessageQueue_t *mq) {
+    osRtxThread_t *thread = MessageQueueWaiter(mq, osRtxThreadWaitingMessagePut);
+    if (thread == nullptr) {
+        return false;
+    }
+
+    auto *msg = static_cast<osRtxMessage_t *>(osRtxMemoryPoolAlloc(&mq->mp_info));
+    if (msg == nullptr) {
+        return false;
+    }
+
+    // Wakeup waiting Thread with highest Priority
+    osRtxThreadListRemove(thread);
+    msg->id = osRtxIdMessage;
+    msg->flags = 0U;
+    msg->priority = 0U;
+
+    const void *ptr_src = thread->queueBlockedData.msg_body.send;
+    if (ptr_src == nullptr) {
+        // Thread is waiting in osMessageQueueReserve(), give it the Message itself
+        msg->reserved_state = MESSAGE_RESERVED;
+        osRtxThreadWaitExit(thread, reinterpret_cast<uintptr_t>(&msg[1]), false);
+    } else {
+        memcpy(&msg[1], ptr_src, mq->msg_size);
+        msg->priority = thread->queueBlockedData.msg_prio.send;
+        osRtxThreadWaitExit(thread, (uint32_t) osOK, false);
+
+        // Store Message into Queue
+        (void) MessageQueueDeliver(mq, msg);
+    }
+    return true;
+}
+
+/// Switch to a higher priority Thread if one was woken by the running Thread.
+static void MessageQueueDispatch() {
+    ThreadDispatcher::instance().dispatch(nullptr);
+
+    if (ThreadDispatcher::instance().thread.run.curr->state != osRtxThreadRunning) {
+        // other thread has higher priority, switch to it
+        ThreadDispatcher::instance().blockUntilWoken();
+    }
+}
+
+/// Free a Message and pass the space on to any Thread waiting to put one.
+/// \param[in]  mq              message queue object.
+/// \param[in]  msg             message object, already out of the Queue.
+/// \return true if a Thread was woken.
+static bool MessageQueueFree(osRtxMessageQueue_t *mq, osRtxMessage_t *msg) {
+    msg->id = osRtxIdInvalid;
+    msg->reserved_state = 0U;
+    (void) osRtxMemoryPoolFree(&mq->mp_info, msg);
+
+    // Check if Thread is waiting to send a Message
+    return (mq->thread_list != nullptr) && sendWaitingMessage(mq);
 }
 
 //  ==== Post ISR processing ====
@@ -140,32 +314,18 @@ static void osRtxMessageQueuePostProcess(osRtxMessage_t *msg) {
     osRtxMessageQueue_t *mq;
 
     if (msg->flags != 0U) {
-        // Remove Message
+        // Remove or release Message
         //lint -e{9079} -e{9087} "cast between pointers to different object types"
         mq = *((osRtxMessageQueue_t **) (void *) &msg[1]);
-        MessageQueueRemove(mq, msg);
-        // Free memory
-        msg->id = osRtxIdInvalid;
-        (void) osRtxMemoryPoolFree(&mq->mp_info, msg);
-        // Check if Thread is waiting to send a Message
-        if (mq->thread_list != nullptr) {
-            sendWaitingMessage(mq, false);
+        if (msg->reserved_state == 0U) {
+            // got by osMessageQueueGet(), still in the Queue
+            MessageQueueRemove(mq, msg);
         }
+        (void) MessageQueueFree(mq, msg);
     } else {
         // New Message
         mq = reinterpret_cast<osRtxMessageQueue_t *>(msg->next);
-
-        // Check if Thread is waiting to receive a Message
-        if ((mq->thread_list != nullptr) && (mq->thread_list->state == osRtxThreadWaitingMessageGet)) {
-            receiveWaitingMessage(mq, &msg[1], msg->priority, false);
-
-            // Free memory
-            msg->id = osRtxIdInvalid;
-            (void) osRtxMemoryPoolFree(&mq->mp_info, msg);
-
-        } else {
-            MessageQueuePut(mq, msg);
-        }
+        (void) MessageQueueDeliver(mq, msg);
     }
 }
 
@@ -184,6 +344,7 @@ osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, cons
     uint32_t mq_size;
     uint32_t block_size;
     uint32_t size;
+    uint32_t index_size;
     uint8_t flags;
     const char *name;
 
@@ -204,6 +365,7 @@ osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, cons
     }
 
     size = msg_count * block_size;
+    index_size = osRtxMessageQueueIndexSize(msg_count);
 
     // Process attributes
     if (attr != nullptr) {
@@ -249,7 +411,10 @@ osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, cons
 
     // Allocate object memory if not provided
     if (mq == nullptr) {
-        mq = new osRtxMessageQueue_t;
+        mq = static_cast<osRtxMessageQueue_t *>(osRtxMemoryAlloc(sizeof(osRtxMessageQueue_t)));
+        if (mq == nullptr) {
+            return nullptr;
+        }
         flags = osRtxFlagSystemObject;
     } else {
         flags = 0U;
@@ -258,8 +423,15 @@ osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, cons
     // Allocate data memory if not provided
     if (mq_mem == nullptr) {
         //lint -e{9079} "conversion from pointer to void to pointer to other type" [MISRA Note 5]
-        mq_mem = new uint8_t[size];
-        memset(mq_mem, 0, size);
+        mq_mem = osRtxMemoryAlloc(size + index_size);
+        if (mq_mem == nullptr) {
+            if ((flags & osRtxFlagSystemObject) != 0U) {
+                osRtxMemoryFree(mq);
+            }
+            return nullptr;
+        }
+        memset(mq_mem, 0, size + index_size);
+        mq_size = size + index_size;
 
         flags |= osRtxFlagSystemMemory;
     }
@@ -273,6 +445,17 @@ osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, cons
     mq->msg_count = 0U;
     mq->msg_first = nullptr;
     mq->msg_last = nullptr;
+    mq->msg_run_count = 0U;
+
+    // The index of priorities goes after the Messages, so it comes out of the same memory as them.  If the
+    // storage was sized for RTX, without room for the index, Messages put ahead of the tail search the Queue
+    // for their place instead.
+    if (mq_size >= size + index_size) {
+        //lint -e{9079} "conversion from pointer to void to pointer to other type" [MISRA Note 5]
+        mq->msg_runs = reinterpret_cast<osRtxMessage_t **>(static_cast<uint8_t *>(mq_mem) + size);
+    } else {
+        mq->msg_runs = nullptr;
+    }
 
     (void) osRtxMemoryPoolInit(&mq->mp_info, msg_count, block_size, mq_mem);
 
@@ -322,14 +505,11 @@ osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_pri
         return osErrorParameter;
     }
 
-    // Check if Thread is waiting to receive a Message
-    if (!isISR && (mq->thread_list != nullptr) && (mq->thread_list->state == osRtxThreadWaitingMessageGet)) {
-        receiveWaitingMessage(mq, msg_ptr, msg_prio, true);
-
-        if (ThreadDispatcher::instance().thread.run.curr->state != osRtxThreadRunning) {
-            // other thread has higher priority, switch to it
-            ThreadDispatcher::instance().blockUntilWoken();
-        }
+    // Check if Thread is waiting to receive a copy of a Message
+    osRtxThread_t *receiver = isISR ? nullptr : MessageQueueWaiter(mq, osRtxThreadWaitingMessageGet);
+    if ((receiver != nullptr) && (receiver->queueBlockedData.msg_body.receive != nullptr)) {
+        receiveWaitingMessage(mq, receiver, msg_ptr, msg_prio);
+        MessageQueueDispatch();
 
         status = osOK;
     } else {
@@ -340,6 +520,7 @@ osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_pri
             memcpy(&msg[1], msg_ptr, mq->msg_size);
             // Put Message into Queue
             msg->id = osRtxIdMessage;
+            msg->reserved_state = 0U;
             msg->flags = 0U;
             msg->priority = msg_prio;
 
@@ -350,6 +531,10 @@ osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_pri
                 //lint -e{9079} -e{9087} "cast between pointers to different object types"
                 *((void **) &msg->next) = mq;
                 ThreadDispatcher::instance().queuePostProcess(reinterpret_cast<osRtxObject_t *>(msg));
+            } else if (receiver != nullptr) {
+                // Thread is waiting in osMessageQueueBorrow()
+                (void) MessageQueueDeliver(mq, msg);
+                MessageQueueDispatch();
             } else {
                 MessageQueuePut(mq, msg);
             }
@@ -372,7 +557,7 @@ osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_pri
 
                     if(currentThread->waitValPresent) {
                         currentThread->waitValPresent = false;
-                        return osOK;
+                        return static_cast<osStatus_t>(currentThread->waitExitVal);
                     }
                 }
                 status = osErrorTimeout;
@@ -424,19 +609,9 @@ osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t *m
             return osOK;
         }
 
-        // Free memory
-        msg->id = osRtxIdInvalid;
-        (void) osRtxMemoryPoolFree(&mq->mp_info, msg);
-        // Check if Thread is waiting to send a Message
-        if (mq->thread_list != nullptr) {
-            // Try to allocate memory
-            //lint -e{9079} "conversion from pointer to void to pointer to other type" [MISRA Note 5]
-            sendWaitingMessage(mq, true);
-
-            if (ThreadDispatcher::instance().thread.run.curr->state != osRtxThreadRunning) {
-                // other thread has higher priority, switch to it
-                ThreadDispatcher::instance().blockUntilWoken();
-            }
+        // Free memory, and check if Thread is waiting to send a Message
+        if (MessageQueueFree(mq, msg)) {
+            MessageQueueDispatch();
         }
         status = osOK;
     } else {
@@ -456,7 +631,7 @@ osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t *m
 
                 if(currentThread->waitValPresent) {
                     currentThread->waitValPresent = false;
-                    return osOK;
+                    return static_cast<osStatus_t>(currentThread->waitExitVal);
                 }
 
             }
@@ -522,7 +697,8 @@ uint32_t osMessageQueueGetSpace(osMessageQueueId_t mq_id) {
         return 0U;
     }
 
-    return (mq->mp_info.max_blocks - mq->msg_count);
+    // reserved and borrowed Messages take up space too
+    return (mq->mp_info.max_blocks - mq->mp_info.used_blocks);
 }
 
 /// Reset a Message Queue to initial empty state.
@@ -554,21 +730,17 @@ osStatus_t osMessageQueueReset(osMessageQueueId_t mq_id) {
 
         // Free memory
         msg->id = osRtxIdInvalid;
-        delete msg;
+        (void) osRtxMemoryPoolFree(&mq->mp_info, msg);
     }
 
     // Check if Threads are waiting to send Messages
-    if ((mq->thread_list != nullptr) && (mq->thread_list->state == osRtxThreadWaitingMessagePut)) {
-        do {
-            sendWaitingMessage(mq, false);
-        } while (mq->thread_list != nullptr);
-
-        ThreadDispatcher::instance().dispatch(nullptr);
-
-        if (ThreadDispatcher::instance().thread.run.curr->state != osRtxThreadRunning) {
-            // other thread has higher priority, switch to it
-            ThreadDispatcher::instance().blockUntilWoken();
-        }
+    // (reserved and borrowed Messages stay with their threads, so there may not be room for all of them)
+    bool woken = false;
+    while (sendWaitingMessage(mq)) {
+        woken = true;
+    }
+    if (woken) {
+        MessageQueueDispatch();
     }
 
 
@@ -598,7 +770,12 @@ osStatus_t osMessageQueueDelete(osMessageQueueId_t mq_id) {
     if (mq->thread_list != nullptr) {
         do {
             thread = osRtxThreadListGet(reinterpret_cast<osRtxObject_t *>(mq));
-            osRtxThreadWaitExit(thread, (uint32_t) osErrorResource, false);
+            if (thread->queueBlockedData.msg_body.receive == nullptr) {
+                // waiting in osMessageQueueReserve() or osMessageQueueBorrow(), which return a pointer
+                osRtxThreadWaitExit(thread, 0U, false);
+            } else {
+                osRtxThreadWaitExit(thread, (uint32_t) osErrorResource, false);
+            }
         } while (mq->thread_list != nullptr);
 
         ThreadDispatcher::instance().dispatch(nullptr);
@@ -614,13 +791,190 @@ osStatus_t osMessageQueueDelete(osMessageQueueId_t mq_id) {
 
     // Free data memory
     if ((mq->flags & osRtxFlagSystemMemory) != 0U) {
-        delete static_cast<uint8_t *>(mq->mp_info.block_base);
+        osRtxMemoryFree(mq->mp_info.block_base);
     }
-
     // Free object memory
     if ((mq->flags & osRtxFlagSystemObject) != 0U) {
-        delete mq;
+        osRtxMemoryFree(mq);
     }
 
     return osOK;
-}
\ No newline at end of file
+}
+
+//  ==== Zero-copy extension (see rtxoff_msgqueue.h) ====
+
+/// Reserve a message block in a Message Queue, or timeout if the Queue is full.
+void *osMessageQueueReserve(osMessageQueueId_t mq_id, uint32_t timeout) {
+    ThreadDispatcher::Mutex mutex;
+    auto *mq = static_cast<osRtxMessageQueue_t *>(mq_id);
+    osRtxMessage_t *msg;
+
+    // Check parameters
+    if ((mq == nullptr) || (mq->id != osRtxIdMessageQueue)) {
+
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return nullptr;
+    }
+
+    bool isISR = IsIrqMode() || IsIrqMasked();
+
+    if (isISR && timeout != 0U) {
+        return nullptr;
+    }
+
+    // Try to allocate memory
+    msg = static_cast<osRtxMessage_t *>(osRtxMemoryPoolAlloc(&mq->mp_info));
+    if (msg != nullptr) {
+        msg->id = osRtxIdMessage;
+        msg->reserved_state = MESSAGE_RESERVED;
+        msg->flags = 0U;
+        msg->priority = 0U;
+        return &msg[1];
+    }
+
+    // No memory available
+    if (timeout != 0U) {
+
+        // Suspend current Thread, as a sender without a message
+        if (osRtxThreadWaitEnter(osRtxThreadWaitingMessagePut, timeout)) {
+            auto currentThread = ThreadDispatcher::instance().thread.run.curr;
+            osRtxThreadListPut(reinterpret_cast<osRtxObject_t *>(mq), currentThread);
+
+            currentThread->queueBlockedData.msg_body.send = nullptr;
+            currentThread->queueBlockedData.msg_prio.send = 0U;
+            currentThread->waitValPresent = false;
+
+            ThreadDispatcher::instance().blockUntilWoken();
+
+            if(currentThread->waitValPresent) {
+                currentThread->waitValPresent = false;
+                return reinterpret_cast<void *>(static_cast<uintptr_t>(currentThread->waitExitVal));
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+/// Put a message block from osMessageQueueReserve() into its Message Queue.
+osStatus_t osMessageQueueCommit(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t msg_prio) {
+    ThreadDispatcher::Mutex mutex;
+    auto *mq = static_cast<osRtxMessageQueue_t *>(mq_id);
+    osRtxMessage_t *msg;
+
+    // Check parameters
+    if ((mq == nullptr) || (mq->id != osRtxIdMessageQueue)) {
+
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return osErrorParameter;
+    }
+    msg = MessageQueueBlock(mq, msg_ptr);
+    if ((msg == nullptr) || (msg->reserved_state != MESSAGE_RESERVED)) {
+
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return osErrorParameter;
+    }
+
+    msg->priority = msg_prio;
+
+    if (IsIrqMode() || IsIrqMasked()) {
+        // Register post ISR processing, like osMessageQueuePut()
+        msg->reserved_state = 0U;
+        msg->flags = 0U;
+        //lint -e{9079} -e{9087} "cast between pointers to different object types"
+        *((void **) &msg->next) = mq;
+        ThreadDispatcher::instance().queuePostProcess(reinterpret_cast<osRtxObject_t *>(msg));
+    } else if (MessageQueueDeliver(mq, msg)) {
+        MessageQueueDispatch();
+    }
+
+    return osOK;
+}
+
+/// Take the highest priority message out of a Message Queue without copying it, or timeout if the Queue is empty.
+void *osMessageQueueBorrow(osMessageQueueId_t mq_id, uint8_t *msg_prio, uint32_t timeout) {
+    ThreadDispatcher::Mutex mutex;
+    auto *mq = static_cast<osRtxMessageQueue_t *>(mq_id);
+    osRtxMessage_t *msg;
+
+    // Check parameters
+    if ((mq == nullptr) || (mq->id != osRtxIdMessageQueue)) {
+
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return nullptr;
+    }
+
+    bool isISR = IsIrqMode() || IsIrqMasked();
+
+    if (isISR && timeout != 0U) {
+        return nullptr;
+    }
+
+    // Get Message from Queue.  It leaves the Queue straight away even in an ISR, since
+    // its body can't hold the queue pointer that post ISR processing would need.
+    msg = MessageQueueGet(mq);
+    if (msg != nullptr) {
+        MessageQueueRemove(mq, msg);
+        msg->flags = 0U;
+        msg->reserved_state = MESSAGE_BORROWED;
+        if (msg_prio != nullptr) {
+            *msg_prio = msg->priority;
+        }
+        return &msg[1];
+    }
+
+    // No Message available
+    if (timeout != 0U) {
+
+        // Suspend current Thread, as a receiver without a buffer
+        if (osRtxThreadWaitEnter(osRtxThreadWaitingMessageGet, timeout)) {
+            auto currentThread = ThreadDispatcher::instance().thread.run.curr;
+            osRtxThreadListPut(reinterpret_cast<osRtxObject_t *>(mq), currentThread);
+
+            currentThread->queueBlockedData.msg_body.receive = nullptr;
+            currentThread->queueBlockedData.msg_prio.receive = msg_prio;
+            currentThread->waitValPresent = false;
+
+            ThreadDispatcher::instance().blockUntilWoken();
+
+            if(currentThread->waitValPresent) {
+                currentThread->waitValPresent = false;
+                return reinterpret_cast<void *>(static_cast<uintptr_t>(currentThread->waitExitVal));
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+/// Give a message block from osMessageQueueBorrow() or osMessageQueueReserve() back to its Message Queue.
+osStatus_t osMessageQueueRelease(osMessageQueueId_t mq_id, void *msg_ptr) {
+    ThreadDispatcher::Mutex mutex;
+    auto *mq = static_cast<osRtxMessageQueue_t *>(mq_id);
+    osRtxMessage_t *msg;
+
+    // Check parameters
+    if ((mq == nullptr) || (mq->id != osRtxIdMessageQueue)) {
+
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return osErrorParameter;
+    }
+    msg = MessageQueueBlock(mq, msg_ptr);
+    if ((msg == nullptr) || (msg->flags != 0U)) {
+
+        //lint -e{904} "Return statement before end of function" [MISRA Note 1]
+        return osErrorParameter;
+    }
+
+    if (IsIrqMode() || IsIrqMasked()) {
+        // Register post ISR processing, like osMessageQueueGet()
+        msg->flags = 1U;
+        //lint -e{9079} -e{9087} "cast between pointers to different object types"
+        *((osRtxMessageQueue_t **) (void *) &msg[1]) = mq;
+        ThreadDispatcher::instance().queuePostProcess(reinterpret_cast<osRtxObject_t *>(msg));
+    } else if (MessageQueueFree(mq, msg)) {
+        MessageQueueDispatch();
+    }
+
+    return osOK;
+}
@@ -0,0 +1,77 @@
+//
+// Header providing RTXOff's zero-copy extension to the CMSIS-RTOS2 message queue API.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_MSGQUEUE_H
+#define MBED_BENCHTEST_RTXOFF_MSGQUEUE_H
+
+#include "cmsis_os2.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * osMessageQueuePut() and osMessageQueueGet() copy each message into and out of the queue's memory.  These
+ * functions hand out the queue's message blocks instead, so the producer writes a message in place and the
+ * consumer reads it in place:
+ *
+ * 1. The producer takes a block with osMessageQueueReserve() and fills it in.
+ * 2. osMessageQueueCommit() puts the block into the queue at the given priority.
+ * 3. The consumer takes the highest priority message with osMessageQueueBorrow() and reads it.
+ * 4. osMessageQueueRelease() gives the block back to the queue.
+ *
+ * A reserved or borrowed block still counts against the queue's capacity, so osMessageQueueGetSpace() doesn't
+ * include it, and a full queue can be waited on by both producers and consumers at once.  Blocked threads are
+ * woken in the same order as for osMessageQueuePut() and osMessageQueueGet(): highest thread priority first,
+ * whichever of the two APIs they are waiting in.  Copying and zero-copy calls can be mixed on the same queue.
+ */
+
+/**
+ * Reserve a message block in a Message Queue, or timeout if the Queue is full.
+ *
+ * @param mq_id   message queue ID obtained by \ref osMessageQueueNew.
+ * @param timeout \ref CMSIS_RTOS_TimeOutValue or 0 in case of no time-out.
+ * @return pointer to osMessageQueueGetMsgSize() bytes for the message, or NULL in case of error.
+ */
+void *osMessageQueueReserve(osMessageQueueId_t mq_id, uint32_t timeout);
+
+/**
+ * Put a message block from osMessageQueueReserve() into its Message Queue.  The caller must not touch the block
+ * afterwards.
+ *
+ * @param mq_id    message queue ID obtained by \ref osMessageQueueNew.
+ * @param msg_ptr  message block from osMessageQueueReserve().
+ * @param msg_prio message priority.
+ * @return status code that indicates the execution status of the function.
+ */
+osStatus_t osMessageQueueCommit(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t msg_prio);
+
+/**
+ * Take the highest priority message out of a Message Queue without copying it, or timeout if the Queue is empty.
+ * The message block must be given back with osMessageQueueRelease().
+ *
+ * @param mq_id    message queue ID obtained by \ref osMessageQueueNew.
+ * @param msg_prio pointer to buffer for message priority or NULL.
+ * @param timeout  \ref CMSIS_RTOS_TimeOutValue or 0 in case of no time-out.
+ * @return pointer to the message, or NULL in case of error.
+ */
+void *osMessageQueueBorrow(osMessageQueueId_t mq_id, uint8_t *msg_prio, uint32_t timeout);
+
+/**
+ * Give a message block from osMessageQueueBorrow() back to its Message Queue.  Also takes back a block from
+ * osMessageQueueReserve() that won't be committed.
+ *
+ * @param mq_id   message queue ID obtained by \ref osMessageQueueNew.
+ * @param msg_ptr message block from osMessageQueueBorrow() or osMessageQueueReserve().
+ * @return status code that indicates the execution status of the function.
+ */
+osStatus_t osMessageQueueRelease(osMessageQueueId_t mq_id, void *msg_ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MBED_BENCHTEST_RTXOFF_MSGQUEUE_H
@@ -1,6 +1,7 @@
 
 #include "rtxoff_internal.h"
 #include "ThreadDispatcher.h"
+#include <new>
 
 /// Release Mutexes owned by thread.  Called when owner Thread terminates.
 /// \param[in]  mutex_list      mutex list.
@@ -95,14 +96,30 @@ osMutexId_t osMutexNew (const osMutexAttr_t *attr)
 	{
 		name      = attr->name;
 		attr_bits = attr->attr_bits;
+		mutex     = static_cast<osRtxMutex_t *>(attr->cb_mem);
+		if (mutex != nullptr) {
+			if (!is_aligned_p(mutex) || (attr->cb_size < sizeof(osRtxMutex_t))) {
+				return nullptr;
+			}
+		} else {
+			if (attr->cb_size != 0U) {
+				return nullptr;
+			}
+		}
 	} else {
 		name      = "<anonymous mutex>";
 		attr_bits = 0U;
 	}
 
-	mutex = new osRtxMutex_t();
+	// Allocate object memory if not provided
+	if (mutex == nullptr) {
+		mutex = static_cast<osRtxMutex_t *>(osRtxMemoryAlloc(sizeof(osRtxMutex_t)));
+		flags = osRtxFlagSystemObject;
+	}
 
 	if (mutex != nullptr) {
+		new (mutex) osRtxMutex_t();
+
 		// Initialize control block
 		mutex->id           = osRtxIdMutex;
 		mutex->flags        = flags;
@@ -187,6 +204,8 @@ osStatus_t osMutexAcquire (osMutexId_t mutex_id, uint32_t timeout)
 		}
 		else
 		{
+			RTXOFF_TRACE_EVENT(RTXOFF_TRACE_MUTEX_CONTENDED, thread, mutex, mutex->owner_thread);
+
 			// Check if timeout is specified
 			if (timeout != 0U)
 			{
@@ -418,7 +437,9 @@ osStatus_t osMutexDelete (osMutexId_t mutex_id)
 	mutex->id = osRtxIdInvalid;
 
 	// Free object memory
-	delete mutex;
+	if ((mutex->flags & osRtxFlagSystemObject) != 0U) {
+		osRtxMemoryFree(mutex);
+	}
 
 	return osOK;
 }
\ No newline at end of file
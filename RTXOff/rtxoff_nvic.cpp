@@ -6,161 +6,282 @@
 #include "rtxoff_internal.h"
 #include "ThreadDispatcher.h"
 
-#include <map>
-#include <set>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
 
-// Called after an interrupt is added to the interrupt queue.
-// Should be called with the interrupts mutex held (which is passed in here so we can unlock it).
-void deliverNewInterrupt(InterruptData & interrupt, std::unique_lock<std::recursive_mutex> & interruptDataLock)
+namespace
 {
-	if(ThreadDispatcher::instance().interrupt.active)
+// Locks the interrupt data.  RTX threads also lock the kernel mutex first, because the dispatcher only suspends
+// them while it holds that.  Otherwise a thread could be suspended with the interrupt data locked, and the
+// dispatcher would then deadlock locking it to deliver an interrupt.
+class InterruptDataLock
+{
+	bool lockKernel = ThreadDispatcher::onRtxThread();
+	bool locked = false;
+
+public:
+	InterruptDataLock()
 	{
-		// We are already in an interrupt vector (or at least one is currently running in another thread).
-		// Do nothing since once the vector returns the new interrupt will be processed.
+		lock();
 	}
-	else
+
+	~InterruptDataLock()
 	{
-		// unlock the interrupts mutex so the scheduler can run
-		interruptDataLock.unlock();
+		if(locked)
+		{
+			unlock();
+		}
+	}
 
-		// Note: It should be more or less safe to access interrupt.pending and interrupt.enabled here even without the mutex locked.
-		// We wouldn't want to access the other ThreadDispatcher interrupt data because other threads (e.g. test harness
-		// code) could be changing those.  The only issue would be if two threads (at least one of which has to be
-		// a test harness thread) try to SetPending the same interrupt at the same time, it could be called once or
-		// twice, but that's basically expected behavior anyway.
+	void lock()
+	{
+		if(lockKernel)
+		{
+			ThreadDispatcher::instance().lockKernelDataMutex();
+		}
+		ThreadDispatcher::instance().interrupt.mutex.lock();
+		locked = true;
+	}
 
-		// Following real-time behavior, wait for the new interrupt to be executed.
-		while(ThreadDispatcher::instance().interrupt.enabled && interrupt.enabled && interrupt.pending)
+	void unlock()
+	{
+		locked = false;
+		ThreadDispatcher::instance().interrupt.mutex.unlock();
+		if(lockKernel)
 		{
+			ThreadDispatcher::instance().unlockKernelDataMutex();
+		}
+	}
+};
 
-			// request the scheduler to run
-			ThreadDispatcher::instance().requestSchedule();
-			rtxoff_thread_yield();
+// Lets NVIC_SetPendingIRQ() wait for the vector of the interrupt it raised to finish running
+struct InjectionWaiter
+{
+	std::atomic<bool> done{false};
+
+	// Only used by host threads that aren't RTX threads.  An RTX thread can be suspended by the dispatcher
+	// while it holds a mutex, which would deadlock the dispatcher when it calls finished().
+	bool useCondVar = !ThreadDispatcher::onRtxThread();
+	std::mutex mutex;
+	std::condition_variable condVar;
+
+	static void finished(IRQn_Type IRQn, uint32_t delivered, void * context)
+	{
+		InjectionWaiter * waiter = static_cast<InjectionWaiter *>(context);
+		if(waiter->useCondVar)
+		{
+			std::unique_lock<std::mutex> lock(waiter->mutex);
+			waiter->done = true;
+			waiter->condVar.notify_one();
+		}
+		else
+		{
+			waiter->done = true;
+		}
+	}
+
+	void wait()
+	{
+		if(useCondVar)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condVar.wait(lock, [this]() { return done.load(); });
+		}
+		else
+		{
+			// the dispatcher runs the vector as soon as it suspends this thread, so this rarely loops
+			while(!done)
+			{
+				rtxoff_thread_yield();
+			}
 		}
+	}
+};
+}
 
+// Called after an interrupt is added to the interrupt queue.
+// Should be called with the interrupts mutex held (which is passed in here so we can unlock it).
+void deliverNewInterrupt(InterruptData & interrupt, InterruptDataLock & interruptDataLock)
+{
+	if(ThreadDispatcher::instance().interrupt.active)
+	{
+		// We are already in an interrupt vector (or at least one is currently running in another thread).
+		// If the vector raised this interrupt itself and it has a higher preempt priority, it runs now.
+		// Otherwise, it will be processed once the vector returns.
+		ThreadDispatcher::instance().interruptPreemptionPoint();
+	}
+	else if(ThreadDispatcher::instance().interrupt.enabled && interrupt.enabled && interrupt.pending)
+	{
+		// Following real-time behavior, wait for the new interrupt to be executed.
+		// The dispatcher calls the waiter back once the vector returns, or if the interrupt gets disabled or cleared first.
+		InjectionWaiter waiter;
+		InterruptInjection request;
+		request.irq = interrupt.irq;
+		request.callback = &InjectionWaiter::finished;
+		request.context = &waiter;
+		request.next = interrupt.waiting;
+		interrupt.waiting = &request;
+
+		// unlock the interrupt data (and the kernel mutex) so the scheduler can run
+		interruptDataLock.unlock();
+		ThreadDispatcher::instance().wakeForInjection();
+		waiter.wait();
 		interruptDataLock.lock();
 	}
 }
 
 /**
- * Get a reference to an interrupt data, adding it to the map if needed.
+ * Get a reference to an interrupt's data.
  * @param IRQn
  * @return
  */
 InterruptData & getInterruptData(IRQn_Type IRQn)
 {
-	auto interruptDataIter = ThreadDispatcher::instance().interrupt.interruptData.find(IRQn);
-	if(interruptDataIter == ThreadDispatcher::instance().interrupt.interruptData.end())
+	InterruptData * interruptData = ThreadDispatcher::instance().interrupt.table.find(IRQn);
+	if(interruptData == nullptr)
 	{
-		interruptDataIter = ThreadDispatcher::instance().interrupt.interruptData.insert(std::make_pair(IRQn, InterruptData(IRQn))).first;
+		std::cerr << "RTXOFF Critical Error: IRQ " << IRQn << " is out of range.  Increase RTXOFF_NVIC_IRQ_COUNT (currently "
+			<< RTXOFF_NVIC_IRQ_COUNT << ") to use it." << std::endl;
+		exit(4);
 	}
-	return interruptDataIter->second;
+	return *interruptData;
 }
 
 // implementations
 void NVIC_SetPriorityGrouping(uint32_t PriorityGroup)
 {
-	// NOTE: The priority group mask does not actually do anything in RTXOff because it doesn't support
-	// interrupts interrupting interrupts.  We do store the value though.
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	// The priority grouping decides which part of each priority is the preempt priority, see
+	// ThreadDispatcher::canPreempt().
+	InterruptDataLock interruptDataLock;
 	ThreadDispatcher::instance().interrupt.priorityGroupMask = PriorityGroup;
 }
 
 uint32_t NVIC_GetPriorityGrouping(void)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 	return ThreadDispatcher::instance().interrupt.priorityGroupMask;
 }
 
 void NVIC_EnableIRQ(IRQn_Type IRQn)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 
 	InterruptData & interruptData = getInterruptData(IRQn);
-	interruptData.enabled = true;
+	ThreadDispatcher::instance().interrupt.table.setEnabled(interruptData, true);
 
-	// if interrupt was previously pending, add it to the queue.
+	// if interrupt was previously pending, deliver it now.
 	if(interruptData.pending)
 	{
-		ThreadDispatcher::instance().interrupt.pendingInterrupts.insert(&interruptData);
 		deliverNewInterrupt(interruptData, interruptDataLock);
 	}
 }
 
 uint32_t NVIC_GetEnableIRQ(IRQn_Type IRQn)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 	return getInterruptData(IRQn).enabled;
 }
 
 void NVIC_DisableIRQ(IRQn_Type IRQn)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
-	getInterruptData(IRQn).enabled = false;
+	InterruptDataLock interruptDataLock;
+
+	InterruptData & interruptData = getInterruptData(IRQn);
+	ThreadDispatcher::instance().interrupt.table.setEnabled(interruptData, false);
+
+	// anyone waiting for the interrupt would wait until it is enabled again
+	ThreadDispatcher::instance().finishInjections(interruptData, false);
 }
 
 void NVIC_SetVector(IRQn_Type IRQn, void (*vector)())
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 	getInterruptData(IRQn).vector = vector;
 }
 
 void (*NVIC_GetVector(IRQn_Type IRQn))()
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 	return getInterruptData(IRQn).vector;
 }
 
 uint32_t NVIC_GetPendingIRQ(IRQn_Type IRQn)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 	return getInterruptData(IRQn).pending;
 }
 
 void NVIC_SetPendingIRQ(IRQn_Type IRQn)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 
 	InterruptData & interruptData = getInterruptData(IRQn);
 
-	interruptData.pending = true;
-	ThreadDispatcher::instance().interrupt.pendingInterrupts.insert(&interruptData);
+	ThreadDispatcher::instance().interrupt.table.setPending(interruptData, true);
 
 	deliverNewInterrupt(interruptData, interruptDataLock);
 }
 
+void NVIC_SetPendingIRQAsync(IRQn_Type IRQn, NVIC_InjectionCallback callback, void * context)
+{
+	// no lock needed, this only checks the IRQ number
+	getInterruptData(IRQn);
+
+	InterruptInjectionQueue & injections = ThreadDispatcher::instance().interrupt.injections;
+	bool wasEmpty;
+	if(callback == nullptr)
+	{
+		wasEmpty = injections.push(InterruptTable::indexOf(IRQn));
+	}
+	else
+	{
+		InterruptInjection * request = new InterruptInjection();
+		request->irq = IRQn;
+		request->callback = callback;
+		request->context = context;
+		request->allocated = true;
+		wasEmpty = injections.push(request);
+	}
+
+	// if the queue wasn't empty, whoever made it non-empty has already woken up the dispatcher
+	if(wasEmpty)
+	{
+		ThreadDispatcher::instance().wakeForInjection();
+	}
+}
+
 void NVIC_ClearPendingIRQ(IRQn_Type IRQn)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 
 	InterruptData & interruptData = getInterruptData(IRQn);
 
-	interruptData.pending = false;
-	ThreadDispatcher::instance().interrupt.pendingInterrupts.erase(&interruptData);
+	ThreadDispatcher::instance().interrupt.table.setPending(interruptData, false);
+	ThreadDispatcher::instance().finishInjections(interruptData, false);
 }
 
 uint32_t NVIC_GetActive(IRQn_Type IRQn) {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 
 	return getInterruptData(IRQn).active;
 }
 
 void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 
-	getInterruptData(IRQn).priority = priority;
+	ThreadDispatcher::instance().interrupt.table.setPriority(getInterruptData(IRQn), priority);
 }
 
 uint32_t NVIC_GetPriority(IRQn_Type IRQn)
 {
-	std::unique_lock<std::recursive_mutex> interruptDataLock(ThreadDispatcher::instance().interrupt.mutex);
+	InterruptDataLock interruptDataLock;
 
 	return getInterruptData(IRQn).priority;
 }
 
-// value from core_cm3.h
-#define NVIC_PRIO_BITS 5
-
 // note: these functions copied exactly from the arm implementation
 uint32_t NVIC_EncodePriority(uint32_t PriorityGroup, uint32_t PreemptPriority, uint32_t SubPriority) {
 	uint32_t PriorityGroupTmp = (PriorityGroup & (uint32_t) 0x07UL);   /* only values 0..7 are used          */
@@ -14,6 +14,9 @@ extern "C" {
 // The enum values for this are defined elsewhere but we don't need to care about those yet.
 typedef int IRQn_Type;
 
+// Number of priority bits implemented by the simulated NVIC (value from core_cm3.h)
+#define NVIC_PRIO_BITS 5
+
 /**
   \brief   Set Priority Grouping
   \details Sets the priority grouping field using the required unlock sequence.
@@ -76,6 +79,27 @@ uint32_t NVIC_GetPendingIRQ(IRQn_Type IRQn);
  */
 void NVIC_SetPendingIRQ(IRQn_Type IRQn);
 
+/**
+  \brief   Callback for an asynchronously raised interrupt, see NVIC_SetPendingIRQAsync().
+  \param [in]      IRQn  Interrupt number that was raised.
+  \param [in] delivered  1 if the interrupt's vector ran, 0 if the interrupt was disabled or its pending bit cleared first.
+  \param [in]   context  Context pointer passed to NVIC_SetPendingIRQAsync().
+ */
+typedef void (*NVIC_InjectionCallback)(IRQn_Type IRQn, uint32_t delivered, void * context);
+
+/**
+  \brief   Set Pending Interrupt without waiting (RTXOff extension)
+  \details Sets the pending bit of an interrupt without waiting for its vector to run, unlike NVIC_SetPendingIRQ().
+           The interrupt is added to a lock-free queue that the RTXOff dispatcher empties the next time it runs,
+           so it can be called from any host thread (e.g. a simulated peripheral) without blocking.
+           Until then, NVIC_GetPendingIRQ() may still return 0 for the interrupt.
+  \param [in]      IRQn  Interrupt number.
+  \param [in]  callback  Function to call once the interrupt's vector has finished running, or NULL.  It is called
+                         exactly once, on the dispatcher thread (or the thread that disabled or cleared the interrupt),
+                         with the interrupts mutex locked, so it must not block (e.g. by calling NVIC_SetPendingIRQ()).
+  \param [in]   context  Passed to the callback.
+ */
+void NVIC_SetPendingIRQAsync(IRQn_Type IRQn, NVIC_InjectionCallback callback, void * context);
 
 /**
   \brief   Clear Pending Interrupt
@@ -116,16 +116,23 @@ typedef struct osRtxThread_s {
   struct osRtxThread_s    *delay_prev;  ///< Link pointer to previous Thread in Delay list
   struct osRtxThread_s   *thread_join;  ///< Thread waiting to join until this thread finishes
   int64_t                      delay;  ///< Delay Time.  When in delay list, this gives the ADDITIONAL delay time from the previous thread.
+  uint32_t              delay_heap_index;  ///< Position in the delay heap (RTXOFF_DEADLINE_HEAP only)
+  uint64_t              delay_heap_order;  ///< Insertion order in the delay heap (RTXOFF_DEADLINE_HEAP only)
+  uint8_t                  in_wait_list;  ///< Whether the thread is in the Wait List rather than the Delay list or heap.  Can't be told from delay, since a tickless deadline can equal osWaitForever.
   int8_t                     priority;  ///< Thread Priority  Effective priority accounting for mutexes the thread holds.
   int8_t                priority_base;  ///< Base Priority.  Priority that the thread was set to.
+  int8_t               ready_priority;  ///< Priority level the thread is queued at in the ready list, or osPriorityNone if it's not in the ready list.
   uint8_t                 stack_frame;  ///< Stack Frame (EXC_RETURN[7..0])
   uint8_t               flags_options;  ///< Thread/Event Flags Options
   uint32_t                 wait_flags;  ///< Waiting Thread/Event Flags
   uint32_t               thread_flags;  ///< Thread Flags
   struct osRtxMutex_s     *mutex_list;  ///< Link pointer to list of owned Mutexes
+  void                     *stack_mem;  ///< Stack Memory passed to osThreadNew().  Not used, the thread runs on its host thread's stack (see RTXOFF_STACK_CHECK).
+  uint32_t                 stack_size;  ///< Stack Size
 
   uint64_t waitExitVal;                 // return value passed from osRtxThreadWaitExit().  Set only when this function is called, not when a thread wait timeout expires.
   uint8_t waitValPresent;               // Whether above value is present.
+  uint32_t serial;                      // Order that the thread was created in on its kernel, starting from 0
 
     // when a queue is blocked on a get or put, it will store its information here
     struct {
@@ -146,6 +153,16 @@ typedef struct osRtxThread_s {
   osThreadFunc_t start_func;
   void * start_func_argument;
 
+  // CPU usage statistics (see rtxoff_stats.h).  Times are in RTXClock::duration units.
+  struct {
+    int64_t run_time;                   // Total time spent running
+    int64_t ready_time;                 // Total time spent in the ready list waiting to run
+    int64_t ready_since;                // Time that the thread last became ready
+    uint32_t voluntary_switches;        // Times the thread stopped running because it blocked or exited
+    uint32_t involuntary_switches;      // Times the thread stopped running while it was still ready (preemption, round robin, yield)
+    uint32_t isr_preemptions;           // Times the thread was interrupted to run an ISR
+  } stats;
+
 } osRtxThread_t;
  
  
@@ -174,7 +191,9 @@ typedef struct osRtxTimer_s {
   const char                    *name;  ///< Object Name
   struct osRtxTimer_s           *prev;  ///< Pointer to previous active Timer
   struct osRtxTimer_s           *next;  ///< Pointer to next active Timer
-  uint32_t                       tick;  ///< Timer current Tick.  Delta from previous timer in the timer list.
+  int64_t                        tick;  ///< Timer current Tick.  Delta from previous timer in the timer list.
+  uint32_t                 heap_index;  ///< Position in the timer heap (RTXOFF_DEADLINE_HEAP only)
+  uint64_t                 heap_order;  ///< Insertion order in the timer heap (RTXOFF_DEADLINE_HEAP only)
   uint32_t                       load;  ///< Timer Load value
   osRtxTimerFinfo_t             finfo;  ///< Timer Function Info
 } osRtxTimer_t;
@@ -256,7 +275,7 @@ typedef struct {
 /// Message Control Block
 typedef struct osRtxMessage_s {
   uint8_t                          id;  ///< Object Identifier
-  uint8_t              reserved_state;  ///< Object State (not used)
+  uint8_t              reserved_state;  ///< Object State: reserved or borrowed with the zero-copy calls (see rtxoff_msgqueue.h), 0 otherwise
   uint8_t                       flags;  ///< Object Flags
   uint8_t                    priority;  ///< Message Priority
   struct osRtxMessage_s         *prev;  ///< Pointer to previous Message
@@ -276,6 +295,8 @@ typedef struct {
   uint32_t                  msg_count;  ///< Number of queued Messages
   osRtxMessage_t           *msg_first;  ///< Pointer to first Message
   osRtxMessage_t            *msg_last;  ///< Pointer to last Message
+  osRtxMessage_t          **msg_runs;  ///< Last Message of each priority in the Queue, highest priority first (nullptr if the Queue storage has no room for it)
+  uint32_t              msg_run_count;  ///< Number of priorities in the Queue
 } osRtxMessageQueue_t;
  
  
@@ -325,15 +346,21 @@ typedef struct {
 #define osRtxMemoryPoolMemSize(block_count, block_size) \
   (4*(block_count)*(((block_size)+3)/4))
 
+/// Memory size in bytes for the index of the priorities of a Message Queue's messages, which RTXOff keeps
+/// after the messages in the Message Queue storage.
+/// \param         msg_count     maximum number of messages in queue.
+#define osRtxMessageQueueIndexSize(msg_count) \
+  ((((msg_count) < 256U) ? (msg_count) : 256U)*sizeof(osRtxMessage_t *))
+
 /// Memory size in bytes for Message Queue storage.
 /// \param         msg_count     maximum number of messages in queue.
 /// \param         msg_size      maximum message size in bytes.
 #if RTXOFF_USE_32BIT
 #define osRtxMessageQueueMemSize(msg_count, msg_size) \
-  (4*(msg_count)*(sizeof(osRtxMessage_t)/4+(((msg_size)+3)/4)))
+  (4*(msg_count)*(sizeof(osRtxMessage_t)/4+(((msg_size)+3)/4)) + osRtxMessageQueueIndexSize(msg_count))
 #else
 #define osRtxMessageQueueMemSize(msg_count, msg_size) \
-  (4*(msg_count)*(sizeof(osRtxMessage_t)/4+(((msg_size+7U)&~7UL)/4)))
+  (4*(msg_count)*(sizeof(osRtxMessage_t)/4+(((msg_size+7U)&~7UL)/4)) + osRtxMessageQueueIndexSize(msg_count))
 #endif
 
 
@@ -0,0 +1,170 @@
+//
+// Recording and replaying of the RTXOff kernel's scheduling decisions.
+//
+
+#include "rtxoff_replay.h"
+
+#include <cinttypes>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+constexpr std::chrono::seconds ScheduleReplay::interruptTimeout;
+
+// File format: one event per line.
+//   T <step> <thread serial> <tick> <tick delta>
+//   I <step> <thread serial> <irq> [<irq> ...]
+// Lines starting with # are comments.
+
+void ScheduleReplay::start()
+{
+	char const * replayFilename = getenv("RTXOFF_REPLAY_FILE");
+	char const * recordFilename = getenv("RTXOFF_RECORD_FILE");
+
+	if(replayFilename != nullptr && replayFilename[0] != '\0')
+	{
+		if(recordFilename != nullptr && recordFilename[0] != '\0')
+		{
+			std::cerr << "RTXOFF: both RTXOFF_RECORD_FILE and RTXOFF_REPLAY_FILE are set, only replaying" << std::endl;
+		}
+
+		if(load(replayFilename))
+		{
+			std::cerr << "RTXOFF: replaying " << events.size() << " scheduling events from " << replayFilename << std::endl;
+			mode = events.empty() ? Mode::Off : Mode::Replay;
+		}
+	}
+	else if(recordFilename != nullptr && recordFilename[0] != '\0')
+	{
+		recordFile = fopen(recordFilename, "w");
+		if(recordFile == nullptr)
+		{
+			std::cerr << "RTXOFF: could not open " << recordFilename << " to record scheduling events" << std::endl;
+			return;
+		}
+
+		// flush each line, so that the recording survives the program crashing
+		setvbuf(recordFile, nullptr, _IOLBF, BUFSIZ);
+		fputs("# RTXOff schedule recording.  Replay with RTXOFF_REPLAY_FILE=<this file>.\n", recordFile);
+		mode = Mode::Record;
+	}
+}
+
+bool ScheduleReplay::load(char const * filename)
+{
+	std::ifstream file(filename);
+	if(!file)
+	{
+		std::cerr << "RTXOFF: could not open " << filename << " to replay scheduling events" << std::endl;
+		return false;
+	}
+
+	std::string line;
+	size_t lineNumber = 0;
+	while(std::getline(file, line))
+	{
+		++lineNumber;
+		if(line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		std::istringstream lineStream(line);
+		char type;
+		Event event;
+		lineStream >> type >> event.step >> event.thread;
+
+		if(type == Event::Tick)
+		{
+			event.type = Event::Tick;
+			lineStream >> event.tick >> event.tickDelta;
+		}
+		else if(type == Event::Interrupts)
+		{
+			event.type = Event::Interrupts;
+			int irq;
+			while(lineStream >> irq)
+			{
+				event.irqs.push_back(static_cast<IRQn_Type>(irq));
+			}
+			if(!lineStream.eof())
+			{
+				lineStream.setstate(std::ios::failbit);
+			}
+			else
+			{
+				lineStream.clear();
+			}
+		}
+		else
+		{
+			lineStream.setstate(std::ios::failbit);
+		}
+
+		if(!lineStream)
+		{
+			std::cerr << "RTXOFF: " << filename << ":" << lineNumber << ": invalid scheduling event" << std::endl;
+			events.clear();
+			return false;
+		}
+		events.push_back(event);
+	}
+
+	return true;
+}
+
+void ScheduleReplay::finishEvent(osRtxThread_t const * chosen)
+{
+	Event const & event = events[nextEvent];
+	if(chosen->serial != event.thread)
+	{
+		diverge("thread " + std::to_string(chosen->serial) + " (" + chosen->name + ") was chosen instead of thread " + std::to_string(event.thread));
+		return;
+	}
+
+	++nextEvent;
+	++eventsReplayed;
+
+	if(nextEvent == events.size())
+	{
+		std::cerr << "RTXOFF: replay finished at step " << step << ", scheduling normally from now on" << std::endl;
+		mode = Mode::Off;
+	}
+}
+
+void ScheduleReplay::diverge(std::string const & reason)
+{
+	std::cerr << "RTXOFF: replay diverged from the recording at step " << step << " (event " << nextEvent + 1 << " of "
+		<< events.size() << "): " << reason << ".  Scheduling normally from now on." << std::endl;
+	mode = Mode::Off;
+
+	// wake up anyone waiting for the event
+	++eventsReplayed;
+}
+
+void ScheduleReplay::recordTick(uint32_t tick, uint32_t tickDelta, osRtxThread_t const * chosen)
+{
+	if(mode != Mode::Record)
+	{
+		return;
+	}
+
+	fprintf(recordFile, "T %" PRIu64 " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n", step, chosen->serial, tick, tickDelta);
+}
+
+void ScheduleReplay::recordInterrupts(osRtxThread_t const * chosen)
+{
+	if(mode != Mode::Record)
+	{
+		return;
+	}
+
+	fprintf(recordFile, "I %" PRIu64 " %" PRIu32, step, chosen->serial);
+	for(IRQn_Type irq : batch)
+	{
+		fprintf(recordFile, " %d", static_cast<int>(irq));
+	}
+	fputc('\n', recordFile);
+	batch.clear();
+}
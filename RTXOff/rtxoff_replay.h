@@ -0,0 +1,126 @@
+//
+// Recording and replaying of the RTXOff kernel's scheduling decisions.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_REPLAY_H
+#define MBED_BENCHTEST_RTXOFF_REPLAY_H
+
+#include "rtxoff_os.h"
+#include "rtxoff_nvic.h"
+#include "RTX_Config.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if RTXOFF_RECORD_REPLAY && (RTXOFF_TICKLESS || RTXOFF_DEADLINE_HEAP)
+#error "RTXOFF_RECORD_REPLAY requires tick based delays (RTXOFF_TICKLESS and RTXOFF_DEADLINE_HEAP must be 0)"
+#endif
+
+/**
+ * Keeps a log of the points where the dispatcher preempted the running thread to deliver a tick or run ISRs,
+ * so that they can be repeated exactly in a later run.
+ *
+ * Preemptions are located by logical step rather than by time: the step is the number of times that RTX threads
+ * have entered the kernel (locked the kernel mutex) since the kernel started.  Each recorded preemption happened
+ * between two kernel entries, and when replaying, the dispatcher delivers it between the same two entries.  If a
+ * thread gets to its next kernel entry first, it is held there until the preemption has been delivered.  Since
+ * the only other thing that decides which thread runs is the order of kernel calls, this reproduces the same
+ * schedule, as long as the program doesn't branch on host time or on data races.
+ *
+ * The thread chosen after each preemption is also recorded.  If the replay picks a different one, the run
+ * has diverged from the recording, so the replay stops with a warning and the kernel goes back to normal scheduling.
+ */
+class ScheduleReplay
+{
+public:
+	enum class Mode
+	{
+		Off,
+		Record,
+		Replay
+	};
+
+	struct Event
+	{
+		enum Type : char
+		{
+			Tick = 'T',
+			Interrupts = 'I'
+		};
+
+		Type type;
+		uint64_t step;                  ///< Number of kernel entries before the event
+		uint32_t thread;                ///< Serial number of the thread that ran afterwards
+		uint32_t tick = 0;              ///< Tick count after the tick was delivered (ticks only)
+		uint32_t tickDelta = 0;         ///< Ticks delivered at once (ticks only)
+		std::vector<IRQn_Type> irqs;    ///< Interrupts delivered, in order (interrupts only)
+	};
+
+	std::atomic<Mode> mode{Mode::Off};
+
+	// Number of kernel entries by RTX threads so far
+	uint64_t step = 0;
+
+	// Number of events replayed so far.  Read by threads waiting for an event without holding the kernel mutex.
+	std::atomic<uint64_t> eventsReplayed{0};
+
+	// Interrupts delivered by the current call to processInterrupts(), when recording
+	std::vector<IRQn_Type> batch;
+
+	// When replaying, the time that the dispatcher started waiting for the interrupts in the next event to be raised
+	std::chrono::steady_clock::time_point waitingSince;
+
+	// How long to wait for recorded interrupts before deciding that the run has diverged
+	static constexpr std::chrono::seconds interruptTimeout{10};
+
+	/**
+	 * Start recording or replaying if the RTXOFF_RECORD_FILE or RTXOFF_REPLAY_FILE environment variables are set.
+	 * Called when the kernel starts.
+	 */
+	void start();
+
+	/**
+	 * Whether the next event in the recording should be delivered now.
+	 */
+	bool eventDue() const
+	{
+		return mode == Mode::Replay && nextEvent < events.size() && events[nextEvent].step <= step;
+	}
+
+	/**
+	 * Get the next event to replay.  Only valid if eventDue() is true.
+	 */
+	Event const & currentEvent() const
+	{
+		return events[nextEvent];
+	}
+
+	/**
+	 * Call after the current event has been replayed.  Checks that the same thread was chosen as in the recording.
+	 */
+	void finishEvent(osRtxThread_t const * chosen);
+
+	/**
+	 * Stop replaying because the run no longer matches the recording.
+	 */
+	void diverge(std::string const & reason);
+
+	// Record a tick that the dispatcher just delivered
+	void recordTick(uint32_t tick, uint32_t tickDelta, osRtxThread_t const * chosen);
+
+	// Record the interrupts in batch, which the dispatcher just delivered
+	void recordInterrupts(osRtxThread_t const * chosen);
+
+private:
+	FILE * recordFile = nullptr;
+	std::vector<Event> events;
+	size_t nextEvent = 0;
+
+	bool load(char const * filename);
+};
+
+#endif //MBED_BENCHTEST_RTXOFF_REPLAY_H
@@ -3,6 +3,7 @@
 //
 
 #include "ThreadDispatcher.h"
+#include <new>
 
 //  ==== Helper functions ====
 
@@ -82,13 +83,31 @@ osSemaphoreId_t osSemaphoreNew (uint32_t max_count, uint32_t initial_count, cons
 	if (attr != nullptr)
 	{
 		name      = attr->name;
+		semaphore = static_cast<osRtxSemaphore_t *>(attr->cb_mem);
+		if (semaphore != nullptr) {
+			if (!is_aligned_p(semaphore) || (attr->cb_size < sizeof(osRtxSemaphore_t))) {
+				return nullptr;
+			}
+		} else {
+			if (attr->cb_size != 0U) {
+				return nullptr;
+			}
+		}
 	}
 	else
 	{
 		name      = "<anonymous semaphore>";
 	}
 
-	semaphore = new osRtxSemaphore_t();
+	// Allocate object memory if not provided
+	if (semaphore == nullptr) {
+		semaphore = static_cast<osRtxSemaphore_t *>(osRtxMemoryAlloc(sizeof(osRtxSemaphore_t)));
+		if (semaphore == nullptr) {
+			return nullptr;
+		}
+		flags = osRtxFlagSystemObject;
+	}
+	new (semaphore) osRtxSemaphore_t();
 
 	// Initialize control block
 	semaphore->id          = osRtxIdSemaphore;
@@ -280,7 +299,9 @@ osStatus_t osSemaphoreDelete (osSemaphoreId_t semaphore_id)
 	semaphore->id = osRtxIdInvalid;
 
 	// Free object memory
-	delete semaphore;
+	if ((semaphore->flags & osRtxFlagSystemObject) != 0U) {
+		osRtxMemoryFree(semaphore);
+	}
 
 	if (thisThread->state != osRtxThreadRunning)
 	{
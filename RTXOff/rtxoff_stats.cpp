@@ -0,0 +1,163 @@
+//
+// RTXOff CPU usage statistics
+//
+
+#include "rtxoff_stats.h"
+#include "ThreadDispatcher.h"
+
+#include <vector>
+#include <cinttypes>
+
+using namespace std::chrono;
+
+// Convert a time in RTXClock::duration units to microseconds
+static uint64_t toMicroseconds(int64_t rtxTime)
+{
+	return static_cast<uint64_t>(duration_cast<microseconds>(RTXClock::duration(rtxTime)).count());
+}
+
+size_t rtxoff_stats_thread_get_each(rtxoff_thread_stats_t * stats, size_t count)
+{
+	if (IsIrqMode() || IsIrqMasked() || stats == nullptr || count == 0)
+	{
+		return 0;
+	}
+
+	// hold the mutex so that threads can't exit while we look at them
+	ThreadDispatcher::Mutex mutex;
+
+	std::vector<osThreadId_t> threads(count);
+	size_t threadCount = osThreadEnumerate(threads.data(), static_cast<uint32_t>(count));
+
+	for(size_t index = 0; index < threadCount; ++index)
+	{
+		osRtxThread_t * thread = reinterpret_cast<osRtxThread_t *>(threads[index]);
+
+		stats[index].id = threads[index];
+		stats[index].name = thread->name;
+		stats[index].state = osThreadGetState(threads[index]);
+		stats[index].priority = static_cast<osPriority_t>(thread->priority);
+		stats[index].run_time = toMicroseconds(ThreadDispatcher::instance().statsGetRunTime(thread));
+		stats[index].ready_time = toMicroseconds(thread->stats.ready_time);
+		stats[index].voluntary_switches = thread->stats.voluntary_switches;
+		stats[index].involuntary_switches = thread->stats.involuntary_switches;
+		stats[index].isr_preemptions = thread->stats.isr_preemptions;
+		stats[index].stack_size = osThreadGetStackSize(threads[index]);
+		stats[index].stack_space = osThreadGetStackSpace(threads[index]);
+	}
+
+	return threadCount;
+}
+
+void rtxoff_stats_cpu_get(rtxoff_cpu_stats_t * stats)
+{
+	if (IsIrqMode() || IsIrqMasked() || stats == nullptr)
+	{
+		return;
+	}
+
+	ThreadDispatcher::Mutex mutex;
+	ThreadDispatcher & dispatcher = ThreadDispatcher::instance();
+
+	stats->uptime = toMicroseconds((RTXClock::now() - dispatcher.stats.startTime).count());
+	stats->idle_time = dispatcher.thread.idle != nullptr ? toMicroseconds(dispatcher.statsGetRunTime(dispatcher.thread.idle)) : 0;
+	stats->switches = dispatcher.stats.switches;
+	stats->interrupts = dispatcher.stats.interrupts;
+	stats->critical_sections = dispatcher.stats.criticalSections;
+}
+
+void rtxoff_stats_memory_get(rtxoff_memory_stats_t * stats)
+{
+	if (IsIrqMode() || IsIrqMasked() || stats == nullptr)
+	{
+		return;
+	}
+
+	ThreadDispatcher::Mutex mutex;
+	MemoryArena const & memory = ThreadDispatcher::instance().memory;
+
+	stats->size = memory.size();
+	stats->used = memory.used();
+	stats->max_used = memory.maxUsed();
+	stats->blocks = memory.blocks();
+	stats->failures = memory.failures();
+}
+
+void rtxoff_stats_reset(void)
+{
+	if (IsIrqMode() || IsIrqMasked())
+	{
+		return;
+	}
+
+	ThreadDispatcher::Mutex mutex;
+	ThreadDispatcher & dispatcher = ThreadDispatcher::instance();
+	RTXClock::time_point now = RTXClock::now();
+
+	std::vector<osThreadId_t> threads(osThreadGetCount());
+	size_t threadCount = osThreadEnumerate(threads.data(), static_cast<uint32_t>(threads.size()));
+	for(size_t index = 0; index < threadCount; ++index)
+	{
+		osRtxThread_t * thread = reinterpret_cast<osRtxThread_t *>(threads[index]);
+		thread->stats.run_time = 0;
+		thread->stats.ready_time = 0;
+		thread->stats.ready_since = now.time_since_epoch().count();
+		thread->stats.voluntary_switches = 0;
+		thread->stats.involuntary_switches = 0;
+		thread->stats.isr_preemptions = 0;
+	}
+
+	// the running thread's time is charged from runStartTime, so restart that too
+	dispatcher.stats.startTime = now;
+	dispatcher.stats.runStartTime = now;
+	dispatcher.stats.switches = 0;
+	dispatcher.stats.interrupts = 0;
+	dispatcher.stats.criticalSections = 0;
+}
+
+void rtxoff_stats_dump(FILE * stream)
+{
+	if (IsIrqMode() || IsIrqMasked())
+	{
+		return;
+	}
+
+	rtxoff_cpu_stats_t cpuStats;
+	rtxoff_memory_stats_t memoryStats;
+	std::vector<rtxoff_thread_stats_t> threadStats;
+	size_t threadCount;
+
+	{
+		ThreadDispatcher::Mutex mutex;
+		rtxoff_stats_cpu_get(&cpuStats);
+		rtxoff_stats_memory_get(&memoryStats);
+		threadStats.resize(osThreadGetCount());
+		threadCount = rtxoff_stats_thread_get_each(threadStats.data(), threadStats.size());
+	}
+
+	fprintf(stream, "RTXOff CPU stats: uptime %" PRIu64 " us, idle %" PRIu64 " us, %" PRIu64 " thread switches, %" PRIu64 " interrupts, %" PRIu64 " critical sections\n",
+		cpuStats.uptime, cpuStats.idle_time, cpuStats.switches, cpuStats.interrupts, cpuStats.critical_sections);
+	fprintf(stream, "%-24s %5s %14s %6s %14s %11s %11s %11s %15s\n",
+		"Thread", "Prio", "Run (us)", "CPU %", "Ready (us)", "Voluntary", "Involuntary", "ISR", "Stack used");
+
+	for(size_t index = 0; index < threadCount; ++index)
+	{
+		const rtxoff_thread_stats_t & stats = threadStats[index];
+		double cpuPercent = cpuStats.uptime > 0 ? (100.0 * stats.run_time) / cpuStats.uptime : 0.0;
+
+		// without stack checking there's only the size
+		char stackUsage[32];
+#if RTXOFF_STACK_CHECK
+		snprintf(stackUsage, sizeof(stackUsage), "%" PRIu32 "/%" PRIu32, stats.stack_size - stats.stack_space, stats.stack_size);
+#else
+		snprintf(stackUsage, sizeof(stackUsage), "?/%" PRIu32, stats.stack_size);
+#endif
+
+		fprintf(stream, "%-24s %5d %14" PRIu64 " %6.2f %14" PRIu64 " %11" PRIu32 " %11" PRIu32 " %11" PRIu32 " %15s\n",
+			stats.name != nullptr ? stats.name : "<unnamed>", static_cast<int>(stats.priority), stats.run_time, cpuPercent,
+			stats.ready_time, stats.voluntary_switches, stats.involuntary_switches, stats.isr_preemptions, stackUsage);
+	}
+
+	fprintf(stream, "RTXOff dynamic memory: %zu of %zu bytes used in %" PRIu32 " blocks, %zu bytes max used, %" PRIu32 " failed allocations\n",
+		memoryStats.used, memoryStats.size, memoryStats.blocks, memoryStats.max_used, memoryStats.failures);
+}
@@ -0,0 +1,96 @@
+//
+// Header providing RTXOff CPU usage statistics.
+// These are also available through mbed_stats_cpu_get(), mbed_stats_thread_get_each() and mbed_stats_stack_get_each().
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_STATS_H
+#define MBED_BENCHTEST_RTXOFF_STATS_H
+
+#include "cmsis_os2.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Statistics for one thread.  Times are in microseconds on the kernel clock.
+ */
+typedef struct {
+	osThreadId_t id;                ///< ID of the thread
+	const char * name;              ///< Name of the thread
+	osThreadState_t state;          ///< State of the thread
+	osPriority_t priority;          ///< Priority of the thread
+	uint64_t run_time;              ///< Time spent running
+	uint64_t ready_time;            ///< Time spent ready to run but waiting for another thread
+	uint32_t voluntary_switches;    ///< Times the thread stopped running because it blocked or exited
+	uint32_t involuntary_switches;  ///< Times the thread was switched out while still ready to run (preemption, round robin, or osThreadYield())
+	uint32_t isr_preemptions;       ///< Times the thread was interrupted to run ISRs
+	uint32_t stack_size;            ///< Stack size the thread was created with, in bytes
+	uint32_t stack_space;           ///< Stack that the thread has never used, in bytes.  0 unless RTXOFF_STACK_CHECK is 1.
+} rtxoff_thread_stats_t;
+
+/**
+ * Statistics for the whole kernel.  Times are in microseconds on the kernel clock.
+ */
+typedef struct {
+	uint64_t uptime;                ///< Time since the kernel was started
+	uint64_t idle_time;             ///< Time spent in the idle thread
+	uint64_t switches;              ///< Number of thread switches
+	uint64_t interrupts;            ///< Number of times that ISRs have been run
+	uint64_t critical_sections;     ///< Number of times that core_util_critical_section_enter() was called outside of a critical section
+} rtxoff_cpu_stats_t;
+
+/**
+ * Statistics for the kernel's dynamic memory (OS_DYNAMIC_MEM_SIZE), which RTOS objects created without
+ * caller-provided memory are allocated from.  Sizes are in bytes.
+ */
+typedef struct {
+	size_t size;                    ///< Size of the dynamic memory
+	size_t used;                    ///< Memory currently allocated, including block headers
+	size_t max_used;                ///< Most memory that has been allocated at once
+	uint32_t blocks;                ///< Number of blocks currently allocated
+	uint32_t failures;              ///< Number of allocations that failed because the memory was full
+} rtxoff_memory_stats_t;
+
+/**
+ * Fill in statistics for each active thread.  Must be called from an RTX thread.
+ *
+ * @param stats Array to fill in
+ * @param count Size of the array
+ * @return Number of threads filled in.
+ */
+size_t rtxoff_stats_thread_get_each(rtxoff_thread_stats_t * stats, size_t count);
+
+/**
+ * Fill in statistics for the kernel.  Must be called from an RTX thread.
+ */
+void rtxoff_stats_cpu_get(rtxoff_cpu_stats_t * stats);
+
+/**
+ * Fill in statistics for the kernel's dynamic memory.  Must be called from an RTX thread.
+ */
+void rtxoff_stats_memory_get(rtxoff_memory_stats_t * stats);
+
+/**
+ * Zero the CPU statistics of the kernel and each active thread, so that they only cover what happens from now on
+ * (e.g. to leave out a test's setup).  Doesn't change the dynamic memory statistics.  Must be called from an RTX thread.
+ */
+void rtxoff_stats_reset(void);
+
+/**
+ * Print a table of CPU and stack usage for the kernel and each active thread, and the kernel's dynamic memory usage.  Must be called from an RTX thread.
+ * Useful to call from a thread terminate hook or at the end of a test.
+ *
+ * @param stream Stream to print to, e.g. stderr
+ */
+void rtxoff_stats_dump(FILE * stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MBED_BENCHTEST_RTXOFF_STATS_H
@@ -6,6 +6,7 @@
 #include "ThreadDispatcher.h"
 
 #include <cstring>
+#include <new>
 
 //  ==== Helper functions ====
 
@@ -85,6 +86,79 @@ void printThreadLL(osRtxThread_t * head)
 	std::cerr << "]" << std::endl;
 }
 
+//  ==== Ready list index ====
+// The ready list is the same linked list as every other thread list, but since it can get long, we also keep track of
+// the last thread at each priority level plus a bitmap of which levels are non-empty.  This lets us find where to
+// insert a thread in constant time instead of walking the list.
+
+/// Get the index of the lowest set bit in a nonzero value.
+static inline int LowestSetBit (uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctzll(value);
+#endif
+}
+
+/// Put a Thread into the Ready list, at either the front or back of its priority level.
+/// \param[in]  thread          thread object.
+/// \param[in]  front           true to put the thread in front of other threads at the same priority.
+static void ReadyListInsert (osRtxThread_t *thread, bool front) {
+	auto & readyIndex = ThreadDispatcher::instance().thread.readyIndex;
+	osRtxThread_t *prev, *next;
+	int32_t      priority;
+
+	priority = thread->priority;
+	uint64_t levelBit = uint64_t(1) << priority;
+
+	// The thread goes after the last thread at the nearest priority level above it (for front)
+	// or at or above it (for back).  Since the list is sorted highest first, that's the lowest set bit in the
+	// bitmap when masked to those levels.
+	uint64_t levelsBefore = readyIndex.levels & ~(front ? (levelBit | (levelBit - 1)) : (levelBit - 1));
+	if (levelsBefore == 0U) {
+		prev = reinterpret_cast<osRtxThread_t *>(&ThreadDispatcher::instance().thread.ready);
+	} else {
+		prev = readyIndex.tails[LowestSetBit(levelsBefore)];
+	}
+	next = prev->thread_next;
+
+	thread->thread_prev = prev;
+	thread->thread_next = next;
+	prev->thread_next = thread;
+	if (next != NULL) {
+		next->thread_prev = thread;
+	}
+
+	// update index
+	if (!front || (readyIndex.levels & levelBit) == 0U) {
+		readyIndex.tails[priority] = thread;
+	}
+	readyIndex.levels |= levelBit;
+	thread->ready_priority = (int8_t)priority;
+}
+
+/// Update the Ready list index before a Thread is taken out of the Ready list.
+/// \param[in]  thread          thread object.
+static void ReadyListIndexRemove (osRtxThread_t *thread) {
+	auto & readyIndex = ThreadDispatcher::instance().thread.readyIndex;
+	int32_t priority = thread->ready_priority;
+
+	if (readyIndex.tails[priority] == thread) {
+		// note: the previous thread is the list head object (whose ready_priority is never valid) if this is the first thread
+		osRtxThread_t *prev = thread->thread_prev;
+		if (prev != reinterpret_cast<osRtxThread_t *>(&ThreadDispatcher::instance().thread.ready) &&
+			prev->ready_priority == priority) {
+			readyIndex.tails[priority] = prev;
+		} else {
+			readyIndex.tails[priority] = NULL;
+			readyIndex.levels &= ~(uint64_t(1) << priority);
+		}
+	}
+	thread->ready_priority = osPriorityNone;
+}
+
 /// Put a Thread into specified Object list sorted by Priority (Highest at Head).
 /// \param[in]  object          generic object.
 /// \param[in]  thread          thread object.
@@ -92,6 +166,11 @@ void osRtxThreadListPut (osRtxObject_t *object, osRtxThread_t *thread) {
 	osRtxThread_t *prev, *next;
 	int32_t      priority;
 
+	if (object == &ThreadDispatcher::instance().thread.ready) {
+		ReadyListInsert(thread, false);
+		return;
+	}
+
 	priority = thread->priority;
 
 	prev = reinterpret_cast<osRtxThread_t *>(object);
@@ -136,6 +215,9 @@ osRtxThread_t *osRtxThreadListGet (osRtxObject_t *object) {
 	osRtxThread_t *thread;
 
 	thread = object->thread_list;
+	if (thread->ready_priority != osPriorityNone) {
+		ReadyListIndexRemove(thread);
+	}
 	object->thread_list = thread->thread_next;
 	if (thread->thread_next != nullptr) {
 		thread->thread_next->thread_prev = reinterpret_cast<osRtxThread_t *>(object);
@@ -150,6 +232,9 @@ osRtxThread_t *osRtxThreadListGet (osRtxObject_t *object) {
 void osRtxThreadListRemove (osRtxThread_t *thread) {
 
 	if (thread->thread_prev != NULL) {
+		if (thread->ready_priority != osPriorityNone) {
+			ReadyListIndexRemove(thread);
+		}
 		thread->thread_prev->thread_next = thread->thread_next;
 		if (thread->thread_next != NULL) {
 			thread->thread_next->thread_prev = thread->thread_prev;
@@ -163,29 +248,9 @@ void osRtxThreadListRemove (osRtxThread_t *thread) {
 /// to the FRONT of the queue at this priority instead of the back.
 /// \param[in]  thread          running thread object.
 void osRtxThreadBlock (osRtxThread_t *thread) {
-	osRtxThread_t *prev, *next;
-	int32_t      priority;
-
 	thread->state = osRtxThreadReady;
-
-	priority = thread->priority;
-
-	prev = reinterpret_cast<osRtxThread_t *>(&ThreadDispatcher::instance().thread.ready);
-	next = prev->thread_next;
-
-	// find point in linked list to insert this thread
-	while ((next != nullptr) && (next->priority > priority)) {
-		prev = next;
-		next = next->thread_next;
-	}
-
-	// insert to LL
-	thread->thread_prev = prev;
-	thread->thread_next = next;
-	prev->thread_next = thread;
-	if (next != NULL) {
-		next->thread_prev = thread;
-	}
+	thread->stats.ready_since = RTXClock::now().time_since_epoch().count();
+	ReadyListInsert(thread, true);
 }
 
 /// Unlink a Thread from specified linked list.
@@ -211,15 +276,16 @@ static void osRtxThreadFree (osRtxThread_t *thread)
 	thread->state = osRtxThreadInactive;
 	thread->id    = osRtxIdInvalid;
 
-	// remove OS thread handle
+	// remove OS thread handle.  POSIX threads are detached by the thread suspender.
 #if USE_WINTHREAD
 	CloseHandle(thread->osThread);
-#else
-    pthread_detach(thread->osThread);
 #endif
 
-	// delete thread object itself
-	delete thread;
+	// Free object memory
+	if ((thread->flags & osRtxFlagSystemObject) != 0U)
+	{
+		osRtxMemoryFree(thread);
+	}
 }
 
 /// Mark a Thread as Ready and put it into Ready list (sorted by Priority).
@@ -230,7 +296,11 @@ void osRtxThreadReadyPut (osRtxThread_t * thread)
 	std::cerr << "Putting " << thread->name << " onto ready list" << std::endl;
 #endif
 	thread->state = osRtxThreadReady;
+	thread->stats.ready_since = RTXClock::now().time_since_epoch().count();
 	osRtxThreadListPut(&ThreadDispatcher::instance().thread.ready, thread);
+
+	// might need to start a round robin timeout
+	ThreadDispatcher::instance().updateWakeupTime();
 }
 
 void *osRtxThreadListRoot (osRtxThread_t *thread)
@@ -250,6 +320,7 @@ void *osRtxThreadListRoot (osRtxThread_t *thread)
 /// \param[in]  dispatch        dispatch flag.
 void osRtxThreadWaitExit(osRtxThread_t *thread, uint64_t ret_val, bool dispatch)
 {
+	RTXOFF_TRACE_EVENT(RTXOFF_TRACE_WAIT_EXIT, thread, ret_val, 0);
 	ThreadDispatcher::instance().delayListRemove(thread);
 	thread->waitExitVal = ret_val;
 	thread->waitValPresent = 1;
@@ -283,6 +354,7 @@ bool osRtxThreadWaitEnter (uint8_t state, uint32_t timeout) {
 	// Get running thread
 	thread = ThreadDispatcher::instance().thread.run.curr;
 
+	RTXOFF_TRACE_EVENT(RTXOFF_TRACE_WAIT_ENTER, thread, state, timeout);
 	thread->state = state;
 	ThreadDispatcher::instance().delayListInsert(thread, timeout);
 	osRtxThread_t * newThread = osRtxThreadListGet(&ThreadDispatcher::instance().thread.ready);
@@ -314,13 +386,20 @@ static void osRtxThreadPostProcess (osRtxThread_t *thread) {
 
 //  ==== Public API ====
 
+static void osRtxThreadExitRunning();
+
 /*
  * Helper function for starting threads.
  * Assembly code in RTX causes threads to call osThreadExit() after they return from their main functions.
- * RTXOff cannot do this so we use this helper function to call osThreadExit()
+ * RTXOff cannot do this so we use this helper function to do the same thing.  Instead of exiting the host
+ * thread, it returns to the thread suspender, which can keep the host thread to run another RTX thread.
  */
-void startThreadHelper(void * unused)
+void startThreadHelper(void * dispatcher)
 {
+    // this thread belongs to the same board as the thread that created it
+    ThreadDispatcher::setCurrent(static_cast<ThreadDispatcher *>(dispatcher));
+    ThreadDispatcher::markRtxThread();
+
     // load data from the scheduler with the mutex locked to prevent switches
     osThreadFunc_t start_func;
     void * start_func_argument;
@@ -334,7 +413,9 @@ void startThreadHelper(void * unused)
 
     // once we've loaded the data it doesn't matter if we get suspended/killed
     start_func(start_func_argument);
-	osThreadExit();
+
+    ThreadDispatcher::instance().hooks.thread_terminate_hook(ThreadDispatcher::instance().thread.run.curr);
+	osRtxThreadExitRunning();
 }
 
 osThreadId_t osThreadNew (osThreadFunc_t func, void *argument, const osThreadAttr_t *attr)
@@ -360,6 +441,8 @@ osThreadId_t osThreadNew (osThreadFunc_t func, void *argument, const osThreadAtt
 	osPriority_t  priority;
 	uint8_t       flags = 0;
 	const char   *name;
+	void         *stack_mem;
+	uint32_t      stack_size;
 
 	// Process attributes
 	if (attr != NULL)
@@ -367,6 +450,9 @@ osThreadId_t osThreadNew (osThreadFunc_t func, void *argument, const osThreadAtt
 		name       = attr->name;
 		attr_bits  = attr->attr_bits;
 		priority   = attr->priority;
+		thread     = static_cast<osRtxThread_t *>(attr->cb_mem);
+		stack_mem  = attr->stack_mem;
+		stack_size = attr->stack_size;
 		if (priority == osPriorityNone)
 		{
 			priority = osPriorityNormal;
@@ -375,10 +461,32 @@ osThreadId_t osThreadNew (osThreadFunc_t func, void *argument, const osThreadAtt
 				return NULL;
 			}
 		}
+		if (thread != NULL) {
+			if (!is_aligned_p(thread) || (attr->cb_size < sizeof(osRtxThread_t))) {
+				return NULL;
+			}
+		} else {
+			if (attr->cb_size != 0U) {
+				return NULL;
+			}
+		}
+		if (stack_mem != NULL) {
+			if ((reinterpret_cast<uintptr_t>(stack_mem) & 7U) != 0U) {
+				return NULL;
+			}
+		}
 	} else {
 		name       = NULL;
 		attr_bits  = 0U;
 		priority   = osPriorityNormal;
+		stack_mem  = NULL;
+		stack_size = 0U;
+	}
+
+	// Use default stack size if not provided
+	if (stack_size == 0U) {
+		stack_size = OS_STACK_SIZE;
+		flags |= osRtxThreadFlagDefStack;
 	}
 
 	// make sure all threads have names (makes debugging easier)
@@ -387,8 +495,17 @@ osThreadId_t osThreadNew (osThreadFunc_t func, void *argument, const osThreadAtt
 		name = "<anonymous thread>";
 	}
 
-	// create object memory
-	thread = new osRtxThread_t();
+	// Allocate object memory if not provided.  The stack is always the host thread's own stack.
+	if (thread == NULL)
+	{
+		thread = static_cast<osRtxThread_t *>(osRtxMemoryAlloc(sizeof(osRtxThread_t)));
+		if (thread == NULL)
+		{
+			return NULL;
+		}
+		flags |= osRtxFlagSystemObject;
+	}
+	new (thread) osRtxThread_t();
 
 	// Initialize control block
 	thread->id            = osRtxIdThread;
@@ -402,18 +519,31 @@ osThreadId_t osThreadNew (osThreadFunc_t func, void *argument, const osThreadAtt
 	thread->delay_prev    = NULL;
 	thread->thread_join   = NULL;
 	thread->delay         = 0U;
+	thread->in_wait_list  = 0U;
 	thread->priority      = (int8_t)priority;
 	thread->priority_base = (int8_t)priority;
+	thread->ready_priority = osPriorityNone;
+	thread->serial        = ThreadDispatcher::instance().thread.nextSerial++;
+	thread->stats.ready_since = RTXClock::now().time_since_epoch().count();
 	thread->flags_options = 0U;
 	thread->wait_flags    = 0U;
 	thread->thread_flags  = 0U;
 	thread->mutex_list    = NULL;
+	thread->stack_mem     = stack_mem;
+	thread->stack_size    = stack_size;
 	thread->waitValPresent = 0;
     thread->start_func = func;
     thread->start_func_argument = argument;
 
-	// Create OS thread
-	thread->osThread = thread_suspender_create_suspended_thread(&thread->suspenderData, reinterpret_cast<void (*)(void*)>(&startThreadHelper), nullptr);
+	RTXOFF_TRACE_THREAD_NEW(thread);
+
+	// Create OS thread.  With stack checking, its host stack is sized from the thread's stack size.
+#if RTXOFF_STACK_CHECK
+	size_t hostStackSize = static_cast<size_t>(stack_size) * RTXOFF_STACK_SCALE;
+#else
+	size_t hostStackSize = 0;
+#endif
+	thread->osThread = thread_suspender_create_suspended_thread(&thread->suspenderData, reinterpret_cast<void (*)(void*)>(&startThreadHelper), &ThreadDispatcher::instance(), hostStackSize);
 
 #if !USE_WINTHREAD && defined(HAVE_PTHREAD_SETNAME_NP)
     // copy to 15 character max buffer
@@ -486,6 +616,53 @@ osThreadState_t osThreadGetState(osThreadId_t thread_id)
 	return static_cast<osThreadState_t>(thread->state & osRtxThreadStateMask);
 }
 
+/// Get stack size of a thread.
+uint32_t osThreadGetStackSize (osThreadId_t thread_id)
+{
+	if (IsIrqMode() || IsIrqMasked()) {
+		return 0U;
+	}
+
+	osRtxThread_t *thread = reinterpret_cast<osRtxThread_t *>(thread_id);
+
+	// Check parameters
+	if ((thread == nullptr) || (thread->id != osRtxIdThread)) {
+		return 0U;
+	}
+	return thread->stack_size;
+}
+
+/// Get available stack space of a thread based on stack watermark recording during execution.
+uint32_t osThreadGetStackSpace (osThreadId_t thread_id)
+{
+	if (IsIrqMode() || IsIrqMasked()) {
+		return 0U;
+	}
+
+	ThreadDispatcher::Mutex mutex;
+
+	osRtxThread_t *thread = reinterpret_cast<osRtxThread_t *>(thread_id);
+
+	// Check parameters
+	if ((thread == nullptr) || (thread->id != osRtxIdThread)) {
+		return 0U;
+	}
+
+#if RTXOFF_STACK_CHECK
+	// once the thread has terminated, its host thread may be running something else
+	if (thread->state == osRtxThreadTerminated) {
+		return 0U;
+	}
+
+	// scale the host's usage back to target bytes, rounding up
+	size_t used = (thread_suspender_stack_used(thread->suspenderData) + RTXOFF_STACK_SCALE - 1U) / RTXOFF_STACK_SCALE;
+	return used < thread->stack_size ? thread->stack_size - static_cast<uint32_t>(used) : 0U;
+#else
+	// stacks aren't painted, so there's no watermark to measure
+	return 0U;
+#endif
+}
+
 /// Change priority of a thread.
 osStatus_t osThreadSetPriority (osThreadId_t thread_id, osPriority_t priority)
 {
@@ -718,23 +895,30 @@ osStatus_t osThreadJoin (osThreadId_t thread_id)
 	else
 	{
 		// Suspend current Thread
+		status = osErrorResource;
 		if (osRtxThreadWaitEnter(osRtxThreadWaitingJoin, osWaitForever))
 		{
-			thread->thread_join = ThreadDispatcher::instance().thread.run.curr;
+			osRtxThread_t * thisThread = ThreadDispatcher::instance().thread.run.curr;
+			thread->thread_join = thisThread;
 			thread->attr &= ~osThreadJoinable;
 			ThreadDispatcher::instance().blockUntilWoken();
+
+			// the joined thread's exit wakes this one with osOK
+			if(thisThread->waitValPresent)
+			{
+				status = static_cast<osStatus_t>(thisThread->waitExitVal);
+				thisThread->waitValPresent = false;
+			}
 		}
-		status = osErrorResource;
 	}
 
 	return status;
 }
 
-/// Terminate execution of current running thread.
-__NO_RETURN void osThreadExit (void)
+/// Terminate execution of the current running thread and switch to the next one, leaving the host thread
+/// to return or exit.
+static void osRtxThreadExitRunning()
 {
-    ThreadDispatcher::instance().hooks.thread_terminate_hook(ThreadDispatcher::instance().thread.run.curr);
-
     if (IsIrqMode() || IsIrqMasked())
 	{
 		// can't return an error code...
@@ -756,6 +940,7 @@ __NO_RETURN void osThreadExit (void)
 
 	// Get running thread
 	thread = ThreadDispatcher::instance().thread.run.curr;
+	RTXOFF_TRACE_EVENT(RTXOFF_TRACE_THREAD_EXIT, thread, 0, 0);
 
 	// Release owned Mutexes
 	osRtxMutexOwnerRelease(thread->mutex_list);
@@ -790,10 +975,19 @@ __NO_RETURN void osThreadExit (void)
 		ThreadDispatcher::instance().thread.terminate_list = thread;
 	}
 
-	// now trigger the scheduler and exit this thread
+	// now trigger the scheduler
 	ThreadDispatcher::instance().requestSchedule();
 	ThreadDispatcher::instance().unlockMutex();
+}
 
+/// Terminate execution of current running thread.
+__NO_RETURN void osThreadExit (void)
+{
+    ThreadDispatcher::instance().hooks.thread_terminate_hook(ThreadDispatcher::instance().thread.run.curr);
+
+	osRtxThreadExitRunning();
+
+	// This could be called from anywhere in the thread's code, so the host thread can't be reused
 	thread_suspender_current_thread_exit();
 }
 
@@ -847,6 +1041,8 @@ osStatus_t osThreadTerminate (osThreadId_t thread_id)
 
 	if (status == osOK)
 	{
+		RTXOFF_TRACE_EVENT(RTXOFF_TRACE_THREAD_EXIT, thread, 0, 0);
+
 		// Release owned Mutexes
 		osRtxMutexOwnerRelease(thread->mutex_list);
 
@@ -926,11 +1122,15 @@ uint32_t osThreadGetCount (void)
 	}
 
 	// Delay List
+#if RTXOFF_DEADLINE_HEAP
+	count += ThreadDispatcher::instance().thread.delay_heap.size();
+#else
 	for (thread = ThreadDispatcher::instance().thread.delay_list;
 		 thread != NULL; thread = thread->delay_next)
 	{
 		count++;
 	}
+#endif
 
 	// Wait List
 	for (thread = ThreadDispatcher::instance().thread.wait_list;
@@ -973,12 +1173,23 @@ uint32_t osThreadEnumerate (osThreadId_t *thread_array, uint32_t array_items)
 	}
 
 	// Delay List
+#if RTXOFF_DEADLINE_HEAP
+	for (osRtxThread_t * delayedThread : ThreadDispatcher::instance().thread.delay_heap) {
+		if (count >= array_items) {
+			break;
+		}
+		*thread_array = delayedThread;
+		thread_array++;
+		count++;
+	}
+#else
 	for (thread = ThreadDispatcher::instance().thread.delay_list;
 		 (thread != NULL) && (count < array_items); thread = thread->delay_next) {
 		*thread_array = thread;
 		thread_array++;
 		count++;
 	}
+#endif
 
 	// Wait List
 	for (thread = ThreadDispatcher::instance().thread.wait_list;
@@ -3,20 +3,37 @@
 //
 
 #include <cstring>
+#include <new>
 #include "ThreadDispatcher.h"
 
 //  ==== Helper functions ====
 
 /// Insert Timer into the Timer List sorted by Time.
 /// \param[in]  timer           timer object.
-/// \param[in]  tick            timer tick.
-static void TimerInsert(osRtxTimer_t *timer, uint32_t tick) {
+/// \param[in]  tick            timer tick.  In tickless mode, this is an absolute deadline (see deadlineAfterTicks()).
+static void TimerInsert(osRtxTimer_t *timer, int64_t tick) {
+#if RTXOFF_DEADLINE_HEAP
+
+#if !RTXOFF_TICKLESS
+    tick = ThreadDispatcher::instance().deadlineAfterTicks(tick);
+#endif
+    timer->tick = tick;
+    ThreadDispatcher::instance().timer.heap.insert(timer);
+
+#else
     osRtxTimer_t *prev, *next;
 
+#if !RTXOFF_TICKLESS
+    // Timer ticks are relative to the last tick delivered by the dispatcher
+    tick += ThreadDispatcher::instance().ticksSinceLastTick();
+#endif
+
     prev = nullptr;
     next = ThreadDispatcher::instance().timer.list;
     while ((next != nullptr) && (next->tick <= tick)) {
+#if !RTXOFF_TICKLESS
         tick -= next->tick;
+#endif
         prev = next;
         next = next->next;
     }
@@ -24,7 +41,9 @@ static void TimerInsert(osRtxTimer_t *timer, uint32_t tick) {
     timer->prev = prev;
     timer->next = next;
     if (next != nullptr) {
+#if !RTXOFF_TICKLESS
         next->tick -= timer->tick;
+#endif
         next->prev = timer;
     }
     if (prev != nullptr) {
@@ -32,14 +51,40 @@ static void TimerInsert(osRtxTimer_t *timer, uint32_t tick) {
     } else {
         ThreadDispatcher::instance().timer.list = timer;
     }
+#endif
+
+    ThreadDispatcher::instance().updateWakeupTime();
+}
+
+#if RTXOFF_DEADLINE_HEAP
+
+/// Remove Timer from the Timer Heap.
+/// \param[in]  timer           timer object.
+static void TimerRemove(osRtxTimer_t *timer) {
+    ThreadDispatcher::instance().timer.heap.remove(timer);
+}
+
+/// Get the Timer with the earliest deadline.
+static osRtxTimer_t *TimerHead() {
+    return ThreadDispatcher::instance().timer.heap.top();
+}
+
+/// Unlink Timer from the Timer Heap top.
+/// \param[in]  timer           timer object.
+static void TimerUnlink(osRtxTimer_t *timer) {
+    ThreadDispatcher::instance().timer.heap.remove(timer);
 }
 
+#else
+
 /// Remove Timer from the Timer List.
 /// \param[in]  timer           timer object.
 static void TimerRemove(const osRtxTimer_t *timer) {
 
     if (timer->next != nullptr) {
+#if !RTXOFF_TICKLESS
         timer->next->tick += timer->tick;
+#endif
         timer->next->prev = timer->prev;
     }
     if (timer->prev != nullptr) {
@@ -49,6 +94,11 @@ static void TimerRemove(const osRtxTimer_t *timer) {
     }
 }
 
+/// Get the Timer List Head.
+static osRtxTimer_t *TimerHead() {
+    return ThreadDispatcher::instance().timer.list;
+}
+
 /// Unlink Timer from the Timer List Head.
 /// \param[in]  timer           timer object.
 static void TimerUnlink(const osRtxTimer_t *timer) {
@@ -59,6 +109,8 @@ static void TimerUnlink(const osRtxTimer_t *timer) {
     ThreadDispatcher::instance().timer.list = timer->next;
 }
 
+#endif
+
 
 //  ==== Library functions ====
 
@@ -67,7 +119,7 @@ static void osRtxTimerTick(void) {
     osRtxTimer_t *timer;
     osStatus_t status;
 
-    timer = ThreadDispatcher::instance().timer.list;
+    timer = TimerHead();
     if (timer == nullptr) {
         //lint -e{904} "Return statement before end of function" [MISRA Note 1]
 #if RTXOFF_DEBUG && RTXOFF_VERBOSE
@@ -76,9 +128,17 @@ static void osRtxTimerTick(void) {
         return;
     }
 
-    timer->tick -= 1;ThreadDispatcher::instance().kernel.tickDelta;
-    while ((timer != nullptr) && (timer->tick <= 0U)) {
+    // Timers whose tick value is at or below this have expired
+#if RTXOFF_TICKLESS || RTXOFF_DEADLINE_HEAP
+    // Deadlines are absolute, so every overdue timer expires here without needing a negative delay carry
+    const int64_t expiry = ThreadDispatcher::instance().deadlineNow();
+#else
+    const int64_t expiry = 0;
+    timer->tick -= ThreadDispatcher::instance().kernel.tickDelta;
+#endif
+    while ((timer != nullptr) && (timer->tick <= expiry)) {
         TimerUnlink(timer);
+        RTXOFF_TRACE_EVENT(RTXOFF_TRACE_TIMER_EXPIRE, nullptr, timer, timer->finfo.func);
         status = osMessageQueuePut(ThreadDispatcher::instance().timer.mq, &timer->finfo, 0U, 0U);
         if (status != osOK) {
 #if RTXOFF_DEBUG
@@ -88,18 +148,25 @@ static void osRtxTimerTick(void) {
             //(void) osRtxErrorNotify(osRtxErrorTimerQueueOverflow, timer);
         }
 
+#if !RTXOFF_TICKLESS && !RTXOFF_DEADLINE_HEAP
 		// proxy a negative delay value onto the next timer
 		if(ThreadDispatcher::instance().timer.list != nullptr)
 		{
 			ThreadDispatcher::instance().timer.list->tick += timer->tick;
 		}
+#endif
 
         if (timer->type == osRtxTimerPeriodic) {
+#if RTXOFF_TICKLESS
+            // count from the previous deadline so that the period doesn't drift
+            TimerInsert(timer, timer->tick + std::chrono::duration_cast<RTXClock::duration>(timer->load * ThreadDispatcher::instance().tickDuration).count());
+#else
             TimerInsert(timer, timer->load);
+#endif
         } else {
             timer->state = osRtxTimerStopped;
         }
-        timer = ThreadDispatcher::instance().timer.list;
+        timer = TimerHead();
     }
 }
 
@@ -112,10 +179,10 @@ static void osRtxTimerTick(void) {
     const osMessageQueueAttr_t os_timer_mq_attr = {
             NULL,
             0U,
-            nullptr,
-            0,
-            nullptr,
-            0
+            &ThreadDispatcher::instance().system_objects.timer_mq,
+            sizeof(osRtxMessageQueue_t),
+            ThreadDispatcher::instance().system_objects.timer_mq_data,
+            sizeof(ThreadDispatcher::instance().system_objects.timer_mq_data)
     };
 
     ThreadDispatcher::instance().timer.mq = reinterpret_cast<osRtxMessageQueue_t *>(
@@ -172,13 +239,15 @@ osTimerId_t osTimerNew(osTimerFunc_t func, osTimerType_t type, void *argument, c
 
     // Allocate object memory if not provided
     if (timer == nullptr) {
-        timer = new osRtxTimer_t;
+        timer = static_cast<osRtxTimer_t *>(osRtxMemoryAlloc(sizeof(osRtxTimer_t)));
         flags = osRtxFlagSystemObject;
     } else {
         flags = 0U;
     }
 
     if (timer != nullptr) {
+        new (timer) osRtxTimer_t();
+
         // Initialize control block
         timer->id = osRtxIdTimer;
         timer->state = osRtxTimerStopped;
@@ -236,7 +305,11 @@ osStatus_t osTimerStart(osTimerId_t timer_id, uint32_t ticks) {
         }
     }
 
+#if RTXOFF_TICKLESS
+    TimerInsert(timer, ThreadDispatcher::instance().deadlineAfterTicks(ticks));
+#else
     TimerInsert(timer, ticks);
+#endif
 
     return osOK;
 }
@@ -309,7 +382,7 @@ osStatus_t osTimerDelete(osTimerId_t timer_id) {
 
     // Free object memory
     if ((timer->flags & osRtxFlagSystemObject) != 0U) {
-        delete timer;
+        osRtxMemoryFree(timer);
     }
 
     return osOK;
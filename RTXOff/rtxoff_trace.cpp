@@ -0,0 +1,197 @@
+//
+// RTXOff scheduler event trace
+//
+
+#include "rtxoff_trace.h"
+#include "ThreadDispatcher.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std::chrono;
+
+#if RTXOFF_TRACE
+
+static_assert((RTXOFF_TRACE_BUFFER_SIZE & (RTXOFF_TRACE_BUFFER_SIZE - 1)) == 0, "RTXOFF_TRACE_BUFFER_SIZE must be a power of two");
+
+namespace
+{
+	// One entry in the ring buffer.
+	// The sequence number works like a seqlock: it is 0 while the event is being written, and afterwards holds
+	// the event's index + 1.  This lets readers detect events that were overwritten while they were copying them.
+	struct TraceSlot
+	{
+		std::atomic<uint64_t> sequence;
+		rtxoff_trace_event_t event;
+	};
+
+	TraceSlot traceBuffer[RTXOFF_TRACE_BUFFER_SIZE];
+
+	// Index of the next event to be recorded.  Writers claim a slot by incrementing this.
+	std::atomic<uint64_t> traceWriteIndex(0);
+
+	// Events before this index have been cleared
+	std::atomic<uint64_t> traceClearIndex(0);
+
+	// Claim a slot in the buffer and fill in the common fields of the event.
+	// Must be followed by traceCommit().
+	rtxoff_trace_event_t & traceClaim(uint64_t & index, uint32_t type, const void * thread)
+	{
+		index = traceWriteIndex.fetch_add(1, std::memory_order_relaxed);
+		TraceSlot & slot = traceBuffer[index & (RTXOFF_TRACE_BUFFER_SIZE - 1)];
+
+		slot.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.event.timestamp = static_cast<uint64_t>(duration_cast<microseconds>(RTXClock::now().time_since_epoch()).count());
+		slot.event.kernel = reinterpret_cast<uintptr_t>(&ThreadDispatcher::instance());
+		slot.event.thread = reinterpret_cast<uintptr_t>(thread);
+		slot.event.type = type;
+		slot.event.reserved = 0;
+		return slot.event;
+	}
+
+	void traceCommit(uint64_t index)
+	{
+		traceBuffer[index & (RTXOFF_TRACE_BUFFER_SIZE - 1)].sequence.store(index + 1, std::memory_order_release);
+	}
+
+	// Write the trace to the file named by RTXOFF_TRACE_FILE, if it is set
+	void traceWriteAtExit()
+	{
+		const char * filename = getenv("RTXOFF_TRACE_FILE");
+		if(filename != nullptr && filename[0] != '\0')
+		{
+			int64_t count = rtxoff_trace_write(filename);
+			if(count < 0)
+			{
+				std::cerr << "RTXOFF: could not write trace file " << filename << std::endl;
+			}
+		}
+	}
+
+	// Registers traceWriteAtExit() during static initialization
+	struct TraceAtExitRegistrar
+	{
+		TraceAtExitRegistrar()
+		{
+			atexit(traceWriteAtExit);
+		}
+	} traceAtExitRegistrar;
+}
+
+void rtxOffTraceRecord(uint32_t type, const void * thread, uint64_t arg0, uint64_t arg1)
+{
+	uint64_t index;
+	rtxoff_trace_event_t & event = traceClaim(index, type, thread);
+	event.data.args[0] = arg0;
+	event.data.args[1] = arg1;
+	traceCommit(index);
+}
+
+void rtxOffTraceThreadCreate(const osRtxThread_t * thread)
+{
+	uint64_t index;
+	rtxoff_trace_event_t & event = traceClaim(index, RTXOFF_TRACE_THREAD_CREATE, thread);
+	memset(event.data.name, 0, sizeof(event.data.name));
+	if(thread->name != nullptr)
+	{
+		strncpy(event.data.name, thread->name, sizeof(event.data.name));
+	}
+	traceCommit(index);
+}
+
+int64_t rtxoff_trace_write(const char * filename)
+{
+	FILE * file = fopen(filename, "wb");
+	if(file == nullptr)
+	{
+		return -1;
+	}
+
+	// Copy out the events first, so that the buffer is disturbed as little as possible while the file is written
+	const uint64_t end = traceWriteIndex.load(std::memory_order_acquire);
+	uint64_t begin = traceClearIndex.load(std::memory_order_relaxed);
+	if(end - begin > RTXOFF_TRACE_BUFFER_SIZE)
+	{
+		begin = end - RTXOFF_TRACE_BUFFER_SIZE;
+	}
+
+	std::vector<rtxoff_trace_event_t> events;
+	events.reserve(end - begin);
+	uint64_t dropped = begin - traceClearIndex.load(std::memory_order_relaxed);
+
+	for(uint64_t index = begin; index < end; ++index)
+	{
+		TraceSlot & slot = traceBuffer[index & (RTXOFF_TRACE_BUFFER_SIZE - 1)];
+
+		// Skip events that are still being written or that were overwritten while we copied them
+		if(slot.sequence.load(std::memory_order_acquire) != index + 1)
+		{
+			++dropped;
+			continue;
+		}
+		rtxoff_trace_event_t event = slot.event;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(slot.sequence.load(std::memory_order_relaxed) != index + 1)
+		{
+			++dropped;
+			continue;
+		}
+
+		events.push_back(event);
+	}
+
+	rtxoff_trace_file_header_t header;
+	memcpy(header.magic, RTXOFF_TRACE_MAGIC, sizeof(header.magic));
+	header.version = RTXOFF_TRACE_VERSION;
+	header.event_size = sizeof(rtxoff_trace_event_t);
+	header.event_count = events.size();
+	header.dropped = dropped;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if(ok && !events.empty())
+	{
+		ok = fwrite(events.data(), sizeof(rtxoff_trace_event_t), events.size(), file) == events.size();
+	}
+	ok = (fclose(file) == 0) && ok;
+
+	return ok ? static_cast<int64_t>(events.size()) : -1;
+}
+
+void rtxoff_trace_clear(void)
+{
+	traceClearIndex.store(traceWriteIndex.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+#else
+
+// Tracing is compiled out, so traces are always empty.
+
+int64_t rtxoff_trace_write(const char * filename)
+{
+	FILE * file = fopen(filename, "wb");
+	if(file == nullptr)
+	{
+		return -1;
+	}
+
+	rtxoff_trace_file_header_t header;
+	memcpy(header.magic, RTXOFF_TRACE_MAGIC, sizeof(header.magic));
+	header.version = RTXOFF_TRACE_VERSION;
+	header.event_size = sizeof(rtxoff_trace_event_t);
+	header.event_count = 0;
+	header.dropped = 0;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = (fclose(file) == 0) && ok;
+	return ok ? 0 : -1;
+}
+
+void rtxoff_trace_clear(void)
+{
+}
+
+#endif
@@ -0,0 +1,84 @@
+//
+// Header providing the RTXOff scheduler event trace.
+// When RTXOFF_TRACE is enabled, the kernel records thread switches, preemptions, waits, ISRs, timer expiries
+// and mutex contention into a fixed-size ring buffer, which can be written to a file and converted into
+// Chrome trace event JSON (viewable in chrome://tracing or ui.perfetto.dev) with the rtxoff_trace_to_json tool.
+//
+
+#ifndef MBED_BENCHTEST_RTXOFF_TRACE_H
+#define MBED_BENCHTEST_RTXOFF_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Types of trace event.  The meaning of each event's thread and argument fields is listed next to it.
+ */
+typedef enum {
+	RTXOFF_TRACE_THREAD_CREATE = 1,  ///< Thread was created.  thread: new thread, name: its name
+	RTXOFF_TRACE_THREAD_EXIT,        ///< Thread exited or was terminated.  thread: the thread
+	RTXOFF_TRACE_THREAD_SWITCH,      ///< Processor switched threads.  thread: thread now running, arg0: thread that was running (or 0)
+	RTXOFF_TRACE_PREEMPT,            ///< Thread became ready and preempted the running thread.  thread: preempted thread, arg0: preempting thread
+	RTXOFF_TRACE_WAIT_ENTER,         ///< Running thread started waiting.  thread: the thread, arg0: osRtxThreadWaiting* state, arg1: timeout in ticks
+	RTXOFF_TRACE_WAIT_EXIT,          ///< Thread stopped waiting.  thread: the thread, arg0: wait return value, or osErrorTimeout if the timeout ran out
+	RTXOFF_TRACE_ISR_ENTER,          ///< Interrupt handler started.  arg0: IRQ number
+	RTXOFF_TRACE_ISR_EXIT,           ///< Interrupt handler finished.  arg0: IRQ number
+	RTXOFF_TRACE_TIMER_EXPIRE,       ///< RTOS timer expired.  arg0: timer ID, arg1: timer callback function
+	RTXOFF_TRACE_MUTEX_CONTENDED,    ///< Thread tried to acquire a mutex owned by another thread.  thread: the thread, arg0: mutex ID, arg1: owner thread
+} rtxoff_trace_event_type_t;
+
+/**
+ * One trace event, as stored in memory and in trace files.
+ * Pointers are widened to 64 bits so that files have the same layout on 32 and 64 bit hosts.
+ */
+typedef struct {
+	uint64_t timestamp;   ///< Time of the event in microseconds on the kernel clock
+	uint64_t kernel;      ///< Identifies the kernel (see RTXOffBoard) that the event happened on
+	uint64_t thread;      ///< Thread that the event is about, or 0
+	union {
+		uint64_t args[2];
+		char name[16];    ///< For RTXOFF_TRACE_THREAD_CREATE.  Not null terminated if the name fills the whole array.
+	} data;
+	uint32_t type;        ///< rtxoff_trace_event_type_t
+	uint32_t reserved;
+} rtxoff_trace_event_t;
+
+/**
+ * Header at the start of a trace file.  It is followed by event_count rtxoff_trace_event_t structures in time order.
+ */
+typedef struct {
+	char magic[8];        ///< RTXOFF_TRACE_MAGIC
+	uint32_t version;     ///< RTXOFF_TRACE_VERSION
+	uint32_t event_size;  ///< sizeof(rtxoff_trace_event_t)
+	uint64_t event_count; ///< Number of events in the file
+	uint64_t dropped;     ///< Number of older events that were overwritten before the file was written
+} rtxoff_trace_file_header_t;
+
+#define RTXOFF_TRACE_MAGIC "RTXTRACE"
+#define RTXOFF_TRACE_VERSION 1
+
+/**
+ * Write the events currently in the trace buffer to a file.
+ * May be called from any thread, and does not stop other threads from recording events while it runs.
+ *
+ * If the RTXOFF_TRACE_FILE environment variable is set, this is also called with that file name when the program exits.
+ *
+ * @param filename File to write (overwritten if it exists)
+ * @return Number of events written, or -1 if the file could not be written.
+ */
+int64_t rtxoff_trace_write(const char * filename);
+
+/**
+ * Discard all events in the trace buffer.  Events that are recorded while this runs may or may not be kept.
+ */
+void rtxoff_trace_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MBED_BENCHTEST_RTXOFF_TRACE_H
@@ -1,9 +1,18 @@
 
 #include "cmsis_os2.h"
 #include "thread_suspender.h"
+#include "rtxoff_os.h"
+#include "RTX_Config.h"
 #include <iostream>
 #include <system_error>
 #include <cstring>
+#include <cstdio>
+#include <climits>
+#include <algorithm>
+#if !USE_WINTHREAD
+#include <unistd.h>
+#include <alloca.h>
+#endif
 
 #if USE_WINTHREAD
 
@@ -15,16 +24,17 @@ void thread_suspender_init()
 	// Do nothing.
 }
 
-os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_data ** data, void (*start_func)(void* arg), void* arg)
+os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_data ** data, void (*start_func)(void* arg), void* arg, size_t stack_size)
 {
 	// Windows implementation doesn't need data
 	data = nullptr;
 
+	// Windows stacks already have a guard page, but aren't painted, so usage can't be measured
 	os_thread_id thread = CreateThread(nullptr,
-									0,
+									stack_size,
 									reinterpret_cast<LPTHREAD_START_ROUTINE>(start_func),
 									reinterpret_cast<void*>(arg),
-									CREATE_SUSPENDED,
+									CREATE_SUSPENDED | (stack_size != 0 ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0),
 									nullptr);
 
 	if(thread == nullptr)
@@ -36,6 +46,11 @@ os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_da
 	return thread;
 }
 
+size_t thread_suspender_stack_used(struct thread_suspender_data * data)
+{
+	return 0;
+}
+
 void thread_suspender_suspend(os_thread_id thread, struct thread_suspender_data * data)
 {
 	if(SuspendThread(thread) < 0)
@@ -69,22 +84,41 @@ __NO_RETURN void thread_suspender_current_thread_exit()
 
 #define SUSPEND_SIGNAL SIGUSR1
 
+// Size of the alternate stack that signal handlers run on in threads with a sized stack
+#define SIGNAL_STACK_SIZE 32768
+
+// Extra host stack given to threads with a sized stack, on top of the signal stack, for the C library's thread
+// data and TLS and the suspender's own frames.  None of it counts as used stack.
+#define STACK_RESERVE 8192
+
+// Size of the inaccessible area below a sized stack.  Bigger than a page, so that one large stack frame can't
+// jump over it.
+#define STACK_GUARD_SIZE 65536
+
+// Space left unpainted below the frame of the function painting the stack, for that function itself.  The thread's
+// function is called from the same place, so it always uses this space, and it counts as used.
+#define STACK_PAINT_MARGIN 256
+
 // pointer to this thread's thread data
 thread_local thread_suspender_data * myData;
 
-void suspendSignalHandler(int signum)
+// True while this thread is inside waitForWakeup().
+// Lets the signal handler know not to try and suspend the thread a second time.
+thread_local volatile bool waitingForWakeup = false;
+
+// Block the current thread until it is supposed to be running, or until someone tells it to terminate.
+// Returns immediately if it is already supposed to be running.
+static void waitForWakeup()
 {
-    if(myData == nullptr)
-    {
-        std::cerr << "RTXOff internal error: no thread data in signal handler" << std::endl;
-        exit(9);
-    }
+    // Note: flag must be set before locking the mutex so that a suspend signal arriving while we hold it
+    // doesn't try to lock it again.  Any suspend request that sent such a signal has already cleared
+    // shouldRun, so we'll still see it once we have the mutex.
+    waitingForWakeup = true;
 
-    // wait until someone tells us to wake up or terminate
     pthread_mutex_lock(&myData->wakeupMutex);
-    myData->isSuspended = true;
-    while(!myData->shouldWakeUp && !myData->shouldTerminate)
-    { 
+    while(!myData->shouldRun && !myData->shouldTerminate)
+    {
+        myData->isSuspended = true;
         pthread_cond_wait(&myData->wakeupCondVar, &myData->wakeupMutex);
     }
     myData->isSuspended = false;
@@ -94,21 +128,73 @@ void suspendSignalHandler(int signum)
         myData->shouldTerminate = false;
         thread_suspender_current_thread_exit();
     }
-    else
+
+    // Clear the flag before unlocking, so that a suspend request made after this point gets handled by the signal handler
+    waitingForWakeup = false;
+    pthread_mutex_unlock(&myData->wakeupMutex);
+}
+
+void suspendSignalHandler(int signum)
+{
+    if(myData == nullptr)
     {
-        myData->shouldWakeUp = false;
-        pthread_mutex_unlock(&myData->wakeupMutex);
+        std::cerr << "RTXOff internal error: no thread data in signal handler" << std::endl;
+        exit(9);
+    }
+
+    if(waitingForWakeup)
+    {
+        // Thread is already suspending itself, nothing to do
         return;
     }
+
+    waitForWakeup();
 }
 
 
+#if RTXOFF_STACK_CHECK
+// Reports a fault in the guard area below a sized stack as a stack overflow.  Runs on the thread's signal stack,
+// since its own stack is full.
+static void stackOverflowHandler(int signum, siginfo_t * info, void * context)
+{
+    char * address = static_cast<char *>(info->si_addr);
+    if(myData != nullptr && myData->stack_size != 0 &&
+        address < myData->stack_low && address >= myData->stack_low - myData->guard_size)
+    {
+        char name[16] = "";
+#ifdef HAVE_PTHREAD_SETNAME_NP
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+#endif
+        char message[160];
+        int length = snprintf(message, sizeof(message), "RTXOFF Critical Error: stack overflow in thread %s (%zu bytes of host stack)\n",
+            name, myData->stack_size);
+        if(length > 0 && write(STDERR_FILENO, message, std::min(static_cast<size_t>(length), sizeof(message) - 1)) < 0)
+        {
+            // nothing more we can do
+        }
+    }
+
+    // Returning retries the faulting instruction, which now crashes the process as usual
+    signal(SIGSEGV, SIG_DFL);
+}
+#endif
+
 void thread_suspender_init()
 {
+    // Threads with a sized stack have a signal stack, so that being suspended doesn't use their own stack
     struct sigaction newSigaction;
     memset(&newSigaction, 0, sizeof(newSigaction));
     newSigaction.sa_handler = &suspendSignalHandler;
+    newSigaction.sa_flags = SA_ONSTACK;
     sigaction(SUSPEND_SIGNAL, &newSigaction, nullptr);
+
+#if RTXOFF_STACK_CHECK
+    struct sigaction overflowSigaction;
+    memset(&overflowSigaction, 0, sizeof(overflowSigaction));
+    overflowSigaction.sa_sigaction = &stackOverflowHandler;
+    overflowSigaction.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigaction(SIGSEGV, &overflowSigaction, nullptr);
+#endif
 }
 
 /**
@@ -119,10 +205,16 @@ static thread_suspender_data * createSuspenderData()
 {
     thread_suspender_data * data = new thread_suspender_data();
 
-    data->shouldWakeUp = false;
+    data->shouldRun = false;
     data->shouldTerminate = false;
     data->hasStarted = false;
     data->isSuspended = false;
+    data->start_func = nullptr;
+    data->argument = nullptr;
+    data->stack_size = 0;
+    data->stack_low = nullptr;
+    data->stack_top = nullptr;
+    data->guard_size = 0;
 
     pthread_mutex_init(&data->wakeupMutex, nullptr);
     pthread_mutex_init(&data->startMutex, nullptr);
@@ -133,20 +225,101 @@ static thread_suspender_data * createSuspenderData()
     return data;
 }
 
-struct SuspenderThreadStartData
+// Threads whose main functions have returned, waiting to be reused.  Most recently parked last.
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_suspender_data * pool[RTXOFF_THREAD_POOL_SIZE > 0 ? RTXOFF_THREAD_POOL_SIZE : 1];
+static size_t poolCount = 0;
+
+// Called by a thread whose main function has returned.  Puts it in the pool, making room by telling the thread
+// that has been parked the longest to exit if needed, since threads with other stack sizes could otherwise fill
+// the pool for good.  Returns false if there is no pool, in which case the thread should exit.
+static bool parkInPool()
 {
-    thread_suspender_data * suspenderData;
-    void (*start_func)(void* arg);
-    void *argument;
-};
+    if(RTXOFF_THREAD_POOL_SIZE == 0)
+    {
+        return false;
+    }
 
-static void * suspenderStartRoutine(SuspenderThreadStartData * startData)
+    // Stay suspended once the thread gets to waitForWakeup(), until it has been given a new function and resumed
+    pthread_mutex_lock(&myData->wakeupMutex);
+    myData->shouldRun = false;
+    pthread_mutex_unlock(&myData->wakeupMutex);
+
+    thread_suspender_data * evicted = nullptr;
+    pthread_mutex_lock(&poolMutex);
+    if(poolCount == RTXOFF_THREAD_POOL_SIZE)
+    {
+        evicted = pool[0];
+        memmove(&pool[0], &pool[1], (poolCount - 1) * sizeof(pool[0]));
+        --poolCount;
+    }
+    pool[poolCount++] = myData;
+    pthread_mutex_unlock(&poolMutex);
+
+    if(evicted != nullptr)
+    {
+        // it's waiting in waitForWakeup() (or about to be), which sees this and exits
+        pthread_mutex_lock(&evicted->wakeupMutex);
+        evicted->shouldTerminate = true;
+        pthread_cond_signal(&evicted->wakeupCondVar);
+        pthread_mutex_unlock(&evicted->wakeupMutex);
+    }
+    return true;
+}
+
+// Find where the calling thread's stack ends and how big the guard area below it is
+static void findStackBounds()
+{
+#ifdef __APPLE__
+    char * top = static_cast<char *>(pthread_get_stackaddr_np(pthread_self()));
+    myData->stack_low = top - pthread_get_stacksize_np(pthread_self());
+    myData->guard_size = STACK_GUARD_SIZE;
+#else
+    pthread_attr_t attr;
+    void * low;
+    size_t size;
+    pthread_getattr_np(pthread_self(), &attr);
+    pthread_attr_getstack(&attr, &low, &size);
+    pthread_attr_getguardsize(&attr, &myData->guard_size);
+    pthread_attr_destroy(&attr);
+    myData->stack_low = static_cast<char *>(low);
+#endif
+}
+
+// Paint the calling thread's stack below this function's frame with the watermark pattern.  This is always called
+// straight from suspenderStartRoutine(), so the frames of the thread's function all end up in the painted part.
+static __attribute__((noinline)) void paintStack()
+{
+    myData->stack_top = static_cast<char *>(__builtin_frame_address(0));
+
+    // volatile so that this stays a plain loop instead of becoming a call to memset, whose frame would be painted over
+    volatile uint32_t * end = reinterpret_cast<volatile uint32_t *>(myData->stack_top - STACK_PAINT_MARGIN);
+    for(volatile uint32_t * word = reinterpret_cast<volatile uint32_t *>(myData->stack_low); word < end; ++word)
+    {
+        *word = osRtxStackFillPattern;
+    }
+}
+
+static void * suspenderStartRoutine(thread_suspender_data * data)
 {
     // assign thread local variable
-    myData = startData->suspenderData;
+    myData = data;
 
-    // save copy of data on our stack
-    SuspenderThreadStartData startDataCopy = *startData;
+    if(myData->stack_size != 0)
+    {
+        // Threads with a sized stack run signal handlers on an alternate stack, so that being suspended doesn't
+        // count as stack usage, and so that an overflow can still be reported.  It is carved out of the top of the
+        // host stack, which has room for it, and lasts until the thread exits since this function never returns.
+        // Threads without a sized stack don't need one.
+        stack_t altStack;
+        memset(&altStack, 0, sizeof(altStack));
+        altStack.ss_sp = alloca(SIGNAL_STACK_SIZE);
+        altStack.ss_size = SIGNAL_STACK_SIZE;
+        sigaltstack(&altStack, nullptr);
+
+        findStackBounds();
+        paintStack();
+    }
 
     // indicate that we have started
     pthread_mutex_lock(&myData->startMutex);
@@ -154,32 +327,84 @@ static void * suspenderStartRoutine(SuspenderThreadStartData * startData)
     pthread_cond_signal(&myData->startCondVar);
     pthread_mutex_unlock(&myData->startMutex);
 
-    // enter suspend handler once
-    suspendSignalHandler(SUSPEND_SIGNAL);
+    do
+    {
+        // wait until the dispatcher starts us
+        waitForWakeup();
 
-    // now execute user thread function
-    startDataCopy.start_func(startDataCopy.argument);
+        pthread_mutex_lock(&myData->wakeupMutex);
+        void (*start_func)(void* arg) = myData->start_func;
+        void * argument = myData->argument;
+        pthread_mutex_unlock(&myData->wakeupMutex);
 
-    // if user function returns, kill thread
+        // now execute user thread function
+        start_func(argument);
+
+        // clear the watermark for the next function
+        if(myData->stack_size != 0)
+        {
+            paintStack();
+        }
+    }
+    while(parkInPool());
+
+    // if user function returns and there's no room in the pool, kill thread
     thread_suspender_current_thread_exit();
 }
 
-os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_data ** data, void (*start_func)(void* arg), void* arg)
+os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_data ** data, void (*start_func)(void* arg), void* arg, size_t stack_size)
 {
+    // reuse the most recently parked thread with the same stack size, if there is one
+    *data = nullptr;
+    pthread_mutex_lock(&poolMutex);
+    for(size_t index = poolCount; index > 0; --index)
+    {
+        if(pool[index - 1]->stack_size == stack_size)
+        {
+            *data = pool[index - 1];
+            memmove(&pool[index - 1], &pool[index], (poolCount - index) * sizeof(pool[0]));
+            --poolCount;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&poolMutex);
+
+    if(*data != nullptr)
+    {
+        // the thread may not have gotten to waitForWakeup() yet, but it reads these after it gets there
+        pthread_mutex_lock(&(*data)->wakeupMutex);
+        (*data)->start_func = start_func;
+        (*data)->argument = arg;
+        pthread_mutex_unlock(&(*data)->wakeupMutex);
+        return (*data)->thread;
+    }
+
     *data = createSuspenderData();
+    (*data)->start_func = start_func;
+    (*data)->argument = arg;
+    (*data)->stack_size = stack_size;
 
-    SuspenderThreadStartData startData;
-    startData.suspenderData = *data;
-    startData.start_func = start_func;
-    startData.argument = arg;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(stack_size != 0)
+    {
+        size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t hostStackSize = stack_size + SIGNAL_STACK_SIZE + STACK_RESERVE;
+        hostStackSize = std::max((hostStackSize + pageSize - 1) / pageSize * pageSize, static_cast<size_t>(PTHREAD_STACK_MIN));
+        pthread_attr_setstacksize(&attr, hostStackSize);
+        pthread_attr_setguardsize(&attr, STACK_GUARD_SIZE);
+    }
 
-    // start thread in OS
+    // start thread in OS.  Nothing ever joins it, so detach it now.
     pthread_t thread;
-    int pthreadRetval = pthread_create(&thread, nullptr, reinterpret_cast<void * (*)(void *)>(&suspenderStartRoutine), &startData);
+    int pthreadRetval = pthread_create(&thread, &attr, reinterpret_cast<void * (*)(void *)>(&suspenderStartRoutine), *data);
+    pthread_attr_destroy(&attr);
     if(pthreadRetval != 0)
     {
         std::cerr << "Error creating thread: " << std::system_category().message(pthreadRetval) << std::endl;
     }
+    pthread_detach(thread);
+    (*data)->thread = thread;
 
     // Wait for thread to start.
     // This is important because we need to confirm that its copy of myData has been initialized before
@@ -196,11 +421,30 @@ os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_da
     return thread;
 }
 
+size_t thread_suspender_stack_used(struct thread_suspender_data * data)
+{
+    if(data == nullptr || data->stack_size == 0)
+    {
+        return 0;
+    }
+
+    // the thread may be running, so read its stack through volatile
+    volatile uint32_t const * end = reinterpret_cast<volatile uint32_t const *>(data->stack_top - STACK_PAINT_MARGIN);
+    volatile uint32_t const * word = reinterpret_cast<volatile uint32_t const *>(data->stack_low);
+    while(word < end && *word == osRtxStackFillPattern)
+    {
+        ++word;
+    }
+    return static_cast<size_t>(data->stack_top - reinterpret_cast<char const *>(const_cast<uint32_t const *>(word)));
+}
+
 void thread_suspender_suspend(os_thread_id thread, struct thread_suspender_data * data)
 {
     // the thread might still be in a signal handler from a previous suspension, so we need to handle this case
     // without erroring.
+    // Also, if the thread was resumed but has not woken up yet, this cancels that so it stays suspended.
     pthread_mutex_lock(&data->wakeupMutex);
+    data->shouldRun = false;
     if(!data->isSuspended)
     {
         pthread_kill(thread, SUSPEND_SIGNAL);
@@ -211,11 +455,23 @@ void thread_suspender_suspend(os_thread_id thread, struct thread_suspender_data
 void thread_suspender_resume(os_thread_id thread, struct thread_suspender_data * data)
 {
     pthread_mutex_lock(&data->wakeupMutex);
-    data->shouldWakeUp = true;
+    data->shouldRun = true;
     pthread_cond_signal(&data->wakeupCondVar);
     pthread_mutex_unlock(&data->wakeupMutex);
 }
 
+void thread_suspender_prepare_park()
+{
+    pthread_mutex_lock(&myData->wakeupMutex);
+    myData->shouldRun = false;
+    pthread_mutex_unlock(&myData->wakeupMutex);
+}
+
+void thread_suspender_park_current_thread()
+{
+    waitForWakeup();
+}
+
 void thread_suspender_kill(os_thread_id thread, struct thread_suspender_data * data)
 {
     pthread_mutex_lock(&data->wakeupMutex);
@@ -19,6 +19,7 @@
 #  include <signal.h>
 #endif
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,8 +56,9 @@ struct thread_suspender_data {
     // mutex for above cond var and hasStarted
     pthread_mutex_t startMutex;
 
-    // whether the thread should wake up now
-    bool shouldWakeUp;
+    // Whether the thread should currently be running, i.e. whether it was last resumed or suspended.
+    // Protected by wakeupMutex.
+    bool shouldRun;
 
     // whether the thread should terminate now
     bool shouldTerminate;
@@ -67,6 +69,25 @@ struct thread_suspender_data {
     // True iff the thread is currently in the signal handler waiting for wakeup.
     // Protected by wakeupMutex.
     bool isSuspended;
+
+    // Function to run, and its argument, the next time the thread is resumed.  These change when a pooled
+    // thread is reused.  Protected by wakeupMutex.
+    void (*start_func)(void* arg);
+    void *argument;
+
+    // The thread itself, so that it can be handed out again from the pool
+    pthread_t thread;
+
+    // Stack size that the thread was created with, not counting the suspender's own overhead, or 0 if it
+    // runs on a default sized stack.  Pooled threads are only reused for the same stack size.
+    size_t stack_size;
+
+    // For threads with a stack size: the part of the stack below the suspender's own frames, which usage is
+    // measured over and which (apart from STACK_PAINT_MARGIN bytes at the top) is painted with the watermark
+    // pattern each time the thread is handed a new function, and the size of the guard area below it.
+    char * stack_low;
+    char * stack_top;
+    size_t guard_size;
 };
 #endif
 
@@ -77,12 +98,22 @@ void thread_suspender_init();
 
 /**
  * Create a new thread in the suspended state.
- * On POSIX this requires a context switch since we need to wait for the thread to start.
+ * On POSIX, this reuses a pooled thread if there is one (see RTXOFF_THREAD_POOL_SIZE).  Otherwise it requires
+ * a context switch since we need to wait for the thread to start.
  * @param data Pointer which will be filled in with this thread's data struct.
  * @param start_func Function pointer to the function to call when the thread exits.
  * @param on_exit_func If not null, function to call when thread returns from its main function.
+ * @param stack_size Bytes of host stack that start_func may use, or 0 to use the default stack size.
+ *  On POSIX, a sized stack has a guard area below it and is painted with the watermark pattern so that
+ *  thread_suspender_stack_used() can measure it.
+ */
+os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_data ** data, void (*start_func)(void* arg), void* arg, size_t stack_size);
+
+/**
+ * Get the most host stack that the thread's current function has used, in bytes, from the watermark left in
+ * its stack.  Returns 0 if the thread doesn't have a sized stack or the platform can't measure it.
  */
-os_thread_id thread_suspender_create_suspended_thread(struct thread_suspender_data ** data, void (*start_func)(void* arg), void* arg);
+size_t thread_suspender_stack_used(struct thread_suspender_data * data);
 
 /**
  * Suspend the given thread.  Next time the OS transfers control back to this thread, it will be blocked
@@ -99,6 +130,23 @@ void thread_suspender_suspend(os_thread_id thread, struct thread_suspender_data
  */
 void thread_suspender_resume(os_thread_id thread, struct thread_suspender_data * data);
 
+#if !USE_WINTHREAD
+/**
+ * Mark the calling thread as suspended, without actually stopping it yet.  It will stop once it calls
+ * thread_suspender_park_current_thread().
+ * This must be done before any other thread is able to resume this one, otherwise the resume could be lost.
+ */
+void thread_suspender_prepare_park();
+
+/**
+ * Suspend the calling thread until thread_suspender_resume() is called on it.
+ * This is much cheaper than thread_suspender_suspend() since no signal needs to be delivered, so it
+ * is used when a thread switches away from itself.
+ * If thread_suspender_resume() was already called since thread_suspender_prepare_park(), returns immediately.
+ */
+void thread_suspender_park_current_thread();
+#endif
+
 /**
  * Terminate the given thread.  It will terminate at some point in the future and never
  * execute any more instructions.
@@ -112,7 +160,8 @@ void thread_suspender_kill(os_thread_id thread, struct thread_suspender_data * d
  *
  * Automatically called by a thread when:
  *  - it is killed with thread_suspender_kill()
- *  - it returns from its main function
+ *  - it returns from its main function, unless it is kept in the thread pool.  A pooled thread waits
+ *    suspended until thread_suspender_create_suspended_thread() hands it a new function to run.
  */
 __NO_RETURN void thread_suspender_current_thread_exit();
 
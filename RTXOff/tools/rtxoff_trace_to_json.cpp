@@ -0,0 +1,359 @@
+//
+// Converts an RTXOff scheduler trace file (see rtxoff_trace.h) into Chrome trace event JSON,
+// which can be opened in chrome://tracing or https://ui.perfetto.dev.
+//
+// Usage: rtxoff_trace_to_json <trace file> [<output json file>]
+//
+// Each kernel (board) becomes a process, and each RTX thread becomes a thread with "running" slices
+// for the time it held the processor.  Interrupt handlers are drawn on a separate "Interrupts" track,
+// and the other events (preemptions, waits, timer expiries and mutex contention) are shown as instant events.
+//
+
+#include "rtxoff_trace.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <vector>
+
+namespace
+{
+	// Track that interrupt handlers are drawn on
+	const uint32_t interruptTid = 0;
+
+	struct KernelState
+	{
+		uint32_t pid;
+
+		// next tid to give out to a thread on this kernel
+		uint32_t nextTid = interruptTid + 1;
+
+		// tids of the threads on this kernel, by address
+		std::map<uint64_t, uint32_t> tids;
+
+		// thread that is currently running, and when it started
+		uint32_t runningTid = 0;
+		uint64_t runningSince = 0;
+
+		// start times of the ISRs currently running, with the innermost (nested) one last
+		std::vector<uint64_t> isrStarts;
+	};
+
+	class JsonWriter
+	{
+		FILE * out;
+		bool firstEvent = true;
+
+	public:
+		explicit JsonWriter(FILE * out):
+		out(out)
+		{
+			fputs("{\"traceEvents\":[\n", out);
+		}
+
+		~JsonWriter()
+		{
+			fputs("\n]}\n", out);
+		}
+
+		// Start a new event object and write the fields every event has
+		void begin(char phase, const std::string & name, uint32_t pid, uint32_t tid, uint64_t timestamp)
+		{
+			if(!firstEvent)
+			{
+				fputs(",\n", out);
+			}
+			firstEvent = false;
+
+			fprintf(out, "{\"ph\":\"%c\",\"name\":", phase);
+			string(name);
+			fprintf(out, ",\"pid\":%" PRIu32 ",\"tid\":%" PRIu32 ",\"ts\":%" PRIu64, pid, tid, timestamp);
+		}
+
+		void end()
+		{
+			fputc('}', out);
+		}
+
+		void string(const std::string & value)
+		{
+			fputc('"', out);
+			for(char character : value)
+			{
+				if(character == '"' || character == '\\')
+				{
+					fputc('\\', out);
+					fputc(character, out);
+				}
+				else if(static_cast<unsigned char>(character) < 0x20)
+				{
+					fprintf(out, "\\u%04x", character);
+				}
+				else
+				{
+					fputc(character, out);
+				}
+			}
+			fputc('"', out);
+		}
+
+		FILE * file()
+		{
+			return out;
+		}
+
+		// Write a complete ("X") event
+		void slice(const std::string & name, uint32_t pid, uint32_t tid, uint64_t start, uint64_t end)
+		{
+			begin('X', name, pid, tid, start);
+			fprintf(out, ",\"dur\":%" PRIu64, end - start);
+			this->end();
+		}
+
+		// Write metadata naming a process or thread
+		void metadata(const char * type, uint32_t pid, uint32_t tid, const std::string & name)
+		{
+			begin('M', type, pid, tid, 0);
+			fputs(",\"args\":{\"name\":", out);
+			string(name);
+			fputc('}', out);
+			end();
+		}
+	};
+
+	std::string hex(uint64_t value)
+	{
+		char buffer[19];
+		snprintf(buffer, sizeof(buffer), "0x%" PRIx64, value);
+		return buffer;
+	}
+
+	// Name of an osRtxThreadWaiting* state from rtxoff_os.h
+	const char * waitStateName(uint64_t state)
+	{
+		switch(state >> 4U)
+		{
+			case 1: return "delay";
+			case 2: return "join";
+			case 3: return "thread flags";
+			case 4: return "event flags";
+			case 5: return "mutex";
+			case 6: return "semaphore";
+			case 7: return "memory pool";
+			case 8: return "message get";
+			case 9: return "message put";
+			default: return "unknown";
+		}
+	}
+
+	class Converter
+	{
+		JsonWriter & json;
+		std::map<uint64_t, KernelState> kernels;
+
+		KernelState & kernelFor(uint64_t kernelAddress)
+		{
+			auto kernelIter = kernels.find(kernelAddress);
+			if(kernelIter == kernels.end())
+			{
+				KernelState & kernel = kernels[kernelAddress];
+				kernel.pid = static_cast<uint32_t>(kernels.size());
+				json.metadata("process_name", kernel.pid, 0, "RTXOff kernel " + std::to_string(kernel.pid));
+				json.metadata("thread_name", kernel.pid, interruptTid, "Interrupts");
+				return kernel;
+			}
+			return kernelIter->second;
+		}
+
+		// Give a thread a new tid, e.g. because it was just created
+		uint32_t newThread(KernelState & kernel, uint64_t thread, const std::string & name)
+		{
+			uint32_t tid = kernel.nextTid++;
+			kernel.tids[thread] = tid;
+			json.metadata("thread_name", kernel.pid, tid, name);
+			return tid;
+		}
+
+		uint32_t tidFor(KernelState & kernel, uint64_t thread)
+		{
+			auto tidIter = kernel.tids.find(thread);
+			if(tidIter == kernel.tids.end())
+			{
+				// thread was created before the trace started
+				return newThread(kernel, thread, "thread " + hex(thread));
+			}
+			return tidIter->second;
+		}
+
+		void instant(const std::string & name, KernelState & kernel, uint32_t tid, uint64_t timestamp, const std::string & argName = "", const std::string & argValue = "")
+		{
+			json.begin('i', name, kernel.pid, tid, timestamp);
+			fputs(",\"s\":\"t\"", json.file());
+			if(!argName.empty())
+			{
+				fputs(",\"args\":{", json.file());
+				json.string(argName);
+				fputc(':', json.file());
+				json.string(argValue);
+				fputc('}', json.file());
+			}
+			json.end();
+		}
+
+	public:
+		explicit Converter(JsonWriter & json):
+		json(json)
+		{
+		}
+
+		void convert(const rtxoff_trace_event_t & event)
+		{
+			KernelState & kernel = kernelFor(event.kernel);
+
+			switch(event.type)
+			{
+				case RTXOFF_TRACE_THREAD_CREATE:
+				{
+					char name[sizeof(event.data.name) + 1] = {};
+					memcpy(name, event.data.name, sizeof(event.data.name));
+					instant("create", kernel, newThread(kernel, event.thread, name), event.timestamp);
+					break;
+				}
+				case RTXOFF_TRACE_THREAD_EXIT:
+					instant("exit", kernel, tidFor(kernel, event.thread), event.timestamp);
+					break;
+				case RTXOFF_TRACE_THREAD_SWITCH:
+					if(kernel.runningTid != 0)
+					{
+						json.slice("running", kernel.pid, kernel.runningTid, kernel.runningSince, event.timestamp);
+					}
+					kernel.runningTid = tidFor(kernel, event.thread);
+					kernel.runningSince = event.timestamp;
+					break;
+				case RTXOFF_TRACE_PREEMPT:
+					instant("preempted", kernel, tidFor(kernel, event.thread), event.timestamp,
+						"by", "tid " + std::to_string(tidFor(kernel, event.data.args[0])));
+					break;
+				case RTXOFF_TRACE_WAIT_ENTER:
+					instant(std::string("wait ") + waitStateName(event.data.args[0]), kernel, tidFor(kernel, event.thread), event.timestamp,
+						"timeout", event.data.args[1] == UINT32_MAX ? "forever" : std::to_string(event.data.args[1]) + " ticks");
+					break;
+				case RTXOFF_TRACE_WAIT_EXIT:
+					instant("wake", kernel, tidFor(kernel, event.thread), event.timestamp,
+						"result", std::to_string(static_cast<int32_t>(event.data.args[0])));
+					break;
+				case RTXOFF_TRACE_ISR_ENTER:
+					kernel.isrStarts.push_back(event.timestamp);
+					break;
+				case RTXOFF_TRACE_ISR_EXIT:
+					if(!kernel.isrStarts.empty())
+					{
+						json.slice("IRQ " + std::to_string(static_cast<int32_t>(event.data.args[0])), kernel.pid, interruptTid, kernel.isrStarts.back(), event.timestamp);
+						kernel.isrStarts.pop_back();
+					}
+					break;
+				case RTXOFF_TRACE_TIMER_EXPIRE:
+					instant("timer expired", kernel, interruptTid, event.timestamp, "timer", hex(event.data.args[0]));
+					break;
+				case RTXOFF_TRACE_MUTEX_CONTENDED:
+					instant("mutex contended", kernel, tidFor(kernel, event.thread), event.timestamp,
+						"owner", "tid " + std::to_string(tidFor(kernel, event.data.args[1])));
+					break;
+				default:
+					break;
+			}
+		}
+
+		// Close the slices of threads that were still running when the trace ended
+		void finish(uint64_t endTime)
+		{
+			for(auto & kernelPair : kernels)
+			{
+				KernelState & kernel = kernelPair.second;
+				if(kernel.runningTid != 0)
+				{
+					json.slice("running", kernel.pid, kernel.runningTid, kernel.runningSince, endTime);
+				}
+			}
+		}
+	};
+}
+
+int main(int argc, char ** argv)
+{
+	if(argc != 2 && argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <trace file> [<output json file>]\n", argv[0]);
+		return 1;
+	}
+
+	FILE * in = fopen(argv[1], "rb");
+	if(in == nullptr)
+	{
+		fprintf(stderr, "Could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	rtxoff_trace_file_header_t header;
+	if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, RTXOFF_TRACE_MAGIC, sizeof(header.magic)) != 0)
+	{
+		fprintf(stderr, "%s is not an RTXOff trace file\n", argv[1]);
+		return 1;
+	}
+	if(header.version != RTXOFF_TRACE_VERSION || header.event_size != sizeof(rtxoff_trace_event_t))
+	{
+		fprintf(stderr, "%s has an unsupported trace file version (%" PRIu32 ")\n", argv[1], header.version);
+		return 1;
+	}
+
+	std::vector<rtxoff_trace_event_t> events(header.event_count);
+	if(!events.empty() && fread(events.data(), sizeof(rtxoff_trace_event_t), events.size(), in) != events.size())
+	{
+		fprintf(stderr, "%s is truncated\n", argv[1]);
+		return 1;
+	}
+	fclose(in);
+
+	if(header.dropped > 0)
+	{
+		fprintf(stderr, "Note: %" PRIu64 " older events were overwritten before the trace was written\n", header.dropped);
+	}
+
+	// Events from different kernels can be recorded slightly out of order
+	std::stable_sort(events.begin(), events.end(), [](const rtxoff_trace_event_t & a, const rtxoff_trace_event_t & b)
+	{
+		return a.timestamp < b.timestamp;
+	});
+
+	FILE * out = stdout;
+	if(argc == 3)
+	{
+		out = fopen(argv[2], "w");
+		if(out == nullptr)
+		{
+			fprintf(stderr, "Could not open %s for writing\n", argv[2]);
+			return 1;
+		}
+	}
+
+	{
+		JsonWriter json(out);
+		Converter converter(json);
+		for(const rtxoff_trace_event_t & event : events)
+		{
+			converter.convert(event);
+		}
+		converter.finish(events.empty() ? 0 : events.back().timestamp);
+	}
+
+	if(out != stdout)
+	{
+		fclose(out);
+	}
+	return 0;
+}
@@ -114,6 +114,24 @@ public:
         dispatch();
     }
 
+    /** Dispatch events with a budget
+     *
+     *  Executes the events that are already due, without waiting for more,
+     *  and returns after max_events events or ms milliseconds, whichever
+     *  comes first. This lets a cooperative main loop bound how long the
+     *  event queue holds it up.
+     *
+     *  @param max_events   Maximum number of events to execute, 0 for no
+     *                      limit
+     *  @param ms           Time budget in milliseconds, a negative value
+     *                      for no limit (default to -1)
+     *
+     *  @return             Milliseconds until the next event is due,
+     *                      0 if events are still due, or -1 if the queue
+     *                      is empty
+     */
+    int dispatch_slice(unsigned max_events, int ms = -1);
+
     /** Break out of a running event loop
      *
      *  Forces the specified event queue's dispatch loop to terminate. Pending
@@ -226,6 +244,39 @@ public:
         return equeue_timeleft_user_allocated(&_equeue, &event->_e);
     }
 
+    /** Query the memory usage of the event queue's buffer
+     *
+     *  Reports how much of the buffer is in allocated events, how much has
+     *  never been allocated, and how much is held in freed events waiting to
+     *  be reused. See equeue_get_mem_stats for details.
+     *
+     *  This function is IRQ safe.
+     *
+     *  @param stats    Structure to fill in
+     */
+    void mem_stats(struct equeue_mem_stats *stats);
+
+    /** Query the dispatch statistics of the event queue
+     *
+     *  Reports histograms of how late events were dispatched and how long
+     *  their callbacks ran, the high-water marks of the queue's memory
+     *  usage, and how many allocations have failed, which help with sizing
+     *  the queue and finding slow handlers. Only recorded if the library is
+     *  built with EQUEUE_STATS set to 1, otherwise the structure is filled
+     *  with zeros. See equeue_get_stats for details.
+     *
+     *  This function is IRQ safe.
+     *
+     *  @param stats    Structure to fill in
+     */
+    void stats(struct equeue_stats *stats);
+
+    /** Reset the dispatch statistics of the event queue
+     *
+     *  This function is IRQ safe.
+     */
+    void reset_stats();
+
     /** Background an event queue onto a single-shot timer-interrupt
      *
      *  When updated, the event queue will call the provided update function
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2016-2019 ARM Limited
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EVENT_QUEUE_POOL_H
+#define EVENT_QUEUE_POOL_H
+
+#include "events/EventQueue.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Thread.h"
+
+#include <atomic>
+
+namespace events {
+/**
+ * \addtogroup events-public-api
+ * @{
+ */
+
+/**
+ * \defgroup events_EventQueuePool EventQueuePool class
+ * @{
+ */
+
+/** EventQueuePool
+ *
+ *  Event queue dispatched by several threads at once
+ *
+ *  The pool has a number of workers, each with its own event queue and
+ *  dispatch thread. Events posted with call, call_in and call_every are
+ *  handed to the workers in turn. A worker with nothing left to do takes
+ *  events that are already due from the other workers' queues, so one
+ *  slow event does not hold up the events queued behind it while another
+ *  worker is idle.
+ *
+ *  Events posted with call_keyed, call_in_keyed and call_every_keyed are
+ *  never taken by another worker. All events with the same key go to the
+ *  same worker and run one at a time, in the order they are due.
+ *
+ *  Events posted to the pool can run concurrently with each other, so
+ *  unlike events on an EventQueue they must protect any state they share.
+ *
+ *  @note Each worker's queue has its own buffer of the given size, so
+ *  events posted to a full worker fail even if other workers have room.
+ */
+class EventQueuePool : private mbed::NonCopyable<EventQueuePool> {
+public:
+    using duration = EventQueue::duration;
+
+    /** Create an EventQueuePool and start its worker threads
+     *
+     *  @param workers      Number of worker threads, from 1 to 32
+     *  @param size         Size of each worker's event buffers in bytes
+     *                      (default to EVENTS_QUEUE_SIZE)
+     *  @param priority     Priority of the worker threads
+     *                      (default to osPriorityNormal)
+     *  @param stack_size   Stack size of each worker thread in bytes
+     *                      (default to OS_STACK_SIZE)
+     *  @param name         Name of the worker threads, which has to stay
+     *                      allocated for the lifetime of the pool
+     *                      (default to nullptr)
+     */
+    EventQueuePool(unsigned workers, unsigned size = EVENTS_QUEUE_SIZE,
+                   osPriority priority = osPriorityNormal,
+                   uint32_t stack_size = OS_STACK_SIZE, const char *name = nullptr);
+
+    /** Stop the worker threads and destroy the pool
+     *
+     *  Events that have not started are discarded. Waits for running
+     *  events to finish.
+     */
+    ~EventQueuePool();
+
+    /** Calls an event on the pool
+     *
+     *  Takes the same arguments as EventQueue::call.
+     *
+     *  The call function is IRQ safe.
+     *
+     *  @return         A unique ID that represents the posted event and can
+     *                  be passed to cancel, or an ID of 0 if there is not
+     *                  enough memory to allocate the event.
+     *  @see EventQueue::call
+     */
+    template <typename... ArgTs>
+    int call(ArgTs... args)
+    {
+        unsigned worker = next_worker();
+        return posted(worker, false, duration(0), _workers[worker]->queue.call(args...));
+    }
+
+    /** Calls an event on the pool after a specified delay
+     *
+     *  Takes the same arguments as EventQueue::call_in.
+     *
+     *  The call_in function is IRQ safe.
+     *
+     *  @see EventQueuePool::call
+     *  @see EventQueue::call_in
+     */
+    template <typename... ArgTs>
+    int call_in(duration ms, ArgTs... args)
+    {
+        unsigned worker = next_worker();
+        return posted(worker, false, ms, _workers[worker]->queue.call_in(ms, args...));
+    }
+
+    /** Calls an event on the pool periodically
+     *
+     *  Takes the same arguments as EventQueue::call_every.
+     *
+     *  The call_every function is IRQ safe.
+     *
+     *  @see EventQueuePool::call
+     *  @see EventQueue::call_every
+     */
+    template <typename... ArgTs>
+    int call_every(duration ms, ArgTs... args)
+    {
+        unsigned worker = next_worker();
+        return posted(worker, false, ms, _workers[worker]->queue.call_every(ms, args...));
+    }
+
+    /** Calls an event on the pool, serialized with other events with the same key
+     *
+     *  The call_keyed function is IRQ safe.
+     *
+     *  @param key      Ordering key. Events with the same key never run
+     *                  concurrently and run in the order they are due.
+     *  @see EventQueuePool::call
+     */
+    template <typename... ArgTs>
+    int call_keyed(unsigned key, ArgTs... args)
+    {
+        unsigned worker = key % _worker_count;
+        return posted(worker, true, duration(0), _workers[worker]->serial.call(args...));
+    }
+
+    /** Calls an event on the pool after a specified delay, serialized with
+     *  other events with the same key
+     *
+     *  The call_in_keyed function is IRQ safe.
+     *
+     *  @see EventQueuePool::call_keyed
+     *  @see EventQueue::call_in
+     */
+    template <typename... ArgTs>
+    int call_in_keyed(unsigned key, duration ms, ArgTs... args)
+    {
+        unsigned worker = key % _worker_count;
+        return posted(worker, true, ms, _workers[worker]->serial.call_in(ms, args...));
+    }
+
+    /** Calls an event on the pool periodically, serialized with other
+     *  events with the same key
+     *
+     *  The call_every_keyed function is IRQ safe.
+     *
+     *  @see EventQueuePool::call_keyed
+     *  @see EventQueue::call_every
+     */
+    template <typename... ArgTs>
+    int call_every_keyed(unsigned key, duration ms, ArgTs... args)
+    {
+        unsigned worker = key % _worker_count;
+        return posted(worker, true, ms, _workers[worker]->serial.call_every(ms, args...));
+    }
+
+    /** Cancel an in-flight event
+     *
+     *  Behaves like EventQueue::cancel. An event that has been taken by
+     *  another worker can no longer be cancelled once it has started.
+     *
+     *  The cancel function is IRQ safe.
+     *
+     *  @param id       Unique id of the event
+     *  @return         true if event was successfully cancelled
+     *                  false if event was not cancelled (invalid id or
+     *                  executing already begun)
+     */
+    bool cancel(int id);
+
+    /** Query how much time is left for delayed event
+     *
+     *  The time_left function is IRQ safe.
+     *
+     *  @param id       Unique id of the event
+     *  @return         Remaining time in milliseconds, 0 if the event is
+     *                  already due or executing, or -1 if the id is invalid
+     *  @see EventQueue::time_left
+     */
+    int time_left(int id);
+
+    /** Number of worker threads in the pool
+     */
+    unsigned workers() const
+    {
+        return _worker_count;
+    }
+
+private:
+    struct Worker {
+        Worker(EventQueuePool *pool, unsigned index, unsigned size,
+               osPriority priority, uint32_t stack_size, const char *name);
+
+        void run();
+
+        // Record when queue next has an event due, from a dispatch_slice result
+        void set_due(int ms);
+
+        EventQueuePool *pool;
+        unsigned index;
+
+        // Events that any worker may run
+        EventQueue queue;
+
+        // Keyed events, only run by this worker
+        EventQueue serial;
+
+        rtos::Thread thread;
+
+        // Tick when queue next has an event due.  Only a hint for other
+        // workers looking for events to take, it may be out of date.
+        std::atomic<uint32_t> due;
+    };
+
+    Worker **_workers;
+    unsigned _worker_count;
+    std::atomic<uint32_t> _next_worker;
+    std::atomic<uint32_t> _idle_workers;
+    std::atomic<bool> _stopping;
+
+    unsigned next_worker();
+
+    // Wake the workers that should see a newly posted event, and turn the
+    // worker queue's event id into a pool id
+    int posted(unsigned worker, bool keyed, duration ms, int id);
+
+    // Run one due event from another worker's queue.  Returns 0 if more
+    // events may be due, or -1 if no events were found.
+    int steal(unsigned thief);
+};
+
+/** @}*/
+
+/** @}*/
+
+}
+
+#endif
@@ -38,6 +38,63 @@ extern "C" {
 // This size is guaranteed to fit events created by event_call
 #define EQUEUE_EVENT_SIZE (sizeof(struct equeue_event) + 2*sizeof(void*))
 
+// The number of size classes that freed events are sorted into
+// Events are binned by their size in pointer-sized words above the event
+// header. Each class except the last holds events of exactly one size, so
+// events of up to (EQUEUE_SIZE_CLASSES-2)*sizeof(void*) bytes of data are
+// reused in constant time. Larger events share the last class. Must be no
+// more than 32.
+#ifndef EQUEUE_SIZE_CLASSES
+#define EQUEUE_SIZE_CLASSES 32
+#endif
+
+// The structure that orders pending events
+// By default pending events are kept in a list sorted by target tick, so
+// posting an event costs O(n) in the number of distinct pending targets.
+// Setting EQUEUE_PAIRING_HEAP to 1 keeps them in a pairing heap instead,
+// which posts in O(1) and dispatches or cancels in amortized O(log n), at the
+// cost of two more words per event. Events with the same target are still
+// dispatched in the order they were posted.
+#ifndef EQUEUE_PAIRING_HEAP
+#define EQUEUE_PAIRING_HEAP 0
+#endif
+
+// Post immediate events without the queue mutex
+// Setting EQUEUE_LOCKFREE_POST to 1 makes equeue_post push events with no
+// delay (such as those from equeue_call and EventQueue::call) onto a
+// lock-free stack instead of taking the queue mutex, and equeue_dispatch
+// moves them into the queue in one batch. Delayed events, and all events on
+// queues with a background timer or chained to another queue, still take the
+// mutex. Allocating the event still takes the memory mutex. Requires the
+// platform atomic operations in equeue_platform.h.
+#ifndef EQUEUE_LOCKFREE_POST
+#define EQUEUE_LOCKFREE_POST 0
+#endif
+
+// The number of events dispatched per lock acquisition by
+// equeue_dispatch_slice when it has a time budget, which is checked after
+// each batch
+#ifndef EQUEUE_DISPATCH_BATCH
+#define EQUEUE_DISPATCH_BATCH 16
+#endif
+
+// Record dispatch statistics
+// Setting EQUEUE_STATS to 1 makes each queue keep histograms of how late
+// events are dispatched and how long their callbacks run, high-water marks
+// of its memory usage, and a count of failed allocations, which can be read
+// with equeue_get_stats. Timing uses equeue_tick, so it has a resolution of
+// one millisecond. Costs two extra reads of the tick per event dispatched.
+#ifndef EQUEUE_STATS
+#define EQUEUE_STATS 0
+#endif
+
+// The number of buckets in the equeue_stats histograms
+// Bucket 0 counts times of 0 ms, bucket i times from 2^(i-1) up to
+// 2^i - 1 ms, and the last bucket everything longer.
+#ifndef EQUEUE_STATS_BUCKETS
+#define EQUEUE_STATS_BUCKETS 12
+#endif
+
 // Internal event structure
 struct equeue_event {
     unsigned size;
@@ -53,21 +110,56 @@ struct equeue_event {
     void (*dtor)(void *);
 
     void (*cb)(void *);
+
+#if EQUEUE_PAIRING_HEAP
+    struct equeue_event *child;
+    unsigned order;
+#endif
     // data follows
 };
 
+// Memory usage of an event queue, see equeue_get_mem_stats
+struct equeue_mem_stats {
+    size_t used_size;       // bytes in events that are allocated
+    size_t slab_size;       // bytes that have never been allocated
+    size_t chunk_size;      // bytes in freed events waiting to be reused
+    size_t chunk_count;     // number of freed events waiting to be reused
+    size_t max_chunk_size;  // size of the largest freed event
+    unsigned fragmentation; // percentage of free bytes held in freed events
+};
+
+// Dispatch statistics of an event queue, see equeue_get_stats
+struct equeue_stats {
+    unsigned dispatched;                        // number of events dispatched
+    unsigned lateness[EQUEUE_STATS_BUCKETS];    // ms from target to dispatch
+    unsigned runtime[EQUEUE_STATS_BUCKETS];     // ms spent in callbacks
+    unsigned max_lateness;                      // latest dispatch in ms
+    unsigned max_runtime;                       // longest callback in ms
+    size_t max_used_size;   // most bytes in allocated events at once
+    size_t max_chunk_count; // most freed events waiting to be reused at once
+    unsigned alloc_failures;                    // failed equeue_alloc calls
+};
+
 // Event queue structure
 typedef struct equeue {
     struct equeue_event *queue;
+#if EQUEUE_LOCKFREE_POST
+    struct equeue_event *incoming;
+#endif
     unsigned tick;
     bool break_requested;
+    unsigned dispatchers;
     uint8_t generation;
+#if EQUEUE_PAIRING_HEAP
+    unsigned order;
+#endif
 
     unsigned char *buffer;
     unsigned npw2;
     void *allocated;
 
-    struct equeue_event *chunks;
+    struct equeue_event *chunks[EQUEUE_SIZE_CLASSES];
+    uint32_t chunk_map;
     struct equeue_slab {
         size_t size;
         unsigned char *data;
@@ -79,6 +171,12 @@ typedef struct equeue {
         void *timer;
     } background;
 
+#if EQUEUE_STATS
+    struct equeue_stats stats;
+    size_t used_size;
+    size_t chunk_count;
+#endif
+
     equeue_sema_t eventsema;
     equeue_mutex_t queuelock;
     equeue_mutex_t memlock;
@@ -111,6 +209,27 @@ void equeue_destroy(equeue_t *queue);
 // equeue_dispatch does not wait and is irq safe.
 void equeue_dispatch(equeue_t *queue, int ms);
 
+// Dispatch events with a budget
+//
+// Dispatches the events that are due without waiting for more, and returns
+// once there are none left, once max_events events have been dispatched, or
+// once ms milliseconds have passed since the call, whichever comes first.
+// A max_events of 0 or a negative ms means no limit. This lets cooperative
+// loops interleave their own work with the event queue and still bound how
+// long the queue holds them up. The time budget is checked after every
+// EQUEUE_DISPATCH_BATCH events, so an event that runs long can overshoot it.
+//
+// Several threads can dispatch slices of the same queue at once (as
+// EventQueuePool does when an idle worker steals from a busy one). Each event
+// is still dispatched by only one of them, but events of the queue can then
+// run concurrently. The background timer is only updated, and a break
+// request only cleared, once the last of them returns.
+//
+// Returns the number of milliseconds until the next event is due, 0 if
+// events are still due because the budget ran out, or -1 if the queue is
+// empty.
+int equeue_dispatch_slice(equeue_t *queue, unsigned max_events, int ms);
+
 // Break out of a running event loop
 //
 // Forces the specified event queue's dispatch loop to terminate. Pending
@@ -146,9 +265,11 @@ int equeue_call_every(equeue_t *queue, int ms, void (*cb)(void *), void *data);
 // Both equeue_alloc and equeue_dealloc are irq safe.
 //
 // The equeue allocator is designed to minimize jitter in interrupt contexts as
-// well as avoid memory fragmentation on small devices. The allocator achieves
-// both constant-runtime and zero-fragmentation for fixed-size events, however
-// grows linearly as the quantity of different sized allocations increases.
+// well as avoid memory fragmentation on small devices. Freed events are kept
+// in per-size free lists (see EQUEUE_SIZE_CLASSES), so the allocator achieves
+// both constant-runtime and zero-fragmentation for events of any common size,
+// regardless of which other sizes have been allocated before. Only events
+// larger than the biggest size class are found with a search.
 //
 // The equeue_alloc function returns a pointer to the event's allocated memory
 // and acts as a handle to the underlying event. If there is not enough memory
@@ -156,6 +277,32 @@ int equeue_call_every(equeue_t *queue, int ms, void (*cb)(void *), void *data);
 void *equeue_alloc(equeue_t *queue, size_t size);
 void equeue_dealloc(equeue_t *queue, void *event);
 
+// Query the memory usage of an event queue
+//
+// Fills in the equeue_mem_stats structure with how much of the queue's buffer
+// is in allocated events, how much has never been allocated (the slab), and
+// how much is held in freed events waiting to be reused. Memory in freed events
+// can only be reused for events of the same or a smaller size, so the
+// fragmentation field gives the percentage of the free memory that is held
+// in freed events rather than in the slab.
+//
+// The equeue_get_mem_stats function is irq safe.
+void equeue_get_mem_stats(equeue_t *queue, struct equeue_mem_stats *stats);
+
+// Query the dispatch statistics of an event queue
+//
+// Fills in the equeue_stats structure with what the queue has recorded since
+// it was created or equeue_reset_stats was last called. Lateness is the time
+// from when an event was due to when its callback started. If EQUEUE_STATS is
+// 0, nothing is recorded and the structure is filled with zeros.
+//
+// equeue_reset_stats clears the histograms and counters, and restarts the
+// high-water marks from the queue's current memory usage.
+//
+// The equeue_get_stats and equeue_reset_stats functions are irq safe.
+void equeue_get_stats(equeue_t *queue, struct equeue_stats *stats);
+void equeue_reset_stats(equeue_t *queue);
+
 // Configure an allocated event
 //
 // equeue_event_delay  - Millisecond delay before dispatching an event
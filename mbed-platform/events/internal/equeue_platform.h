@@ -147,6 +147,29 @@ void equeue_sema_destroy(equeue_sema_t *sema);
 void equeue_sema_signal(equeue_sema_t *sema);
 bool equeue_sema_wait(equeue_sema_t *sema, int ms);
 
+// Platform atomic operations
+//
+// The lock-free posting path (EQUEUE_LOCKFREE_POST) pushes events onto a
+// stack with these operations instead of taking the equeue mutex. They must
+// be safe against interrupts and other threads, and must be sequentially
+// consistent. EQUEUE_HAS_ATOMICS is defined to 1 if they are available.
+//
+// equeue_atomic_load_ptr     - Load a pointer
+// equeue_atomic_cas_ptr      - Replace *ptr with desired if it is *expected,
+//                              otherwise load *ptr into *expected
+// equeue_atomic_exchange_ptr - Replace a pointer and return its old value
+#if defined(__GNUC__) || defined(__clang__)
+#define EQUEUE_HAS_ATOMICS 1
+#define equeue_atomic_load_ptr(ptr) \
+    __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define equeue_atomic_cas_ptr(ptr, expected, desired) \
+    __atomic_compare_exchange_n(ptr, expected, desired, true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define equeue_atomic_exchange_ptr(ptr, value) \
+    __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST)
+#else
+#define EQUEUE_HAS_ATOMICS 0
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,9 @@
 #include "events/EventQueue.h"
 #include "events/Event.h"
 #include "events/UserAllocatedEvent.h"
+#ifdef MBED_CONF_RTOS_PRESENT
+#include "events/EventQueuePool.h"
+#endif
 
 #include "events/mbed_shared_queues.h"
 
@@ -46,6 +46,11 @@ void EventQueue::dispatch(int ms)
     return equeue_dispatch(&_equeue, ms);
 }
 
+int EventQueue::dispatch_slice(unsigned max_events, int ms)
+{
+    return equeue_dispatch_slice(&_equeue, max_events, ms);
+}
+
 void EventQueue::break_dispatch()
 {
     return equeue_break(&_equeue);
@@ -66,6 +71,21 @@ int EventQueue::time_left(int id)
     return equeue_timeleft(&_equeue, id);
 }
 
+void EventQueue::mem_stats(struct equeue_mem_stats *stats)
+{
+    equeue_get_mem_stats(&_equeue, stats);
+}
+
+void EventQueue::stats(struct equeue_stats *stats)
+{
+    equeue_get_stats(&_equeue, stats);
+}
+
+void EventQueue::reset_stats()
+{
+    equeue_reset_stats(&_equeue);
+}
+
 void EventQueue::background(Callback<void(int)> update)
 {
     _update = update;
@@ -0,0 +1,195 @@
+/* events
+ * Copyright (c) 2016-2019 ARM Limited
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "events/EventQueuePool.h"
+
+#include "platform/mbed_assert.h"
+#include "rtos/ThisThread.h"
+
+#include <climits>
+
+using namespace rtos;
+
+namespace events {
+
+// Thread flag that wakes up a worker
+#define EVENTS_POOL_WAKE_FLAG 1
+
+// Number of event queues per worker, the shared queue and the keyed queue
+#define EVENTS_POOL_QUEUES_PER_WORKER 2
+
+EventQueuePool::Worker::Worker(EventQueuePool *pool, unsigned index, unsigned size,
+                               osPriority priority, uint32_t stack_size, const char *name)
+    : pool(pool), index(index), queue(size), serial(size),
+      thread(priority, stack_size, nullptr, name), due(equeue_tick() + INT_MAX)
+{
+}
+
+void EventQueuePool::Worker::set_due(int ms)
+{
+    due = equeue_tick() + (ms < 0 ? INT_MAX : ms);
+}
+
+void EventQueuePool::Worker::run()
+{
+    while (!pool->_stopping) {
+        int next = serial.dispatch_slice(0);
+
+        int shared = queue.dispatch_slice(0);
+        set_due(shared);
+        if (shared >= 0 && (next < 0 || shared < next)) {
+            next = shared;
+        }
+
+        // with nothing due here, help out the other workers
+        if (next != 0 && pool->steal(index) == 0) {
+            next = 0;
+        }
+
+        if (next == 0) {
+            continue;
+        }
+
+        // any post since the slices above has set the wake flag, so this
+        // returns straight away
+        pool->_idle_workers |= 1U << index;
+        ThisThread::flags_wait_any_for(EVENTS_POOL_WAKE_FLAG,
+                                       next < 0 ? Kernel::wait_for_u32_forever : Kernel::Clock::duration_u32(next));
+        pool->_idle_workers &= ~(1U << index);
+    }
+}
+
+EventQueuePool::EventQueuePool(unsigned workers, unsigned size, osPriority priority,
+                               uint32_t stack_size, const char *name)
+    : _workers(nullptr), _worker_count(workers), _next_worker(0), _idle_workers(0), _stopping(false)
+{
+    MBED_ASSERT(workers >= 1 && workers <= 32);
+
+    _workers = new Worker *[workers];
+    for (unsigned i = 0; i < workers; i++) {
+        _workers[i] = new Worker(this, i, size, priority, stack_size, name);
+    }
+
+    // start the threads once all workers exist, since they look at each other
+    for (unsigned i = 0; i < workers; i++) {
+        osStatus status = _workers[i]->thread.start(mbed::callback(_workers[i], &Worker::run));
+        MBED_ASSERT(status == osOK);
+        (void)status;
+    }
+}
+
+EventQueuePool::~EventQueuePool()
+{
+    _stopping = true;
+    for (unsigned i = 0; i < _worker_count; i++) {
+        _workers[i]->thread.flags_set(EVENTS_POOL_WAKE_FLAG);
+    }
+    for (unsigned i = 0; i < _worker_count; i++) {
+        _workers[i]->thread.join();
+    }
+
+    for (unsigned i = 0; i < _worker_count; i++) {
+        delete _workers[i];
+    }
+    delete[] _workers;
+}
+
+unsigned EventQueuePool::next_worker()
+{
+    return _next_worker++ % _worker_count;
+}
+
+int EventQueuePool::posted(unsigned worker, bool keyed, duration ms, int id)
+{
+    if (!id) {
+        return 0;
+    }
+
+    // ids of the worker queues are interleaved to make pool ids
+    unsigned queues = EVENTS_POOL_QUEUES_PER_WORKER * _worker_count;
+    MBED_ASSERT(id <= (INT_MAX - (int)queues) / (int)queues);
+
+    Worker *w = _workers[worker];
+    if (!keyed) {
+        // bring the due hint forward
+        uint32_t target = equeue_tick() + ms.count();
+        uint32_t due = w->due;
+        while ((int)(target - due) < 0 && !w->due.compare_exchange_weak(due, target)) {
+        }
+    }
+    w->thread.flags_set(EVENTS_POOL_WAKE_FLAG);
+
+    // an event that is due now can be taken by an idle worker straight away
+    if (!keyed && ms.count() <= 0) {
+        uint32_t idle = _idle_workers & ~(1U << worker);
+        for (unsigned i = 0; idle; i++, idle >>= 1) {
+            if (idle & 1) {
+                _workers[i]->thread.flags_set(EVENTS_POOL_WAKE_FLAG);
+                break;
+            }
+        }
+    }
+
+    return id * queues + EVENTS_POOL_QUEUES_PER_WORKER * worker + (keyed ? 1 : 0);
+}
+
+int EventQueuePool::steal(unsigned thief)
+{
+    unsigned tick = equeue_tick();
+    for (unsigned i = 1; i < _worker_count; i++) {
+        Worker *victim = _workers[(thief + i) % _worker_count];
+        if ((int)(victim->due - tick) > 0) {
+            continue;
+        }
+
+        // the victim's owner may be dispatching the same queue, the queue's
+        // lock makes sure that each event is only taken once
+        int next = victim->queue.dispatch_slice(1);
+        victim->set_due(next);
+        if (next == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+bool EventQueuePool::cancel(int id)
+{
+    if (id <= 0) {
+        return false;
+    }
+
+    unsigned queues = EVENTS_POOL_QUEUES_PER_WORKER * _worker_count;
+    Worker *w = _workers[(id % queues) / EVENTS_POOL_QUEUES_PER_WORKER];
+    EventQueue &q = (id % queues) % EVENTS_POOL_QUEUES_PER_WORKER ? w->serial : w->queue;
+    return q.cancel(id / queues);
+}
+
+int EventQueuePool::time_left(int id)
+{
+    if (id <= 0) {
+        return -1;
+    }
+
+    unsigned queues = EVENTS_POOL_QUEUES_PER_WORKER * _worker_count;
+    Worker *w = _workers[(id % queues) / EVENTS_POOL_QUEUES_PER_WORKER];
+    EventQueue &q = (id % queues) % EVENTS_POOL_QUEUES_PER_WORKER ? w->serial : w->queue;
+    return q.time_left(id / queues);
+}
+
+}
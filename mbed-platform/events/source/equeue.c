@@ -91,20 +91,36 @@ int equeue_create_inplace(equeue_t *q, size_t size, void *buffer)
         q->npw2++;
     }
 
-    q->chunks = 0;
+    for (int i = 0; i < EQUEUE_SIZE_CLASSES; i++) {
+        q->chunks[i] = 0;
+    }
+    q->chunk_map = 0;
     q->slab.size = size;
     q->slab.data = q->buffer;
 
     q->queue = 0;
+#if EQUEUE_LOCKFREE_POST
+    q->incoming = 0;
+#endif
+#if EQUEUE_PAIRING_HEAP
+    q->order = 0;
+#endif
     equeue_tick_init();
     q->tick = equeue_tick();
     q->generation = 0;
     q->break_requested = false;
+    q->dispatchers = 0;
 
     q->background.active = false;
     q->background.update = 0;
     q->background.timer = 0;
 
+#if EQUEUE_STATS
+    q->used_size = 0;
+    q->chunk_count = 0;
+    equeue_reset_stats(q);
+#endif
+
     // initialize platform resources
     int err;
     err = equeue_sema_create(&q->eventsema);
@@ -125,9 +141,28 @@ int equeue_create_inplace(equeue_t *q, size_t size, void *buffer)
     return 0;
 }
 
+#if EQUEUE_PAIRING_HEAP
+static struct equeue_event *equeue_heap_pop(equeue_t *q);
+#endif
+#if EQUEUE_LOCKFREE_POST
+static void equeue_incoming_drain(equeue_t *q, unsigned tick);
+#endif
+
 void equeue_destroy(equeue_t *q)
 {
+#if EQUEUE_LOCKFREE_POST
+    equeue_incoming_drain(q, q->tick);
+#endif
+
     // call destructors on pending events
+#if EQUEUE_PAIRING_HEAP
+    while (q->queue) {
+        struct equeue_event *e = equeue_heap_pop(q);
+        if (e->dtor) {
+            e->dtor(e + 1);
+        }
+    }
+#else
     for (struct equeue_event *es = q->queue; es; es = es->next) {
         for (struct equeue_event *e = es->sibling; e; e = e->sibling) {
             if (e->dtor) {
@@ -138,6 +173,7 @@ void equeue_destroy(equeue_t *q)
             es->dtor(es + 1);
         }
     }
+#endif
     // notify background timer
     if (q->background.update) {
         q->background.update(q->background.timer, -1);
@@ -152,24 +188,115 @@ void equeue_destroy(equeue_t *q)
 
 
 // equeue chunk allocation functions
+#if EQUEUE_SIZE_CLASSES > 32 || EQUEUE_SIZE_CLASSES < 1
+#error "EQUEUE_SIZE_CLASSES must be between 1 and 32"
+#endif
+
+// size of the event header once rounded up to the chunk alignment
+#define EQUEUE_CHUNK_OVERHEAD \
+    ((sizeof(struct equeue_event) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+// find the size bin that chunks of the given (aligned) size belong to
+static inline unsigned equeue_size_bin(size_t size)
+{
+    size_t words = (size - EQUEUE_CHUNK_OVERHEAD) / sizeof(void *);
+    return words < EQUEUE_SIZE_CLASSES - 1 ? (unsigned)words : EQUEUE_SIZE_CLASSES - 1;
+}
+
+// find the lowest size bin in a non-zero chunk map
+static inline unsigned equeue_lowest_bin(uint32_t map)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(map);
+#else
+    unsigned bin = 0;
+    while (!(map & 1)) {
+        map >>= 1;
+        bin++;
+    }
+    return bin;
+#endif
+}
+
+// remove the chunk at the head of a list, promoting its siblings
+static inline struct equeue_event *equeue_chunk_pop(equeue_t *q,
+                                                    struct equeue_event **p, unsigned bin)
+{
+    struct equeue_event *e = *p;
+    if (e->sibling) {
+        *p = e->sibling;
+        (*p)->next = e->next;
+    } else {
+        *p = e->next;
+    }
+
+    if (!q->chunks[bin]) {
+        q->chunk_map &= ~((uint32_t)1 << bin);
+    }
+#if EQUEUE_STATS
+    q->chunk_count -= 1;
+#endif
+    return e;
+}
+
+#if EQUEUE_STATS
+// record a successful allocation, with the memory lock held
+static inline struct equeue_event *equeue_stats_alloc(equeue_t *q, struct equeue_event *e)
+{
+    q->used_size += e->size;
+    if (q->used_size > q->stats.max_used_size) {
+        q->stats.max_used_size = q->used_size;
+    }
+    return e;
+}
+
+// return the histogram bucket for a time in ms
+static inline unsigned equeue_stats_bucket(unsigned ms)
+{
+    unsigned bucket = 0;
+    while (ms && bucket < EQUEUE_STATS_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// record the dispatch of an event, with the memory lock like the other stats
+// since several threads can be dispatching slices of the queue
+static void equeue_stats_dispatch(equeue_t *q, unsigned lateness, unsigned runtime)
+{
+    equeue_mutex_lock(&q->memlock);
+    q->stats.dispatched += 1;
+    q->stats.lateness[equeue_stats_bucket(lateness)] += 1;
+    q->stats.runtime[equeue_stats_bucket(runtime)] += 1;
+    if (lateness > q->stats.max_lateness) {
+        q->stats.max_lateness = lateness;
+    }
+    if (runtime > q->stats.max_runtime) {
+        q->stats.max_runtime = runtime;
+    }
+    equeue_mutex_unlock(&q->memlock);
+}
+#endif
+
 static struct equeue_event *equeue_mem_alloc(equeue_t *q, size_t size)
 {
     // add event overhead
     size += sizeof(struct equeue_event);
     size = (size + sizeof(void *) -1) & ~(sizeof(void *) -1);
+    unsigned bin = equeue_size_bin(size);
 
     equeue_mutex_lock(&q->memlock);
 
-    // check if a good chunk is available
-    for (struct equeue_event **p = &q->chunks; *p; p = &(*p)->next) {
+    // check if a chunk of the same size is available
+    // the last bin holds all larger sizes, sorted by size, so the first
+    // chunk that fits is also the best fit
+    for (struct equeue_event **p = &q->chunks[bin]; *p; p = &(*p)->next) {
         if ((*p)->size >= size) {
-            struct equeue_event *e = *p;
-            if (e->sibling) {
-                *p = e->sibling;
-                (*p)->next = e->next;
-            } else {
-                *p = e->next;
-            }
+            struct equeue_event *e = equeue_chunk_pop(q, p, bin);
+#if EQUEUE_STATS
+            equeue_stats_alloc(q, e);
+#endif
 
             equeue_mutex_unlock(&q->memlock);
             return e;
@@ -183,11 +310,30 @@ static struct equeue_event *equeue_mem_alloc(equeue_t *q, size_t size)
         q->slab.size -= size;
         e->size = size;
         e->id = 1;
+#if EQUEUE_STATS
+        equeue_stats_alloc(q, e);
+#endif
+
+        equeue_mutex_unlock(&q->memlock);
+        return e;
+    }
+
+    // otherwise fall back to the smallest larger chunk
+    uint32_t larger = q->chunk_map & ~(((uint32_t)2 << bin) - 1);
+    if (bin < EQUEUE_SIZE_CLASSES - 1 && larger) {
+        unsigned larger_bin = equeue_lowest_bin(larger);
+        struct equeue_event *e = equeue_chunk_pop(q, &q->chunks[larger_bin], larger_bin);
+#if EQUEUE_STATS
+        equeue_stats_alloc(q, e);
+#endif
 
         equeue_mutex_unlock(&q->memlock);
         return e;
     }
 
+#if EQUEUE_STATS
+    q->stats.alloc_failures += 1;
+#endif
     equeue_mutex_unlock(&q->memlock);
     return 0;
 }
@@ -196,8 +342,10 @@ static void equeue_mem_dealloc(equeue_t *q, struct equeue_event *e)
 {
     equeue_mutex_lock(&q->memlock);
 
-    // stick chunk into list of chunks
-    struct equeue_event **p = &q->chunks;
+    // stick chunk into the list for its size bin, only the last bin
+    // holds more than one size
+    unsigned bin = equeue_size_bin(e->size);
+    struct equeue_event **p = &q->chunks[bin];
     while (*p && (*p)->size < e->size) {
         p = &(*p)->next;
     }
@@ -210,8 +358,70 @@ static void equeue_mem_dealloc(equeue_t *q, struct equeue_event *e)
         e->next = *p;
     }
     *p = e;
+    q->chunk_map |= (uint32_t)1 << bin;
+
+#if EQUEUE_STATS
+    q->used_size -= e->size;
+    q->chunk_count += 1;
+    if (q->chunk_count > q->stats.max_chunk_count) {
+        q->stats.max_chunk_count = q->chunk_count;
+    }
+#endif
+
+    equeue_mutex_unlock(&q->memlock);
+}
+
+void equeue_get_mem_stats(equeue_t *q, struct equeue_mem_stats *stats)
+{
+    equeue_mutex_lock(&q->memlock);
 
+    stats->slab_size = q->slab.size;
+    stats->chunk_size = 0;
+    stats->chunk_count = 0;
+    stats->max_chunk_size = 0;
+
+    for (int i = 0; i < EQUEUE_SIZE_CLASSES; i++) {
+        for (struct equeue_event *es = q->chunks[i]; es; es = es->next) {
+            for (struct equeue_event *e = es; e; e = e->sibling) {
+                stats->chunk_size += e->size;
+                stats->chunk_count += 1;
+            }
+            if (es->size > stats->max_chunk_size) {
+                stats->max_chunk_size = es->size;
+            }
+        }
+    }
+
+    size_t carved = q->slab.data - q->buffer;
+    stats->used_size = carved - stats->chunk_size;
+
+    size_t free_size = stats->chunk_size + stats->slab_size;
+    stats->fragmentation = free_size ?
+                           (unsigned)((100 * (uint64_t)stats->chunk_size) / free_size) : 0;
+
+    equeue_mutex_unlock(&q->memlock);
+}
+
+void equeue_get_stats(equeue_t *q, struct equeue_stats *stats)
+{
+#if EQUEUE_STATS
+    equeue_mutex_lock(&q->memlock);
+    *stats = q->stats;
+    equeue_mutex_unlock(&q->memlock);
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void equeue_reset_stats(equeue_t *q)
+{
+#if EQUEUE_STATS
+    equeue_mutex_lock(&q->memlock);
+    memset(&q->stats, 0, sizeof(q->stats));
+    q->stats.max_used_size = q->used_size;
+    q->stats.max_chunk_count = q->chunk_count;
     equeue_mutex_unlock(&q->memlock);
+#endif
 }
 
 void *equeue_alloc(equeue_t *q, size_t size)
@@ -243,19 +453,122 @@ void equeue_dealloc(equeue_t *q, void *p)
     }
 }
 
-void equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick)
+#if EQUEUE_PAIRING_HEAP
+// equeue pairing heap functions
+//
+// Pending events form a pairing heap ordered by target tick, with ties broken
+// by the order the events were posted in. Each event's next points to its
+// next sibling in the heap and ref to the pointer that points at it, so any
+// event can be cut out of the heap in constant time.
+static inline bool equeue_heap_before(struct equeue_event *a, struct equeue_event *b)
 {
-    e->target = tick + equeue_clampdiff(e->target, tick);
-    e->generation = q->generation;
+    int diff = equeue_tickdiff(a->target, b->target);
+    return diff < 0 || (diff == 0 && equeue_tickdiff(a->order, b->order) < 0);
+}
 
-    equeue_mutex_lock(&q->queuelock);
+// link two heap roots, returning the new root
+static struct equeue_event *equeue_heap_meld(struct equeue_event *a, struct equeue_event *b)
+{
+    if (!a) {
+        return b;
+    } else if (!b) {
+        return a;
+    }
 
-    // find the event slot
-    struct equeue_event **p = &q->queue;
-    while (*p && equeue_tickdiff((*p)->target, e->target) < 0) {
-        p = &(*p)->next;
+    if (equeue_heap_before(b, a)) {
+        struct equeue_event *t = a;
+        a = b;
+        b = t;
+    }
+
+    b->next = a->child;
+    if (b->next) {
+        b->next->ref = &b->next;
+    }
+    a->child = b;
+    b->ref = &a->child;
+    return a;
+}
+
+// combine a list of sibling heaps into one heap using the two-pass pairing
+static struct equeue_event *equeue_heap_merge_pairs(struct equeue_event *first)
+{
+    // meld pairs from left to right, collecting the results in reverse
+    struct equeue_event *pairs = 0;
+    while (first) {
+        struct equeue_event *a = first;
+        struct equeue_event *b = a->next;
+        first = b ? b->next : 0;
+
+        a->next = 0;
+        if (b) {
+            b->next = 0;
+        }
+
+        struct equeue_event *m = equeue_heap_meld(a, b);
+        m->next = pairs;
+        pairs = m;
+    }
+
+    // then meld the results from right to left
+    struct equeue_event *root = 0;
+    while (pairs) {
+        struct equeue_event *m = pairs;
+        pairs = m->next;
+        m->next = 0;
+        root = equeue_heap_meld(root, m);
+    }
+
+    return root;
+}
+
+static inline void equeue_heap_setroot(equeue_t *q, struct equeue_event *root)
+{
+    q->queue = root;
+    if (root) {
+        root->next = 0;
+        root->ref = &q->queue;
+    }
+}
+
+static void equeue_heap_insert(equeue_t *q, struct equeue_event *e)
+{
+    e->next = 0;
+    e->child = 0;
+    equeue_heap_setroot(q, equeue_heap_meld(q->queue, e));
+}
+
+static struct equeue_event *equeue_heap_pop(equeue_t *q)
+{
+    struct equeue_event *e = q->queue;
+    equeue_heap_setroot(q, equeue_heap_merge_pairs(e->child));
+    return e;
+}
+
+static void equeue_heap_remove(equeue_t *q, struct equeue_event *e)
+{
+    if (q->queue == e) {
+        equeue_heap_pop(q);
+        return;
+    }
+
+    // cut the event out of its parent's children and meld its own
+    // children back into the heap
+    *e->ref = e->next;
+    if (e->next) {
+        e->next->ref = e->ref;
     }
 
+    struct equeue_event *children = equeue_heap_merge_pairs(e->child);
+    equeue_heap_setroot(q, equeue_heap_meld(q->queue, children));
+}
+#endif
+
+#if !EQUEUE_PAIRING_HEAP
+// insert an event into the queue at the slot that p points to, which is
+// either the slot for the event's target or the slot after where it belongs
+static void equeue_insert_slot(struct equeue_event **p, struct equeue_event *e)
+{
     // insert at head in slot
     if (*p && (*p)->target == e->target) {
         e->next = (*p)->next;
@@ -275,6 +588,34 @@ void equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick)
 
     *p = e;
     e->ref = p;
+}
+#endif
+
+// insert an event into the queue, must be called with the queuelock held
+static void equeue_insert(equeue_t *q, struct equeue_event *e, unsigned tick)
+{
+    e->target = tick + equeue_clampdiff(e->target, tick);
+    e->generation = q->generation;
+
+#if EQUEUE_PAIRING_HEAP
+    e->order = q->order++;
+    e->sibling = 0;
+    equeue_heap_insert(q, e);
+#else
+    // find the event slot
+    struct equeue_event **p = &q->queue;
+    while (*p && equeue_tickdiff((*p)->target, e->target) < 0) {
+        p = &(*p)->next;
+    }
+
+    equeue_insert_slot(p, e);
+#endif
+}
+
+void equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick)
+{
+    equeue_mutex_lock(&q->queuelock);
+    equeue_insert(q, e, tick);
 
     // notify background timer
     if ((q->background.update && q->background.active) &&
@@ -285,6 +626,76 @@ void equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick)
     equeue_mutex_unlock(&q->queuelock);
 }
 
+#if EQUEUE_LOCKFREE_POST
+#if !EQUEUE_HAS_ATOMICS
+#error "EQUEUE_LOCKFREE_POST requires the platform atomic operations in equeue_platform.h"
+#endif
+
+// move events posted through the lock-free path into the queue, must be
+// called with the queuelock held
+static void equeue_incoming_drain(equeue_t *q, unsigned tick)
+{
+    struct equeue_event *es = equeue_atomic_exchange_ptr(&q->incoming, 0);
+    if (!es) {
+        return;
+    }
+
+    // the stack holds the newest event first, reverse it to keep posting order
+    struct equeue_event *ordered = 0;
+    while (es) {
+        struct equeue_event *e = es;
+        es = e->next;
+        e->next = ordered;
+        ordered = e;
+    }
+
+    // producers leave the target of these events relative (always 0) so that
+    // they don't have to read the clock, they are due at the drain's tick
+    while (ordered) {
+        struct equeue_event *e = ordered;
+        ordered = e->next;
+        e->target = tick;
+        equeue_insert(q, e, tick);
+    }
+
+    // notify background timer
+    if (q->background.update && q->background.active && q->queue) {
+        q->background.update(q->background.timer,
+                             equeue_clampdiff(q->queue->target, tick));
+    }
+}
+
+// push an immediate event onto the incoming stack without taking any locks,
+// returns false if the queue has a background timer, in which case the event
+// must be enqueued normally
+static bool equeue_incoming_push(equeue_t *q, struct equeue_event *e)
+{
+    if (equeue_atomic_load_ptr(&q->background.update)) {
+        return false;
+    }
+
+    struct equeue_event *head = equeue_atomic_load_ptr(&q->incoming);
+    do {
+        e->next = head;
+    } while (!equeue_atomic_cas_ptr(&q->incoming, &head, e));
+
+    // only the first event pushed since the last drain needs to wake up the
+    // dispatch loop
+    if (!head) {
+        equeue_sema_signal(&q->eventsema);
+    }
+
+    // if a background timer was set up while we were pushing, it may have
+    // missed the event
+    if (equeue_atomic_load_ptr(&q->background.update)) {
+        equeue_mutex_lock(&q->queuelock);
+        equeue_incoming_drain(q, equeue_tick());
+        equeue_mutex_unlock(&q->queuelock);
+    }
+    return true;
+}
+#endif
+
 // equeue scheduling functions
 static int equeue_event_id(equeue_t *q, struct equeue_event *e)
 {
@@ -295,6 +706,11 @@ static int equeue_event_id(equeue_t *q, struct equeue_event *e)
 static struct equeue_event *equeue_unqueue_by_address(equeue_t *q, struct equeue_event *e)
 {
     equeue_mutex_lock(&q->queuelock);
+#if EQUEUE_LOCKFREE_POST
+    // the event may still be waiting to be moved into the queue
+    equeue_incoming_drain(q, q->tick);
+#endif
+
     // clear the event and check if already in-flight
     e->cb = 0;
     e->period = -1;
@@ -306,6 +722,9 @@ static struct equeue_event *equeue_unqueue_by_address(equeue_t *q, struct equeue
     }
 
     // disentangle from queue
+#if EQUEUE_PAIRING_HEAP
+    equeue_heap_remove(q, e);
+#else
     if (e->sibling) {
         e->sibling->next = e->next;
         if (e->sibling->next) {
@@ -320,6 +739,7 @@ static struct equeue_event *equeue_unqueue_by_address(equeue_t *q, struct equeue
             e->next->ref = e->ref;
         }
     }
+#endif
     equeue_mutex_unlock(&q->queuelock);
     return e;
 }
@@ -347,28 +767,117 @@ static struct equeue_event *equeue_unqueue_by_id(equeue_t *q, int id)
     return e;
 }
 
-static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target)
+// dequeue the events that are due at the target tick, or only the first max
+// of them if max is not zero, in the order they should be dispatched
+static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target, unsigned max)
 {
     equeue_mutex_lock(&q->queuelock);
 
+#if EQUEUE_LOCKFREE_POST
+    equeue_incoming_drain(q, target);
+#endif
+
     // find all expired events and mark a new generation
     q->generation += 1;
+
+#if EQUEUE_PAIRING_HEAP
+    // pop expired events in order, the heap already orders events with the
+    // same target by insertion
+    struct equeue_event *head = 0;
+    struct equeue_event **tail = &head;
+    unsigned count = 0;
+    while (q->queue && equeue_tickdiff(q->queue->target, target) <= 0 &&
+            (!max || count < max)) {
+        struct equeue_event *e = equeue_heap_pop(q);
+        *tail = e;
+        tail = &e->next;
+        count++;
+    }
+    *tail = 0;
+
+    if (q->queue && equeue_tickdiff(q->queue->target, target) <= 0) {
+        // out of budget, so the events that are left become the next due,
+        // give the ones at that tick the new generation so they can still
+        // be cancelled
+        target = q->queue->target;
+
+        struct equeue_event *waiting = 0;
+        while (q->queue && q->queue->target == target) {
+            struct equeue_event *e = equeue_heap_pop(q);
+            e->next = waiting;
+            waiting = e;
+        }
+
+        while (waiting) {
+            struct equeue_event *e = waiting;
+            waiting = e->next;
+            e->generation = q->generation;
+            equeue_heap_insert(q, e);
+        }
+    }
+
     if (equeue_tickdiff(q->tick, target) <= 0) {
         q->tick = target;
     }
 
+    equeue_mutex_unlock(&q->queuelock);
+#else
     struct equeue_event *head = q->queue;
     struct equeue_event **p = &head;
+    unsigned count = 0;
     while (*p && equeue_tickdiff((*p)->target, target) <= 0) {
+        if (max) {
+            unsigned slot = 0;
+            for (struct equeue_event *e = *p; e; e = e->sibling) {
+                slot += 1;
+            }
+
+            if (count + slot > max) {
+                break;
+            }
+            count += slot;
+        }
+
         p = &(*p)->next;
     }
 
-    q->queue = *p;
+    struct equeue_event *rest = *p;
+    struct equeue_event *taken = 0;
+    if (rest && equeue_tickdiff(rest->target, target) <= 0) {
+        // out of budget, so the events that are left become the next due,
+        // take the oldest events from the end of the slot and give the ones
+        // left the new generation so they can still be cancelled
+        target = rest->target;
+
+        unsigned slot = 0;
+        for (struct equeue_event *e = rest; e; e = e->sibling) {
+            slot += 1;
+        }
+
+        struct equeue_event *e = rest;
+        for (unsigned keep = slot - (max - count); keep > 1; keep--) {
+            e->generation = q->generation;
+            e = e->sibling;
+        }
+        e->generation = q->generation;
+
+        taken = e->sibling;
+        e->sibling = 0;
+        if (taken) {
+            taken->next = 0;
+        }
+    }
+
+    if (equeue_tickdiff(q->tick, target) <= 0) {
+        q->tick = target;
+    }
+
+    q->queue = rest;
     if (q->queue) {
         q->queue->ref = &q->queue;
     }
 
-    *p = 0;
+    *p = taken;
 
     equeue_mutex_unlock(&q->queuelock);
 
@@ -388,19 +897,173 @@ static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target)
         *tail = prev;
         tail = &es->next;
     }
+#endif
+
+    return head;
+}
+
+// sort a list of events by target, keeping events with the same target in
+// their original order
+static struct equeue_event *equeue_sort(struct equeue_event *es)
+{
+    if (!es || !es->next) {
+        return es;
+    }
+
+    // split the list in half
+    struct equeue_event *slow = es;
+    struct equeue_event *fast = es->next;
+    while (fast && fast->next) {
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+
+    struct equeue_event *a = es;
+    struct equeue_event *b = slow->next;
+    slow->next = 0;
+
+    a = equeue_sort(a);
+    b = equeue_sort(b);
+
+    // merge, preferring the first half on ties
+    struct equeue_event *head = 0;
+    struct equeue_event **tail = &head;
+    while (a && b) {
+        if (equeue_tickdiff(b->target, a->target) < 0) {
+            *tail = b;
+            b = b->next;
+        } else {
+            *tail = a;
+            a = a->next;
+        }
+        tail = &(*tail)->next;
+    }
+    *tail = a ? a : b;
 
     return head;
 }
 
+// reenqueue a list of periodic events that were just dispatched, merging
+// them into the queue in a single pass
+static void equeue_enqueue_periodic(equeue_t *q, struct equeue_event *es, unsigned tick)
+{
+    struct equeue_event *cancelled = 0;
+
+    // the targets must only change under the lock, equeue_cancel uses them
+    // to tell that the events are in flight
+    equeue_mutex_lock(&q->queuelock);
+    for (struct equeue_event *e = es; e; e = e->next) {
+        e->target = tick + equeue_clampdiff(e->target + e->period, tick);
+    }
+    es = equeue_sort(es);
+
+#if !EQUEUE_PAIRING_HEAP
+    struct equeue_event **p = &q->queue;
+#endif
+    while (es) {
+        struct equeue_event *e = es;
+        es = e->next;
+
+        // events cancelled while they were in flight are not reenqueued
+        if (e->period < 0) {
+            e->next = cancelled;
+            cancelled = e;
+            continue;
+        }
+
+#if EQUEUE_PAIRING_HEAP
+        equeue_insert(q, e, tick);
+#else
+        // the events are sorted, so each one's slot is at or after the last
+        e->generation = q->generation;
+        while (*p && equeue_tickdiff((*p)->target, e->target) < 0) {
+            p = &(*p)->next;
+        }
+        equeue_insert_slot(p, e);
+#endif
+    }
+
+    // notify background timer
+    if (q->background.update && q->background.active && q->queue) {
+        q->background.update(q->background.timer,
+                             equeue_clampdiff(q->queue->target, tick));
+    }
+    equeue_mutex_unlock(&q->queuelock);
+
+    while (cancelled) {
+        struct equeue_event *e = cancelled;
+        cancelled = e->next;
+        if (!EQUEUE_IS_USER_ALLOCATED_EVENT(e)) {
+            equeue_incid(q, e);
+        }
+        equeue_dealloc(q, e + 1);
+    }
+}
+
+// dispatch the events that are due at the given tick, or only the first max
+// of them if max is not zero, and return how many were dispatched
+static unsigned equeue_dispatch_due(equeue_t *q, unsigned tick, unsigned max)
+{
+    struct equeue_event *es = equeue_dequeue(q, tick, max);
+    struct equeue_event *periodic = 0;
+    struct equeue_event **periodic_tail = &periodic;
+    unsigned count = 0;
+
+    while (es) {
+        struct equeue_event *e = es;
+        es = e->next;
+        count += 1;
+
+        // actually dispatch the callbacks
+        void (*cb)(void *) = e->cb;
+#if EQUEUE_STATS
+        unsigned start = equeue_tick();
+        if (cb) {
+            cb(e + 1);
+        }
+        equeue_stats_dispatch(q, equeue_clampdiff(start, e->target),
+                              equeue_tick() - start);
+#else
+        if (cb) {
+            cb(e + 1);
+        }
+#endif
+
+        // collect periodic events to reenqueue together, or deallocate
+        if (e->period >= 0) {
+            e->next = 0;
+            *periodic_tail = e;
+            periodic_tail = &e->next;
+        } else {
+            if (!EQUEUE_IS_USER_ALLOCATED_EVENT(e)) {
+                equeue_incid(q, e);
+            }
+            equeue_dealloc(q, e + 1);
+        }
+    }
+
+    if (periodic) {
+        equeue_enqueue_periodic(q, periodic, equeue_tick());
+    }
+
+    return count;
+}
+
 int equeue_post(equeue_t *q, void (*cb)(void *), void *p)
 {
     struct equeue_event *e = (struct equeue_event *)p - 1;
-    unsigned tick = equeue_tick();
     e->cb = cb;
-    e->target = tick + e->target;
+    int id = equeue_event_id(q, e);
+
+#if EQUEUE_LOCKFREE_POST
+    if (e->target == 0 && equeue_incoming_push(q, e)) {
+        return id;
+    }
+#endif
 
+    unsigned tick = equeue_tick();
+    e->target = tick + e->target;
     equeue_enqueue(q, e, tick);
-    int id = equeue_event_id(q, e);
     equeue_sema_signal(&q->eventsema);
     return id;
 }
@@ -408,11 +1071,17 @@ int equeue_post(equeue_t *q, void (*cb)(void *), void *p)
 void equeue_post_user_allocated(equeue_t *q, void (*cb)(void *), void *p)
 {
     struct equeue_event *e = (struct equeue_event *)p;
-    unsigned tick = equeue_tick();
     e->cb = cb;
-    e->target = tick + e->target;
     e->id = EQUEUE_USER_ALLOCATED_EVENT_STATE_INPROGRESS;
 
+#if EQUEUE_LOCKFREE_POST
+    if (e->target == 0 && equeue_incoming_push(q, e)) {
+        return;
+    }
+#endif
+
+    unsigned tick = equeue_tick();
+    e->target = tick + e->target;
     equeue_enqueue(q, e, tick);
     equeue_sema_signal(&q->eventsema);
 }
@@ -460,6 +1129,10 @@ int equeue_timeleft(equeue_t *q, int id)
                              &q->buffer[id & ((1u << q->npw2) - 1u)];
 
     equeue_mutex_lock(&q->queuelock);
+#if EQUEUE_LOCKFREE_POST
+    // events still on the incoming stack don't have an absolute target yet
+    equeue_incoming_drain(q, equeue_tick());
+#endif
     if (e->id == (unsigned)id >> q->npw2) {
         ret = equeue_clampdiff(e->target, equeue_tick());
     }
@@ -477,6 +1150,9 @@ int equeue_timeleft_user_allocated(equeue_t *q, void *e)
 
     struct equeue_event *_e = (struct equeue_event *)e;
     equeue_mutex_lock(&q->queuelock);
+#if EQUEUE_LOCKFREE_POST
+    equeue_incoming_drain(q, equeue_tick());
+#endif
     ret = equeue_clampdiff(_e->target, equeue_tick());
     equeue_mutex_unlock(&q->queuelock);
     return ret;
@@ -494,35 +1170,13 @@ void equeue_dispatch(equeue_t *q, int ms)
 {
     unsigned tick = equeue_tick();
 	unsigned timeout = tick + ms;
+    equeue_mutex_lock(&q->queuelock);
     q->background.active = false;
+    equeue_mutex_unlock(&q->queuelock);
 
     while (1) {
-		// collect all the available events and next deadline
-        struct equeue_event *es = equeue_dequeue(q, tick);
-
-        // dispatch events
-        while (es) {
-            struct equeue_event *e = es;
-            es = e->next;
-
-            // actually dispatch the callbacks
-            void (*cb)(void *) = e->cb;
-            if (cb) {
-                cb(e + 1);
-            }
-
-            // reenqueue periodic events or deallocate
-            if (e->period >= 0) {
-                e->target += e->period;
-
-                equeue_enqueue(q, e, equeue_tick());
-            } else {
-                if (!EQUEUE_IS_USER_ALLOCATED_EVENT(e)) {
-                    equeue_incid(q, e);
-                }
-                equeue_dealloc(q, e + 1);
-            }
-        }
+        // dispatch all the available events
+        equeue_dispatch_due(q, tick, 0);
 
         int deadline = -1;
         tick = equeue_tick();
@@ -532,16 +1186,16 @@ void equeue_dispatch(equeue_t *q, int ms)
             deadline = equeue_tickdiff(timeout, tick);
             if (deadline <= 0) {
                 // update background timer if necessary
+                equeue_mutex_lock(&q->queuelock);
                 if (q->background.update) {
-                    equeue_mutex_lock(&q->queuelock);
-                    if (q->background.update && q->queue) {
+                    if (q->queue) {
                         q->background.update(q->background.timer,
                                              equeue_clampdiff(q->queue->target, tick));
                     }
                     q->background.active = true;
-                    equeue_mutex_unlock(&q->queuelock);
                 }
                 q->break_requested = false;
+                equeue_mutex_unlock(&q->queuelock);
                 return;
             }
         }
@@ -576,6 +1230,80 @@ void equeue_dispatch(equeue_t *q, int ms)
 }
 
 
+int equeue_dispatch_slice(equeue_t *q, unsigned max_events, int ms)
+{
+    unsigned start = equeue_tick();
+    unsigned tick = start;
+    equeue_mutex_lock(&q->queuelock);
+    q->dispatchers += 1;
+    q->background.active = false;
+    equeue_mutex_unlock(&q->queuelock);
+
+    while (1) {
+        // with a time budget, dispatch in small batches so that the budget
+        // is checked regularly
+        unsigned batch = max_events;
+        if (ms >= 0 && (!batch || batch > EQUEUE_DISPATCH_BATCH)) {
+            batch = EQUEUE_DISPATCH_BATCH;
+        }
+
+        unsigned count = equeue_dispatch_due(q, tick, batch);
+
+        // stop once everything that was due has been dispatched, checking
+        // the time again could find periodic events that are always due
+        if (!batch || count < batch) {
+            break;
+        }
+
+        if (max_events) {
+            max_events -= count;
+            if (!max_events) {
+                break;
+            }
+        }
+
+        tick = equeue_tick();
+        if (ms >= 0 && equeue_tickdiff(tick, start) >= ms) {
+            break;
+        }
+
+        equeue_mutex_lock(&q->queuelock);
+        bool break_requested = q->break_requested;
+        equeue_mutex_unlock(&q->queuelock);
+        if (break_requested) {
+            break;
+        }
+    }
+
+    // find when to dispatch next and update background timer if necessary
+    tick = equeue_tick();
+    int deadline = -1;
+
+    equeue_mutex_lock(&q->queuelock);
+#if EQUEUE_LOCKFREE_POST
+    if (equeue_atomic_load_ptr(&q->incoming)) {
+        deadline = 0;
+    } else
+#endif
+        if (q->queue) {
+            deadline = equeue_clampdiff(q->queue->target, tick);
+        }
+
+    // other threads still dispatching slices of the queue will do this
+    q->dispatchers -= 1;
+    if (!q->dispatchers) {
+        if (q->background.update && q->queue) {
+            q->background.update(q->background.timer,
+                                 equeue_clampdiff(q->queue->target, tick));
+        }
+        q->background.active = true;
+        q->break_requested = false;
+    }
+    equeue_mutex_unlock(&q->queuelock);
+
+    return deadline;
+}
+
 // event functions
 void equeue_event_delay(void *p, int ms)
 {
@@ -660,6 +1388,11 @@ void equeue_background(equeue_t *q,
     q->background.update = update;
     q->background.timer = timer;
 
+#if EQUEUE_LOCKFREE_POST
+    // posts that didn't see the new timer are picked up here
+    equeue_incoming_drain(q, equeue_tick());
+#endif
+
     if (q->background.update && q->queue) {
         q->background.update(q->background.timer,
                              equeue_clampdiff(q->queue->target, equeue_tick()));
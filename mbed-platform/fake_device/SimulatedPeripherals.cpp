@@ -0,0 +1,241 @@
+//
+// Host-side models of serial peripherals, see SimulatedPeripherals.h
+//
+
+#include "SimulatedPeripherals.h"
+
+#include "platform/mbed_assert.h"
+
+namespace sim {
+
+// Longest that the bus thread sleeps without checking for work.  Kicks from the firmware side don't lock
+// the bus mutex, so one can occasionally arrive just before the bus thread goes to sleep and be missed.
+#define SIM_BUS_MAX_SLEEP std::chrono::milliseconds(1)
+
+SimulatedPeripheral::SimulatedPeripheral(IRQn_Type irq)
+    : _irq(irq), _received(0), _transmitted(0), _irqs(0), _overruns(0), _rx_high_water(0)
+{
+}
+
+PeripheralStats SimulatedPeripheral::stats() const
+{
+    PeripheralStats stats;
+    stats.received = _received.load();
+    stats.transmitted = _transmitted.load();
+    stats.irqs = _irqs.load();
+    stats.overruns = _overruns.load();
+    stats.rx_high_water = _rx_high_water.load();
+    return stats;
+}
+
+void SimulatedPeripheral::kick()
+{
+    if (_bus != nullptr) {
+        _bus->kick();
+    }
+}
+
+RTXClock::duration SimulatedPeripheral::bit_time(uint32_t bits, uint32_t rate)
+{
+    MBED_ASSERT(rate > 0);
+    std::chrono::nanoseconds time(static_cast<int64_t>(bits) * 1000000000 / rate);
+    return std::chrono::duration_cast<RTXClock::duration>(time);
+}
+
+void SimulatedPeripheral::count_received(size_t rx_level)
+{
+    ++_received;
+    if (rx_level > _rx_high_water.load()) {
+        _rx_high_water = rx_level;
+    }
+}
+
+SimulatedUart::SimulatedUart(IRQn_Type irq, uint32_t baud, size_t rx_fifo_depth, size_t tx_fifo_depth,
+                             uint32_t frame_bits)
+    : SimulatedLink<uint8_t>(irq, rx_fifo_depth, tx_fifo_depth), _byte_time(bit_time(frame_bits, baud))
+{
+}
+
+RTXClock::duration SimulatedUart::unit_time(const uint8_t &unit) const
+{
+    return _byte_time;
+}
+
+SimulatedCan::SimulatedCan(IRQn_Type irq, uint32_t bitrate, size_t rx_fifo_depth, size_t tx_fifo_depth)
+    : SimulatedLink<SimCanFrame>(irq, rx_fifo_depth, tx_fifo_depth), _bitrate(bitrate)
+{
+}
+
+RTXClock::duration SimulatedCan::unit_time(const SimCanFrame &frame) const
+{
+    uint32_t overhead = frame.extended ? 67 : 47;
+    return bit_time(overhead + 8 * std::min<uint32_t>(frame.len, 8), _bitrate);
+}
+
+SimulatedMaster::SimulatedMaster(IRQn_Type irq, uint32_t clock_hz, uint32_t bits_per_byte, size_t fifo_depth)
+    : SimulatedPeripheral(irq), _rx_fifo(fifo_depth), _tx_fifo(fifo_depth),
+      _byte_time(bit_time(bits_per_byte, clock_hz)), _out(0), _done(time_point::min()), _busy(false)
+{
+}
+
+bool SimulatedMaster::advance(time_point now)
+{
+    bool interrupt = false;
+    bool back_to_back = false;
+    while (true) {
+        if (_busy) {
+            if (_done > now) {
+                break;
+            }
+
+            // the firmware has to read each reply before the next one comes back
+            uint8_t in = exchange(_out);
+            if (_rx_fifo.push(in)) {
+                count_received(_rx_fifo.size());
+            } else {
+                ++_overruns;
+            }
+            ++_transmitted;
+            _busy = false;
+            back_to_back = true;
+            interrupt = true;
+        }
+
+        if (!_tx_fifo.pop(_out)) {
+            break;
+        }
+        _done = (back_to_back ? _done : now) + _byte_time;
+        _busy = true;
+    }
+
+    return interrupt;
+}
+
+SimulatedPeripheral::time_point SimulatedMaster::next_event() const
+{
+    if (_busy) {
+        return _done;
+    }
+    return _tx_fifo.empty() ? time_point::max() : time_point::min();
+}
+
+SimulatedSpi::SimulatedSpi(IRQn_Type irq, uint32_t clock_hz, Device device, size_t fifo_depth)
+    : SimulatedMaster(irq, clock_hz, 8, fifo_depth), _device(device)
+{
+}
+
+uint8_t SimulatedSpi::exchange(uint8_t out)
+{
+    return _device ? _device(out) : 0xFF;
+}
+
+SimulatedI2C::SimulatedI2C(IRQn_Type irq, uint32_t clock_hz, Device device, size_t fifo_depth)
+    : SimulatedMaster(irq, clock_hz, 9, fifo_depth), _device(device), _nacks(0)
+{
+}
+
+uint8_t SimulatedI2C::exchange(uint8_t out)
+{
+    bool ack = false;
+    uint8_t in = _device ? _device(out, ack) : 0xFF;
+    if (!ack) {
+        ++_nacks;
+    }
+    return in;
+}
+
+SimulatedBus::SimulatedBus(RTXOffBoard *board)
+    : _board(board), _kicked(false), _stopping(false)
+{
+}
+
+SimulatedBus::~SimulatedBus()
+{
+    stop();
+}
+
+void SimulatedBus::attach(SimulatedPeripheral &peripheral)
+{
+    MBED_ASSERT(!_thread.joinable());
+    MBED_ASSERT(peripheral._bus == nullptr);
+    peripheral._bus = this;
+    _peripherals.push_back(&peripheral);
+}
+
+void SimulatedBus::start()
+{
+    MBED_ASSERT(!_thread.joinable());
+    _stopping = false;
+    _thread = std::thread(&SimulatedBus::run, this);
+}
+
+void SimulatedBus::stop()
+{
+    if (!_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wakeup.notify_one();
+    _thread.join();
+}
+
+void SimulatedBus::kick()
+{
+    _kicked = true;
+
+    // The firmware side must not block, but if nobody holds the mutex, taking it makes sure that the bus
+    // thread is either about to see _kicked or already waiting for the notification.
+    if (_mutex.try_lock()) {
+        _mutex.unlock();
+    }
+    _wakeup.notify_one();
+}
+
+void SimulatedBus::run()
+{
+    if (_board != nullptr) {
+        _board->select();
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stopping) {
+        lock.unlock();
+
+        SimulatedPeripheral::time_point now = RTXClock::now();
+        SimulatedPeripheral::time_point next = SimulatedPeripheral::time_point::max();
+        for (SimulatedPeripheral *peripheral : _peripherals) {
+            bool interrupt;
+            {
+                std::lock_guard<std::mutex> peripheral_lock(peripheral->_mutex);
+                interrupt = peripheral->advance(now);
+                next = std::min(next, peripheral->next_event());
+            }
+
+            if (interrupt) {
+                ++peripheral->_irqs;
+                NVIC_SetPendingIRQAsync(peripheral->_irq, nullptr, nullptr);
+            }
+        }
+
+        lock.lock();
+        if (_kicked.exchange(false) || next <= now) {
+            continue;
+        }
+
+        // The kernel clock can run slower than real time (e.g. the process clock), so this may wake up early,
+        // in which case the peripherals just have nothing to do yet.
+        std::chrono::nanoseconds sleep = SIM_BUS_MAX_SLEEP;
+        if (next != SimulatedPeripheral::time_point::max()) {
+            sleep = std::min<std::chrono::nanoseconds>(sleep, next - now);
+        }
+        _wakeup.wait_for(lock, sleep, [this]() {
+            return _kicked.load() || _stopping;
+        });
+    }
+}
+
+}
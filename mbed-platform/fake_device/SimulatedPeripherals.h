@@ -0,0 +1,533 @@
+//
+// Host-side models of serial peripherals (UART, SPI, I2C and CAN) that move data at a modeled
+// bit rate on the RTXOff kernel clock and raise interrupts through the simulated NVIC.
+//
+
+#ifndef MBED_BENCHTEST_SIMULATED_PERIPHERALS_H
+#define MBED_BENCHTEST_SIMULATED_PERIPHERALS_H
+
+#include "platform/NonCopyable.h"
+
+#include "rtxoff_board.h"
+#include "rtxoff_clock.h"
+#include "rtxoff_nvic.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Fixed size FIFO between one producer and one consumer, without locks.
+ *
+ * Used for the FIFOs that firmware sees, since firmware accesses them from ISRs and RTX threads, which
+ * must not block on host mutexes (the dispatcher can suspend an RTX thread while it holds one).
+ */
+template<typename T>
+class SimFifo : private mbed::NonCopyable<SimFifo<T> > {
+public:
+    explicit SimFifo(size_t capacity)
+        : _buffer(new T[capacity + 1]), _slots(capacity + 1), _head(0), _tail(0)
+    {
+    }
+
+    /** Add an element.  Only call from the producer.
+     *  @return false if the FIFO is full
+     */
+    bool push(const T &value)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % _slots;
+        if (next == _head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        _buffer[tail] = value;
+        _tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /** Remove the oldest element.  Only call from the consumer.
+     *  @return false if the FIFO is empty
+     */
+    bool pop(T &value)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = _buffer[head];
+        _head.store((head + 1) % _slots, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        size_t head = _head.load(std::memory_order_acquire);
+        size_t tail = _tail.load(std::memory_order_acquire);
+        return (tail + _slots - head) % _slots;
+    }
+
+    size_t capacity() const
+    {
+        return _slots - 1;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    bool full() const
+    {
+        return size() == capacity();
+    }
+
+private:
+    std::unique_ptr<T[]> _buffer;
+    size_t _slots;
+    std::atomic<size_t> _head;
+    std::atomic<size_t> _tail;
+};
+
+/** Counters kept by each simulated peripheral
+ */
+struct PeripheralStats {
+    uint64_t received = 0;      // units (bytes or frames) that reached the firmware's receive FIFO
+    uint64_t transmitted = 0;   // units that the firmware transmitted
+    uint64_t irqs = 0;          // interrupts raised
+    uint64_t overruns = 0;      // units lost because the receive FIFO was full
+    size_t rx_high_water = 0;   // most units in the receive FIFO at once
+};
+
+class SimulatedBus;
+
+/**
+ * Base class of the peripheral models.
+ *
+ * A model has a firmware side, which is lock-free and safe to use from ISRs and RTX threads, and a host side
+ * for test harness threads, which plays the part of whatever is on the other end of the link.  Models are
+ * moved forward in time by the SimulatedBus they are attached to.
+ */
+class SimulatedPeripheral : private mbed::NonCopyable<SimulatedPeripheral> {
+public:
+    using time_point = RTXClock::time_point;
+
+    virtual ~SimulatedPeripheral() = default;
+
+    /** Interrupt that the peripheral raises
+     */
+    IRQn_Type irq() const
+    {
+        return _irq;
+    }
+
+    /** Get a snapshot of the peripheral's counters.  Can be called from any thread.
+     */
+    PeripheralStats stats() const;
+
+protected:
+    friend class SimulatedBus;
+
+    explicit SimulatedPeripheral(IRQn_Type irq);
+
+    /** Move the model forward to the given time.  Called on the bus thread with _mutex locked.
+     *  @return true if the peripheral's interrupt should be raised
+     */
+    virtual bool advance(time_point now) = 0;
+
+    /** Time of the next thing that will happen, time_point::min() if something can happen straight away,
+     *  or time_point::max() if the model is waiting for input.  Called on the bus thread with _mutex locked.
+     */
+    virtual time_point next_event() const = 0;
+
+    /** Wake up the bus thread because the firmware gave the model something to do.  Lock-free.
+     */
+    void kick();
+
+    /** Time taken to move the given number of bits at a rate in bits per second
+     */
+    static RTXClock::duration bit_time(uint32_t bits, uint32_t rate);
+
+    void count_received(size_t rx_level);
+
+    // Protects the host side state of the model
+    std::mutex _mutex;
+
+    SimulatedBus *_bus = nullptr;
+    IRQn_Type _irq;
+
+    std::atomic<uint64_t> _received;
+    std::atomic<uint64_t> _transmitted;
+    std::atomic<uint64_t> _irqs;
+    std::atomic<uint64_t> _overruns;
+    std::atomic<size_t> _rx_high_water;
+};
+
+/**
+ * Asynchronous link that carries units of type T in both directions, e.g. bytes for a UART or frames
+ * for CAN.  The host sends units onto the line, and each one reaches the firmware's receive FIFO after
+ * the time it takes to transmit it.  Units that the firmware writes to its transmit FIFO are sent one
+ * after another and collected for the host.
+ *
+ * The interrupt is raised when units have reached the receive FIFO, and when the transmit FIFO becomes
+ * empty.  Units that arrive while the receive FIFO is full are lost and counted as overruns.
+ */
+template<typename T>
+class SimulatedLink : public SimulatedPeripheral {
+public:
+    // Firmware side
+
+    /** Whether the receive FIFO has data */
+    bool readable() const
+    {
+        return !_rx_fifo.empty();
+    }
+
+    /** Take a unit from the receive FIFO.  @return false if it is empty */
+    bool read(T &unit)
+    {
+        return _rx_fifo.pop(unit);
+    }
+
+    /** Whether the transmit FIFO has space */
+    bool writable() const
+    {
+        return !_tx_fifo.full();
+    }
+
+    /** Add a unit to the transmit FIFO.  @return false if it is full */
+    bool write(const T &unit)
+    {
+        if (!_tx_fifo.push(unit)) {
+            return false;
+        }
+        kick();
+        return true;
+    }
+
+    // Host side
+
+    /** Send a unit towards the firmware.  It is queued behind anything already on the line.
+     */
+    void host_send(const T &unit)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_line_in.empty()) {
+                _rx_done = std::max(_rx_done, RTXClock::now()) + unit_time(unit);
+            }
+            _line_in.push_back(unit);
+        }
+        kick();
+    }
+
+    /** Take a unit that the firmware transmitted.  @return false if there are none
+     */
+    bool host_receive(T &unit)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_line_out.empty()) {
+            return false;
+        }
+        unit = _line_out.front();
+        _line_out.pop_front();
+        return true;
+    }
+
+    /** Number of units sent with host_send() that haven't reached the receive FIFO yet
+     */
+    size_t host_in_flight()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _line_in.size();
+    }
+
+protected:
+    SimulatedLink(IRQn_Type irq, size_t rx_fifo_depth, size_t tx_fifo_depth)
+        : SimulatedPeripheral(irq), _rx_fifo(rx_fifo_depth), _tx_fifo(tx_fifo_depth),
+          _rx_done(time_point::min()), _tx_done(time_point::min()), _tx_busy(false)
+    {
+    }
+
+    /** Time it takes to transmit a unit on the line */
+    virtual RTXClock::duration unit_time(const T &unit) const = 0;
+
+    bool advance(time_point now) override
+    {
+        bool interrupt = false;
+
+        // receive everything that has finished arriving
+        while (!_line_in.empty() && _rx_done <= now) {
+            if (_rx_fifo.push(_line_in.front())) {
+                count_received(_rx_fifo.size());
+            } else {
+                ++_overruns;
+            }
+            _line_in.pop_front();
+            interrupt = true;
+
+            // the next unit starts straight after
+            if (!_line_in.empty()) {
+                _rx_done += unit_time(_line_in.front());
+            }
+        }
+
+        // transmit back to back while the firmware keeps the FIFO filled
+        bool back_to_back = false;
+        while (true) {
+            if (_tx_busy) {
+                if (_tx_done > now) {
+                    break;
+                }
+                _line_out.push_back(_tx_unit);
+                ++_transmitted;
+                _tx_busy = false;
+                back_to_back = true;
+            }
+
+            if (!_tx_fifo.pop(_tx_unit)) {
+                break;
+            }
+            _tx_done = (back_to_back ? _tx_done : now) + unit_time(_tx_unit);
+            _tx_busy = true;
+            if (_tx_fifo.empty()) {
+                // transmit FIFO empty interrupt, so the firmware can refill it while this unit goes out
+                interrupt = true;
+            }
+        }
+
+        return interrupt;
+    }
+
+    time_point next_event() const override
+    {
+        time_point next = time_point::max();
+        if (!_line_in.empty()) {
+            next = _rx_done;
+        }
+        if (_tx_busy) {
+            next = std::min(next, _tx_done);
+        } else if (!_tx_fifo.empty()) {
+            next = time_point::min();
+        }
+        return next;
+    }
+
+private:
+    // firmware side FIFOs.  The bus thread produces into _rx_fifo and consumes from _tx_fifo.
+    SimFifo<T> _rx_fifo;
+    SimFifo<T> _tx_fifo;
+
+    // host side, protected by _mutex
+    std::deque<T> _line_in;     // units on their way to the firmware
+    time_point _rx_done;        // when the first unit of _line_in finishes arriving
+    std::deque<T> _line_out;    // units the firmware transmitted
+    T _tx_unit;                 // unit currently being transmitted
+    time_point _tx_done;        // when it finishes
+    bool _tx_busy;
+};
+
+/**
+ * UART with a receive and transmit FIFO.  Each byte takes frame_bits bit times at the baud rate
+ * (10 for 8N1: start bit, 8 data bits and a stop bit).
+ */
+class SimulatedUart : public SimulatedLink<uint8_t> {
+public:
+    SimulatedUart(IRQn_Type irq, uint32_t baud, size_t rx_fifo_depth = 16, size_t tx_fifo_depth = 16,
+                  uint32_t frame_bits = 10);
+
+protected:
+    RTXClock::duration unit_time(const uint8_t &unit) const override;
+
+private:
+    RTXClock::duration _byte_time;
+};
+
+/** A classic CAN data frame
+ */
+struct SimCanFrame {
+    uint32_t id = 0;
+    bool extended = false;  // 29 bit identifier
+    uint8_t len = 0;        // data length, 0 to 8
+    uint8_t data[8] = {};
+};
+
+/**
+ * CAN controller with receive and transmit FIFOs of whole frames.  A frame takes 47 bit times plus
+ * 8 per data byte with a standard identifier, or 67 plus 8 per data byte with an extended one.
+ * Bit stuffing and arbitration aren't modeled.
+ */
+class SimulatedCan : public SimulatedLink<SimCanFrame> {
+public:
+    SimulatedCan(IRQn_Type irq, uint32_t bitrate, size_t rx_fifo_depth = 3, size_t tx_fifo_depth = 3);
+
+protected:
+    RTXClock::duration unit_time(const SimCanFrame &frame) const override;
+
+private:
+    uint32_t _bitrate;
+};
+
+/**
+ * Synchronous bus master, where the firmware clocks each byte out and a byte comes back from the
+ * device model at the same time.  Each byte written to the transmit FIFO takes bits_per_byte clock
+ * cycles, after which the device's reply goes into the receive FIFO.  The interrupt is raised for each
+ * reply, and when the transmit FIFO becomes empty.
+ */
+class SimulatedMaster : public SimulatedPeripheral {
+public:
+    // Firmware side
+
+    bool readable() const
+    {
+        return !_rx_fifo.empty();
+    }
+
+    bool read(uint8_t &byte)
+    {
+        return _rx_fifo.pop(byte);
+    }
+
+    bool writable() const
+    {
+        return !_tx_fifo.full();
+    }
+
+    bool write(uint8_t byte)
+    {
+        if (!_tx_fifo.push(byte)) {
+            return false;
+        }
+        kick();
+        return true;
+    }
+
+    /** Whether the bus is idle, with nothing left to clock out */
+    bool idle() const
+    {
+        return _tx_fifo.empty() && !_busy.load();
+    }
+
+protected:
+    SimulatedMaster(IRQn_Type irq, uint32_t clock_hz, uint32_t bits_per_byte, size_t fifo_depth);
+
+    /** Exchange a byte with the device model.  Called on the bus thread with _mutex locked. */
+    virtual uint8_t exchange(uint8_t out) = 0;
+
+    bool advance(time_point now) override;
+    time_point next_event() const override;
+
+private:
+    SimFifo<uint8_t> _rx_fifo;
+    SimFifo<uint8_t> _tx_fifo;
+    RTXClock::duration _byte_time;
+    uint8_t _out;
+    time_point _done;
+    std::atomic<bool> _busy;
+};
+
+/**
+ * SPI master.  Each byte takes 8 clock cycles, and the device model returns the byte it shifts out
+ * on MISO while receiving one on MOSI.
+ */
+class SimulatedSpi : public SimulatedMaster {
+public:
+    using Device = std::function<uint8_t(uint8_t mosi)>;
+
+    /**
+     * @param device Called on the bus thread for each byte.  If empty, the device always returns 0xFF.
+     */
+    SimulatedSpi(IRQn_Type irq, uint32_t clock_hz, Device device = Device(), size_t fifo_depth = 4);
+
+protected:
+    uint8_t exchange(uint8_t out) override;
+
+private:
+    Device _device;
+};
+
+/**
+ * I2C master.  Each byte takes 9 clock cycles (8 data bits and the acknowledge bit).  Start and stop
+ * conditions aren't modeled, so the firmware writes the address byte like any other byte.  To read, the
+ * firmware writes 0xFF and the device model drives the byte.  Bytes that the device doesn't acknowledge
+ * are counted by nacks().
+ */
+class SimulatedI2C : public SimulatedMaster {
+public:
+    using Device = std::function<uint8_t(uint8_t written, bool &ack)>;
+
+    /**
+     * @param device Called on the bus thread for each byte, returns the byte seen on SDA and sets ack.
+     *               If empty, nothing acknowledges and SDA reads 0xFF.
+     */
+    SimulatedI2C(IRQn_Type irq, uint32_t clock_hz, Device device = Device(), size_t fifo_depth = 4);
+
+    /** Number of bytes that weren't acknowledged */
+    uint64_t nacks() const
+    {
+        return _nacks.load();
+    }
+
+protected:
+    uint8_t exchange(uint8_t out) override;
+
+private:
+    Device _device;
+    std::atomic<uint64_t> _nacks;
+};
+
+/**
+ * Host thread that moves the peripherals attached to it forward in time and raises their interrupts
+ * with NVIC_SetPendingIRQAsync().  The peripherals run on the kernel clock (RTXClock), so with
+ * RTXOFF_USE_VIRTUAL_TIME they also see time skip ahead while the kernel is idle.
+ */
+class SimulatedBus : private mbed::NonCopyable<SimulatedBus> {
+public:
+    /**
+     * @param board Board to raise interrupts on, or nullptr for the default board.
+     */
+    explicit SimulatedBus(RTXOffBoard *board = nullptr);
+
+    /** Stops the bus thread if it is running */
+    ~SimulatedBus();
+
+    /** Add a peripheral.  Must be called before start(), and the peripheral must outlive the bus. */
+    void attach(SimulatedPeripheral &peripheral);
+
+    /** Start the bus thread */
+    void start();
+
+    /** Stop the bus thread.  Time stops for the peripherals until it is started again. */
+    void stop();
+
+private:
+    friend class SimulatedPeripheral;
+
+    void run();
+
+    // Wake up the bus thread.  Lock-free.
+    void kick();
+
+    RTXOffBoard *_board;
+    std::vector<SimulatedPeripheral *> _peripherals;
+    std::thread _thread;
+
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::atomic<bool> _kicked;
+    bool _stopping;
+};
+
+}
+
+#endif //MBED_BENCHTEST_SIMULATED_PERIPHERALS_H
@@ -71,6 +71,8 @@
 #define MBED_CONF_PLATFORM_STDIO_CONVERT_TTY_NEWLINES                     1                                       // set by library:platform
 #define MBED_CONF_PLATFORM_STDIO_FLUSH_AT_EXIT                            1                                       // set by library:platform
 #define MBED_CONF_PLATFORM_STDIO_MINIMAL_CONSOLE_ONLY                     0
+#define MBED_CPU_STATS_ENABLED                                            1                                       // RTXOff CPU usage statistics
+#define MBED_THREAD_STATS_ENABLED                                         1                                       // RTXOff CPU usage statistics
 #define MBED_CRC_TABLE_SIZE                                               16                                      // set by library:drivers
 
 // disable greentea communication protocol
@@ -18,7 +18,8 @@
 #define MBED_STATS_H
 #include <stdint.h>
 #include <stddef.h>
-#include "hal/ticker_api.h"
+// RTXOff: the HAL isn't available, so define the one type that this header needs from hal/ticker_api.h
+typedef uint64_t us_timestamp_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -131,6 +132,11 @@ typedef struct {
     uint32_t stack_size;        /**< Current number of bytes reserved for the stack */
     uint32_t stack_space;       /**< Current number of free bytes remaining on the stack */
     const char   *name;         /**< Name of the thread */
+    us_timestamp_t run_time;    /**< Time spent running (RTXOff only) */
+    us_timestamp_t ready_time;  /**< Time spent ready to run but waiting for another thread (RTXOff only) */
+    uint32_t voluntary_switches;    /**< Times the thread stopped running because it blocked or exited (RTXOff only) */
+    uint32_t involuntary_switches;  /**< Times the thread was switched out while still ready to run (RTXOff only) */
+    uint32_t isr_preemptions;       /**< Times the thread was interrupted to run ISRs (RTXOff only) */
 } mbed_stats_thread_t;
 
 /**
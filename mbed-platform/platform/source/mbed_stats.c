@@ -16,7 +16,10 @@
  */
 #include "platform/mbed_assert.h"
 #include "platform/mbed_stats.h"
+#ifndef MBED_CONF_RTOS_PRESENT
+// only needed for CPU stats without RTXOff, and includes HAL headers that aren't available
 #include "platform/mbed_power_mgmt.h"
+#endif
 #include "platform/mbed_version.h"
 #include <string.h>
 #include <stdlib.h>
@@ -24,6 +27,7 @@
 #include "device.h"
 #ifdef MBED_CONF_RTOS_PRESENT
 #include "cmsis_os2.h"
+#include "rtxoff_stats.h"
 #elif defined(MBED_STACK_STATS_ENABLED) || defined(MBED_THREAD_STATS_ENABLED)
 #warning Statistics are currently not supported without the rtos.
 #endif
@@ -36,7 +40,13 @@ void mbed_stats_cpu_get(mbed_stats_cpu_t *stats)
 {
     MBED_ASSERT(stats != NULL);
     memset(stats, 0, sizeof(mbed_stats_cpu_t));
-#if defined(MBED_CPU_STATS_ENABLED) && DEVICE_LPTICKER && DEVICE_SLEEP
+#if defined(MBED_CPU_STATS_ENABLED) && defined(MBED_CONF_RTOS_PRESENT)
+    // RTXOff measures these on the kernel clock.  The simulated processor never sleeps.
+    rtxoff_cpu_stats_t cpu_stats;
+    rtxoff_stats_cpu_get(&cpu_stats);
+    stats->uptime = cpu_stats.uptime;
+    stats->idle_time = cpu_stats.idle_time;
+#elif defined(MBED_CPU_STATS_ENABLED) && DEVICE_LPTICKER && DEVICE_SLEEP
     stats->uptime = mbed_uptime();
     stats->idle_time = mbed_time_idle();
     stats->sleep_time = mbed_time_sleep();
@@ -53,26 +63,24 @@ void mbed_stats_stack_get(mbed_stats_stack_t *stats)
 #if defined(MBED_STACK_STATS_ENABLED) && defined(MBED_CONF_RTOS_PRESENT)
     uint32_t thread_n = osThreadGetCount();
     unsigned i;
-    osThreadId_t *threads;
+    rtxoff_thread_stats_t *thread_stats;
 
-    threads = malloc(sizeof(osThreadId_t) * thread_n);
+    thread_stats = malloc(sizeof(rtxoff_thread_stats_t) * thread_n);
     // Don't fail on lack of memory
-    if (!threads) {
+    if (!thread_stats) {
         return;
     }
 
-    osKernelLock();
-    thread_n = osThreadEnumerate(threads, thread_n);
+    // RTXOff takes a consistent snapshot of all threads, so osKernelLock() isn't needed
+    thread_n = rtxoff_stats_thread_get_each(thread_stats, thread_n);
 
     for (i = 0; i < thread_n; i++) {
-        uint32_t stack_size = osThreadGetStackSize(threads[i]);
-        stats->max_size += stack_size - osThreadGetStackSpace(threads[i]);
-        stats->reserved_size += stack_size;
+        stats->max_size += thread_stats[i].stack_size - thread_stats[i].stack_space;
+        stats->reserved_size += thread_stats[i].stack_size;
         stats->stack_cnt++;
     }
-    osKernelUnlock();
 
-    free(threads);
+    free(thread_stats);
 #endif
 }
 
@@ -84,27 +92,25 @@ size_t mbed_stats_stack_get_each(mbed_stats_stack_t *stats, size_t count)
     size_t i = 0;
 
 #if defined(MBED_STACK_STATS_ENABLED) && defined(MBED_CONF_RTOS_PRESENT)
-    osThreadId_t *threads;
+    rtxoff_thread_stats_t *thread_stats;
 
-    threads = malloc(sizeof(osThreadId_t) * count);
+    thread_stats = malloc(sizeof(rtxoff_thread_stats_t) * count);
     // Don't fail on lack of memory
-    if (!threads) {
+    if (!thread_stats) {
         return 0;
     }
 
-    osKernelLock();
-    count = osThreadEnumerate(threads, count);
+    // RTXOff takes a consistent snapshot of all threads, so osKernelLock() isn't needed
+    count = rtxoff_stats_thread_get_each(thread_stats, count);
 
     for (i = 0; i < count; i++) {
-        uint32_t stack_size = osThreadGetStackSize(threads[i]);
-        stats[i].max_size = stack_size - osThreadGetStackSpace(threads[i]);
-        stats[i].reserved_size = stack_size;
-        stats[i].thread_id = (uint32_t)threads[i];
+        stats[i].max_size = thread_stats[i].stack_size - thread_stats[i].stack_space;
+        stats[i].reserved_size = thread_stats[i].stack_size;
+        stats[i].thread_id = (uint32_t)(uintptr_t)thread_stats[i].id;
         stats[i].stack_cnt = 1;
     }
-    osKernelUnlock();
 
-    free(threads);
+    free(thread_stats);
 #endif
 
     return i;
@@ -117,24 +123,28 @@ size_t mbed_stats_thread_get_each(mbed_stats_thread_t *stats, size_t count)
     size_t i = 0;
 
 #if defined(MBED_THREAD_STATS_ENABLED) && defined(MBED_CONF_RTOS_PRESENT)
-    osThreadId_t *threads;
+    rtxoff_thread_stats_t *thread_stats;
 
-    threads = malloc(sizeof(osThreadId_t) * count);
-    MBED_ASSERT(threads != NULL);
+    thread_stats = malloc(sizeof(rtxoff_thread_stats_t) * count);
+    MBED_ASSERT(thread_stats != NULL);
 
-    osKernelLock();
-    count = osThreadEnumerate(threads, count);
+    // RTXOff takes a consistent snapshot of all threads, so osKernelLock() isn't needed
+    count = rtxoff_stats_thread_get_each(thread_stats, count);
 
     for (i = 0; i < count; i++) {
-        stats[i].id = (uint32_t)threads[i];
-        stats[i].state = (uint32_t)osThreadGetState(threads[i]);
-        stats[i].priority = (uint32_t)osThreadGetPriority(threads[i]);
-        stats[i].stack_size = osThreadGetStackSize(threads[i]);
-        stats[i].stack_space = osThreadGetStackSpace(threads[i]);
-        stats[i].name = osThreadGetName(threads[i]);
+        stats[i].id = (uint32_t)(uintptr_t)thread_stats[i].id;
+        stats[i].state = (uint32_t)thread_stats[i].state;
+        stats[i].priority = (uint32_t)thread_stats[i].priority;
+        stats[i].stack_size = thread_stats[i].stack_size;
+        stats[i].stack_space = thread_stats[i].stack_space;
+        stats[i].name = thread_stats[i].name;
+        stats[i].run_time = thread_stats[i].run_time;
+        stats[i].ready_time = thread_stats[i].ready_time;
+        stats[i].voluntary_switches = thread_stats[i].voluntary_switches;
+        stats[i].involuntary_switches = thread_stats[i].involuntary_switches;
+        stats[i].isr_preemptions = thread_stats[i].isr_preemptions;
     }
-    osKernelUnlock();
-    free(threads);
+    free(thread_stats);
 #endif
     return i;
 }
@@ -26,11 +26,11 @@
 #include <stdint.h>
 #include <string.h>
 
-#include "rtos/Queue.h"
-#include "rtos/MemoryPool.h"
 #include "rtos/mbed_rtos_types.h"
 #include "rtos/mbed_rtos_storage.h"
 #include "rtos/mbed_rtos1_types.h"
+#include "rtos/Kernel.h"
+#include "rtxoff_msgqueue.h"
 
 #include "platform/mbed_toolchain.h"
 #include "platform/mbed_assert.h"
@@ -62,6 +62,10 @@ namespace rtos {
  * pools are not being used).
  *
  * @note
+ * Each mail is allocated in place in a single RTOS message queue (see rtxoff_msgqueue.h), so putting and getting
+ * a mail copies neither the mail nor a pointer to it.
+ *
+ * @note
  * Bare metal profile: This class is not supported.
  */
 template<typename T, uint32_t queue_sz>
@@ -71,7 +75,25 @@ public:
      *
      * @note You cannot call this function from ISR context.
      */
-    Mail() = default;
+    Mail()
+    {
+        osMessageQueueAttr_t attr = { 0 };
+        attr.mq_mem = _queue_mem;
+        attr.mq_size = sizeof(_queue_mem);
+        attr.cb_mem = &_obj_mem;
+        attr.cb_size = sizeof(_obj_mem);
+        _id = osMessageQueueNew(queue_sz, sizeof(T), &attr);
+        MBED_ASSERT(_id);
+    }
+
+    /** Mail destructor
+     *
+     * @note You cannot call this function from ISR context.
+     */
+    ~Mail()
+    {
+        osMessageQueueDelete(_id);
+    }
 
     /** Check if the mail queue is empty.
      *
@@ -83,7 +105,7 @@ public:
      */
     bool empty() const
     {
-        return _queue.empty();
+        return osMessageQueueGetCount(_id) == 0;
     }
 
     /** Check if the mail queue is full.
@@ -96,7 +118,7 @@ public:
      */
     bool full() const
     {
-        return _queue.full();
+        return osMessageQueueGetSpace(_id) == 0;
     }
 
     /** Allocate a memory block of type T, without blocking.
@@ -124,7 +146,7 @@ public:
      */
     T *try_alloc()
     {
-        return _pool.try_alloc();
+        return static_cast<T *>(osMessageQueueReserve(_id, 0));
     }
 
     /** Allocate a memory block of type T, optionally blocking.
@@ -137,7 +159,7 @@ public:
      */
     T *try_alloc_for(Kernel::Clock::duration_u32 rel_time)
     {
-        return _pool.try_alloc_for(rel_time);
+        return static_cast<T *>(osMessageQueueReserve(_id, rel_time.count()));
     }
 
     /** Allocate a memory block of type T, optionally blocking.
@@ -169,7 +191,16 @@ public:
      */
     T *try_alloc_until(Kernel::Clock::time_point abs_time)
     {
-        return _pool.try_alloc_until(abs_time);
+        Kernel::Clock::time_point now = Kernel::Clock::now();
+        Kernel::Clock::duration_u32 rel_time;
+        if (now >= abs_time) {
+            rel_time = rel_time.zero();
+        } else if (abs_time - now > Kernel::wait_for_u32_max) {
+            rel_time = Kernel::wait_for_u32_max;
+        } else {
+            rel_time = abs_time - now;
+        }
+        return try_alloc_for(rel_time);
     }
 
     /** Allocate a memory block of type T, blocking.
@@ -217,7 +248,11 @@ public:
      */
     T *try_calloc()
     {
-        return _pool.try_calloc();
+        T *mptr = try_alloc();
+        if (mptr != nullptr) {
+            memset(mptr, 0, sizeof(T));
+        }
+        return mptr;
     }
 
     /** Allocate a memory block of type T, optionally blocking, and set memory block to zero.
@@ -230,7 +265,11 @@ public:
      */
     T *try_calloc_for(Kernel::Clock::duration_u32 rel_time)
     {
-        return _pool.try_calloc_for(rel_time);
+        T *mptr = try_alloc_for(rel_time);
+        if (mptr != nullptr) {
+            memset(mptr, 0, sizeof(T));
+        }
+        return mptr;
     }
 
     /** Allocate a memory block of type T, optionally blocking, and set memory block to zero.
@@ -262,7 +301,11 @@ public:
      */
     T *try_calloc_until(Kernel::Clock::time_point abs_time)
     {
-        return _pool.try_calloc_until(abs_time);
+        T *mptr = try_alloc_until(abs_time);
+        if (mptr != nullptr) {
+            memset(mptr, 0, sizeof(T));
+        }
+        return mptr;
     }
 
     /** Allocate a memory block of type T, blocking, and set memory block to zero.
@@ -293,16 +336,15 @@ public:
      *          See note.
      *
      * @note You may call this function from ISR context.
-     * @note As the mail should have already been allocated, and the memory pool is the same size
-     *       as the queue, the put operation should always succeed, despite being implemented with
-     *       Queue::try_put - there is room in the queue for every mail from the pool. Therefore
-     *       use of the return value is deprecated, and the function will return void in future.
+     * @note As the mail should have already been allocated in the queue, the put operation
+     *       should always succeed. Therefore use of the return value is deprecated, and the
+     *       function will return void in future.
      */
     osStatus put(T *mptr)
     {
-        bool ok = _queue.try_put(mptr);
-        MBED_ASSERT(ok);
-        return ok ? osOK : osErrorResource;
+        osStatus_t status = osMessageQueueCommit(_id, mptr, 0);
+        MBED_ASSERT(status == osOK);
+        return status;
     }
 
     /** Get a mail from the queue.
@@ -322,11 +364,20 @@ public:
     MBED_DEPRECATED_SINCE("mbed-os-6.0.0", "Replaced with try_get and try_get_for. In future get will be an untimed blocking call.")
     osEvent get(uint32_t millisec = osWaitForever)
     {
-        osEvent evt = _queue.get(millisec);
-        if (evt.status == osEventMessage) {
-            evt.status = osEventMail;
+        osEvent event;
+        T *mptr = static_cast<T *>(osMessageQueueBorrow(_id, nullptr, millisec));
+
+        if (mptr != nullptr) {
+            event.status = (osStatus)osEventMail;
+            event.value.p = mptr;
+        } else if (millisec == 0) {
+            event.status = osOK;
+        } else {
+            event.status = (osStatus)osEventTimeout;
         }
-        return evt;
+        event.def.message_id = _id;
+
+        return event;
     }
 
     /** Get a mail from the queue.
@@ -337,9 +388,7 @@ public:
      */
     T *try_get()
     {
-        T *mptr = nullptr;
-        _queue.try_get(&mptr);
-        return mptr;
+        return static_cast<T *>(osMessageQueueBorrow(_id, nullptr, 0));
     }
 
     /** Get a mail from the queue.
@@ -352,9 +401,7 @@ public:
      */
     T *try_get_for(Kernel::Clock::duration_u32 rel_time)
     {
-        T *mptr = nullptr;
-        _queue.try_get_for(rel_time, &mptr);
-        return mptr;
+        return static_cast<T *>(osMessageQueueBorrow(_id, nullptr, rel_time.count()));
     }
 
     /** Free a memory block from a mail.
@@ -367,12 +414,13 @@ public:
      */
     osStatus free(T *mptr)
     {
-        return _pool.free(mptr);
+        return osMessageQueueRelease(_id, mptr);
     }
 
 private:
-    Queue<T, queue_sz> _queue;
-    MemoryPool<T, queue_sz> _pool;
+    osMessageQueueId_t            _id;
+    char                          _queue_mem[MBED_RTOS_STORAGE_MSG_QUEUE_MEM_SIZE(queue_sz, sizeof(T))];
+    mbed_rtos_storage_msg_queue_t _obj_mem;
 };
 
 /** @}*/
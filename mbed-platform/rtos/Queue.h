@@ -335,7 +335,7 @@ public:
     }
 private:
     osMessageQueueId_t            _id;
-    char                          _queue_mem[queue_sz * (sizeof(T *) + sizeof(mbed_rtos_storage_message_t))];
+    char                          _queue_mem[MBED_RTOS_STORAGE_MSG_QUEUE_MEM_SIZE(queue_sz, sizeof(T *))];
     mbed_rtos_storage_msg_queue_t _obj_mem;
 };
 /** @}*/
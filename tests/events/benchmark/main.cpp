@@ -0,0 +1,209 @@
+/*
+ * Microbenchmark for the equeue pending event structure.
+ *
+ * This file is built twice, as equeue_benchmark_list and equeue_benchmark_heap, each with
+ * its own copy of equeue.c configured with EQUEUE_PAIRING_HEAP = 0 or 1.  It runs equeue on
+ * the posix platform with a simulated millisecond tick provided below, so the results only
+ * measure the queue itself and don't depend on the RTOS or on sleeping.
+ *
+ * Usage: equeue_benchmark_<list|heap> [<event count> ...]
+ */
+
+#include "events/equeue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#if EQUEUE_PAIRING_HEAP
+#define BENCHMARK_BACKEND "pairing heap"
+#else
+#define BENCHMARK_BACKEND "sorted list"
+#endif
+
+// Simulated platform
+// -------------------------------------------------------------
+
+static unsigned benchmark_tick = 0;
+
+void equeue_tick_init(void)
+{
+}
+
+unsigned equeue_tick(void)
+{
+    return benchmark_tick;
+}
+
+// equeue_cancel locks the queue mutex recursively, which is fine with the critical sections used on mbed
+int equeue_mutex_create(equeue_mutex_t *m)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    int err = pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return err;
+}
+
+void equeue_mutex_destroy(equeue_mutex_t *m)
+{
+    pthread_mutex_destroy(m);
+}
+
+void equeue_mutex_lock(equeue_mutex_t *m)
+{
+    pthread_mutex_lock(m);
+}
+
+void equeue_mutex_unlock(equeue_mutex_t *m)
+{
+    pthread_mutex_unlock(m);
+}
+
+// The benchmark only dispatches with a timeout of 0, so the semaphore never has to block
+int equeue_sema_create(equeue_sema_t *s)
+{
+    s->signal = false;
+    return 0;
+}
+
+void equeue_sema_destroy(equeue_sema_t *s)
+{
+}
+
+void equeue_sema_signal(equeue_sema_t *s)
+{
+    s->signal = true;
+}
+
+bool equeue_sema_wait(equeue_sema_t *s, int ms)
+{
+    bool signal = s->signal;
+    s->signal = false;
+    return signal;
+}
+
+// Benchmarks
+// -------------------------------------------------------------
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+static uint64_t dispatched = 0;
+
+static void count_func(void *)
+{
+    dispatched++;
+}
+
+static double ns_per(bench_clock::duration elapsed, uint64_t count)
+{
+    return count ? std::chrono::duration<double, std::nano>(elapsed).count() / count : 0;
+}
+
+static void create_queue(equeue_t *q, size_t events)
+{
+    if (equeue_create(q, events * (EQUEUE_EVENT_SIZE + 2 * sizeof(void *)))) {
+        fprintf(stderr, "could not create a queue for %zu events\n", events);
+        exit(1);
+    }
+}
+
+/*
+ * Telemetry scheduler: n periodic events with periods between 10 and 1000 ms and random phases.
+ * Measures the cost of dispatching and re-enqueueing each event over 10 simulated seconds.
+ */
+static void benchmark_periodic(size_t n)
+{
+    equeue_t q;
+    benchmark_tick = 0;
+    create_queue(&q, n);
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> period_dist(10, 1000);
+    for (size_t i = 0; i < n; i++) {
+        void *e = equeue_alloc(&q, 0);
+        if (!e) {
+            fprintf(stderr, "out of memory posting event %zu\n", i);
+            exit(1);
+        }
+
+        // spread out the first deadlines
+        int period = period_dist(rng);
+        equeue_event_delay(e, std::uniform_int_distribution<int>(0, period - 1)(rng));
+        equeue_event_period(e, period);
+        equeue_post(&q, count_func, e);
+    }
+
+    dispatched = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (int ms = 0; ms < 10000; ms++) {
+        benchmark_tick++;
+        equeue_dispatch(&q, 0);
+    }
+    bench_clock::duration elapsed = bench_clock::now() - start;
+
+    printf("%-28s %8zu events %10" PRIu64 " dispatches %10.1f ns/dispatch\n",
+           "periodic dispatch", n, dispatched, ns_per(elapsed, dispatched));
+
+    equeue_destroy(&q);
+}
+
+/*
+ * Post n events with random delays of up to 10 s, then cancel them all in random order.
+ */
+static void benchmark_post_cancel(size_t n)
+{
+    equeue_t q;
+    benchmark_tick = 0;
+    create_queue(&q, n);
+
+    std::mt19937 rng(2);
+    std::uniform_int_distribution<int> delay_dist(1, 10000);
+    std::vector<int> ids(n);
+
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = equeue_call_in(&q, delay_dist(rng), count_func, 0);
+    }
+    bench_clock::duration post_elapsed = bench_clock::now() - start;
+
+    std::shuffle(ids.begin(), ids.end(), rng);
+
+    start = bench_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        equeue_cancel(&q, ids[i]);
+    }
+    bench_clock::duration cancel_elapsed = bench_clock::now() - start;
+
+    printf("%-28s %8zu events %10.1f ns/post %10.1f ns/cancel\n",
+           "random post and cancel", n, ns_per(post_elapsed, n), ns_per(cancel_elapsed, n));
+
+    equeue_destroy(&q);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        counts.push_back(strtoul(argv[i], 0, 0));
+    }
+    if (counts.empty()) {
+        counts = { 16, 256, 4096 };
+    }
+
+    printf("equeue benchmark, pending events kept in a " BENCHMARK_BACKEND "\n");
+    for (size_t n : counts) {
+        benchmark_periodic(n);
+        benchmark_post_cancel(n);
+    }
+    return 0;
+}
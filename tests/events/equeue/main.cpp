@@ -28,6 +28,9 @@
 #include <ThisThread.h>
 #include <Thread.h>
 #include <EventQueue.h>
+#include <rtxoff_stats.h>
+
+#include <atomic>
 
 using namespace rtos;
 using namespace std::chrono_literals;
@@ -135,6 +138,45 @@ static void multithread_thread(equeue_t *p)
     equeue_dispatch(p, DISPATCH_INFINITE);
 }
 
+struct producer {
+    equeue_t *q;
+    int posted;
+    int received;
+    bool in_order;
+};
+
+struct producer_event {
+    struct producer *producer;
+    int seq;
+};
+
+static void producer_func(void *p)
+{
+    struct producer_event *e = reinterpret_cast<struct producer_event *>(p);
+    if (e->seq != e->producer->received) {
+        e->producer->in_order = false;
+    }
+    e->producer->received++;
+}
+
+template <int N>
+static void producer_thread(struct producer *producer)
+{
+    while (producer->posted < N) {
+        struct producer_event *e = reinterpret_cast<struct producer_event *>(
+                                       equeue_alloc(producer->q, sizeof(struct producer_event)));
+        if (!e) {
+            // wait for the dispatcher to free some events
+            ThisThread::yield();
+            continue;
+        }
+
+        e->producer = producer;
+        e->seq = producer->posted++;
+        equeue_post(producer->q, producer_func, e);
+    }
+}
+
 static void background_func(void *p, int ms)
 {
     *(reinterpret_cast<int *>(p)) = ms;
@@ -669,6 +711,87 @@ static void test_equeue_multithread()
     equeue_destroy(&q);
 }
 
+/** Test that events posted from several threads at once are all dispatched in the order each thread posted them.
+ *
+ *  Given queue is being dispatched in one thread.
+ *  When several other threads post immediate events at the same time.
+ *  Then every event is dispatched once, and each thread's events are dispatched in posting order.
+ */
+template <int N>
+static void test_equeue_multiple_producers()
+{
+    equeue_t q;
+    int err = equeue_create(&q, 16 * (EQUEUE_EVENT_SIZE + sizeof(struct producer_event)));
+    TEST_ASSERT_EQUAL_INT(0, err);
+
+    struct producer producers[3];
+    for (struct producer &producer : producers) {
+        producer = { &q, 0, 0, true };
+    }
+
+    Thread dispatcher(osPriorityNormal, TEST_THREAD_STACK_SIZE);
+    dispatcher.start(mbed::callback(multithread_thread, &q));
+
+    Thread t1(osPriorityNormal, TEST_THREAD_STACK_SIZE);
+    Thread t2(osPriorityNormal, TEST_THREAD_STACK_SIZE);
+    Thread t3(osPriorityNormal, TEST_THREAD_STACK_SIZE);
+    t1.start(mbed::callback(producer_thread<N>, &producers[0]));
+    t2.start(mbed::callback(producer_thread<N>, &producers[1]));
+    t3.start(mbed::callback(producer_thread<N>, &producers[2]));
+    TEST_ASSERT_EQUAL_INT(0, t1.join());
+    TEST_ASSERT_EQUAL_INT(0, t2.join());
+    TEST_ASSERT_EQUAL_INT(0, t3.join());
+
+    ThisThread::sleep_for(10ms);
+    equeue_break(&q);
+    TEST_ASSERT_EQUAL_INT(0, dispatcher.join());
+
+    for (struct producer &producer : producers) {
+        TEST_ASSERT_EQUAL_INT(N, producer.received);
+        TEST_ASSERT_TRUE(producer.in_order);
+    }
+
+    equeue_destroy(&q);
+}
+
+/** Test that posting immediate events with EQUEUE_LOCKFREE_POST doesn't enter a critical section.
+ *
+ *  Given queue is initialized and some events have been allocated.
+ *  When the events are posted with no delay.
+ *  Then no critical section is entered until the queue is dispatched, and the events run in posting order.
+ */
+static void test_equeue_lockfree_post()
+{
+    equeue_t q;
+    int err = equeue_create(&q, 8 * (EQUEUE_EVENT_SIZE + sizeof(struct producer_event)));
+    TEST_ASSERT_EQUAL_INT(0, err);
+
+    struct producer producer = { &q, 0, 0, true };
+    struct producer_event *events[8];
+    for (struct producer_event *&e : events) {
+        e = reinterpret_cast<struct producer_event *>(equeue_alloc(&q, sizeof(struct producer_event)));
+        TEST_ASSERT_NOT_NULL(e);
+        e->producer = &producer;
+        e->seq = producer.posted++;
+    }
+
+    rtxoff_cpu_stats_t before, after;
+    rtxoff_stats_cpu_get(&before);
+    for (struct producer_event *e : events) {
+        TEST_ASSERT_NOT_EQUAL(0, equeue_post(&q, producer_func, e));
+    }
+    rtxoff_stats_cpu_get(&after);
+#if EQUEUE_LOCKFREE_POST
+    TEST_ASSERT_EQUAL_UINT64(before.critical_sections, after.critical_sections);
+#endif
+
+    equeue_dispatch(&q, 0);
+    TEST_ASSERT_EQUAL_INT(8, producer.received);
+    TEST_ASSERT_TRUE(producer.in_order);
+
+    equeue_destroy(&q);
+}
+
 /** Test that variable referred via equeue_background shows value in ms to the next event.
  *
  *  Given queue is initialized.
@@ -990,11 +1113,280 @@ static void test_equeue_sibling()
     equeue_destroy(&q);
 }
 
+struct slice_log {
+    int values[EQUEUE_DISPATCH_BATCH + 4];
+    unsigned count;
+};
+
+static slice_log slice_record;
+
+static void slice_func(void *p)
+{
+    slice_record.values[slice_record.count++] = *reinterpret_cast<int *>(p);
+}
+
+/** Test that equeue_dispatch_slice stops when its budget runs out.
+ *
+ *  Given queue is initialized and several events are due.
+ *  When equeue_dispatch_slice is called with an event limit.
+ *  Then only that many events are dispatched, in the order they were posted, and 0 is returned.
+ *  Then the remaining events can still be cancelled or dispatched by a later slice.
+ *  When equeue_dispatch_slice is called with a time budget of 0.
+ *  Then one batch of events is dispatched.
+ */
+static void test_equeue_dispatch_slice()
+{
+    const int count = EQUEUE_DISPATCH_BATCH + 4;
+    int values[count];
+    int ids[count];
+
+    equeue_t q;
+    int err = equeue_create(&q, count * EQUEUE_EVENT_SIZE);
+    TEST_ASSERT_EQUAL_INT(0, err);
+
+    slice_record.count = 0;
+    for (int i = 0; i < 10; i++) {
+        values[i] = i;
+        ids[i] = equeue_call(&q, slice_func, &values[i]);
+        TEST_ASSERT_NOT_EQUAL(0, ids[i]);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, equeue_dispatch_slice(&q, 4, DISPATCH_INFINITE));
+    TEST_ASSERT_EQUAL_UINT(4, slice_record.count);
+
+    TEST_ASSERT_TRUE(equeue_cancel(&q, ids[9]));
+
+    TEST_ASSERT_EQUAL_INT(-1, equeue_dispatch_slice(&q, 0, DISPATCH_INFINITE));
+    TEST_ASSERT_EQUAL_UINT(9, slice_record.count);
+    for (int i = 0; i < 9; i++) {
+        TEST_ASSERT_EQUAL_INT(i, slice_record.values[i]);
+    }
+
+    // periodic events are dispatched once per period
+    slice_record.count = 0;
+    int id = equeue_call_every(&q, 10, slice_func, &values[0]);
+    TEST_ASSERT_NOT_EQUAL(0, id);
+    TEST_ASSERT_TRUE(equeue_dispatch_slice(&q, 0, DISPATCH_INFINITE) > 0);
+    TEST_ASSERT_EQUAL_UINT(0, slice_record.count);
+    ThisThread::sleep_for(10ms);
+    TEST_ASSERT_TRUE(equeue_dispatch_slice(&q, 0, DISPATCH_INFINITE) > 0);
+    TEST_ASSERT_EQUAL_UINT(1, slice_record.count);
+    TEST_ASSERT_TRUE(equeue_cancel(&q, id));
+
+    // a time budget of 0 allows a single batch
+    slice_record.count = 0;
+    for (int i = 0; i < count - 1; i++) {
+        values[i] = i;
+        TEST_ASSERT_NOT_EQUAL(0, equeue_call(&q, slice_func, &values[i]));
+    }
+    TEST_ASSERT_EQUAL_INT(0, equeue_dispatch_slice(&q, 0, 0));
+    TEST_ASSERT_EQUAL_UINT(EQUEUE_DISPATCH_BATCH, slice_record.count);
+    TEST_ASSERT_EQUAL_INT(-1, equeue_dispatch_slice(&q, 0, DISPATCH_INFINITE));
+    TEST_ASSERT_EQUAL_UINT(count - 1, slice_record.count);
+    for (int i = 0; i < count - 1; i++) {
+        TEST_ASSERT_EQUAL_INT(i, slice_record.values[i]);
+    }
+
+    equeue_destroy(&q);
+}
+
+struct concurrent_slices {
+    equeue_t *q;
+    std::atomic<int> dispatched;
+    std::atomic<int> running;
+    bool overlapped;
+};
+
+static void concurrent_slice_func(void *p)
+{
+    struct concurrent_slices *slices = *reinterpret_cast<struct concurrent_slices **>(p);
+    if (++slices->running > 1) {
+        slices->overlapped = true;
+    }
+
+    // let the other thread dispatch an event while this one is still running
+    ThisThread::yield();
+
+    slices->running--;
+    slices->dispatched++;
+}
+
+template <int N>
+static void concurrent_slice_thread(struct concurrent_slices *slices)
+{
+    while (slices->dispatched < N) {
+        equeue_dispatch_slice(slices->q, 1, DISPATCH_INFINITE);
+        ThisThread::yield();
+    }
+}
+
+/** Test that several threads can dispatch slices of the same queue at once.
+ *
+ *  Given queue has some events posted.
+ *  When two threads dispatch slices of it at the same time.
+ *  Then every event is dispatched once, some of them concurrently, and the stats count each of them.
+ */
+template <int N>
+static void test_equeue_concurrent_dispatch_slice()
+{
+    equeue_t q;
+    int err = equeue_create(&q, N * (EQUEUE_EVENT_SIZE + sizeof(struct concurrent_slices *)));
+    TEST_ASSERT_EQUAL_INT(0, err);
+
+    struct concurrent_slices slices;
+    slices.q = &q;
+    slices.dispatched = 0;
+    slices.running = 0;
+    slices.overlapped = false;
+
+    for (int i = 0; i < N; i++) {
+        struct concurrent_slices **e = reinterpret_cast<struct concurrent_slices **>(
+                                           equeue_alloc(&q, sizeof(struct concurrent_slices *)));
+        TEST_ASSERT_NOT_NULL(e);
+        *e = &slices;
+        equeue_post(&q, concurrent_slice_func, e);
+    }
+
+    Thread t1(osPriorityNormal, TEST_THREAD_STACK_SIZE);
+    Thread t2(osPriorityNormal, TEST_THREAD_STACK_SIZE);
+    t1.start(mbed::callback(concurrent_slice_thread<N>, &slices));
+    t2.start(mbed::callback(concurrent_slice_thread<N>, &slices));
+    TEST_ASSERT_EQUAL_INT(0, t1.join());
+    TEST_ASSERT_EQUAL_INT(0, t2.join());
+
+    TEST_ASSERT_EQUAL_INT(N, slices.dispatched);
+    TEST_ASSERT_TRUE(slices.overlapped);
+    TEST_ASSERT_EQUAL_UINT(0, q.dispatchers);
+    TEST_ASSERT_EQUAL_INT(-1, equeue_dispatch_slice(&q, 0, DISPATCH_INFINITE));
+
+#if EQUEUE_STATS
+    struct equeue_stats stats;
+    equeue_get_stats(&q, &stats);
+    TEST_ASSERT_EQUAL_UINT(N, stats.dispatched);
+#endif
+
+    equeue_destroy(&q);
+}
+
+/** Test that equeue records dispatch statistics when built with EQUEUE_STATS.
+ *
+ *  Given queue is initialized.
+ *  When a slow event and an event that is held up by it are dispatched, and an allocation fails.
+ *  Then the statistics show both events, the slow callback, the late dispatch and the failed allocation.
+ *  When the statistics are reset.
+ *  Then the counts are cleared.
+ */
+static void test_equeue_stats()
+{
+    equeue_t q;
+    int err = equeue_create(&q, TEST_EQUEUE_SIZE);
+    TEST_ASSERT_EQUAL_INT(0, err);
+
+    uint8_t touched = 0;
+    TEST_ASSERT_NOT_EQUAL(0, equeue_call(&q, sloth_func, &touched));
+    TEST_ASSERT_NOT_EQUAL(0, equeue_call_in(&q, 1, simple_func, &touched));
+    equeue_dispatch(&q, 20);
+    TEST_ASSERT_EQUAL_UINT8(2, touched);
+    TEST_ASSERT_NULL(equeue_alloc(&q, 2 * TEST_EQUEUE_SIZE));
+
+    struct equeue_stats stats;
+    equeue_get_stats(&q, &stats);
+#if EQUEUE_STATS
+    TEST_ASSERT_EQUAL_UINT(2, stats.dispatched);
+    TEST_ASSERT_TRUE(stats.max_runtime >= 10);
+    TEST_ASSERT_TRUE(stats.max_lateness >= 8);
+    unsigned late = 0, slow = 0;
+    for (int i = 0; i < EQUEUE_STATS_BUCKETS; i++) {
+        late += stats.lateness[i];
+        slow += stats.runtime[i];
+    }
+    TEST_ASSERT_EQUAL_UINT(2, late);
+    TEST_ASSERT_EQUAL_UINT(2, slow);
+    TEST_ASSERT_TRUE(stats.runtime[4] >= 1);
+    TEST_ASSERT_TRUE(stats.max_used_size >= 2 * EQUEUE_EVENT_SIZE);
+    TEST_ASSERT_EQUAL_UINT(2, stats.max_chunk_count);
+    TEST_ASSERT_EQUAL_UINT(1, stats.alloc_failures);
+
+    equeue_reset_stats(&q);
+    equeue_get_stats(&q, &stats);
+    TEST_ASSERT_EQUAL_UINT(0, stats.dispatched);
+    TEST_ASSERT_EQUAL_UINT(0, stats.alloc_failures);
+    TEST_ASSERT_EQUAL_UINT(0, stats.max_used_size);
+    TEST_ASSERT_EQUAL_UINT(2, stats.max_chunk_count);
+#else
+    TEST_ASSERT_EQUAL_UINT(0, stats.dispatched);
+    TEST_ASSERT_EQUAL_UINT(0, stats.alloc_failures);
+#endif
+
+    equeue_destroy(&q);
+}
+
 struct user_allocated_event {
     struct equeue_event e;
     uint8_t touched;
 };
 
+/** Test that freed events are reused by events of the same size, whatever else has been freed.
+ *
+ *  Given queue is initialized and events of several sizes have been allocated and freed.
+ *  When an event of one of those sizes is allocated.
+ *  Then the freed event of that size is reused and the memory statistics account for it.
+ *  When the slab is used up.
+ *  Then a larger freed event is reused for a smaller allocation.
+ */
+static void test_equeue_size_classes()
+{
+    const size_t sizes[] = { 0, 8 * sizeof(void *), 2 * sizeof(void *), 64 * sizeof(void *), 4 * sizeof(void *) };
+    const size_t count = sizeof(sizes) / sizeof(sizes[0]);
+
+    equeue_t q;
+    int err = equeue_create(&q, count * EQUEUE_EVENT_SIZE + 80 * sizeof(void *));
+    TEST_ASSERT_EQUAL_INT(0, err);
+
+    struct equeue_mem_stats stats;
+    equeue_get_mem_stats(&q, &stats);
+    TEST_ASSERT_EQUAL_UINT(0, stats.used_size);
+    TEST_ASSERT_EQUAL_UINT(0, stats.chunk_count);
+    TEST_ASSERT_EQUAL_UINT(0, stats.fragmentation);
+    size_t total = stats.slab_size;
+
+    void *events[count];
+    for (size_t i = 0; i < count; i++) {
+        events[i] = equeue_alloc(&q, sizes[i]);
+        TEST_ASSERT_NOT_NULL(events[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        equeue_dealloc(&q, events[i]);
+    }
+
+    equeue_get_mem_stats(&q, &stats);
+    TEST_ASSERT_EQUAL_UINT(0, stats.used_size);
+    TEST_ASSERT_EQUAL_UINT(count, stats.chunk_count);
+    TEST_ASSERT_EQUAL_UINT(total, stats.chunk_size + stats.slab_size);
+    TEST_ASSERT_TRUE(stats.fragmentation > 0);
+
+    // each size gets its own event back, in any order
+    for (size_t i = count; i > 0; i--) {
+        TEST_ASSERT_EQUAL_PTR(events[i - 1], equeue_alloc(&q, sizes[i - 1]));
+    }
+    equeue_get_mem_stats(&q, &stats);
+    TEST_ASSERT_EQUAL_UINT(0, stats.chunk_count);
+    TEST_ASSERT_EQUAL_UINT(total - stats.slab_size, stats.used_size);
+
+    // once the slab is used up, larger events are used for smaller allocations
+    equeue_dealloc(&q, events[3]);
+    void *p;
+    do {
+        p = equeue_alloc(&q, 0);
+        TEST_ASSERT_NOT_NULL(p);
+    } while (p != events[3]);
+    equeue_get_mem_stats(&q, &stats);
+    TEST_ASSERT_EQUAL_UINT(0, stats.chunk_count);
+    TEST_ASSERT_EQUAL_UINT(total - stats.slab_size, stats.used_size);
+
+    equeue_destroy(&q);
+}
+
 /** Test that equeue executes user allocated events passed by equeue_post.
  *
  *  Given queue is initialized and its size is set to store one event at max in its internal memory.
@@ -1073,6 +1465,8 @@ Case cases[] = {
     Case("sloth test", test_equeue_sloth),
 
     Case("multithread test", test_equeue_multithread),
+    Case("multiple producers test", test_equeue_multiple_producers<200>),
+    Case("lock-free post test", test_equeue_lockfree_post),
 
     Case("background test", test_equeue_background),
     Case("chain test", test_equeue_chain),
@@ -1083,6 +1477,10 @@ Case cases[] = {
     Case("multithreaded barrage test", test_equeue_multithreaded_barrage<10>),
     Case("break request cleared on timeout test", test_equeue_break_request_cleared_on_timeout),
     Case("sibling test", test_equeue_sibling),
+    Case("size class test", test_equeue_size_classes),
+    Case("dispatch slice test", test_equeue_dispatch_slice),
+    Case("concurrent dispatch slice test", test_equeue_concurrent_dispatch_slice<20>),
+    Case("stats test", test_equeue_stats),
     Case("user allocated event test", test_equeue_user_allocated_event_post)
 
 };
@@ -15,6 +15,9 @@
  * limitations under the License.
  */
 #include "mbed_events.h"
+#include "rtos/ThisThread.h"
+
+#include <atomic>
 #include "greentea-client/test_env.h"
 #include "unity.h"
 #include "utest.h"
@@ -509,6 +512,84 @@ void static_events_queue_test()
     ue4.cancel();
 }
 
+// Testing EventQueuePool
+std::atomic<uint32_t> pool_running;
+std::atomic<uint32_t> pool_max_running;
+std::atomic<uint32_t> pool_done;
+
+void pool_func(std::chrono::milliseconds delay)
+{
+    uint32_t running = ++pool_running;
+    uint32_t max_running = pool_max_running;
+    while (running > max_running && !pool_max_running.compare_exchange_weak(max_running, running)) {
+    }
+
+    rtos::ThisThread::sleep_for(delay);
+
+    pool_running--;
+    pool_done++;
+}
+
+unsigned pool_order[10];
+
+void pool_keyed_func(unsigned index)
+{
+    pool_order[pool_done] = index;
+    pool_func(1ms);
+}
+
+void pool_wait_for(uint32_t done)
+{
+    for (int i = 0; i < 100 && pool_done < done; i++) {
+        rtos::ThisThread::sleep_for(5ms);
+    }
+    TEST_ASSERT_EQUAL_UINT32(done, pool_done);
+}
+
+/** Test that an EventQueuePool runs events on several workers.
+ *
+ *  Given a pool with two workers.
+ *  When a slow keyed event and then several unkeyed events are posted.
+ *  Then the unkeyed events all run while the slow event is still running, including any
+ *  that were given to the busy worker.
+ *  When several events with the same key are posted.
+ *  Then they run one at a time, in the order they were posted.
+ */
+void event_queue_pool_test()
+{
+    EventQueuePool pool(2, TEST_EQUEUE_SIZE);
+    TEST_ASSERT_EQUAL_UINT(2, pool.workers());
+
+    pool_running = 0;
+    pool_max_running = 0;
+    pool_done = 0;
+
+    TEST_ASSERT_NOT_EQUAL(0, pool.call_keyed(0, pool_func, 100ms));
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_NOT_EQUAL(0, pool.call(pool_func, 1ms));
+    }
+    pool_wait_for(4);
+    TEST_ASSERT_EQUAL_UINT32(2, pool_max_running);
+    pool_wait_for(5);
+
+    int id = pool.call_in(100ms, pool_func, 1ms);
+    TEST_ASSERT_NOT_EQUAL(0, id);
+    TEST_ASSERT_INT_WITHIN(ALLOWED_TIME_LEFT_TOLERANCE_MS, 100, pool.time_left(id));
+    TEST_ASSERT_TRUE(pool.cancel(id));
+    TEST_ASSERT_FALSE(pool.cancel(id));
+
+    pool_max_running = 0;
+    pool_done = 0;
+    for (unsigned i = 0; i < 10; i++) {
+        TEST_ASSERT_NOT_EQUAL(0, pool.call_keyed(7, pool_keyed_func, i));
+    }
+    pool_wait_for(10);
+    TEST_ASSERT_EQUAL_UINT32(1, pool_max_running);
+    for (unsigned i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL_UINT(i, pool_order[i]);
+    }
+}
+
 // Test setup
 utest::v1::status_t test_setup(const size_t number_of_cases)
 {
@@ -536,7 +617,8 @@ const Case cases[] = {
 
     Case("Testing time_left", time_left_test),
     Case("Testing mixed dynamic & static events queue", mixed_dynamic_static_events_queue_test),
-    Case("Testing static events queue", static_events_queue_test)
+    Case("Testing static events queue", static_events_queue_test),
+    Case("Testing event queue pool", event_queue_pool_test)
 
 };
 
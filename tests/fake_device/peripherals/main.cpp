@@ -0,0 +1,402 @@
+/*
+ * Tests for the simulated UART, CAN, SPI and I2C peripherals.  Each bus is looped back (by an echoing host thread
+ * or device model), and the firmware side moves data through it from an ISR the way a driver would.
+ */
+
+#include "cmsis_os2.h"
+#include "platform/mbed_critical.h"
+#include "rtxoff_clock.h"
+#include "rtxoff_nvic.h"
+#include "SimulatedPeripherals.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using namespace utest::v1;
+
+#define TEST_UART_IRQ 40
+#define TEST_CAN_IRQ 41
+#define TEST_SPI_IRQ 42
+#define TEST_I2C_IRQ 43
+
+// Slow enough rates that each unit takes around a millisecond, so the bus thread wakes up for each one
+#define TEST_UART_BAUD 9600
+#define TEST_CAN_BITRATE 125000
+#define TEST_SPI_CLOCK_HZ 10000
+#define TEST_I2C_CLOCK_HZ 10000
+
+#define TEST_BYTE_COUNT 32
+#define TEST_FRAME_COUNT 16
+
+// Byte that the simulated I2C device doesn't acknowledge
+#define TEST_I2C_NACK_BYTE 0xAA
+
+// Longest that a transfer may take beyond its modeled time, for host scheduling and bus thread wakeups
+#define TEST_TIMING_SLACK std::chrono::milliseconds(50)
+#define TEST_TRANSFER_TIMEOUT std::chrono::seconds(5)
+
+using sim::SimCanFrame;
+
+static RTXClock::duration bit_time(uint32_t bits, uint32_t rate)
+{
+    return std::chrono::duration_cast<RTXClock::duration>(std::chrono::nanoseconds(static_cast<int64_t>(bits) * 1000000000 / rate));
+}
+
+/**
+ * Firmware side of a transfer, serviced from the peripheral's ISR like an interrupt driven driver: it refills
+ * the transmit FIFO and empties the receive FIFO until everything has come back.
+ */
+class Transfer {
+public:
+    virtual ~Transfer() = default;
+
+    // Move data between the FIFOs and the buffers.  Called from the ISR, or with interrupts masked.
+    virtual void service() = 0;
+
+    std::atomic<bool> done{false};
+    RTXClock::time_point done_time;
+    uint32_t vector_calls = 0;
+};
+
+template<typename Peripheral, typename T>
+class BufferTransfer : public Transfer {
+public:
+    BufferTransfer(Peripheral &peripheral, const T *tx_data, T *rx_data, size_t count)
+        : _peripheral(peripheral), _tx_data(tx_data), _rx_data(rx_data), _count(count), _sent(0), _received(0)
+    {
+    }
+
+    void service() override
+    {
+        T unit;
+        while (_received < _count && _peripheral.read(unit)) {
+            _rx_data[_received++] = unit;
+        }
+        while (_sent < _count && _peripheral.writable()) {
+            _peripheral.write(_tx_data[_sent++]);
+        }
+        if (_received == _count && !done) {
+            done_time = RTXClock::now();
+            done = true;
+        }
+    }
+
+private:
+    Peripheral &_peripheral;
+    const T *_tx_data;
+    T *_rx_data;
+    size_t _count;
+    size_t _sent;
+    size_t _received;
+};
+
+static Transfer *active_transfer;
+
+static void transfer_isr()
+{
+    ++active_transfer->vector_calls;
+    active_transfer->service();
+}
+
+/**
+ * Run a transfer through a peripheral's interrupt.
+ * @return kernel time from starting the transfer until the last unit came back, or the timeout
+ */
+static RTXClock::duration run_transfer(Transfer &transfer, IRQn_Type irq)
+{
+    active_transfer = &transfer;
+    NVIC_SetVector(irq, transfer_isr);
+    NVIC_EnableIRQ(irq);
+
+    RTXClock::time_point start = RTXClock::now();
+
+    // mask interrupts so that the ISR doesn't write to the transmit FIFO at the same time
+    core_util_critical_section_enter();
+    transfer.service();
+    core_util_critical_section_exit();
+
+    // Busy-wait like firmware polling a flag.  This also makes time pass with the process clock, which only
+    // runs while the program is using the CPU.
+    RTXClock::time_point timeout = start + TEST_TRANSFER_TIMEOUT;
+    while (!transfer.done && RTXClock::now() < timeout) {
+    }
+
+    NVIC_DisableIRQ(irq);
+    NVIC_ClearPendingIRQ(irq);
+    active_transfer = nullptr;
+
+    TEST_ASSERT_TRUE_MESSAGE(transfer.done, "transfer timed out");
+    return transfer.done_time - start;
+}
+
+static void assert_transfer_time(RTXClock::duration elapsed, RTXClock::duration modeled)
+{
+    TEST_ASSERT_TRUE_MESSAGE(elapsed >= modeled, "transfer was faster than the modeled rate");
+    TEST_ASSERT_TRUE_MESSAGE(elapsed <= modeled + modeled + TEST_TIMING_SLACK, "transfer was much slower than the modeled rate");
+}
+
+static void assert_irq_counts(sim::PeripheralStats const &stats, Transfer const &transfer, uint64_t units)
+{
+    // each unit raises at most an interrupt when it arrives and one when it empties the transmit FIFO, and
+    // interrupts raised before the ISR has run coalesce
+    TEST_ASSERT_TRUE(transfer.vector_calls >= 1);
+    TEST_ASSERT_TRUE(transfer.vector_calls <= stats.irqs);
+    TEST_ASSERT_TRUE(stats.irqs <= 2 * units);
+}
+
+/**
+ * Host end of an asynchronous link that sends back everything the firmware transmits.
+ */
+template<typename T>
+class HostEcho {
+public:
+    explicit HostEcho(sim::SimulatedLink<T> &link)
+        : _link(link), _stopping(false), _thread(&HostEcho::run, this)
+    {
+    }
+
+    ~HostEcho()
+    {
+        _stopping = true;
+        _thread.join();
+    }
+
+private:
+    void run()
+    {
+        T unit;
+        while (!_stopping) {
+            if (_link.host_receive(unit)) {
+                _link.host_send(unit);
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+
+    sim::SimulatedLink<T> &_link;
+    std::atomic<bool> _stopping;
+    std::thread _thread;
+};
+
+static void fill_bytes(uint8_t *data, size_t count)
+{
+    for (size_t index = 0; index < count; ++index) {
+        data[index] = static_cast<uint8_t>(index * 7 + 3);
+    }
+}
+
+/** Test that a looped back UART carries bytes at its baud rate.
+ *
+ *  Given a UART whose host end sends back every byte it receives.
+ *  When the firmware transmits bytes from its ISR and reads the echoes.
+ *  Then the same bytes come back, taking at least a frame time per byte plus one for the last echo, without overruns.
+ */
+static void test_uart_loopback()
+{
+    sim::SimulatedUart uart(TEST_UART_IRQ, TEST_UART_BAUD);
+    sim::SimulatedBus bus;
+    bus.attach(uart);
+    bus.start();
+    HostEcho<uint8_t> echo(uart);
+
+    uint8_t tx_data[TEST_BYTE_COUNT];
+    uint8_t rx_data[TEST_BYTE_COUNT] = {};
+    fill_bytes(tx_data, TEST_BYTE_COUNT);
+    BufferTransfer<sim::SimulatedUart, uint8_t> transfer(uart, tx_data, rx_data, TEST_BYTE_COUNT);
+
+    RTXClock::duration elapsed = run_transfer(transfer, TEST_UART_IRQ);
+
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(tx_data, rx_data, TEST_BYTE_COUNT);
+    assert_transfer_time(elapsed, bit_time(10 * (TEST_BYTE_COUNT + 1), TEST_UART_BAUD));
+
+    sim::PeripheralStats stats = uart.stats();
+    TEST_ASSERT_EQUAL_UINT64(TEST_BYTE_COUNT, stats.transmitted);
+    TEST_ASSERT_EQUAL_UINT64(TEST_BYTE_COUNT, stats.received);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.overruns);
+    assert_irq_counts(stats, transfer, TEST_BYTE_COUNT);
+}
+
+/** Test that a UART counts bytes that arrive while its receive FIFO is full as overruns.
+ *
+ *  Given a UART with a 16 byte receive FIFO whose interrupt is disabled.
+ *  When the host sends 20 bytes.
+ *  Then the first 16 are in the FIFO and the other 4 are counted as overruns.
+ */
+static void test_uart_overrun()
+{
+    const size_t fifo_depth = 16;
+    const size_t sent = 20;
+
+    sim::SimulatedUart uart(TEST_UART_IRQ, TEST_UART_BAUD * 12, fifo_depth);
+    sim::SimulatedBus bus;
+    bus.attach(uart);
+    bus.start();
+
+    uint8_t tx_data[sent];
+    fill_bytes(tx_data, sent);
+    for (size_t index = 0; index < sent; ++index) {
+        uart.host_send(tx_data[index]);
+    }
+
+    RTXClock::time_point timeout = RTXClock::now() + TEST_TRANSFER_TIMEOUT;
+    while (uart.host_in_flight() != 0 && RTXClock::now() < timeout) {
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, uart.host_in_flight());
+
+    sim::PeripheralStats stats = uart.stats();
+    TEST_ASSERT_EQUAL_UINT64(fifo_depth, stats.received);
+    TEST_ASSERT_EQUAL_UINT64(sent - fifo_depth, stats.overruns);
+    TEST_ASSERT_EQUAL_UINT32(fifo_depth, stats.rx_high_water);
+    TEST_ASSERT_TRUE(stats.irqs >= 1);
+
+    for (size_t index = 0; index < fifo_depth; ++index) {
+        uint8_t byte;
+        TEST_ASSERT_TRUE(uart.read(byte));
+        TEST_ASSERT_EQUAL_UINT8(tx_data[index], byte);
+    }
+    TEST_ASSERT_FALSE(uart.readable());
+
+    NVIC_ClearPendingIRQ(TEST_UART_IRQ);
+}
+
+/** Test that a looped back CAN controller carries frames at its bit rate.
+ *
+ *  Given a CAN controller whose host end sends back every frame it receives.
+ *  When the firmware transmits frames with 8 data bytes from its ISR and reads the echoes.
+ *  Then the same frames come back, taking at least 111 bit times per frame plus one frame for the last echo.
+ */
+static void test_can_loopback()
+{
+    sim::SimulatedCan can(TEST_CAN_IRQ, TEST_CAN_BITRATE);
+    sim::SimulatedBus bus;
+    bus.attach(can);
+    bus.start();
+    HostEcho<SimCanFrame> echo(can);
+
+    SimCanFrame tx_frames[TEST_FRAME_COUNT];
+    SimCanFrame rx_frames[TEST_FRAME_COUNT];
+    for (size_t index = 0; index < TEST_FRAME_COUNT; ++index) {
+        tx_frames[index].id = 0x100 + index;
+        tx_frames[index].len = 8;
+        fill_bytes(tx_frames[index].data, 8);
+        tx_frames[index].data[0] = static_cast<uint8_t>(index);
+    }
+    BufferTransfer<sim::SimulatedCan, SimCanFrame> transfer(can, tx_frames, rx_frames, TEST_FRAME_COUNT);
+
+    RTXClock::duration elapsed = run_transfer(transfer, TEST_CAN_IRQ);
+
+    for (size_t index = 0; index < TEST_FRAME_COUNT; ++index) {
+        TEST_ASSERT_EQUAL_UINT32(tx_frames[index].id, rx_frames[index].id);
+        TEST_ASSERT_EQUAL_UINT8(tx_frames[index].len, rx_frames[index].len);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(tx_frames[index].data, rx_frames[index].data, 8);
+    }
+    assert_transfer_time(elapsed, bit_time((47 + 8 * 8) * (TEST_FRAME_COUNT + 1), TEST_CAN_BITRATE));
+
+    sim::PeripheralStats stats = can.stats();
+    TEST_ASSERT_EQUAL_UINT64(TEST_FRAME_COUNT, stats.transmitted);
+    TEST_ASSERT_EQUAL_UINT64(TEST_FRAME_COUNT, stats.received);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.overruns);
+    assert_irq_counts(stats, transfer, TEST_FRAME_COUNT);
+}
+
+/** Test that a SPI master with MISO looped back to MOSI clocks bytes at its clock rate.
+ *
+ *  Given a SPI master whose device returns each byte it is sent.
+ *  When the firmware writes bytes from its ISR and reads the replies.
+ *  Then the same bytes come back, taking at least 8 clock cycles per byte.
+ */
+static void test_spi_loopback()
+{
+    sim::SimulatedSpi spi(TEST_SPI_IRQ, TEST_SPI_CLOCK_HZ, [](uint8_t mosi) {
+        return mosi;
+    });
+    sim::SimulatedBus bus;
+    bus.attach(spi);
+    bus.start();
+
+    uint8_t tx_data[TEST_BYTE_COUNT];
+    uint8_t rx_data[TEST_BYTE_COUNT] = {};
+    fill_bytes(tx_data, TEST_BYTE_COUNT);
+    BufferTransfer<sim::SimulatedSpi, uint8_t> transfer(spi, tx_data, rx_data, TEST_BYTE_COUNT);
+
+    RTXClock::duration elapsed = run_transfer(transfer, TEST_SPI_IRQ);
+
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(tx_data, rx_data, TEST_BYTE_COUNT);
+    assert_transfer_time(elapsed, bit_time(8 * TEST_BYTE_COUNT, TEST_SPI_CLOCK_HZ));
+    TEST_ASSERT_TRUE(spi.idle());
+
+    sim::PeripheralStats stats = spi.stats();
+    TEST_ASSERT_EQUAL_UINT64(TEST_BYTE_COUNT, stats.transmitted);
+    TEST_ASSERT_EQUAL_UINT64(TEST_BYTE_COUNT, stats.received);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.overruns);
+    assert_irq_counts(stats, transfer, TEST_BYTE_COUNT);
+}
+
+/** Test that an I2C master clocks bytes at its clock rate and counts the ones that aren't acknowledged.
+ *
+ *  Given an I2C master whose device echoes each byte, and acknowledges all but one value.
+ *  When the firmware writes bytes from its ISR, including that value twice, and reads what was on SDA.
+ *  Then the same bytes come back, taking at least 9 clock cycles per byte, and two bytes weren't acknowledged.
+ */
+static void test_i2c_loopback()
+{
+    sim::SimulatedI2C i2c(TEST_I2C_IRQ, TEST_I2C_CLOCK_HZ, [](uint8_t written, bool &ack) {
+        ack = written != TEST_I2C_NACK_BYTE;
+        return written;
+    });
+    sim::SimulatedBus bus;
+    bus.attach(i2c);
+    bus.start();
+
+    uint8_t tx_data[TEST_BYTE_COUNT];
+    uint8_t rx_data[TEST_BYTE_COUNT] = {};
+    fill_bytes(tx_data, TEST_BYTE_COUNT);
+    for (size_t index = 0; index < TEST_BYTE_COUNT; ++index) {
+        if (tx_data[index] == TEST_I2C_NACK_BYTE) {
+            tx_data[index] = 0;
+        }
+    }
+    tx_data[5] = TEST_I2C_NACK_BYTE;
+    tx_data[20] = TEST_I2C_NACK_BYTE;
+    BufferTransfer<sim::SimulatedI2C, uint8_t> transfer(i2c, tx_data, rx_data, TEST_BYTE_COUNT);
+
+    RTXClock::duration elapsed = run_transfer(transfer, TEST_I2C_IRQ);
+
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(tx_data, rx_data, TEST_BYTE_COUNT);
+    assert_transfer_time(elapsed, bit_time(9 * TEST_BYTE_COUNT, TEST_I2C_CLOCK_HZ));
+    TEST_ASSERT_EQUAL_UINT64(2, i2c.nacks());
+
+    sim::PeripheralStats stats = i2c.stats();
+    TEST_ASSERT_EQUAL_UINT64(TEST_BYTE_COUNT, stats.transmitted);
+    TEST_ASSERT_EQUAL_UINT64(TEST_BYTE_COUNT, stats.received);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.overruns);
+    assert_irq_counts(stats, transfer, TEST_BYTE_COUNT);
+}
+
+Case cases[] = {
+    Case("UART loopback test", test_uart_loopback),
+    Case("UART overrun test", test_uart_overrun),
+    Case("CAN loopback test", test_can_loopback),
+    Case("SPI loopback test", test_spi_loopback),
+    Case("I2C loopback test", test_i2c_loopback),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(60, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
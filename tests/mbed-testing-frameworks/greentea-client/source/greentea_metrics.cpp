@@ -47,6 +47,7 @@ static SingletonPtr<CircularBuffer<thread_info_t, THREAD_BUF_COUNT> > queue;
 #endif
 
 #if defined(MBED_CPU_STATS_ENABLED)
+#include "mbed_stats.h"
 static void send_CPU_info(void);
 #endif
 
@@ -0,0 +1,263 @@
+/*
+ * Microbenchmark for putting messages into and getting them out of a message queue.
+ *
+ * Each round fills a queue to the given depth with osMessageQueuePut(), then drains it with
+ * osMessageQueueGet(), checking that messages come out highest priority first and FIFO within
+ * a priority.  Priority mixes:
+ *  - same:      every message has priority 0
+ *  - 4 levels:  random priorities from 0 to 3
+ *  - random:    random priorities from 0 to 255
+ *  - ascending: each message has a higher priority than the one before (wrapping at 255), so
+ *               it goes in ahead of everything already in the queue
+ *
+ * Then it compares osMessageQueuePut()/osMessageQueueGet() with the zero-copy calls from rtxoff_msgqueue.h for
+ * different message sizes.  Either way, the producer fills in every byte of each message and the consumer reads
+ * every byte; with the zero-copy calls they do so in the queue's memory instead of in their own buffers.
+ *
+ * Usage: msgqueue_benchmark
+ */
+
+#include "cmsis_os2.h"
+#include "mbed_rtxoff_storage.h"
+#include "rtxoff_msgqueue.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+// Number of messages put and got for each depth and priority mix
+#define MESSAGES_PER_RUN 262144
+
+enum class PriorityMix {
+    SAME,
+    FOUR_LEVELS,
+    RANDOM,
+    ASCENDING
+};
+
+static const char *mix_name(PriorityMix mix)
+{
+    switch (mix) {
+        case PriorityMix::SAME:
+            return "same";
+        case PriorityMix::FOUR_LEVELS:
+            return "4 levels";
+        case PriorityMix::RANDOM:
+            return "random";
+        default:
+            return "ascending";
+    }
+}
+
+static double messages_per_second(bench_clock::duration elapsed, size_t count)
+{
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    return seconds > 0 ? count / seconds : 0;
+}
+
+static void benchmark(uint32_t depth, PriorityMix mix)
+{
+    // the queue uses its own memory, so that deep queues don't run out of dynamic memory
+    mbed_rtos_storage_msg_queue_t cb;
+    std::vector<uint64_t> data((osRtxMessageQueueMemSize(depth, sizeof(uint32_t)) + 7) / 8);
+
+    osMessageQueueAttr_t attr = {};
+    attr.name = "benchmark";
+    attr.cb_mem = &cb;
+    attr.cb_size = sizeof(cb);
+    attr.mq_mem = data.data();
+    attr.mq_size = data.size() * sizeof(uint64_t);
+
+    osMessageQueueId_t queue = osMessageQueueNew(depth, sizeof(uint32_t), &attr);
+    if (queue == nullptr) {
+        fprintf(stderr, "could not create a queue of depth %" PRIu32 "\n", depth);
+        exit(1);
+    }
+
+    // pick the priorities up front, so that the random number generator isn't timed
+    std::mt19937 random(depth);
+    std::vector<uint8_t> priorities(depth);
+
+    bench_clock::duration put_time(0);
+    bench_clock::duration get_time(0);
+    size_t rounds = MESSAGES_PER_RUN / depth;
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (uint32_t i = 0; i < depth; i++) {
+            switch (mix) {
+                case PriorityMix::SAME:
+                    priorities[i] = 0;
+                    break;
+                case PriorityMix::FOUR_LEVELS:
+                    priorities[i] = random() % 4;
+                    break;
+                case PriorityMix::RANDOM:
+                    priorities[i] = random() % 256;
+                    break;
+                case PriorityMix::ASCENDING:
+                    priorities[i] = i % 256;
+                    break;
+            }
+        }
+
+        bench_clock::time_point start = bench_clock::now();
+        for (uint32_t i = 0; i < depth; i++) {
+            if (osMessageQueuePut(queue, &i, priorities[i], 0) != osOK) {
+                fprintf(stderr, "put failed\n");
+                exit(1);
+            }
+        }
+        bench_clock::time_point filled = bench_clock::now();
+
+        // the sequence number of the last message seen at each priority, to check FIFO order
+        int64_t last_sequence[256];
+        for (int64_t &sequence : last_sequence) {
+            sequence = -1;
+        }
+        int last_priority = 256;
+
+        for (uint32_t i = 0; i < depth; i++) {
+            uint32_t sequence;
+            uint8_t priority;
+            if (osMessageQueueGet(queue, &sequence, &priority, 0) != osOK) {
+                fprintf(stderr, "get failed\n");
+                exit(1);
+            }
+            if (priority > last_priority || static_cast<int64_t>(sequence) <= last_sequence[priority]
+                    || priorities[sequence] != priority) {
+                fprintf(stderr, "messages came out of order\n");
+                exit(1);
+            }
+            last_priority = priority;
+            last_sequence[priority] = sequence;
+        }
+        bench_clock::time_point drained = bench_clock::now();
+
+        put_time += filled - start;
+        get_time += drained - filled;
+    }
+
+    osMessageQueueDelete(queue);
+
+    size_t count = rounds * depth;
+    printf("%-10s depth %6" PRIu32 " %14.0f puts/s %14.0f gets/s\n",
+           mix_name(mix), depth, messages_per_second(put_time, count), messages_per_second(get_time, count));
+}
+
+static uint32_t read_message(const uint8_t *msg, uint32_t size)
+{
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        sum += msg[i];
+    }
+    return sum;
+}
+
+static void benchmark_zero_copy(uint32_t depth, uint32_t msg_size)
+{
+    mbed_rtos_storage_msg_queue_t cb;
+    std::vector<uint64_t> data((osRtxMessageQueueMemSize(depth, msg_size) + 7) / 8);
+
+    osMessageQueueAttr_t attr = {};
+    attr.name = "benchmark";
+    attr.cb_mem = &cb;
+    attr.cb_size = sizeof(cb);
+    attr.mq_mem = data.data();
+    attr.mq_size = data.size() * sizeof(uint64_t);
+
+    osMessageQueueId_t queue = osMessageQueueNew(depth, msg_size, &attr);
+    if (queue == nullptr) {
+        fprintf(stderr, "could not create a queue of %" PRIu32 " byte messages\n", msg_size);
+        exit(1);
+    }
+
+    std::vector<uint8_t> buffer(msg_size);
+    size_t rounds = MESSAGES_PER_RUN / depth;
+    uint32_t expected = static_cast<uint32_t>(rounds) * depth * msg_size;
+
+    // copying
+    uint32_t sum = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t round = 0; round < rounds; round++) {
+        for (uint32_t i = 0; i < depth; i++) {
+            memset(buffer.data(), 1, msg_size);
+            if (osMessageQueuePut(queue, buffer.data(), 0, 0) != osOK) {
+                fprintf(stderr, "put failed\n");
+                exit(1);
+            }
+        }
+        for (uint32_t i = 0; i < depth; i++) {
+            if (osMessageQueueGet(queue, buffer.data(), nullptr, 0) != osOK) {
+                fprintf(stderr, "get failed\n");
+                exit(1);
+            }
+            sum += read_message(buffer.data(), msg_size);
+        }
+    }
+    bench_clock::duration copy_time = bench_clock::now() - start;
+    if (sum != expected) {
+        fprintf(stderr, "copied messages were corrupted\n");
+        exit(1);
+    }
+
+    // zero-copy
+    sum = 0;
+    start = bench_clock::now();
+    for (size_t round = 0; round < rounds; round++) {
+        for (uint32_t i = 0; i < depth; i++) {
+            void *msg = osMessageQueueReserve(queue, 0);
+            if (msg == nullptr) {
+                fprintf(stderr, "reserve failed\n");
+                exit(1);
+            }
+            memset(msg, 1, msg_size);
+            osMessageQueueCommit(queue, msg, 0);
+        }
+        for (uint32_t i = 0; i < depth; i++) {
+            void *msg = osMessageQueueBorrow(queue, nullptr, 0);
+            if (msg == nullptr) {
+                fprintf(stderr, "borrow failed\n");
+                exit(1);
+            }
+            sum += read_message(static_cast<uint8_t *>(msg), msg_size);
+            osMessageQueueRelease(queue, msg);
+        }
+    }
+    bench_clock::duration zero_copy_time = bench_clock::now() - start;
+    if (sum != expected) {
+        fprintf(stderr, "zero-copy messages were corrupted\n");
+        exit(1);
+    }
+
+    osMessageQueueDelete(queue);
+
+    size_t count = rounds * depth;
+    printf("%6" PRIu32 " byte messages %14.0f copied/s %14.0f zero-copy/s\n",
+           msg_size, messages_per_second(copy_time, count), messages_per_second(zero_copy_time, count));
+}
+
+}
+
+extern "C" int mbed_start()
+{
+    for (PriorityMix mix : { PriorityMix::SAME, PriorityMix::FOUR_LEVELS, PriorityMix::RANDOM, PriorityMix::ASCENDING }) {
+        for (uint32_t depth : { 16, 256, 4096 }) {
+            benchmark(depth, mix);
+        }
+    }
+
+    printf("\n");
+    for (uint32_t msg_size : { 4, 64, 1024, 8192 }) {
+        benchmark_zero_copy(16, msg_size);
+    }
+
+    exit(0);
+}
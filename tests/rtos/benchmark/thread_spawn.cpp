@@ -0,0 +1,113 @@
+/*
+ * Microbenchmark for creating and exiting threads.
+ *
+ * Each RTX thread runs on a host thread, so without the host thread pool every osThreadNew()
+ * creates a host thread and every exit destroys one.  This measures how many short-lived threads
+ * per second the kernel can run, for workloads like thread-per-request servers.  The result
+ * depends on RTXOFF_THREAD_POOL_SIZE, which is printed with the results.
+ *
+ * Usage: thread_spawn_benchmark
+ */
+
+#include "cmsis_os2.h"
+#include "mbed_rtxoff_storage.h"
+#include "RTX_Config.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+static uint32_t ran = 0;
+
+static void count_func(void *)
+{
+    ran++;
+}
+
+static double threads_per_second(bench_clock::duration elapsed, size_t count)
+{
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    return seconds > 0 ? count / seconds : 0;
+}
+
+// Threads use their own control blocks, like rtos::Thread, so that bursts don't run out of dynamic memory
+static osThreadId_t spawn(osPriority_t priority, mbed_rtos_storage_thread_t *cb)
+{
+    osThreadAttr_t attr = {};
+    attr.name = "spawned";
+    attr.attr_bits = osThreadJoinable;
+    attr.priority = priority;
+    attr.cb_mem = cb;
+    attr.cb_size = sizeof(*cb);
+
+    osThreadId_t thread = osThreadNew(count_func, nullptr, &attr);
+    if (thread == nullptr) {
+        fprintf(stderr, "could not create a thread\n");
+        exit(1);
+    }
+    return thread;
+}
+
+/*
+ * Create n threads one at a time, each with a higher priority than this one so that it runs
+ * and exits straight away, and join each one.
+ */
+static void benchmark_sequential(size_t n)
+{
+    mbed_rtos_storage_thread_t cb;
+
+    ran = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        osThreadJoin(spawn(osPriorityAboveNormal, &cb));
+    }
+    bench_clock::duration elapsed = bench_clock::now() - start;
+
+    printf("%-28s %8zu threads %10" PRIu32 " ran %12.0f threads/s\n",
+           "spawn and join", n, ran, threads_per_second(elapsed, n));
+}
+
+/*
+ * Create a burst of n threads with a lower priority than this one, then join them all, so all
+ * of them exist at once.
+ */
+static void benchmark_burst(size_t n)
+{
+    std::vector<osThreadId_t> threads(n);
+    std::vector<mbed_rtos_storage_thread_t> cbs(n);
+
+    ran = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        threads[i] = spawn(osPriorityBelowNormal, &cbs[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        osThreadJoin(threads[i]);
+    }
+    bench_clock::duration elapsed = bench_clock::now() - start;
+
+    printf("%-28s %8zu threads %10" PRIu32 " ran %12.0f threads/s\n",
+           "burst spawn then join", n, ran, threads_per_second(elapsed, n));
+}
+
+}
+
+extern "C" int mbed_start()
+{
+    printf("RTXOFF_THREAD_POOL_SIZE = %d\n", RTXOFF_THREAD_POOL_SIZE);
+
+    for (size_t n : { 100, 1000, 10000 }) {
+        benchmark_sequential(n);
+    }
+    for (size_t n : { 16, 64, 256 }) {
+        benchmark_burst(n);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,182 @@
+/*
+ * Tests for running several independent RTXOff kernels (boards) in one process.
+ */
+
+#include "cmsis_os2.h"
+#include "rtxoff_board.h"
+#include "rtxoff_nvic.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace utest::v1;
+
+#define TEST_IRQ 30
+#define TEST_WORKER_COUNT 2
+#define TEST_WORKER_DELAYS 5
+#define TEST_WORKER_DELAY_MS 10
+#define TEST_MAX_THREADS 16
+
+// How long to wait for the other board, in 1ms delays
+#define TEST_BOARD_TIMEOUT_MS 2000
+
+#define FLAG_IRQ 0x1U
+
+// What one board saw.  Written by that board's threads, and only read once it has set done.
+struct BoardResults {
+    osThreadId_t main_thread;
+    osSemaphoreId_t workers_done;
+    std::atomic<uint32_t> worker_runs;
+    std::atomic<uint32_t> irq_count;
+    uint32_t thread_count_before;
+    uint32_t thread_count_with_workers;
+    uint32_t thread_count;
+    osThreadId_t threads[TEST_MAX_THREADS];
+    uint32_t irq_flags;
+    std::atomic<bool> irq_ready;
+    std::atomic<bool> done;
+};
+
+static BoardResults default_results;
+static BoardResults other_results;
+
+static void worker_thread(void *argument)
+{
+    BoardResults *results = static_cast<BoardResults *>(argument);
+    for (int delay = 0; delay < TEST_WORKER_DELAYS; ++delay) {
+        osDelay(TEST_WORKER_DELAY_MS);
+        results->worker_runs.fetch_add(1);
+    }
+    osSemaphoreRelease(results->workers_done);
+}
+
+// Starts the workers, records this board's threads while they exist, then waits for them
+static void run_workers(BoardResults *results)
+{
+    results->main_thread = osThreadGetId();
+    results->workers_done = osSemaphoreNew(TEST_WORKER_COUNT, 0, nullptr);
+    results->thread_count_before = osThreadGetCount();
+
+    for (int worker = 0; worker < TEST_WORKER_COUNT; ++worker) {
+        osThreadNew(worker_thread, results, nullptr);
+    }
+
+    results->thread_count_with_workers = osThreadGetCount();
+    results->thread_count = osThreadEnumerate(results->threads, TEST_MAX_THREADS);
+
+    for (int worker = 0; worker < TEST_WORKER_COUNT; ++worker) {
+        osSemaphoreAcquire(results->workers_done, osWaitForever);
+    }
+    osSemaphoreDelete(results->workers_done);
+}
+
+static void default_irq_handler()
+{
+    default_results.irq_count.fetch_add(1);
+}
+
+static void other_irq_handler()
+{
+    other_results.irq_count.fetch_add(1);
+    osThreadFlagsSet(other_results.main_thread, FLAG_IRQ);
+}
+
+static void other_board_main(void *)
+{
+    run_workers(&other_results);
+
+    // the same IRQ number as the default board's, with a different handler
+    NVIC_SetVector(TEST_IRQ, other_irq_handler);
+    NVIC_EnableIRQ(TEST_IRQ);
+    other_results.irq_ready = true;
+
+    other_results.irq_flags = osThreadFlagsWait(FLAG_IRQ, osFlagsWaitAny, TEST_BOARD_TIMEOUT_MS);
+    other_results.done = true;
+}
+
+// Waits on the kernel of the calling thread, since a host wait here would stop this board's other threads
+static bool wait_for(std::atomic<bool> &condition)
+{
+    for (int waited = 0; waited < TEST_BOARD_TIMEOUT_MS && !condition; ++waited) {
+        osDelay(1);
+    }
+    return condition;
+}
+
+static bool contains(BoardResults const &results, osThreadId_t thread)
+{
+    for (uint32_t index = 0; index < results.thread_count; ++index) {
+        if (results.threads[index] == thread) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Test that two boards run their own threads, delays and interrupts at the same time.
+ *
+ *  Given the default board and another board, each with a handler for the same IRQ number.
+ *  When both boards run threads that delay at the same time, and a host thread raises the IRQ on the other board.
+ *  Then each board only sees its own threads, all the delays finish, and only the other board's handler runs.
+ */
+static void test_two_boards()
+{
+    NVIC_SetVector(TEST_IRQ, default_irq_handler);
+    NVIC_EnableIRQ(TEST_IRQ);
+
+    // boards can't be stopped, so this is never deleted
+    RTXOffBoard *other_board = new RTXOffBoard("other");
+    other_board->start(other_board_main);
+
+    run_workers(&default_results);
+    TEST_ASSERT_TRUE(wait_for(other_results.irq_ready));
+
+    // deliver the interrupt like a simulated peripheral would, from a host thread that isn't on either board
+    std::thread peripheral([other_board]() {
+        other_board->select();
+        NVIC_SetPendingIRQ(TEST_IRQ);
+        RTXOffBoard::selectDefault();
+    });
+    peripheral.join();
+
+    TEST_ASSERT_TRUE(wait_for(other_results.done));
+
+    TEST_ASSERT_EQUAL_UINT32(TEST_WORKER_COUNT * TEST_WORKER_DELAYS, default_results.worker_runs);
+    TEST_ASSERT_EQUAL_UINT32(TEST_WORKER_COUNT * TEST_WORKER_DELAYS, other_results.worker_runs);
+
+    TEST_ASSERT_EQUAL_UINT32(default_results.thread_count_before + TEST_WORKER_COUNT, default_results.thread_count_with_workers);
+    TEST_ASSERT_EQUAL_UINT32(other_results.thread_count_before + TEST_WORKER_COUNT, other_results.thread_count_with_workers);
+    for (uint32_t index = 0; index < other_results.thread_count; ++index) {
+        TEST_ASSERT_FALSE(contains(default_results, other_results.threads[index]));
+    }
+    TEST_ASSERT_TRUE(contains(default_results, default_results.main_thread));
+    TEST_ASSERT_TRUE(contains(other_results, other_results.main_thread));
+
+    TEST_ASSERT_EQUAL_UINT32(FLAG_IRQ, other_results.irq_flags);
+    TEST_ASSERT_EQUAL_UINT32(1, other_results.irq_count);
+    TEST_ASSERT_EQUAL_UINT32(0, default_results.irq_count);
+    TEST_ASSERT_EQUAL_UINT32(0, NVIC_GetPendingIRQ(TEST_IRQ));
+
+    NVIC_DisableIRQ(TEST_IRQ);
+}
+
+Case cases[] = {
+    Case("two boards test", test_two_boards),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
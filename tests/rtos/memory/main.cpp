@@ -0,0 +1,218 @@
+/*
+ * Tests for the kernel's dynamic memory (OS_DYNAMIC_MEM_SIZE): objects created with caller memory don't use it,
+ * objects created without it fail cleanly once it is full, and deleting objects gives their memory back.
+ */
+
+#include "cmsis_os2.h"
+#include "mbed_rtxoff_storage.h"
+#include "rtxoff_stats.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <vector>
+
+using namespace utest::v1;
+
+#define TEST_QUEUE_DEPTH 8
+
+static mbed_rtos_storage_thread_t thread_cb;
+static mbed_rtos_storage_mutex_t mutex_cb;
+static mbed_rtos_storage_semaphore_t semaphore_cb;
+static mbed_rtos_storage_event_flags_t event_flags_cb;
+static mbed_rtos_storage_msg_queue_t queue_cb;
+static uint64_t queue_mem[(MBED_RTOS_STORAGE_MSG_QUEUE_MEM_SIZE(TEST_QUEUE_DEPTH, sizeof(uint32_t)) + 7) / 8];
+
+static void empty_thread(void *)
+{
+}
+
+static osThreadId_t create_joinable_thread(void *cb_mem, uint32_t cb_size)
+{
+    osThreadAttr_t attr = {};
+    attr.attr_bits = osThreadJoinable;
+    attr.cb_mem = cb_mem;
+    attr.cb_size = cb_size;
+    return osThreadNew(empty_thread, nullptr, &attr);
+}
+
+static osMessageQueueId_t create_queue(void *cb_mem, uint32_t cb_size, void *mq_mem, uint32_t mq_size)
+{
+    osMessageQueueAttr_t attr = {};
+    attr.cb_mem = cb_mem;
+    attr.cb_size = cb_size;
+    attr.mq_mem = mq_mem;
+    attr.mq_size = mq_size;
+    return osMessageQueueNew(TEST_QUEUE_DEPTH, sizeof(uint32_t), &attr);
+}
+
+static void expect_memory_unchanged(rtxoff_memory_stats_t const &before)
+{
+    rtxoff_memory_stats_t now;
+    rtxoff_stats_memory_get(&now);
+    TEST_ASSERT_EQUAL_UINT32(before.used, now.used);
+    TEST_ASSERT_EQUAL_UINT32(before.blocks, now.blocks);
+}
+
+/** Test that objects created with caller memory use it, and not the dynamic memory.
+ *
+ *  Given control blocks, and message queue storage, passed in the attributes.
+ *  When a thread, mutex, semaphore, event flags and message queue are created with them, used and deleted.
+ *  Then each object's ID is its control block, and the dynamic memory in use never changes.
+ */
+static void test_caller_memory()
+{
+    rtxoff_memory_stats_t before;
+    rtxoff_stats_memory_get(&before);
+
+    osThreadId_t thread = create_joinable_thread(&thread_cb, sizeof(thread_cb));
+    TEST_ASSERT_EQUAL_PTR(&thread_cb, thread);
+
+    osMutexAttr_t mutex_attr = {};
+    mutex_attr.cb_mem = &mutex_cb;
+    mutex_attr.cb_size = sizeof(mutex_cb);
+    osMutexId_t mutex = osMutexNew(&mutex_attr);
+    TEST_ASSERT_EQUAL_PTR(&mutex_cb, mutex);
+
+    osSemaphoreAttr_t semaphore_attr = {};
+    semaphore_attr.cb_mem = &semaphore_cb;
+    semaphore_attr.cb_size = sizeof(semaphore_cb);
+    osSemaphoreId_t semaphore = osSemaphoreNew(1, 0, &semaphore_attr);
+    TEST_ASSERT_EQUAL_PTR(&semaphore_cb, semaphore);
+
+    osEventFlagsAttr_t event_flags_attr = {};
+    event_flags_attr.cb_mem = &event_flags_cb;
+    event_flags_attr.cb_size = sizeof(event_flags_cb);
+    osEventFlagsId_t event_flags = osEventFlagsNew(&event_flags_attr);
+    TEST_ASSERT_EQUAL_PTR(&event_flags_cb, event_flags);
+
+    osMessageQueueId_t queue = create_queue(&queue_cb, sizeof(queue_cb), queue_mem, sizeof(queue_mem));
+    TEST_ASSERT_EQUAL_PTR(&queue_cb, queue);
+
+    TEST_ASSERT_EQUAL(osOK, osMutexAcquire(mutex, 0));
+    TEST_ASSERT_EQUAL(osOK, osMutexRelease(mutex));
+    TEST_ASSERT_EQUAL(osOK, osSemaphoreRelease(semaphore));
+    TEST_ASSERT_EQUAL(osOK, osSemaphoreAcquire(semaphore, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, osEventFlagsSet(event_flags, 1));
+    uint32_t message = 42;
+    TEST_ASSERT_EQUAL(osOK, osMessageQueuePut(queue, &message, 0, 0));
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueGet(queue, &message, nullptr, 0));
+    expect_memory_unchanged(before);
+
+    TEST_ASSERT_EQUAL(osOK, osThreadJoin(thread));
+    TEST_ASSERT_EQUAL(osOK, osMutexDelete(mutex));
+    TEST_ASSERT_EQUAL(osOK, osSemaphoreDelete(semaphore));
+    TEST_ASSERT_EQUAL(osOK, osEventFlagsDelete(event_flags));
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+    expect_memory_unchanged(before);
+}
+
+/** Test that objects created without caller memory are allocated from the dynamic memory, and give it back.
+ *
+ *  Given no memory passed in the attributes.
+ *  When a thread, mutex, semaphore, event flags and message queue are created, and then deleted.
+ *  Then the dynamic memory in use grows by a block for each control block and one for the queue's storage,
+ *  and goes back to what it was once they are deleted.
+ */
+static void test_dynamic_memory_returned()
+{
+    rtxoff_memory_stats_t before;
+    rtxoff_stats_memory_get(&before);
+
+    osThreadId_t thread = create_joinable_thread(nullptr, 0);
+    osMutexId_t mutex = osMutexNew(nullptr);
+    osSemaphoreId_t semaphore = osSemaphoreNew(1, 0, nullptr);
+    osEventFlagsId_t event_flags = osEventFlagsNew(nullptr);
+    osMessageQueueId_t queue = create_queue(nullptr, 0, nullptr, 0);
+    TEST_ASSERT_NOT_NULL(thread);
+    TEST_ASSERT_NOT_NULL(mutex);
+    TEST_ASSERT_NOT_NULL(semaphore);
+    TEST_ASSERT_NOT_NULL(event_flags);
+    TEST_ASSERT_NOT_NULL(queue);
+
+    rtxoff_memory_stats_t during;
+    rtxoff_stats_memory_get(&during);
+    TEST_ASSERT_EQUAL_UINT32(before.blocks + 6, during.blocks);
+    TEST_ASSERT_TRUE(during.used >= before.used + sizeof(osRtxThread_t) + sizeof(osRtxMutex_t) + sizeof(osRtxSemaphore_t)
+                     + sizeof(osRtxEventFlags_t) + sizeof(osRtxMessageQueue_t)
+                     + osRtxMessageQueueMemSize(TEST_QUEUE_DEPTH, sizeof(uint32_t)));
+    TEST_ASSERT_TRUE(during.max_used >= during.used);
+
+    TEST_ASSERT_EQUAL(osOK, osThreadJoin(thread));
+    TEST_ASSERT_EQUAL(osOK, osMutexDelete(mutex));
+    TEST_ASSERT_EQUAL(osOK, osSemaphoreDelete(semaphore));
+    TEST_ASSERT_EQUAL(osOK, osEventFlagsDelete(event_flags));
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+    expect_memory_unchanged(before);
+}
+
+/** Test that creating objects fails cleanly once the dynamic memory is full.
+ *
+ *  Given dynamic memory that has been filled up with semaphores.
+ *  When more objects of each kind are created without caller memory.
+ *  Then each creation returns NULL and counts a failure, objects with caller memory can still be created,
+ *  and the memory is all given back once the semaphores are deleted.
+ */
+static void test_out_of_memory()
+{
+    rtxoff_memory_stats_t before;
+    rtxoff_stats_memory_get(&before);
+
+    // more semaphores than can fit in the dynamic memory
+    size_t max_semaphores = before.size / sizeof(osRtxSemaphore_t) + 1;
+    std::vector<osSemaphoreId_t> semaphores;
+    while (semaphores.size() < max_semaphores) {
+        osSemaphoreId_t semaphore = osSemaphoreNew(1, 0, nullptr);
+        if (semaphore == nullptr) {
+            break;
+        }
+        semaphores.push_back(semaphore);
+    }
+    TEST_ASSERT_TRUE(semaphores.size() > 0);
+    TEST_ASSERT_TRUE(semaphores.size() < max_semaphores);
+
+    TEST_ASSERT_NULL(create_joinable_thread(nullptr, 0));
+    TEST_ASSERT_NULL(osMutexNew(nullptr));
+    TEST_ASSERT_NULL(osSemaphoreNew(1, 0, nullptr));
+    TEST_ASSERT_NULL(osEventFlagsNew(nullptr));
+    TEST_ASSERT_NULL(create_queue(nullptr, 0, nullptr, 0));
+
+    rtxoff_memory_stats_t full;
+    rtxoff_stats_memory_get(&full);
+    TEST_ASSERT_EQUAL_UINT32(before.failures + 6, full.failures);
+    TEST_ASSERT_EQUAL_UINT32(before.blocks + semaphores.size(), full.blocks);
+    TEST_ASSERT_TRUE(full.max_used >= full.used);
+
+    osMessageQueueId_t queue = create_queue(&queue_cb, sizeof(queue_cb), queue_mem, sizeof(queue_mem));
+    TEST_ASSERT_EQUAL_PTR(&queue_cb, queue);
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+
+    for (osSemaphoreId_t semaphore : semaphores) {
+        TEST_ASSERT_EQUAL(osOK, osSemaphoreDelete(semaphore));
+    }
+    expect_memory_unchanged(before);
+
+    osSemaphoreId_t semaphore = osSemaphoreNew(1, 0, nullptr);
+    TEST_ASSERT_NOT_NULL(semaphore);
+    TEST_ASSERT_EQUAL(osOK, osSemaphoreDelete(semaphore));
+}
+
+Case cases[] = {
+    Case("caller memory test", test_caller_memory),
+    Case("dynamic memory returned test", test_dynamic_memory_returned),
+    Case("out of memory test", test_out_of_memory),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,596 @@
+/*
+ * Tests for RTXOff's message queues: the order that messages come out in, including messages that ISRs have
+ * taken but that are still in the queue until the kernel post-processes the ISR's calls, and the zero-copy calls
+ * from rtxoff_msgqueue.h.
+ */
+
+#include "cmsis_os2.h"
+#include "mbed_rtxoff_storage.h"
+#include "rtxoff_msgqueue.h"
+#include "rtxoff_nvic.h"
+#include "rtxoff_stats.h"
+#include "platform/mbed_critical.h"
+#include "rtos/Mail.h"
+#include "rtos/Queue.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <random>
+#include <vector>
+
+using namespace utest::v1;
+
+#define TEST_QUEUE_DEPTH 64
+
+// IRQ whose (empty) vector is run to make the kernel post-process calls made with interrupts masked
+#define TEST_FLUSH_IRQ 10
+
+// IRQ whose vector makes zero-copy calls
+#define TEST_ZERO_COPY_IRQ 11
+
+static mbed_rtos_storage_msg_queue_t queue_cb;
+static uint64_t queue_mem[(MBED_RTOS_STORAGE_MSG_QUEUE_MEM_SIZE(TEST_QUEUE_DEPTH, sizeof(uint32_t)) + 7) / 8];
+
+// Storage sized the way RTX sizes it, which leaves no room for RTXOff's priority index
+#define TEST_QUEUE_MEM_SIZE_WITHOUT_INDEX \
+  (MBED_RTOS_STORAGE_MSG_QUEUE_MEM_SIZE(TEST_QUEUE_DEPTH, sizeof(uint32_t)) - osRtxMessageQueueIndexSize(TEST_QUEUE_DEPTH))
+
+static osMessageQueueId_t create_queue(uint32_t mq_size = sizeof(queue_mem))
+{
+    osMessageQueueAttr_t attr = {};
+    attr.name = "test";
+    attr.cb_mem = &queue_cb;
+    attr.cb_size = sizeof(queue_cb);
+    attr.mq_mem = queue_mem;
+    attr.mq_size = mq_size;
+
+    osMessageQueueId_t queue = osMessageQueueNew(TEST_QUEUE_DEPTH, sizeof(uint32_t), &attr);
+    TEST_ASSERT_NOT_NULL(queue);
+    return queue;
+}
+
+static void put(osMessageQueueId_t queue, uint32_t value, uint8_t priority)
+{
+    TEST_ASSERT_EQUAL(osOK, osMessageQueuePut(queue, &value, priority, 0));
+}
+
+static void expect_get(osMessageQueueId_t queue, uint32_t value, uint8_t priority)
+{
+    uint32_t got;
+    uint8_t got_priority;
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueGet(queue, &got, &got_priority, 0));
+    TEST_ASSERT_EQUAL_UINT32(value, got);
+    TEST_ASSERT_EQUAL_UINT8(priority, got_priority);
+}
+
+static void flush_isr_calls()
+{
+}
+
+// Messages that should be in the queue, to check what comes out of it against
+class ExpectedQueue {
+public:
+    void put(uint32_t value, uint8_t priority)
+    {
+        messages.push_back({value, priority});
+    }
+
+    // highest priority first, then first in first out
+    void expect_get(osMessageQueueId_t queue)
+    {
+        size_t next = 0;
+        for (size_t index = 1; index < messages.size(); index++) {
+            if (messages[index].priority > messages[next].priority) {
+                next = index;
+            }
+        }
+        ::expect_get(queue, messages[next].value, messages[next].priority);
+        messages.erase(messages.begin() + next);
+    }
+
+    size_t size() const
+    {
+        return messages.size();
+    }
+
+private:
+    struct Message {
+        uint32_t value;
+        uint8_t priority;
+    };
+    std::vector<Message> messages;
+};
+
+// Put and get messages in a random order, with few and then with many different priorities
+static void check_random_order(osMessageQueueId_t queue, unsigned seed)
+{
+    std::mt19937 random(seed);
+    ExpectedQueue expected;
+    uint32_t value = 0;
+
+    for (int step = 0; step < 4000; step++) {
+        if (expected.size() == 0 || (expected.size() < TEST_QUEUE_DEPTH && random() % 3 != 0)) {
+            uint8_t priority = random() % (step < 2000 ? 4 : 256);
+            put(queue, value, priority);
+            expected.put(value, priority);
+            value++;
+        } else {
+            expected.expect_get(queue);
+        }
+        TEST_ASSERT_EQUAL_UINT32(expected.size(), osMessageQueueGetCount(queue));
+    }
+
+    while (expected.size() != 0) {
+        expected.expect_get(queue);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, osMessageQueueGetCount(queue));
+}
+
+/** Test that messages come out highest priority first, and in the order they were put within a priority.
+ *
+ *  Given a message queue.
+ *  When messages with random priorities are put and got in a random order.
+ *  Then each get returns the oldest message with the highest priority in the queue.
+ */
+static void test_random_order()
+{
+    osMessageQueueId_t queue = create_queue();
+    TEST_ASSERT_NOT_NULL(queue_cb.msg_runs);
+
+    check_random_order(queue, 1);
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+}
+
+/** Test that message order is right when the queue's storage has no room for its priority index.
+ *
+ *  Given a message queue whose storage is only big enough for its messages.
+ *  When messages with random priorities are put and got in a random order.
+ *  Then each get returns the oldest message with the highest priority in the queue.
+ */
+static void test_random_order_without_index()
+{
+    osMessageQueueId_t queue = create_queue(TEST_QUEUE_MEM_SIZE_WITHOUT_INDEX);
+    TEST_ASSERT_NULL(queue_cb.msg_runs);
+
+    check_random_order(queue, 2);
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+}
+
+/** Test that queues created in caller memory don't use the kernel's dynamic memory.
+ *
+ *  Given message queues whose control block and storage are passed in, including an rtos::Queue and an rtos::Mail.
+ *  When they are created, used with messages of several priorities, and deleted.
+ *  Then the dynamic memory in use doesn't change, and each queue still has its priority index.
+ */
+static void test_caller_memory_not_from_dynamic_memory()
+{
+    rtxoff_memory_stats_t before;
+    rtxoff_stats_memory_get(&before);
+
+    osMessageQueueId_t queue = create_queue();
+    TEST_ASSERT_NOT_NULL(queue_cb.msg_runs);
+    put(queue, 1, 1);
+    put(queue, 2, 3);
+    put(queue, 3, 2);
+    expect_get(queue, 2, 3);
+    expect_get(queue, 3, 2);
+    expect_get(queue, 1, 1);
+
+    {
+        rtos::Queue<uint32_t, 8> rtos_queue;
+        static uint32_t value;
+        TEST_ASSERT_TRUE(rtos_queue.try_put(&value));
+
+        rtos::Mail<uint32_t, 8> mail;
+        uint32_t *block = mail.try_alloc();
+        TEST_ASSERT_NOT_NULL(block);
+        TEST_ASSERT_EQUAL(osOK, mail.put(block));
+
+        rtxoff_memory_stats_t during;
+        rtxoff_stats_memory_get(&during);
+        TEST_ASSERT_EQUAL_UINT32(before.used, during.used);
+        TEST_ASSERT_EQUAL_UINT32(before.blocks, during.blocks);
+    }
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+
+    rtxoff_memory_stats_t after;
+    rtxoff_stats_memory_get(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.used, after.used);
+    TEST_ASSERT_EQUAL_UINT32(before.blocks, after.blocks);
+}
+
+/** Test that a priority is forgotten once its last message has been got.
+ *
+ *  Given a message queue with messages of a few priorities.
+ *  When all the messages of one priority are got, and messages of that priority and others are put.
+ *  Then the new messages still come out in priority order.
+ */
+static void test_last_message_of_priority()
+{
+    osMessageQueueId_t queue = create_queue();
+
+    put(queue, 1, 3);
+    put(queue, 2, 1);
+    expect_get(queue, 1, 3);
+
+    // priority 3 has no messages left, and goes back in ahead of priority 2
+    put(queue, 3, 2);
+    put(queue, 4, 3);
+    put(queue, 5, 1);
+
+    // priority 5 runs out while it is at the head, then comes back behind a higher one
+    put(queue, 6, 5);
+    put(queue, 7, 5);
+    expect_get(queue, 6, 5);
+    expect_get(queue, 7, 5);
+    put(queue, 8, 6);
+    put(queue, 9, 5);
+
+    expect_get(queue, 8, 6);
+    expect_get(queue, 9, 5);
+    expect_get(queue, 4, 3);
+    expect_get(queue, 3, 2);
+    expect_get(queue, 2, 1);
+    expect_get(queue, 5, 1);
+    TEST_ASSERT_EQUAL_UINT32(0, osMessageQueueGetCount(queue));
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+}
+
+/** Test messages got with interrupts masked, which stay in the queue until the kernel post-processes the gets.
+ *
+ *  Given a message queue with messages of a few priorities.
+ *  When messages are got with interrupts masked, and more messages are put before the gets are post-processed.
+ *  Then the later gets skip the messages that were already got, and the rest come out in priority order,
+ *  including after a message that was the last of its priority is removed from the middle of the queue.
+ */
+static void test_isr_gets_processed_after_puts()
+{
+    NVIC_SetVector(TEST_FLUSH_IRQ, flush_isr_calls);
+    NVIC_EnableIRQ(TEST_FLUSH_IRQ);
+
+    osMessageQueueId_t queue = create_queue();
+
+    put(queue, 1, 5);
+    put(queue, 2, 5);
+    put(queue, 3, 1);
+    put(queue, 4, 9);
+
+    core_util_critical_section_enter();
+    expect_get(queue, 4, 9);
+    expect_get(queue, 1, 5);
+    core_util_critical_section_exit();
+
+    // 4 and 1 are still in the queue, 4 as the last message of priority 9
+    put(queue, 5, 8);
+    put(queue, 6, 5);
+    put(queue, 7, 10);
+    TEST_ASSERT_EQUAL_UINT32(5, osMessageQueueGetCount(queue));
+    TEST_ASSERT_EQUAL_UINT8(9, queue_cb.msg_first->next->priority);
+    TEST_ASSERT_NOT_EQUAL(0, queue_cb.msg_first->next->flags);
+
+    // removes 4 from between 7 and 5
+    NVIC_SetPendingIRQ(TEST_FLUSH_IRQ);
+
+    put(queue, 8, 9);
+    put(queue, 9, 1);
+
+    expect_get(queue, 7, 10);
+    expect_get(queue, 8, 9);
+    expect_get(queue, 5, 8);
+    expect_get(queue, 2, 5);
+    expect_get(queue, 6, 5);
+    expect_get(queue, 3, 1);
+    expect_get(queue, 9, 1);
+    TEST_ASSERT_EQUAL_UINT32(0, osMessageQueueGetCount(queue));
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+    NVIC_DisableIRQ(TEST_FLUSH_IRQ);
+}
+
+/** Test the zero-copy calls on their own.
+ *
+ *  Given a message queue.
+ *  When a message is reserved, committed, borrowed and released.
+ *  Then the borrower reads what the producer wrote, and the block counts against the queue's space until released.
+ */
+static void test_reserve_commit_borrow_release()
+{
+    osMessageQueueId_t queue = osMessageQueueNew(2, sizeof(uint32_t), nullptr);
+    TEST_ASSERT_NOT_NULL(queue);
+
+    uint32_t *reserved = static_cast<uint32_t *>(osMessageQueueReserve(queue, 0));
+    TEST_ASSERT_NOT_NULL(reserved);
+    TEST_ASSERT_EQUAL_UINT32(1, osMessageQueueGetSpace(queue));
+    TEST_ASSERT_EQUAL_UINT32(0, osMessageQueueGetCount(queue));
+
+    *reserved = 42;
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueCommit(queue, reserved, 7));
+    TEST_ASSERT_EQUAL_UINT32(1, osMessageQueueGetCount(queue));
+
+    uint8_t priority;
+    uint32_t *borrowed = static_cast<uint32_t *>(osMessageQueueBorrow(queue, &priority, 0));
+    TEST_ASSERT_EQUAL_PTR(reserved, borrowed);
+    TEST_ASSERT_EQUAL_UINT32(42, *borrowed);
+    TEST_ASSERT_EQUAL_UINT8(7, priority);
+    TEST_ASSERT_EQUAL_UINT32(0, osMessageQueueGetCount(queue));
+    TEST_ASSERT_EQUAL_UINT32(1, osMessageQueueGetSpace(queue));
+
+    // a block can only be given back once, and not to the wrong call
+    TEST_ASSERT_EQUAL(osErrorParameter, osMessageQueueCommit(queue, borrowed, 0));
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueRelease(queue, borrowed));
+    TEST_ASSERT_EQUAL(osErrorParameter, osMessageQueueRelease(queue, borrowed));
+    TEST_ASSERT_EQUAL_UINT32(2, osMessageQueueGetSpace(queue));
+    TEST_ASSERT_NULL(osMessageQueueBorrow(queue, nullptr, 0));
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+}
+
+// A thread blocked on a message queue.  It records what its call returned for the test thread to check, since
+// only the test thread can fail the test.
+struct Waiter {
+    osMessageQueueId_t queue;
+    bool zero_copy;
+    uint32_t value;
+    void *result;       // block, or &value for a copying call that succeeded
+    uint32_t received;  // message got by a consumer
+};
+
+static int wake_order[4];
+static int wake_count;
+
+static void record_wakeup(Waiter *waiter, void *result)
+{
+    waiter->result = result;
+    wake_order[wake_count++] = waiter->value;
+}
+
+static void producer_waiter(void *argument)
+{
+    Waiter *waiter = static_cast<Waiter *>(argument);
+    if (waiter->zero_copy) {
+        uint32_t *block = static_cast<uint32_t *>(osMessageQueueReserve(waiter->queue, osWaitForever));
+        record_wakeup(waiter, block);
+        if (block != nullptr) {
+            *block = waiter->value;
+            osMessageQueueCommit(waiter->queue, block, 0);
+        }
+    } else {
+        osStatus_t status = osMessageQueuePut(waiter->queue, &waiter->value, 0, osWaitForever);
+        record_wakeup(waiter, status == osOK ? &waiter->value : nullptr);
+    }
+}
+
+static void consumer_waiter(void *argument)
+{
+    Waiter *waiter = static_cast<Waiter *>(argument);
+    if (waiter->zero_copy) {
+        uint32_t *block = static_cast<uint32_t *>(osMessageQueueBorrow(waiter->queue, nullptr, osWaitForever));
+        if (block != nullptr) {
+            waiter->received = *block;
+            osMessageQueueRelease(waiter->queue, block);
+        }
+        record_wakeup(waiter, block);
+    } else {
+        osStatus_t status = osMessageQueueGet(waiter->queue, &waiter->received, nullptr, osWaitForever);
+        record_wakeup(waiter, status == osOK ? &waiter->value : nullptr);
+    }
+}
+
+// Start a thread that blocks straight away, since it has a higher priority than the test thread
+static void start_waiter(void (*func)(void *), Waiter *waiter, osPriority_t priority)
+{
+    osThreadAttr_t attr = {};
+    attr.priority = priority;
+    TEST_ASSERT_NOT_NULL(osThreadNew(func, waiter, &attr));
+}
+
+/** Test that copying and zero-copy waiters on the same queue are woken highest thread priority first.
+ *
+ *  Given a full message queue with threads of different priorities waiting in osMessageQueuePut() and
+ *  osMessageQueueReserve(), and an empty one with threads waiting in osMessageQueueGet() and osMessageQueueBorrow().
+ *  When space and messages become available one at a time.
+ *  Then the waiters get them highest priority first, whichever call they are waiting in.
+ */
+static void test_mixed_waiters()
+{
+    osMessageQueueId_t queue = osMessageQueueNew(3, sizeof(uint32_t), nullptr);
+    TEST_ASSERT_NOT_NULL(queue);
+    for (uint32_t value = 0; value < 3; value++) {
+        put(queue, value, 0);
+    }
+
+    Waiter producers[] = {
+        { queue, true, 10, nullptr, 0 },
+        { queue, false, 11, nullptr, 0 },
+        { queue, true, 12, nullptr, 0 },
+    };
+    wake_count = 0;
+    start_waiter(producer_waiter, &producers[0], osPriorityAboveNormal);
+    start_waiter(producer_waiter, &producers[1], osPriorityHigh);
+    start_waiter(producer_waiter, &producers[2], osPriorityRealtime);
+    TEST_ASSERT_EQUAL_INT(0, wake_count);
+
+    // each get makes room for the highest priority waiter, which puts its message behind the remaining ones
+    for (uint32_t value = 0; value < 3; value++) {
+        expect_get(queue, value, 0);
+    }
+    TEST_ASSERT_EQUAL_INT(3, wake_count);
+    TEST_ASSERT_EQUAL_INT(12, wake_order[0]);
+    TEST_ASSERT_EQUAL_INT(11, wake_order[1]);
+    TEST_ASSERT_EQUAL_INT(10, wake_order[2]);
+    for (Waiter &producer : producers) {
+        TEST_ASSERT_NOT_NULL(producer.result);
+    }
+    expect_get(queue, 12, 0);
+    expect_get(queue, 11, 0);
+    expect_get(queue, 10, 0);
+
+    Waiter consumers[] = {
+        { queue, true, 20, nullptr, 0 },
+        { queue, false, 21, nullptr, 0 },
+        { queue, true, 22, nullptr, 0 },
+    };
+    wake_count = 0;
+    start_waiter(consumer_waiter, &consumers[0], osPriorityHigh);
+    start_waiter(consumer_waiter, &consumers[1], osPriorityRealtime);
+    start_waiter(consumer_waiter, &consumers[2], osPriorityAboveNormal);
+
+    // each put wakes the highest priority waiter, which gets the message with its own value
+    put(queue, 21, 0);
+    put(queue, 20, 0);
+    put(queue, 22, 0);
+    TEST_ASSERT_EQUAL_INT(3, wake_count);
+    TEST_ASSERT_EQUAL_INT(21, wake_order[0]);
+    TEST_ASSERT_EQUAL_INT(20, wake_order[1]);
+    TEST_ASSERT_EQUAL_INT(22, wake_order[2]);
+    for (Waiter &consumer : consumers) {
+        TEST_ASSERT_NOT_NULL(consumer.result);
+        TEST_ASSERT_EQUAL_UINT32(consumer.value, consumer.received);
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, osMessageQueueGetSpace(queue));
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+}
+
+/** Test that deleting a message queue wakes threads waiting in the zero-copy calls with nullptr.
+ *
+ *  Given a message queue whose only block is reserved, so that it is both full and empty.
+ *  When one thread waits to reserve a block and another waits to borrow a message, and the queue is deleted.
+ *  Then both calls return nullptr.
+ */
+static void test_delete_wakes_zero_copy_waiters()
+{
+    osMessageQueueId_t queue = osMessageQueueNew(1, sizeof(uint32_t), nullptr);
+    TEST_ASSERT_NOT_NULL(queue);
+    TEST_ASSERT_NOT_NULL(osMessageQueueReserve(queue, 0));
+
+    uint32_t not_null = 0;
+    Waiter producer = { queue, true, 30, &not_null, 0 };
+    Waiter consumer = { queue, true, 31, &not_null, 0 };
+    wake_count = 0;
+    start_waiter(producer_waiter, &producer, osPriorityHigh);
+    start_waiter(consumer_waiter, &consumer, osPriorityHigh);
+    TEST_ASSERT_EQUAL_INT(0, wake_count);
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(queue));
+    TEST_ASSERT_EQUAL_INT(2, wake_count);
+    TEST_ASSERT_NULL(producer.result);
+    TEST_ASSERT_NULL(consumer.result);
+}
+
+static osMessageQueueId_t isr_queue;
+static void *isr_commit;
+static void *isr_release;
+static osStatus_t isr_commit_status;
+static osStatus_t isr_release_status;
+
+static void zero_copy_isr()
+{
+    isr_commit_status = osMessageQueueCommit(isr_queue, isr_commit, 3);
+    isr_release_status = osMessageQueueRelease(isr_queue, isr_release);
+}
+
+/** Test committing and releasing message blocks from an ISR.
+ *
+ *  Given a full message queue whose blocks are reserved and borrowed, and a thread waiting to reserve a block.
+ *  When an ISR commits the reserved block and releases the borrowed one.
+ *  Then the committed message is in the queue, and the released block goes to the waiting thread.
+ */
+static void test_zero_copy_from_isr()
+{
+    isr_queue = osMessageQueueNew(2, sizeof(uint32_t), nullptr);
+    TEST_ASSERT_NOT_NULL(isr_queue);
+    put(isr_queue, 40, 0);
+    isr_release = osMessageQueueBorrow(isr_queue, nullptr, 0);
+    TEST_ASSERT_NOT_NULL(isr_release);
+    isr_commit = osMessageQueueReserve(isr_queue, 0);
+    TEST_ASSERT_NOT_NULL(isr_commit);
+    *static_cast<uint32_t *>(isr_commit) = 41;
+    TEST_ASSERT_EQUAL_UINT32(0, osMessageQueueGetSpace(isr_queue));
+
+    Waiter producer = { isr_queue, true, 42, nullptr, 0 };
+    wake_count = 0;
+    start_waiter(producer_waiter, &producer, osPriorityHigh);
+    TEST_ASSERT_EQUAL_INT(0, wake_count);
+
+    NVIC_SetVector(TEST_ZERO_COPY_IRQ, zero_copy_isr);
+    NVIC_EnableIRQ(TEST_ZERO_COPY_IRQ);
+    NVIC_SetPendingIRQ(TEST_ZERO_COPY_IRQ);
+    NVIC_DisableIRQ(TEST_ZERO_COPY_IRQ);
+
+    TEST_ASSERT_EQUAL(osOK, isr_commit_status);
+    TEST_ASSERT_EQUAL(osOK, isr_release_status);
+    TEST_ASSERT_EQUAL_INT(1, wake_count);
+    TEST_ASSERT_NOT_NULL(producer.result);
+
+    // the ISR's message has a higher priority than the waiter's
+    TEST_ASSERT_EQUAL_UINT32(2, osMessageQueueGetCount(isr_queue));
+    expect_get(isr_queue, 41, 3);
+    expect_get(isr_queue, 42, 0);
+
+    TEST_ASSERT_EQUAL(osOK, osMessageQueueDelete(isr_queue));
+}
+
+/** Test freeing mail that was never put.
+ *
+ *  Given a mail queue.
+ *  When mail is allocated and freed without being put, more times than the queue has room for.
+ *  Then the mail goes back to the queue each time, so the queue can still be filled and stays empty.
+ */
+static void test_mail_free_without_put()
+{
+    static rtos::Mail<uint64_t, 4> mail;
+
+    for (int i = 0; i < 12; i++) {
+        uint64_t *block = mail.try_alloc();
+        TEST_ASSERT_NOT_NULL(block);
+        TEST_ASSERT_EQUAL(osOK, mail.free(block));
+    }
+    TEST_ASSERT_TRUE(mail.empty());
+
+    uint64_t *blocks[4];
+    for (uint64_t *&block : blocks) {
+        block = mail.try_alloc();
+        TEST_ASSERT_NOT_NULL(block);
+    }
+    TEST_ASSERT_TRUE(mail.full());
+    TEST_ASSERT_NULL(mail.try_alloc());
+    TEST_ASSERT_TRUE(mail.empty());
+
+    for (uint64_t *block : blocks) {
+        TEST_ASSERT_EQUAL(osOK, mail.free(block));
+    }
+    TEST_ASSERT_FALSE(mail.full());
+}
+
+Case cases[] = {
+    Case("random order test", test_random_order),
+    Case("random order without index test", test_random_order_without_index),
+    Case("caller memory not from dynamic memory test", test_caller_memory_not_from_dynamic_memory),
+    Case("last message of a priority test", test_last_message_of_priority),
+    Case("ISR gets processed after puts test", test_isr_gets_processed_after_puts),
+    Case("reserve commit borrow release test", test_reserve_commit_borrow_release),
+    Case("mixed waiters test", test_mixed_waiters),
+    Case("delete wakes zero-copy waiters test", test_delete_wakes_zero_copy_waiters),
+    Case("zero-copy from ISR test", test_zero_copy_from_isr),
+    Case("mail free without put test", test_mail_free_without_put),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
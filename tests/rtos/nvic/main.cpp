@@ -0,0 +1,283 @@
+/*
+ * Tests for RTXOff's simulated NVIC: nested interrupts and their preempt priorities, and interrupts raised
+ * asynchronously with NVIC_SetPendingIRQAsync().
+ */
+
+#include "cmsis_os2.h"
+#include "rtxoff_nvic.h"
+#include "platform/mbed_critical.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+using namespace utest::v1;
+
+#define TEST_LOW_IRQ 20
+#define TEST_HIGH_IRQ 21
+#define TEST_SAME_PREEMPT_IRQ 22
+#define TEST_ASYNC_IRQ 23
+
+// How many 1ms delays to wait for the dispatcher to take an asynchronously raised interrupt
+#define TEST_ASYNC_WAIT_MS 100
+
+// With this grouping, the top 2 of the 5 priority bits are the preempt priority and the other 3 the subpriority
+#define TEST_PRIORITY_GROUP 5
+
+// Handlers append a letter when they start and end, so the order they ran and nested in can be checked
+static char handler_log[16];
+static int handler_log_length;
+static uint32_t low_active_in_high;
+static uint32_t same_preempt_pending_in_low;
+
+static void log_handler(char letter)
+{
+    if (handler_log_length < static_cast<int>(sizeof(handler_log)) - 1) {
+        handler_log[handler_log_length++] = letter;
+        handler_log[handler_log_length] = '\0';
+    }
+}
+
+static void low_handler()
+{
+    log_handler('L');
+
+    // same preempt priority, so it waits even though its subpriority is more urgent
+    NVIC_SetPendingIRQ(TEST_SAME_PREEMPT_IRQ);
+
+    // higher preempt priority, so it runs inside this call
+    NVIC_SetPendingIRQ(TEST_HIGH_IRQ);
+
+    same_preempt_pending_in_low = NVIC_GetPendingIRQ(TEST_SAME_PREEMPT_IRQ);
+    log_handler('l');
+}
+
+static void high_handler()
+{
+    log_handler('H');
+    low_active_in_high = NVIC_GetActive(TEST_LOW_IRQ);
+    log_handler('h');
+}
+
+static void same_preempt_handler()
+{
+    log_handler('S');
+    log_handler('s');
+}
+
+static void setup_irq(IRQn_Type irq, void (*handler)(), uint32_t preempt_priority, uint32_t subpriority)
+{
+    NVIC_SetVector(irq, handler);
+    NVIC_SetPriority(irq, NVIC_EncodePriority(TEST_PRIORITY_GROUP, preempt_priority, subpriority));
+    NVIC_EnableIRQ(irq);
+}
+
+static void teardown_irq(IRQn_Type irq)
+{
+    NVIC_DisableIRQ(irq);
+    NVIC_SetPriority(irq, 0);
+}
+
+/** Test that a handler is preempted by a higher preempt priority interrupt, but not by a lower subpriority.
+ *
+ *  Given interrupts with preempt priorities 2 and 1, and another one with preempt priority 2 and a lower subpriority.
+ *  When the priority 2 handler raises the other two.
+ *  Then the priority 1 handler runs nested inside it, and the one with the same preempt priority runs after it.
+ */
+static void test_nested_preemption()
+{
+    NVIC_SetPriorityGrouping(TEST_PRIORITY_GROUP);
+    setup_irq(TEST_LOW_IRQ, low_handler, 2, 3);
+    setup_irq(TEST_HIGH_IRQ, high_handler, 1, 3);
+    setup_irq(TEST_SAME_PREEMPT_IRQ, same_preempt_handler, 2, 0);
+
+    handler_log_length = 0;
+    handler_log[0] = '\0';
+    NVIC_SetPendingIRQ(TEST_LOW_IRQ);
+
+    TEST_ASSERT_EQUAL_STRING("LHhlSs", handler_log);
+    TEST_ASSERT_EQUAL_UINT32(1, low_active_in_high);
+    TEST_ASSERT_EQUAL_UINT32(1, same_preempt_pending_in_low);
+    TEST_ASSERT_EQUAL_UINT32(0, NVIC_GetActive(TEST_LOW_IRQ));
+
+    teardown_irq(TEST_LOW_IRQ);
+    teardown_irq(TEST_HIGH_IRQ);
+    teardown_irq(TEST_SAME_PREEMPT_IRQ);
+    NVIC_SetPriorityGrouping(0);
+}
+
+static volatile uint32_t async_vector_count;
+
+static void async_handler()
+{
+    async_vector_count = async_vector_count + 1;
+}
+
+// Recorded by the injection callback, which may run on the dispatcher thread
+struct InjectionResult {
+    volatile uint32_t calls;
+    volatile uint32_t delivered;
+    volatile uint32_t vector_count_at_callback;
+    volatile IRQn_Type irq;
+};
+
+static void injection_callback(IRQn_Type irq, uint32_t delivered, void *context)
+{
+    InjectionResult *result = static_cast<InjectionResult *>(context);
+    result->calls = result->calls + 1;
+    result->delivered = delivered;
+    result->vector_count_at_callback = async_vector_count;
+    result->irq = irq;
+}
+
+static void setup_async_irq()
+{
+    async_vector_count = 0;
+    NVIC_SetVector(TEST_ASYNC_IRQ, async_handler);
+}
+
+// Waits until the dispatcher has taken an injection for the disabled async IRQ and made it pending
+static void wait_for_async_pending()
+{
+    for (int waited = 0; waited < TEST_ASYNC_WAIT_MS && !NVIC_GetPendingIRQ(TEST_ASYNC_IRQ); ++waited) {
+        osDelay(1);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, NVIC_GetPendingIRQ(TEST_ASYNC_IRQ));
+}
+
+/** Test that an injection's callback is called once after the interrupt's vector has run.
+ *
+ *  Given an enabled interrupt.
+ *  When it is raised with NVIC_SetPendingIRQAsync() and a callback.
+ *  Then the callback is called exactly once, with delivered set, after the vector has run once.
+ */
+static void test_async_callback_delivered()
+{
+    setup_async_irq();
+    NVIC_EnableIRQ(TEST_ASYNC_IRQ);
+
+    InjectionResult result = {};
+    NVIC_SetPendingIRQAsync(TEST_ASYNC_IRQ, injection_callback, &result);
+    for (int waited = 0; waited < TEST_ASYNC_WAIT_MS && result.calls == 0; ++waited) {
+        osDelay(1);
+    }
+
+    // give a second callback time to show up
+    osDelay(10);
+
+    TEST_ASSERT_EQUAL_UINT32(1, result.calls);
+    TEST_ASSERT_EQUAL_UINT32(1, result.delivered);
+    TEST_ASSERT_EQUAL_UINT32(1, result.vector_count_at_callback);
+    TEST_ASSERT_EQUAL_INT(TEST_ASYNC_IRQ, result.irq);
+    TEST_ASSERT_EQUAL_UINT32(1, async_vector_count);
+
+    NVIC_DisableIRQ(TEST_ASYNC_IRQ);
+}
+
+/** Test that an injection's callback is told the vector didn't run when the interrupt is disabled.
+ *
+ *  Given a disabled interrupt that was raised with NVIC_SetPendingIRQAsync() and a callback.
+ *  When NVIC_DisableIRQ() is called while it is pending.
+ *  Then the callback is called once without delivered set, and the vector never runs.
+ */
+static void test_async_callback_disabled()
+{
+    setup_async_irq();
+
+    InjectionResult result = {};
+    NVIC_SetPendingIRQAsync(TEST_ASYNC_IRQ, injection_callback, &result);
+    wait_for_async_pending();
+    TEST_ASSERT_EQUAL_UINT32(0, result.calls);
+
+    NVIC_DisableIRQ(TEST_ASYNC_IRQ);
+
+    TEST_ASSERT_EQUAL_UINT32(1, result.calls);
+    TEST_ASSERT_EQUAL_UINT32(0, result.delivered);
+
+    NVIC_ClearPendingIRQ(TEST_ASYNC_IRQ);
+    NVIC_EnableIRQ(TEST_ASYNC_IRQ);
+    osDelay(10);
+
+    TEST_ASSERT_EQUAL_UINT32(1, result.calls);
+    TEST_ASSERT_EQUAL_UINT32(0, async_vector_count);
+
+    NVIC_DisableIRQ(TEST_ASYNC_IRQ);
+}
+
+/** Test that an injection's callback is told the vector didn't run when the pending bit is cleared.
+ *
+ *  Given a disabled interrupt that was raised with NVIC_SetPendingIRQAsync() and a callback.
+ *  When NVIC_ClearPendingIRQ() is called and the interrupt is enabled.
+ *  Then the callback is called once without delivered set, and the vector never runs.
+ */
+static void test_async_callback_cleared()
+{
+    setup_async_irq();
+
+    InjectionResult result = {};
+    NVIC_SetPendingIRQAsync(TEST_ASYNC_IRQ, injection_callback, &result);
+    wait_for_async_pending();
+
+    NVIC_ClearPendingIRQ(TEST_ASYNC_IRQ);
+
+    TEST_ASSERT_EQUAL_UINT32(1, result.calls);
+    TEST_ASSERT_EQUAL_UINT32(0, result.delivered);
+    TEST_ASSERT_EQUAL_UINT32(0, NVIC_GetPendingIRQ(TEST_ASYNC_IRQ));
+
+    NVIC_EnableIRQ(TEST_ASYNC_IRQ);
+    osDelay(10);
+
+    TEST_ASSERT_EQUAL_UINT32(1, result.calls);
+    TEST_ASSERT_EQUAL_UINT32(0, async_vector_count);
+
+    NVIC_DisableIRQ(TEST_ASYNC_IRQ);
+}
+
+/** Test that injections without a callback coalesce like writes to the pending register.
+ *
+ *  Given an enabled interrupt.
+ *  When it is raised several times with NVIC_SetPendingIRQAsync() while interrupts are masked.
+ *  Then its vector runs once after they are unmasked.
+ */
+static void test_async_coalesce()
+{
+    setup_async_irq();
+    NVIC_EnableIRQ(TEST_ASYNC_IRQ);
+
+    core_util_critical_section_enter();
+    for (int injection = 0; injection < 5; ++injection) {
+        NVIC_SetPendingIRQAsync(TEST_ASYNC_IRQ, nullptr, nullptr);
+    }
+    core_util_critical_section_exit();
+
+    for (int waited = 0; waited < TEST_ASYNC_WAIT_MS && async_vector_count == 0; ++waited) {
+        osDelay(1);
+    }
+    osDelay(10);
+
+    TEST_ASSERT_EQUAL_UINT32(1, async_vector_count);
+    TEST_ASSERT_EQUAL_UINT32(0, NVIC_GetPendingIRQ(TEST_ASYNC_IRQ));
+
+    NVIC_DisableIRQ(TEST_ASYNC_IRQ);
+}
+
+Case cases[] = {
+    Case("nested preemption test", test_nested_preemption),
+    Case("async callback delivered test", test_async_callback_delivered),
+    Case("async callback disabled test", test_async_callback_disabled),
+    Case("async callback cleared test", test_async_callback_cleared),
+    Case("async coalesce test", test_async_coalesce),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,154 @@
+/*
+ * Tests for the order that ready threads run in when their priorities change while they are ready, through
+ * osThreadSetPriority() and through mutex priority inheritance.
+ */
+
+#include "cmsis_os2.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <cstring>
+
+using namespace utest::v1;
+
+#define FLAG_GO 0x1U
+
+// Names of the threads in the order they ran, each followed by a space
+static char run_log[64];
+
+static void log_run(char const *name)
+{
+    strncat(run_log, name, sizeof(run_log) - strlen(run_log) - 1);
+    strncat(run_log, " ", sizeof(run_log) - strlen(run_log) - 1);
+}
+
+static void log_thread(void *argument)
+{
+    log_run(static_cast<char const *>(argument));
+}
+
+static osThreadId_t start_thread(osThreadFunc_t func, char const *name, osPriority_t priority)
+{
+    osThreadAttr_t attr = {};
+    attr.name = name;
+    attr.priority = priority;
+    osThreadId_t thread = osThreadNew(func, const_cast<char *>(name), &attr);
+    TEST_ASSERT_NOT_NULL(thread);
+    return thread;
+}
+
+// Lets every ready thread run, in order, and then takes the processor back
+static void run_ready_threads()
+{
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(osThreadGetId(), osPriorityLow));
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(osThreadGetId(), osPriorityHigh));
+}
+
+/** Test that osThreadSetPriority() moves a ready thread to the back of its new priority level.
+ *
+ *  Given threads that are ready at three neighbouring priority levels, with several at the same level, while
+ *  the test thread runs above them.
+ *  When ready threads are moved up a level, down a level, and to the level they are already at.
+ *  Then the threads run highest level first, and in the order they became ready at each level, with each moved
+ *  thread after the threads that were already at its new level, and the unmoved thread where it was.
+ */
+static void test_set_priority_of_ready_threads()
+{
+    run_log[0] = '\0';
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(osThreadGetId(), osPriorityHigh));
+
+    osThreadId_t a1 = start_thread(log_thread, "A1", osPriorityNormal);
+    osThreadId_t a2 = start_thread(log_thread, "A2", osPriorityNormal);
+    osThreadId_t a3 = start_thread(log_thread, "A3", osPriorityNormal);
+    osThreadId_t b1 = start_thread(log_thread, "B1", osPriorityBelowNormal);
+    start_thread(log_thread, "B2", osPriorityBelowNormal);
+    start_thread(log_thread, "C1", osPriorityAboveNormal);
+
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(b1, osPriorityNormal));
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(a1, osPriorityBelowNormal));
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(a2, osPriorityAboveNormal));
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(a3, osPriorityNormal));
+    TEST_ASSERT_EQUAL_STRING("", run_log);
+
+    run_ready_threads();
+    TEST_ASSERT_EQUAL_STRING("C1 A2 A3 B1 B2 A1 ", run_log);
+
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(osThreadGetId(), osPriorityNormal));
+}
+
+static osMutexId_t inherit_mutex;
+
+// Takes the mutex, waits to be told to go on, and then holds the mutex while it runs once
+static void owner_thread(void *)
+{
+    osMutexAcquire(inherit_mutex, osWaitForever);
+    osThreadFlagsWait(FLAG_GO, osFlagsWaitAny, osWaitForever);
+    log_run("O");
+    osMutexRelease(inherit_mutex);
+    log_run("O");
+}
+
+/** Test that priority inheritance moves a ready mutex owner between levels, and back once it is released.
+ *
+ *  Given a mutex owner that is ready after other threads at its level, and threads ready at the levels around it.
+ *  When a thread one level up waits for the mutex, and the owner releases it.
+ *  Then the owner runs after the threads that were already at the waiter's level instead of after its own
+ *  level's, and once it releases the mutex it is preempted by the waiter and goes back to its own priority,
+ *  running after threads at the waiter's level and before the others at its own.
+ */
+static void test_priority_inheritance_of_ready_thread()
+{
+    run_log[0] = '\0';
+    osMutexAttr_t mutex_attr = {};
+    mutex_attr.attr_bits = osMutexPrioInherit;
+    inherit_mutex = osMutexNew(&mutex_attr);
+    TEST_ASSERT_NOT_NULL(inherit_mutex);
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(osThreadGetId(), osPriorityHigh));
+
+    // the owner takes the mutex, and then waits
+    osThreadId_t owner = start_thread(owner_thread, "O", osPriorityNormal);
+    run_ready_threads();
+    TEST_ASSERT_EQUAL_PTR(owner, osMutexGetOwner(inherit_mutex));
+
+    start_thread(log_thread, "N1", osPriorityNormal);
+    start_thread(log_thread, "N2", osPriorityNormal);
+    start_thread(log_thread, "B1", osPriorityBelowNormal);
+    start_thread(log_thread, "A1", osPriorityAboveNormal);
+    osThreadFlagsSet(owner, FLAG_GO);
+    TEST_ASSERT_EQUAL(osPriorityNormal, osThreadGetPriority(owner));
+
+    // waiting raises the owner to this thread's priority, behind the thread already there
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(osThreadGetId(), osPriorityAboveNormal));
+    TEST_ASSERT_EQUAL(osOK, osMutexAcquire(inherit_mutex, osWaitForever));
+    log_run("T");
+    TEST_ASSERT_EQUAL(osPriorityNormal, osThreadGetPriority(owner));
+
+    // the owner was preempted at its own priority again, so another thread at this level runs first
+    start_thread(log_thread, "A2", osPriorityAboveNormal);
+    TEST_ASSERT_EQUAL(osOK, osMutexRelease(inherit_mutex));
+    run_ready_threads();
+    TEST_ASSERT_EQUAL_STRING("A1 O T A2 O N1 N2 B1 ", run_log);
+
+    TEST_ASSERT_EQUAL(osOK, osThreadSetPriority(osThreadGetId(), osPriorityNormal));
+    TEST_ASSERT_EQUAL(osOK, osMutexDelete(inherit_mutex));
+}
+
+Case cases[] = {
+    Case("set priority of ready threads test", test_set_priority_of_ready_threads),
+    Case("priority inheritance of ready thread test", test_priority_inheritance_of_ready_thread),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,140 @@
+/*
+ * Test for RTXOff's schedule record/replay.  ctest runs it twice: once with RTXOFF_RECORD_FILE set, and then
+ * with RTXOFF_REPLAY_FILE set to the same file.  The recording run saves the order that its threads were
+ * switched in next to the recording, and the replay run checks that it switched threads in the same order.
+ */
+
+#include "cmsis_os2.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace utest::v1;
+
+#define TEST_WORKER_COUNT 3
+#define TEST_ITERATIONS 300
+
+// Host work between kernel calls, long enough that round robin preempts the workers several times
+#define TEST_SPIN_COUNT 100000
+
+#define TEST_LOG_LENGTH (TEST_WORKER_COUNT * TEST_ITERATIONS)
+
+static osMutexId_t log_mutex;
+static osSemaphoreId_t workers_done;
+
+// Worker that got the mutex each time, so where the workers were preempted shows up as where the letters change.
+// Only changed with log_mutex held, so the order comes from the kernel calls, which are what the replay reproduces.
+static char switch_log[TEST_LOG_LENGTH + 1];
+static int switch_log_length;
+
+static int count_switches()
+{
+    int switches = 0;
+    for (int index = 1; index < switch_log_length; ++index) {
+        if (switch_log[index] != switch_log[index - 1]) {
+            ++switches;
+        }
+    }
+    return switches;
+}
+
+static void worker_thread(void *argument)
+{
+    char worker = static_cast<char>('A' + reinterpret_cast<intptr_t>(argument));
+
+    for (int iteration = 0; iteration < TEST_ITERATIONS; ++iteration) {
+        // a fixed amount of work rather than a fixed time, since replays can't reproduce reads of the host clock
+        for (volatile int spin = 0; spin < TEST_SPIN_COUNT; ++spin) {
+        }
+
+        osMutexAcquire(log_mutex, osWaitForever);
+        switch_log[switch_log_length++] = worker;
+        osMutexRelease(log_mutex);
+    }
+
+    osSemaphoreRelease(workers_done);
+}
+
+static void run_workers()
+{
+    log_mutex = osMutexNew(nullptr);
+    workers_done = osSemaphoreNew(TEST_WORKER_COUNT, 0, nullptr);
+    switch_log_length = 0;
+
+    for (intptr_t worker = 0; worker < TEST_WORKER_COUNT; ++worker) {
+        osThreadAttr_t attr = {};
+        attr.priority = osPriorityBelowNormal;
+        osThreadNew(worker_thread, reinterpret_cast<void *>(worker), &attr);
+    }
+    for (int worker = 0; worker < TEST_WORKER_COUNT; ++worker) {
+        osSemaphoreAcquire(workers_done, osWaitForever);
+    }
+
+    switch_log[switch_log_length] = '\0';
+    osSemaphoreDelete(workers_done);
+    osMutexDelete(log_mutex);
+}
+
+// Name of the file that the switch order is saved in, next to the schedule recording
+static std::string switch_log_filename(char const *schedule_filename)
+{
+    return std::string(schedule_filename) + ".switches";
+}
+
+/** Test that replaying a recorded schedule switches threads in the same order.
+ *
+ *  Given threads of the same priority that do host work between kernel calls, so round robin preempts them.
+ *  When the program is recorded, and then replayed from the recording.
+ *  Then the replay switches between the threads in the same order as the recording.
+ */
+static void test_record_replay()
+{
+    char const *record_filename = getenv("RTXOFF_RECORD_FILE");
+    char const *replay_filename = getenv("RTXOFF_REPLAY_FILE");
+
+    run_workers();
+
+    // without preemptions, each worker would run to the end in turn and there would be nothing to replay
+    TEST_ASSERT_TRUE(count_switches() >= TEST_WORKER_COUNT);
+
+    if (replay_filename != nullptr && replay_filename[0] != '\0') {
+        FILE *file = fopen(switch_log_filename(replay_filename).c_str(), "r");
+        TEST_ASSERT_NOT_NULL_MESSAGE(file, "switch order from the recording run not found");
+
+        static char recorded_log[TEST_LOG_LENGTH + 2];
+        if (fgets(recorded_log, sizeof(recorded_log), file) == nullptr) {
+            recorded_log[0] = '\0';
+        }
+        fclose(file);
+
+        TEST_ASSERT_EQUAL_STRING(recorded_log, switch_log);
+    } else if (record_filename != nullptr && record_filename[0] != '\0') {
+        FILE *file = fopen(switch_log_filename(record_filename).c_str(), "w");
+        TEST_ASSERT_NOT_NULL(file);
+        fputs(switch_log, file);
+        fclose(file);
+    }
+}
+
+Case cases[] = {
+    Case("record replay test", test_record_replay),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(60, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,198 @@
+/*
+ * Tests for RTXOff's stack checking (RTXOFF_STACK_CHECK), where each thread runs on a painted host stack sized
+ * from its stack_size, and its usage is reported scaled down by RTXOFF_STACK_SCALE.
+ */
+
+#include "cmsis_os2.h"
+#include "RTX_Config.h"
+#include "platform/mbed_stats.h"
+#include "platform/mbed_toolchain.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <alloca.h>
+#include <cstdint>
+#include <thread>
+
+using namespace utest::v1;
+
+#define TEST_STACK_SIZE 8192
+#define TEST_SMALL_STACK_SIZE 2048
+#define TEST_LARGE_STACK_SIZE 16384
+#define TEST_MAX_THREADS 16
+
+// Host bytes touched before measuring, deeper than the kernel calls the thread has made, and then on top of that
+#define TEST_BASE_BYTES (TEST_STACK_SIZE * RTXOFF_STACK_SCALE / 4)
+#define TEST_TOUCH_BYTES (TEST_STACK_SIZE * RTXOFF_STACK_SCALE / 4)
+
+// Host bytes that a thread with the large stack touches, more than a thread with the small stack has
+#define TEST_LARGE_TOUCH_BYTES (TEST_LARGE_STACK_SIZE * RTXOFF_STACK_SCALE / 2)
+
+// Leeway in reported bytes for the alignment of the touched stack
+#define TEST_ALIGNMENT_SLACK 16
+
+// Time for a returned thread's host thread to park itself in the pool
+#define TEST_PARK_DELAY_MS 10
+
+// What a thread saw of its own stack.  Only read once the thread has been joined.
+struct StackResults {
+    uint32_t stack_size;
+    uint32_t space_before;
+    uint32_t space_after;
+    uint32_t stats_used_before;
+    uint32_t stats_used_after;
+    uint32_t stats_reserved;
+    std::thread::id host_thread;
+};
+
+// Writes bytes of stack below the caller's frame, so that the watermark goes at least that deep
+static MBED_NOINLINE void touch_stack(size_t bytes)
+{
+    volatile uint8_t *stack = static_cast<volatile uint8_t *>(alloca(bytes));
+    for (size_t index = 0; index < bytes; ++index) {
+        stack[index] = 0;
+    }
+}
+
+// Stack used by the calling thread according to mbed_stats_stack_get_each(), which identifies threads by the
+// low bits of their IDs
+static void get_stack_stats(uint32_t *used, uint32_t *reserved)
+{
+    mbed_stats_stack_t stats[TEST_MAX_THREADS];
+    size_t count = mbed_stats_stack_get_each(stats, TEST_MAX_THREADS);
+    uint32_t id = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(osThreadGetId()));
+
+    *used = 0;
+    *reserved = 0;
+    for (size_t index = 0; index < count; ++index) {
+        if (stats[index].thread_id == id) {
+            *used = stats[index].max_size;
+            *reserved = stats[index].reserved_size;
+        }
+    }
+}
+
+static void measure_thread(void *argument)
+{
+    StackResults *results = static_cast<StackResults *>(argument);
+    osThreadId_t self = osThreadGetId();
+
+    results->stack_size = osThreadGetStackSize(self);
+
+    touch_stack(TEST_BASE_BYTES);
+    results->space_before = osThreadGetStackSpace(self);
+    get_stack_stats(&results->stats_used_before, &results->stats_reserved);
+
+    touch_stack(TEST_BASE_BYTES + TEST_TOUCH_BYTES);
+    results->space_after = osThreadGetStackSpace(self);
+    get_stack_stats(&results->stats_used_after, &results->stats_reserved);
+}
+
+static void run_thread(osThreadFunc_t func, uint32_t stack_size, StackResults *results)
+{
+    osThreadAttr_t attr = {};
+    attr.attr_bits = osThreadJoinable;
+    attr.stack_size = stack_size;
+    osThreadId_t thread = osThreadNew(func, results, &attr);
+    TEST_ASSERT_NOT_NULL(thread);
+    TEST_ASSERT_EQUAL(osOK, osThreadJoin(thread));
+}
+
+/** Test that touching the stack grows the watermark by the amount touched, scaled down to target bytes.
+ *
+ *  Given a thread with an explicit stack size.
+ *  When it touches a known amount of stack below what it had already used.
+ *  Then osThreadGetStackSpace() and mbed_stats_stack_get_each() report that amount more used, divided by
+ *  RTXOFF_STACK_SCALE, and the stack size it was created with.
+ */
+static void test_watermark_grows()
+{
+    StackResults results = {};
+    run_thread(measure_thread, TEST_STACK_SIZE, &results);
+
+    TEST_ASSERT_EQUAL_UINT32(TEST_STACK_SIZE, results.stack_size);
+    TEST_ASSERT_EQUAL_UINT32(TEST_STACK_SIZE, results.stats_reserved);
+    TEST_ASSERT_TRUE(results.space_before < TEST_STACK_SIZE);
+    TEST_ASSERT_TRUE(results.space_after > 0);
+
+    uint32_t growth = results.space_before - results.space_after;
+    TEST_ASSERT_TRUE(growth >= TEST_TOUCH_BYTES / RTXOFF_STACK_SCALE);
+    TEST_ASSERT_TRUE(growth <= TEST_TOUCH_BYTES / RTXOFF_STACK_SCALE + TEST_ALIGNMENT_SLACK);
+
+    TEST_ASSERT_EQUAL_UINT32(TEST_STACK_SIZE - results.space_before, results.stats_used_before);
+    TEST_ASSERT_EQUAL_UINT32(TEST_STACK_SIZE - results.space_after, results.stats_used_after);
+}
+
+static void small_stack_thread(void *argument)
+{
+    StackResults *results = static_cast<StackResults *>(argument);
+    osThreadId_t self = osThreadGetId();
+
+    results->host_thread = std::this_thread::get_id();
+    results->stack_size = osThreadGetStackSize(self);
+    results->space_before = osThreadGetStackSpace(self);
+    touch_stack(TEST_SMALL_STACK_SIZE * RTXOFF_STACK_SCALE / 2);
+    results->space_after = osThreadGetStackSpace(self);
+}
+
+static void large_stack_thread(void *argument)
+{
+    StackResults *results = static_cast<StackResults *>(argument);
+    osThreadId_t self = osThreadGetId();
+
+    results->host_thread = std::this_thread::get_id();
+    results->stack_size = osThreadGetStackSize(self);
+    results->space_before = osThreadGetStackSpace(self);
+    touch_stack(TEST_LARGE_TOUCH_BYTES);
+    results->space_after = osThreadGetStackSpace(self);
+}
+
+/** Test that threads get the stack they ask for when host threads are reused.
+ *
+ *  Given a thread with a small stack that has used half of it and returned, leaving its host thread in the pool.
+ *  When another thread with the same stack size is created, and then a thread with a larger stack.
+ *  Then the second thread reuses the host thread with a clean watermark, and the third gets a new host thread,
+ *  reports the larger size and can use more stack than the small stack has.
+ */
+static void test_pooled_thread_stack_size()
+{
+    StackResults first = {};
+    run_thread(small_stack_thread, TEST_SMALL_STACK_SIZE, &first);
+    TEST_ASSERT_EQUAL_UINT32(TEST_SMALL_STACK_SIZE, first.stack_size);
+    TEST_ASSERT_TRUE(first.space_after <= TEST_SMALL_STACK_SIZE / 2);
+    osDelay(TEST_PARK_DELAY_MS);
+
+    StackResults reused = {};
+    run_thread(small_stack_thread, TEST_SMALL_STACK_SIZE, &reused);
+    TEST_ASSERT_TRUE(first.host_thread == reused.host_thread);
+    TEST_ASSERT_EQUAL_UINT32(TEST_SMALL_STACK_SIZE, reused.stack_size);
+    TEST_ASSERT_TRUE(reused.space_before > TEST_SMALL_STACK_SIZE / 2);
+    osDelay(TEST_PARK_DELAY_MS);
+
+    StackResults large = {};
+    run_thread(large_stack_thread, TEST_LARGE_STACK_SIZE, &large);
+    TEST_ASSERT_TRUE(first.host_thread != large.host_thread);
+    TEST_ASSERT_EQUAL_UINT32(TEST_LARGE_STACK_SIZE, large.stack_size);
+    TEST_ASSERT_TRUE(large.space_before > TEST_LARGE_STACK_SIZE / 2);
+    TEST_ASSERT_TRUE(TEST_LARGE_STACK_SIZE - large.space_after >= TEST_LARGE_TOUCH_BYTES / RTXOFF_STACK_SCALE);
+}
+
+Case cases[] = {
+    Case("watermark grows test", test_watermark_grows),
+    Case("pooled thread stack size test", test_pooled_thread_stack_size),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,204 @@
+/*
+ * Tests for RTXOff's CPU usage statistics, read through mbed_stats_thread_get_each() and mbed_stats_cpu_get() as
+ * well as rtxoff_stats.h.
+ */
+
+#include "cmsis_os2.h"
+#include "rtxoff_nvic.h"
+#include "rtxoff_stats.h"
+#include "platform/mbed_stats.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <cstdint>
+
+using namespace utest::v1;
+
+#define TEST_IRQ 40
+#define TEST_PHASES 5
+#define TEST_MAX_THREADS 16
+
+// The busy thread mostly spins and briefly blocks, and the blocked thread briefly spins and mostly blocks
+#define TEST_LONG_MS 20
+#define TEST_SHORT_MS 2
+
+#define FLAG_EXIT 0x1U
+
+static osSemaphoreId_t phases_done;
+
+// Spins on the host until the kernel clock has advanced, which it only does while the program uses CPU time
+static void spin_ms(uint32_t ms)
+{
+    uint32_t start = osKernelGetTickCount();
+    while (osKernelGetTickCount() - start < ms) {
+    }
+}
+
+static void empty_handler()
+{
+}
+
+// Waits to be told to exit, so that the thread's statistics can be read after it has done its phases
+static void finish_phases()
+{
+    osSemaphoreRelease(phases_done);
+    osThreadFlagsWait(FLAG_EXIT, osFlagsWaitAny, osWaitForever);
+}
+
+static void busy_thread(void *)
+{
+    for (int phase = 0; phase < TEST_PHASES; ++phase) {
+        spin_ms(TEST_LONG_MS);
+        NVIC_SetPendingIRQ(TEST_IRQ);
+        osDelay(TEST_SHORT_MS);
+    }
+    finish_phases();
+}
+
+static void blocked_thread(void *)
+{
+    for (int phase = 0; phase < TEST_PHASES; ++phase) {
+        spin_ms(TEST_SHORT_MS);
+        osDelay(TEST_LONG_MS);
+    }
+    finish_phases();
+}
+
+static osThreadId_t start_thread(osThreadFunc_t func, char const *name, osPriority_t priority)
+{
+    osThreadAttr_t attr = {};
+    attr.name = name;
+    attr.attr_bits = osThreadJoinable;
+    attr.priority = priority;
+    osThreadId_t thread = osThreadNew(func, nullptr, &attr);
+    TEST_ASSERT_NOT_NULL(thread);
+    return thread;
+}
+
+static void stop_thread(osThreadId_t thread)
+{
+    osThreadFlagsSet(thread, FLAG_EXIT);
+    TEST_ASSERT_EQUAL(osOK, osThreadJoin(thread));
+}
+
+// mbed_stats_thread_get_each() identifies threads by the low bits of their IDs
+static mbed_stats_thread_t const *find_stats(mbed_stats_thread_t const *stats, size_t count, osThreadId_t thread)
+{
+    uint32_t id = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(thread));
+    for (size_t index = 0; index < count; ++index) {
+        if (stats[index].id == id) {
+            return &stats[index];
+        }
+    }
+    return nullptr;
+}
+
+// For a thread that hasn't run since the statistics were reset
+static void expect_cleared(mbed_stats_thread_t const *stats)
+{
+    TEST_ASSERT_EQUAL_UINT64(0, stats->run_time);
+    TEST_ASSERT_EQUAL_UINT64(0, stats->ready_time);
+    TEST_ASSERT_EQUAL_UINT32(0, stats->voluntary_switches);
+    TEST_ASSERT_EQUAL_UINT32(0, stats->involuntary_switches);
+    TEST_ASSERT_EQUAL_UINT32(0, stats->isr_preemptions);
+}
+
+/** Test that threads' run times and switches are counted, and cleared by rtxoff_stats_reset().
+ *
+ *  Given a thread that mostly spins and raises an interrupt between short delays, and a higher priority thread
+ *  that mostly delays, started right after the statistics are reset.
+ *  When they have each done a known number of phases.
+ *  Then the busy thread has run longer, been preempted by the other thread and interrupted once per phase, each
+ *  thread has blocked once per phase, the kernel's switch count matches the threads', and after another reset
+ *  all of these read as zero.
+ */
+static void test_busy_and_blocked_threads()
+{
+    NVIC_SetVector(TEST_IRQ, empty_handler);
+    NVIC_EnableIRQ(TEST_IRQ);
+    phases_done = osSemaphoreNew(2, 0, nullptr);
+
+    rtxoff_stats_reset();
+    osThreadId_t busy = start_thread(busy_thread, "busy", osPriorityBelowNormal);
+    osThreadId_t blocked = start_thread(blocked_thread, "blocked", osPriorityNormal);
+    osSemaphoreAcquire(phases_done, osWaitForever);
+    osSemaphoreAcquire(phases_done, osWaitForever);
+
+    static mbed_stats_thread_t stats[TEST_MAX_THREADS];
+    size_t count = mbed_stats_thread_get_each(stats, TEST_MAX_THREADS);
+    rtxoff_cpu_stats_t kernel_stats;
+    rtxoff_stats_cpu_get(&kernel_stats);
+    mbed_stats_cpu_t cpu_stats;
+    mbed_stats_cpu_get(&cpu_stats);
+
+    mbed_stats_thread_t const *busy_stats = find_stats(stats, count, busy);
+    mbed_stats_thread_t const *blocked_stats = find_stats(stats, count, blocked);
+    TEST_ASSERT_NOT_NULL(busy_stats);
+    TEST_ASSERT_NOT_NULL(blocked_stats);
+    TEST_ASSERT_EQUAL_STRING("busy", busy_stats->name);
+
+    // the busy thread runs for most of each of its phases, even with the other thread preempting it.  A spin
+    // can end up to a tick early, since it starts part way through a tick.
+    TEST_ASSERT_TRUE(busy_stats->run_time >= TEST_PHASES * (TEST_LONG_MS - TEST_SHORT_MS - 1) * 1000U);
+    TEST_ASSERT_TRUE(busy_stats->run_time > 2 * blocked_stats->run_time);
+    TEST_ASSERT_TRUE(blocked_stats->run_time >= TEST_PHASES * (TEST_SHORT_MS - 1) * 1000U);
+    TEST_ASSERT_TRUE(cpu_stats.uptime >= busy_stats->run_time + blocked_stats->run_time + cpu_stats.idle_time);
+
+    // each phase's delay (the busy thread may not have gotten to waiting for its flags yet)
+    TEST_ASSERT_TRUE(busy_stats->voluntary_switches >= TEST_PHASES);
+    TEST_ASSERT_TRUE(blocked_stats->voluntary_switches >= TEST_PHASES);
+
+    // the blocked thread wakes up while the busy thread is spinning, and can only run by preempting it
+    TEST_ASSERT_TRUE(busy_stats->involuntary_switches > 0);
+    TEST_ASSERT_TRUE(busy_stats->ready_time > 0);
+    TEST_ASSERT_EQUAL_UINT32(0, blocked_stats->involuntary_switches);
+
+    TEST_ASSERT_EQUAL_UINT32(TEST_PHASES, busy_stats->isr_preemptions);
+    TEST_ASSERT_EQUAL_UINT32(0, blocked_stats->isr_preemptions);
+    TEST_ASSERT_TRUE(kernel_stats.interrupts >= TEST_PHASES);
+
+    // every switch since the reset was away from one of these threads, none of which have exited
+    uint64_t thread_switches = 0;
+    for (size_t index = 0; index < count; ++index) {
+        thread_switches += stats[index].voluntary_switches + stats[index].involuntary_switches;
+    }
+    TEST_ASSERT_EQUAL_UINT64(kernel_stats.switches, thread_switches);
+
+    rtxoff_stats_reset();
+    count = mbed_stats_thread_get_each(stats, TEST_MAX_THREADS);
+    rtxoff_stats_cpu_get(&kernel_stats);
+    busy_stats = find_stats(stats, count, busy);
+    blocked_stats = find_stats(stats, count, blocked);
+    TEST_ASSERT_NOT_NULL(busy_stats);
+    TEST_ASSERT_NOT_NULL(blocked_stats);
+
+    expect_cleared(busy_stats);
+    expect_cleared(blocked_stats);
+    TEST_ASSERT_EQUAL_UINT64(0, kernel_stats.switches);
+    TEST_ASSERT_EQUAL_UINT64(0, kernel_stats.interrupts);
+    TEST_ASSERT_TRUE(kernel_stats.uptime < cpu_stats.uptime);
+
+    stop_thread(busy);
+    stop_thread(blocked);
+    osSemaphoreDelete(phases_done);
+    NVIC_DisableIRQ(TEST_IRQ);
+}
+
+Case cases[] = {
+    Case("busy and blocked threads test", test_busy_and_blocked_threads),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,74 @@
+# Converts the trace of the known sequence that trace_test leaves behind with rtxoff_trace_to_json, and checks that
+# the output is valid JSON with the events of that sequence.
+# usage: cmake -DTRACE_TO_JSON=<converter> -DTRACE_FILE=<trace file> -DJSON_FILE=<output json file> -P check_json.cmake
+
+execute_process(COMMAND ${TRACE_TO_JSON} ${TRACE_FILE} ${JSON_FILE}
+	RESULT_VARIABLE CONVERT_RESULT)
+if(NOT CONVERT_RESULT EQUAL 0)
+	message(FATAL_ERROR "rtxoff_trace_to_json failed: ${CONVERT_RESULT}")
+endif()
+
+file(READ ${JSON_FILE} JSON)
+string(JSON EVENT_COUNT ERROR_VARIABLE JSON_ERROR LENGTH "${JSON}" traceEvents)
+if(JSON_ERROR)
+	message(FATAL_ERROR "${JSON_FILE} is not valid JSON: ${JSON_ERROR}")
+endif()
+
+# find the helper thread's track
+set(HELPER_TID "")
+math(EXPR LAST_EVENT "${EVENT_COUNT} - 1")
+foreach(INDEX RANGE ${LAST_EVENT})
+	string(JSON EVENT GET "${JSON}" traceEvents ${INDEX})
+	string(JSON PHASE GET "${EVENT}" ph)
+	string(JSON NAME GET "${EVENT}" name)
+	if(PHASE STREQUAL "M" AND NAME STREQUAL "thread_name")
+		string(JSON THREAD_NAME GET "${EVENT}" args name)
+		if(THREAD_NAME STREQUAL "trace helper")
+			string(JSON HELPER_TID GET "${EVENT}" tid)
+		endif()
+	endif()
+endforeach()
+if(HELPER_TID STREQUAL "")
+	message(FATAL_ERROR "No track for the trace helper thread")
+endif()
+
+# what should be drawn, as <phase>:<name>:<tid>, with the helper's instant events in the order they happened
+set(EXPECTED_IN_ORDER
+	"i:create:${HELPER_TID}"
+	"i:wait semaphore:${HELPER_TID}"
+	"i:wake:${HELPER_TID}"
+	"i:wait semaphore:${HELPER_TID}"
+	"i:wake:${HELPER_TID}"
+	"i:exit:${HELPER_TID}")
+set(EXPECTED_ANYWHERE
+	"X:running:${HELPER_TID}"
+	"X:IRQ 40:0"
+	"i:preempted")
+
+foreach(INDEX RANGE ${LAST_EVENT})
+	string(JSON EVENT GET "${JSON}" traceEvents ${INDEX})
+	string(JSON PHASE GET "${EVENT}" ph)
+	string(JSON NAME GET "${EVENT}" name)
+	string(JSON TID GET "${EVENT}" tid)
+
+	# every event needs these to be drawn
+	string(JSON PID GET "${EVENT}" pid)
+	string(JSON TIMESTAMP GET "${EVENT}" ts)
+	if(PHASE STREQUAL "X")
+		string(JSON DURATION GET "${EVENT}" dur)
+	endif()
+
+	list(LENGTH EXPECTED_IN_ORDER REMAINING)
+	if(REMAINING GREATER 0)
+		list(GET EXPECTED_IN_ORDER 0 NEXT_EXPECTED)
+		if(NEXT_EXPECTED STREQUAL "${PHASE}:${NAME}:${TID}")
+			list(REMOVE_AT EXPECTED_IN_ORDER 0)
+		endif()
+	endif()
+
+	list(REMOVE_ITEM EXPECTED_ANYWHERE "${PHASE}:${NAME}:${TID}" "${PHASE}:${NAME}")
+endforeach()
+
+if(EXPECTED_IN_ORDER OR EXPECTED_ANYWHERE)
+	message(FATAL_ERROR "${JSON_FILE} is missing events: ${EXPECTED_IN_ORDER} ${EXPECTED_ANYWHERE}")
+endif()
@@ -0,0 +1,232 @@
+/*
+ * Tests for RTXOff's scheduler trace (RTXOFF_TRACE): the events recorded for a known sequence of thread switches,
+ * semaphore waits and an ISR, and what is kept once the ring buffer wraps.  The trace of the sequence is left in
+ * TEST_TRACE_FILE for the rtxoff_trace_to_json check that runs after this test.
+ */
+
+#include "cmsis_os2.h"
+#include "rtxoff_nvic.h"
+#include "rtxoff_os.h"
+#include "rtxoff_trace.h"
+#include "RTX_Config.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace utest::v1;
+
+#define TEST_IRQ 40
+
+// Interrupts raised to fill the trace buffer, at two events (ISR enter and exit) each, and then some more
+#define TEST_WRAP_EXTRA_IRQS 1000
+#define TEST_WRAP_IRQS (RTXOFF_TRACE_BUFFER_SIZE / 2 + TEST_WRAP_EXTRA_IRQS)
+
+static osSemaphoreId_t semaphore;
+
+// An event that should be in the trace.  Its arg0 is only checked if check_arg0 is set.
+struct ExpectedEvent {
+    uint32_t type;
+    osThreadId_t thread;
+    bool check_arg0;
+    uint64_t arg0;
+};
+
+static bool read_trace(char const *filename, rtxoff_trace_file_header_t *header, std::vector<rtxoff_trace_event_t> *events)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool ok = fread(header, sizeof(*header), 1, file) == 1;
+    if (ok) {
+        events->resize(header->event_count);
+        ok = events->empty() || fread(events->data(), sizeof(rtxoff_trace_event_t), events->size(), file) == events->size();
+    }
+    fclose(file);
+    return ok;
+}
+
+static void write_and_read_trace(char const *filename, rtxoff_trace_file_header_t *header, std::vector<rtxoff_trace_event_t> *events)
+{
+    int64_t written = rtxoff_trace_write(filename);
+    TEST_ASSERT_TRUE(written > 0);
+    TEST_ASSERT_TRUE(read_trace(filename, header, events));
+
+    TEST_ASSERT_EQUAL_MEMORY(RTXOFF_TRACE_MAGIC, header->magic, sizeof(header->magic));
+    TEST_ASSERT_EQUAL_UINT32(RTXOFF_TRACE_VERSION, header->version);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(rtxoff_trace_event_t), header->event_size);
+    TEST_ASSERT_EQUAL_UINT64(written, header->event_count);
+}
+
+static bool matches(rtxoff_trace_event_t const &event, ExpectedEvent const &expected)
+{
+    return event.type == expected.type && event.thread == reinterpret_cast<uintptr_t>(expected.thread)
+           && (!expected.check_arg0 || event.data.args[0] == expected.arg0);
+}
+
+// Number of the expected events that are found in the trace in order, with any other events in between
+static size_t count_in_order(std::vector<rtxoff_trace_event_t> const &events, ExpectedEvent const *expected, size_t expected_count)
+{
+    size_t found = 0;
+    for (rtxoff_trace_event_t const &event : events) {
+        if (found < expected_count && matches(event, expected[found])) {
+            ++found;
+        }
+    }
+    return found;
+}
+
+static void give_semaphore_handler()
+{
+    osSemaphoreRelease(semaphore);
+}
+
+static void helper_thread(void *)
+{
+    // given by the test thread, and then by the interrupt
+    osSemaphoreAcquire(semaphore, osWaitForever);
+    osSemaphoreAcquire(semaphore, osWaitForever);
+}
+
+/** Test that the events of a known sequence are recorded in the order they happened.
+ *
+ *  Given a cleared trace, and a higher priority thread that takes a semaphore twice.
+ *  When the test thread starts it, gives the semaphore once itself, and once from an ISR.
+ *  Then the trace has the thread's creation, the switches to and from it, its waits on the semaphore and how
+ *  they ended, the preemption of the test thread, the ISR's entry and exit, and the thread's exit, in that order.
+ */
+static void test_known_sequence()
+{
+    NVIC_SetVector(TEST_IRQ, give_semaphore_handler);
+    NVIC_EnableIRQ(TEST_IRQ);
+    semaphore = osSemaphoreNew(1, 0, nullptr);
+    TEST_ASSERT_NOT_NULL(semaphore);
+    osThreadId_t self = osThreadGetId();
+
+    rtxoff_trace_clear();
+
+    osThreadAttr_t attr = {};
+    attr.name = "trace helper";
+    attr.attr_bits = osThreadJoinable;
+    attr.priority = osPriorityAboveNormal;
+    osThreadId_t helper = osThreadNew(helper_thread, nullptr, &attr);
+    TEST_ASSERT_NOT_NULL(helper);
+
+    osSemaphoreRelease(semaphore);
+    NVIC_SetPendingIRQ(TEST_IRQ);
+    TEST_ASSERT_EQUAL(osOK, osThreadJoin(helper));
+
+    rtxoff_trace_file_header_t header;
+    std::vector<rtxoff_trace_event_t> events;
+    write_and_read_trace(TEST_TRACE_FILE, &header, &events);
+    TEST_ASSERT_EQUAL_UINT64(0, header.dropped);
+
+    ExpectedEvent const expected[] = {
+        {RTXOFF_TRACE_THREAD_CREATE, helper, false, 0},
+        {RTXOFF_TRACE_THREAD_SWITCH, helper, true, reinterpret_cast<uintptr_t>(self)},
+        {RTXOFF_TRACE_WAIT_ENTER, helper, true, osRtxThreadWaitingSemaphore},
+        {RTXOFF_TRACE_THREAD_SWITCH, self, true, reinterpret_cast<uintptr_t>(helper)},
+
+        // given by the test thread
+        {RTXOFF_TRACE_WAIT_EXIT, helper, true, osOK},
+        {RTXOFF_TRACE_PREEMPT, self, true, reinterpret_cast<uintptr_t>(helper)},
+        {RTXOFF_TRACE_THREAD_SWITCH, helper, true, reinterpret_cast<uintptr_t>(self)},
+        {RTXOFF_TRACE_WAIT_ENTER, helper, true, osRtxThreadWaitingSemaphore},
+        {RTXOFF_TRACE_THREAD_SWITCH, self, true, reinterpret_cast<uintptr_t>(helper)},
+
+        // given by the ISR, which wakes the thread once it returns
+        {RTXOFF_TRACE_ISR_ENTER, nullptr, true, TEST_IRQ},
+        {RTXOFF_TRACE_ISR_EXIT, nullptr, true, TEST_IRQ},
+        {RTXOFF_TRACE_WAIT_EXIT, helper, true, osOK},
+        {RTXOFF_TRACE_PREEMPT, self, true, reinterpret_cast<uintptr_t>(helper)},
+        {RTXOFF_TRACE_THREAD_SWITCH, helper, true, reinterpret_cast<uintptr_t>(self)},
+
+        // switching away from a thread that has exited records no previous thread
+        {RTXOFF_TRACE_THREAD_EXIT, helper, false, 0},
+        {RTXOFF_TRACE_THREAD_SWITCH, self, true, 0},
+    };
+    size_t expected_count = sizeof(expected) / sizeof(expected[0]);
+    TEST_ASSERT_EQUAL_UINT32(expected_count, count_in_order(events, expected, expected_count));
+
+    for (rtxoff_trace_event_t const &event : events) {
+        if (matches(event, expected[0])) {
+            TEST_ASSERT_EQUAL_STRING_LEN("trace helper", event.data.name, sizeof(event.data.name));
+        }
+    }
+
+    osSemaphoreDelete(semaphore);
+    NVIC_DisableIRQ(TEST_IRQ);
+}
+
+static void empty_handler()
+{
+}
+
+/** Test that the oldest events are dropped, and counted, once the ring buffer wraps.
+ *
+ *  Given a cleared trace.
+ *  When more ISR events are recorded than the buffer holds.
+ *  Then the file has a full buffer of the newest events, and counts the rest as dropped.
+ */
+static void test_wrap_drops_oldest()
+{
+    NVIC_SetVector(TEST_IRQ, empty_handler);
+    NVIC_EnableIRQ(TEST_IRQ);
+
+    rtxoff_trace_clear();
+    for (uint32_t count = 0; count < TEST_WRAP_IRQS; ++count) {
+        NVIC_SetPendingIRQ(TEST_IRQ);
+    }
+    NVIC_DisableIRQ(TEST_IRQ);
+
+    rtxoff_trace_file_header_t header;
+    std::vector<rtxoff_trace_event_t> events;
+    write_and_read_trace(TEST_WRAP_TRACE_FILE, &header, &events);
+
+    TEST_ASSERT_EQUAL_UINT64(RTXOFF_TRACE_BUFFER_SIZE, header.event_count);
+    TEST_ASSERT_TRUE(header.dropped >= 2 * TEST_WRAP_IRQS - RTXOFF_TRACE_BUFFER_SIZE);
+
+    // the newest events were kept
+    rtxoff_trace_event_t const &last = events.back();
+    TEST_ASSERT_EQUAL_UINT32(RTXOFF_TRACE_ISR_EXIT, last.type);
+    TEST_ASSERT_EQUAL_UINT64(TEST_IRQ, last.data.args[0]);
+
+    uint32_t isr_exits = 0;
+    for (rtxoff_trace_event_t const &event : events) {
+        if (event.type == RTXOFF_TRACE_ISR_EXIT && event.data.args[0] == TEST_IRQ) {
+            ++isr_exits;
+        }
+    }
+    TEST_ASSERT_TRUE(isr_exits >= RTXOFF_TRACE_BUFFER_SIZE / 2 - 1);
+
+    // clearing forgets the dropped events too
+    rtxoff_trace_clear();
+    rtxoff_trace_write(TEST_WRAP_TRACE_FILE);
+    TEST_ASSERT_TRUE(read_trace(TEST_WRAP_TRACE_FILE, &header, &events));
+    TEST_ASSERT_EQUAL_UINT64(0, header.dropped);
+    TEST_ASSERT_EQUAL_UINT64(0, header.event_count);
+}
+
+Case cases[] = {
+    Case("known sequence test", test_known_sequence),
+    Case("wrap drops oldest test", test_wrap_drops_oldest),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}
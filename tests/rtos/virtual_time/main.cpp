@@ -0,0 +1,99 @@
+/*
+ * Tests for RTXOff's virtual time mode, where the kernel clock skips ahead while only the idle thread can run.
+ */
+
+#include "cmsis_os2.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include <chrono>
+
+using namespace utest::v1;
+
+// A minute of kernel time, which must take much less than that on the host
+#define TEST_LONG_DELAY_MS 60000
+#define TEST_MAX_HOST_MS 2000
+
+#define TEST_TIMER_MS 20000
+#define TEST_TIMER_WAIT_MS 30000
+
+#define FLAG_TIMER 0x1U
+
+static uint32_t host_ms_since(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/** Test that a long delay is skipped instead of waited out.
+ *
+ *  Given no other threads are ready to run.
+ *  When a thread delays for a minute.
+ *  Then the tick count advances by a minute, in much less than a minute of host time.
+ */
+static void test_long_delay()
+{
+    auto host_start = std::chrono::steady_clock::now();
+    uint32_t tick_start = osKernelGetTickCount();
+
+    TEST_ASSERT_EQUAL(osOK, osDelay(TEST_LONG_DELAY_MS));
+
+    uint32_t ticks = osKernelGetTickCount() - tick_start;
+    uint32_t host_ms = host_ms_since(host_start);
+
+    TEST_ASSERT_TRUE(ticks >= TEST_LONG_DELAY_MS);
+    TEST_ASSERT_TRUE(ticks < TEST_LONG_DELAY_MS + TEST_MAX_HOST_MS);
+    TEST_ASSERT_TRUE(host_ms < TEST_MAX_HOST_MS);
+}
+
+static void timer_callback(void *argument)
+{
+    osThreadFlagsSet(static_cast<osThreadId_t>(argument), FLAG_TIMER);
+}
+
+/** Test that skipping ahead stops at the next timer expiration.
+ *
+ *  Given a timer that expires before a thread's wait times out.
+ *  When the thread waits, with no other threads ready to run.
+ *  Then the timer wakes the thread at its expiry tick rather than at the timeout, in little host time.
+ */
+static void test_timer_during_wait()
+{
+    osTimerId_t timer = osTimerNew(timer_callback, osTimerOnce, osThreadGetId(), nullptr);
+    TEST_ASSERT_NOT_NULL(timer);
+
+    auto host_start = std::chrono::steady_clock::now();
+    uint32_t tick_start = osKernelGetTickCount();
+
+    TEST_ASSERT_EQUAL(osOK, osTimerStart(timer, TEST_TIMER_MS));
+    uint32_t flags = osThreadFlagsWait(FLAG_TIMER, osFlagsWaitAny, TEST_TIMER_WAIT_MS);
+
+    uint32_t ticks = osKernelGetTickCount() - tick_start;
+    uint32_t host_ms = host_ms_since(host_start);
+
+    TEST_ASSERT_EQUAL_UINT32(FLAG_TIMER, flags);
+    TEST_ASSERT_TRUE(ticks >= TEST_TIMER_MS);
+    TEST_ASSERT_TRUE(ticks < TEST_TIMER_WAIT_MS);
+    TEST_ASSERT_TRUE(host_ms < TEST_MAX_HOST_MS);
+
+    osTimerDelete(timer);
+}
+
+Case cases[] = {
+    Case("long delay test", test_long_delay),
+    Case("timer during wait test", test_timer_during_wait),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(20, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+
+extern "C" int mbed_start()
+{
+    return !Harness::run(specification);
+}